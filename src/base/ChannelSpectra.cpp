@@ -0,0 +1,164 @@
+#include "ChannelSpectra.hpp"
+#include <string.h>
+#include <math.h>
+
+using namespace PETSYS;
+
+ChannelSpectra::ChannelSpectra(SystemConfig *config, double Tps)
+{
+	energyBins = config->channel_spectra_energy_bins;
+	timeBins = config->channel_spectra_time_bins;
+	energyMin = config->channel_spectra_energy_min;
+	energyMax = config->channel_spectra_energy_max;
+	this->Tps = Tps;
+	this->Tns = Tps / 1000.;
+	pthread_mutex_init(&shardsLock, NULL);
+}
+
+ChannelSpectra::~ChannelSpectra()
+{
+	for(auto it = shards.begin(); it != shards.end(); it++) {
+		Shard *shard = it->second;
+		for(unsigned p = 0; p < CHANNEL_PAGES; p++) {
+			if(shard->pages[p] == NULL) continue;
+			for(unsigned n = 0; n < 4096; n++) delete [] shard->pages[p][n];
+			delete [] shard->pages[p];
+		}
+		pthread_mutex_destroy(&shard->lock);
+		delete shard;
+	}
+	pthread_mutex_destroy(&shardsLock);
+}
+
+void ChannelSpectra::getHeader(ChannelSpectraHeader &header)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHANNEL_SPECTRA_MAGIC, sizeof(header.magic));
+	header.energyMin = energyMin;
+	header.energyMax = energyMax;
+	header.energyBins = energyBins;
+	header.timeBins = timeBins;
+	header.frameLength = 1024 * Tps;
+}
+
+ChannelSpectra::Shard *ChannelSpectra::getShard()
+{
+	pthread_t self = pthread_self();
+	pthread_mutex_lock(&shardsLock);
+	Shard *&shard = shards[self];
+	if(shard == NULL) {
+		shard = new Shard();
+		pthread_mutex_init(&shard->lock, NULL);
+		for(unsigned p = 0; p < CHANNEL_PAGES; p++) shard->pages[p] = NULL;
+	}
+	pthread_mutex_unlock(&shardsLock);
+	return shard;
+}
+
+uint32_t *ChannelSpectra::getRecord(Shard *shard, unsigned channelID)
+{
+	unsigned indexH = channelID / 4096;
+	unsigned indexL = channelID % 4096;
+	if(indexH >= CHANNEL_PAGES) return NULL;
+
+	uint32_t **page = shard->pages[indexH];
+	if(page == NULL) {
+		page = new uint32_t *[4096];
+		for(unsigned n = 0; n < 4096; n++) page[n] = NULL;
+		shard->pages[indexH] = page;
+	}
+
+	uint32_t *record = page[indexL];
+	if(record == NULL) {
+		record = new uint32_t[getRecordSize()];
+		memset(record, 0, getRecordSize() * sizeof(uint32_t));
+		((ChannelSpectraChannel *)record)->channelID = channelID;
+		page[indexL] = record;
+	}
+	return record;
+}
+
+void ChannelSpectra::fill(EventBuffer<Hit> *buffer)
+{
+	Shard *shard = getShard();
+	pthread_mutex_lock(&shard->lock);
+
+	const size_t headerSize = sizeof(ChannelSpectraChannel) / sizeof(uint32_t);
+	double frameLength = 1024 * Tps;
+	double energyScale = energyBins / (energyMax - energyMin);
+	double timeScale = 1 / frameLength;
+	// Time of the buffer start since the start of its frame
+	double frameOffset = (buffer->getTMin() % 1024) * Tps;
+
+	int N = buffer->getSize();
+	for(int i = 0; i < N; i++) {
+		Hit &hit = buffer->get(i);
+		if(!hit.valid) continue;
+
+		uint32_t *record = getRecord(shard, hit.channelID);
+		if(record == NULL) continue;
+		ChannelSpectraChannel *channel = (ChannelSpectraChannel *)record;
+
+		float Eunit = hit.qdcMode ? 1.0 : Tns;
+		float energy = hit.energy * Eunit;
+		double energyBin = floor((energy - energyMin) * energyScale);
+		if(energyBin < 0)
+			channel->energyUnderflow += 1;
+		else if(!(energyBin < energyBins))
+			// Also singles without a finite energy
+			channel->energyOverflow += 1;
+		else
+			record[headerSize + (unsigned)energyBin] += 1;
+
+		// Fraction of the frame elapsed
+		double f = (frameOffset + hit.time) * timeScale;
+		f -= floor(f);
+		unsigned timeBin = f * timeBins;
+		if(timeBin >= timeBins) timeBin = timeBins - 1;
+		record[headerSize + energyBins + timeBin] += 1;
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void ChannelSpectra::takeStep(std::vector<uint32_t> &records, uint64_t &nChannels)
+{
+	// Add up the records of each channel in channelID order, releasing them
+	const size_t recordSize = getRecordSize();
+	const size_t headerSize = sizeof(ChannelSpectraChannel) / sizeof(uint32_t);
+	records.clear();
+	nChannels = 0;
+
+	pthread_mutex_lock(&shardsLock);
+	for(auto it = shards.begin(); it != shards.end(); it++) pthread_mutex_lock(&it->second->lock);
+
+	std::vector<uint32_t **> pages;
+	for(unsigned p = 0; p < CHANNEL_PAGES; p++) {
+		pages.clear();
+		for(auto it = shards.begin(); it != shards.end(); it++) {
+			if(it->second->pages[p] != NULL) pages.push_back(it->second->pages[p]);
+		}
+		for(unsigned n = 0; n < 4096 && !pages.empty(); n++) {
+			size_t begin = records.size();
+			for(unsigned k = 0; k < pages.size(); k++) {
+				uint32_t *record = pages[k][n];
+				if(record == NULL) continue;
+				if(records.size() == begin) {
+					records.insert(records.end(), record, record + recordSize);
+					nChannels += 1;
+				}
+				else {
+					ChannelSpectraChannel *channel = (ChannelSpectraChannel *)&records[begin];
+					channel->energyUnderflow += ((ChannelSpectraChannel *)record)->energyUnderflow;
+					channel->energyOverflow += ((ChannelSpectraChannel *)record)->energyOverflow;
+					for(size_t b = headerSize; b < recordSize; b++) records[begin + b] += record[b];
+				}
+				delete [] record;
+				pages[k][n] = NULL;
+			}
+		}
+	}
+
+	for(auto it = shards.begin(); it != shards.end(); it++) pthread_mutex_unlock(&it->second->lock);
+	pthread_mutex_unlock(&shardsLock);
+}
@@ -0,0 +1,100 @@
+#ifndef __PETSYS_CHANNELSPECTRA_HPP__DEFINED__
+#define __PETSYS_CHANNELSPECTRA_HPP__DEFINED__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <map>
+#include <vector>
+#include <Event.hpp>
+#include <EventBuffer.hpp>
+#include <SystemConfig.hpp>
+
+namespace PETSYS {
+
+/*
+ * Channel spectra file (.lspc): energy and time of frame histograms of the singles of each channel:
+ *   ChannelSpectraHeader
+ *   For each step: a ChannelSpectraStep followed by nChannels channel records, sorted by channelID
+ *   Channel record: a ChannelSpectraChannel, energyBins uint32_t counts and timeBins uint32_t counts
+ * Only the channels with singles are written. Energy bins split [energyMin, energyMax) evenly, in the
+ * units of the singles output, and singles outside of it are counted as underflow or overflow;
+ * singles without a finite energy are counted as overflow.
+ * Time bins split the frame, 1024 clock periods or frameLength picoseconds, evenly: the time of frame
+ * of a single is its time since the start of its frame.
+ */
+
+static const char CHANNEL_SPECTRA_MAGIC[8] = { 'P', 'S', 'S', 'P', 'E', 'C', 'T', 'R' };
+
+struct ChannelSpectraHeader {
+	char magic[8];
+	float energyMin;
+	float energyMax;
+	uint32_t energyBins;
+	uint32_t timeBins;
+	float frameLength;
+	uint32_t reserved;
+};
+
+struct ChannelSpectraStep {
+	float step1;
+	float step2;
+	uint64_t nChannels;
+};
+
+struct ChannelSpectraChannel {
+	uint32_t channelID;
+	uint32_t energyUnderflow;
+	uint32_t energyOverflow;
+	uint32_t reserved;
+};
+
+/*
+ * Accumulates the channel spectra of a step.
+ * Each filling thread counts into its own shard, which are merged when the step is taken.
+ */
+class ChannelSpectra {
+public:
+	// Binning from the channel_spectra section of the configuration; Tps is the clock period in picoseconds
+	ChannelSpectra(SystemConfig *config, double Tps);
+	~ChannelSpectra();
+
+	void getHeader(ChannelSpectraHeader &header);
+	unsigned getEnergyBins() { return energyBins; };
+	unsigned getTimeBins() { return timeBins; };
+	// Size of a channel record, in uint32_t
+	size_t getRecordSize() { return sizeof(ChannelSpectraChannel) / sizeof(uint32_t) + energyBins + timeBins; };
+
+	// Count the singles of a buffer; may be called concurrently
+	void fill(EventBuffer<Hit> *buffer);
+
+	// Merge the counts of all threads into one record per channel and start counting the next step
+	void takeStep(std::vector<uint32_t> &records, uint64_t &nChannels);
+
+private:
+	static const unsigned CHANNEL_PAGES = 1024;	// 22 bit channel ID in 4096 channel pages
+
+	struct Shard {
+		// Only held against takeStep(), a shard is filled by one thread
+		pthread_mutex_t lock;
+		// Records of the channels seen by this thread, allocated on first use, in pages of 4096 channelIDs
+		uint32_t **pages[CHANNEL_PAGES];
+	};
+
+	unsigned energyBins;
+	unsigned timeBins;
+	double energyMin;
+	double energyMax;
+	double Tps;
+	float Tns;
+
+	pthread_mutex_t shardsLock;
+	std::map<pthread_t, Shard *> shards;
+
+	Shard *getShard();
+	uint32_t *getRecord(Shard *shard, unsigned channelID);
+};
+
+}
+
+#endif // __PETSYS_CHANNELSPECTRA_HPP__DEFINED__
@@ -53,6 +53,7 @@ EventBuffer<RawHit> * CoarseSorter::handleEvents (EventBuffer<RawHit> *inBuffer)
 	atomicAdd(nSingleRead, lSingleRead);
 
 	outBuffer->setUsed(lSingleRead);
+	outBuffer->releaseParent();
 	return outBuffer;
 }
 
@@ -1,13 +1,25 @@
 #include "CoincidenceGrouper.hpp"
 #include <math.h>
+#include <stdlib.h>
 #include <algorithm>
+#include <stdint.h>
 #include <vector>
 
 using namespace PETSYS;
 
-CoincidenceGrouper::CoincidenceGrouper(SystemConfig *systemConfig, EventSink<Coincidence> *sink)
-	: systemConfig(systemConfig), UnorderedEventHandler<GammaPhoton, Coincidence>(sink)
+CoincidenceGrouper::CoincidenceGrouper(SystemConfig *systemConfig, EventStream *eventStream, EventSink<Coincidence> *sink)
+	: systemConfig(systemConfig), eventStream(eventStream), UnorderedEventHandler<GammaPhoton, Coincidence>(sink)
 {
+	// List, for each trigger region, the regions it can be in coincidence with
+	unsigned nRegions = systemConfig->getNumberOfDenseRegions();
+	coincidentRegions.resize(nRegions);
+	for(unsigned r1 = 0; r1 < nRegions; r1++) {
+		for(unsigned r2 = 0; r2 < nRegions; r2++) {
+			if(systemConfig->isCoincidenceAllowedDense(r1, r2))
+				coincidentRegions[r1].push_back(r2);
+		}
+	}
+
 	resetCounters();
 }
 
@@ -15,40 +27,240 @@ CoincidenceGrouper::~CoincidenceGrouper()
 {
 }
 
-EventBuffer<Coincidence> * CoincidenceGrouper::handleEvents(EventBuffer<GammaPhoton> *inBuffer)
+static void addCoincidence(EventBuffer<Coincidence> *outBuffer, GammaPhoton &photon1, GammaPhoton &photon2, short delayed)
+{
+	Coincidence &c = outBuffer->getWriteSlot();
+	c.nPhotons = 2;
+	c.delayed = delayed;
+
+	bool first1 = photon1.region > photon2.region;
+	c.photons[0] = first1 ? &photon1 : &photon2;
+	c.photons[1] = first1 ? &photon2 : &photon1;
+	c.valid = true;
+	outBuffer->pushWriteSlot();
+}
+
+/*
+ * Reference engine: pair each photon with all the following photons in the window
+ */
+u_int64_t CoincidenceGrouper::findScan(EventBuffer<GammaPhoton> *inBuffer, EventBuffer<Coincidence> *outBuffer, long long cWindow, long long maxUnorder)
 {
-	double cWindow = systemConfig->sw_trigger_coincidence_time_window;
-	double Tps = 5000; //harcoded clock time in ps!!!!!!!!!!
-	long long tMin = inBuffer->getTMin() * (long long)Tps; 
-	unsigned N =  inBuffer->getSize();
-	EventBuffer<Coincidence> * outBuffer = new EventBuffer<Coincidence>(N, inBuffer);
-	//bool useListControlData = systemConfig->useListModeControlData();
 	u_int64_t lPrompts = 0;
-	u_int64_t lHits = 0;
-	u_int64_t lCoincPhotopeak = 0;
+	unsigned N =  inBuffer->getSize();
 	for(unsigned i = 0; i < N; i++) {
 		GammaPhoton &photon1 = inBuffer->get(i);
 		for(unsigned j = i+1; j < N; j++) {
 			GammaPhoton &photon2 = inBuffer->get(j);			
-			if ((photon2.time - photon1.time) > (cWindow + MAX_UNORDER)) break;
+			if ((photon2.time - photon1.time) > (cWindow + maxUnorder)) break;
 			
-			if(!systemConfig->isCoincidenceAllowed(photon1.region, photon2.region)) continue;
+			if(!systemConfig->isCoincidenceAllowedDense(photon1.denseRegion, photon2.denseRegion)) continue;
 			
-			if(fabs(photon1.time - photon2.time) <= cWindow) {
-				Coincidence &c = outBuffer->getWriteSlot();
-				c.nPhotons = 2;
-				
-
-				bool first1 = photon1.region > photon2.region;
-				c.photons[0] = first1 ? &photon1 : &photon2;
-				c.photons[1] = first1 ? &photon2 : &photon1;
-				c.valid = true;
-				outBuffer->pushWriteSlot();
+			if(llabs(photon1.time - photon2.time) <= cWindow) {
+				addCoincidence(outBuffer, photon1, photon2, 0);
 				lPrompts++;
 			}
 		}
 	}
+	return lPrompts;
+}
+
+/*
+ * Region queue engine, produces the same coincidences, in the same order, as findScan().
+ *
+ * The photons of the buffer are queued per trigger region, in buffer order, and each
+ * queue has a cursor which only moves forward as the first photon of a pair advances.
+ * The end of the window is found on a compact time column; only the queues of the
+ * regions in coincidence with the first photon are then visited, unless the window
+ * holds fewer photons than there are such queues.
+ */
+u_int64_t CoincidenceGrouper::findByRegion(EventBuffer<GammaPhoton> *inBuffer, EventBuffer<Coincidence> *outBuffer, long long cWindow, long long maxUnorder)
+{
+	u_int64_t lPrompts = 0;
+	unsigned N =  inBuffer->getSize();
+	unsigned nRegions = coincidentRegions.size();
+
+	long long *photonTime = new long long[N];
+	short *photonRegion = new short[N];
+	unsigned *queueStart = new unsigned[nRegions + 1];
+	unsigned *queueCursor = new unsigned[nRegions];
+	for(unsigned r = 0; r <= nRegions; r++)
+		queueStart[r] = 0;
+
+	for(unsigned i = 0; i < N; i++) {
+		GammaPhoton &photon = inBuffer->get(i);
+		photonTime[i] = photon.time;
+		photonRegion[i] = photon.denseRegion;
+		if(photon.denseRegion != -1) queueStart[photon.denseRegion + 1] += 1;
+	}
+	for(unsigned r = 0; r < nRegions; r++) {
+		queueStart[r + 1] += queueStart[r];
+		queueCursor[r] = queueStart[r];
+	}
+	unsigned *queuePhotons = new unsigned[queueStart[nRegions]];
+	long long *queueTime = new long long[queueStart[nRegions]];
+	for(unsigned i = 0; i < N; i++) {
+		int r = photonRegion[i];
+		if(r == -1) continue;
+		queuePhotons[queueCursor[r]] = i;
+		queueTime[queueCursor[r]] = photonTime[i];
+		queueCursor[r]++;
+	}
+	for(unsigned r = 0; r < nRegions; r++)
+		queueCursor[r] = queueStart[r];
+
+	std::vector<unsigned> candidates;
+	std::vector<uint64_t> windowMask;
+	for(unsigned i = 0; i < N; i++) {
+		int r1 = photonRegion[i];
+		if(r1 == -1) continue;
+
+		long long t1 = photonTime[i];
+		long long tLimit = t1 + cWindow + maxUnorder;
+		unsigned jEnd = i + 1;
+		while((jEnd < N) && (photonTime[jEnd] <= tLimit)) jEnd++;
+		if(jEnd == i + 1) continue;
+
+		candidates.clear();
+		std::vector<int> &coincident = coincidentRegions[r1];
+		if((jEnd - i - 1) <= coincident.size()) {
+			// Fewer photons in the window than queues to visit: test them directly
+			for(unsigned j = i + 1; j < jEnd; j++) {
+				if(!systemConfig->isCoincidenceAllowedDense(r1, photonRegion[j])) continue;
+				if(llabs(t1 - photonTime[j]) <= cWindow)
+					candidates.push_back(j);
+			}
+		}
+		else {
+			// Mark the matches of each queue on a bit mask over the window,
+			// which then yields them in buffer order
+			unsigned nWords = (jEnd - i - 1 + 63) / 64;
+			windowMask.assign(nWords, 0);
+			for(unsigned n = 0; n < coincident.size(); n++) {
+				int r2 = coincident[n];
+				unsigned k = queueCursor[r2];
+				unsigned kEnd = queueStart[r2 + 1];
+				while((k < kEnd) && (queuePhotons[k] <= i)) k++;
+				queueCursor[r2] = k;
+
+				for(; (k < kEnd) && (queuePhotons[k] < jEnd); k++) {
+					if(llabs(t1 - queueTime[k]) <= cWindow) {
+						unsigned offset = queuePhotons[k] - i - 1;
+						windowMask[offset / 64] |= 1ULL << (offset % 64);
+					}
+				}
+			}
+			for(unsigned w = 0; w < nWords; w++) {
+				uint64_t bits = windowMask[w];
+				while(bits != 0) {
+					candidates.push_back(i + 1 + w * 64 + __builtin_ctzll(bits));
+					bits &= bits - 1;
+				}
+			}
+		}
+
+		GammaPhoton &photon1 = inBuffer->get(i);
+		for(unsigned n = 0; n < candidates.size(); n++) {
+			addCoincidence(outBuffer, photon1, inBuffer->get(candidates[n]), 0);
+			lPrompts++;
+		}
+	}
+
+	delete [] queueTime;
+	delete [] queuePhotons;
+	delete [] queueCursor;
+	delete [] queueStart;
+	delete [] photonRegion;
+	delete [] photonTime;
+	return lPrompts;
+}
+
+/*
+ * Delayed window search: pair each photon with the photons found around its time plus offset.
+ * These pairs can only be random coincidences, and estimate the randoms among the prompts.
+ * Prompts count each pair of photons once, so only the photon of the lower region is delayed.
+ * Within a region either photon of a pair could be the delayed one, so only the half window
+ * after the delayed photon is searched; its expected count is then also that of the prompts.
+ *
+ * Buffers do not overlap, so photons delayed past the end of the buffer wrap around to
+ * its start. The delayed photons then cover the buffer as the prompts do, with the same
+ * pairs lost at the buffer edges, and both counts have the same expectation.
+ */
+u_int64_t CoincidenceGrouper::findDelayed(EventBuffer<GammaPhoton> *inBuffer, EventBuffer<Coincidence> *outBuffer, long long cWindow, long long maxUnorder, long long offset, long long span, short delayed)
+{
+	u_int64_t lDelayed = 0;
+	unsigned N =  inBuffer->getSize();
+
+	// Wrapping around a buffer not much longer than the delay could pair photons close in time
+	bool wrap = span > (offset + 2 * (cWindow + maxUnorder));
+
+	// Photons are at most maxUnorder out of order, so the start of the window
+	// of the next photons never moves back before jStart, for either case
+	unsigned jStart[2] = { 0, 0 };
+	for(unsigned i = 0; i < N; i++) {
+		GammaPhoton &photon1 = inBuffer->get(i);
+		if(photon1.denseRegion == -1) continue;
+
+		long long tDelayed = photon1.time + offset;
+		int w = 0;
+		if(tDelayed >= span) {
+			if(!wrap) continue;
+			tDelayed -= span;
+			w = 1;
+		}
+
+		long long tLow = tDelayed - cWindow;
+		while((jStart[w] < N) && (inBuffer->get(jStart[w]).time < (tLow - maxUnorder))) jStart[w]++;
+
+		for(unsigned j = jStart[w]; j < N; j++) {
+			GammaPhoton &photon2 = inBuffer->get(j);
+			if ((photon2.time - tDelayed) > (cWindow + maxUnorder)) break;
+			if(j == i) continue;
+
+			if(photon1.region > photon2.region) continue;
+			if(!systemConfig->isCoincidenceAllowedDense(photon1.denseRegion, photon2.denseRegion)) continue;
+
+			long long dt = photon2.time - tDelayed;
+			if(photon1.region == photon2.region) {
+				if((dt < 0) || (dt > cWindow)) continue;
+			}
+			else {
+				if(llabs(dt) > cWindow) continue;
+			}
+			addCoincidence(outBuffer, photon1, photon2, delayed);
+			lDelayed++;
+		}
+	}
+	return lDelayed;
+}
+
+EventBuffer<Coincidence> * CoincidenceGrouper::handleEvents(EventBuffer<GammaPhoton> *inBuffer)
+{
+	// Photon times are in picoseconds; convert the windows once
+	double Tps = 1E12/eventStream->getFrequency();
+	long long cWindow = llround(systemConfig->sw_trigger_coincidence_time_window * Tps);
+	long long maxUnorder = llround(MAX_UNORDER * Tps);
+	unsigned N =  inBuffer->getSize();
+	EventBuffer<Coincidence> * outBuffer = new EventBuffer<Coincidence>(N, inBuffer);
+	//bool useListControlData = systemConfig->useListModeControlData();
+	u_int64_t lPrompts = 0;
+	u_int64_t lHits = 0;
+	u_int64_t lCoincPhotopeak = 0;
+	if(systemConfig->sw_trigger_coincidence_engine == SystemConfig::COINCIDENCE_ENGINE_SCAN)
+		lPrompts = findScan(inBuffer, outBuffer, cWindow, maxUnorder);
+	else
+		lPrompts = findByRegion(inBuffer, outBuffer, cWindow, maxUnorder);
+
+	// Delayed windows are appended to the same buffer, after the prompts
+	u_int64_t lDelayed = 0;
+	std::vector<double> &delayedOffsets = systemConfig->sw_trigger_coincidence_delayed_offsets;
+	long long span = llround((inBuffer->getTMax() - inBuffer->getTMin()) * Tps);
+	for(unsigned k = 0; k < delayedOffsets.size(); k++) {
+		long long offset = llround(delayedOffsets[k] * Tps);
+		lDelayed += findDelayed(inBuffer, outBuffer, cWindow, maxUnorder, offset, span, k + 1);
+	}
+
 	atomicAdd(nPrompts, lPrompts);
+	atomicAdd(nDelayed, lDelayed);
 	atomicAdd(nCoincPhotopeak, lCoincPhotopeak);
 	return outBuffer;
 }
@@ -56,6 +268,7 @@ EventBuffer<Coincidence> * CoincidenceGrouper::handleEvents(EventBuffer<GammaPho
 void CoincidenceGrouper::resetCounters()
 {
 	nPrompts = 0;
+	nDelayed = 0;
 	UnorderedEventHandler<GammaPhoton, Coincidence>::report();
 }
 
@@ -64,5 +277,9 @@ void CoincidenceGrouper::report()
 	fprintf(stderr, ">> CoincidenceGrouper report\n");
 	fprintf(stderr, " prompts passed\n");
 	fprintf(stderr, "  %10lu \n", nPrompts);
+	if(systemConfig->sw_trigger_coincidence_delayed_offsets.size() > 0) {
+		fprintf(stderr, " delayed coincidences passed\n");
+		fprintf(stderr, "  %10lu \n", nDelayed);
+	}
 	UnorderedEventHandler<GammaPhoton, Coincidence>::report();
 }
@@ -5,20 +5,28 @@
 #include <UnorderedEventHandler.hpp>
 #include <Instrumentation.hpp>
 #include <SystemConfig.hpp>
+#include <vector>
 
 namespace PETSYS {
 
 class CoincidenceGrouper : public UnorderedEventHandler<GammaPhoton, Coincidence> {
 public:
-	CoincidenceGrouper(SystemConfig *systemConfig, EventSink<Coincidence> *sink);
+	CoincidenceGrouper(SystemConfig *systemConfig, EventStream *eventStream, EventSink<Coincidence> *sink);
 	~CoincidenceGrouper();
 	virtual void report();
 	virtual void resetCounters();
 private:
 	virtual EventBuffer<Coincidence> * handleEvents(EventBuffer<GammaPhoton> *inBuffer);
+	u_int64_t findScan(EventBuffer<GammaPhoton> *inBuffer, EventBuffer<Coincidence> *outBuffer, long long cWindow, long long maxUnorder);
+	u_int64_t findByRegion(EventBuffer<GammaPhoton> *inBuffer, EventBuffer<Coincidence> *outBuffer, long long cWindow, long long maxUnorder);
+	u_int64_t findDelayed(EventBuffer<GammaPhoton> *inBuffer, EventBuffer<Coincidence> *outBuffer, long long cWindow, long long maxUnorder, long long offset, long long span, short delayed);
 		
 	SystemConfig *systemConfig;
+	EventStream *eventStream;
+	// For each dense trigger region, the dense regions it can be in coincidence with
+	std::vector<std::vector<int> > coincidentRegions;
 	u_int64_t nPrompts;
+	u_int64_t nDelayed;
 	u_int64_t nCoincPhotopeak;
 	u_int64_t nListModeControl;
 };
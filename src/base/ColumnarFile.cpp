@@ -0,0 +1,110 @@
+#include "ColumnarFile.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace PETSYS;
+
+size_t PETSYS::getColumnarTypeSize(const char *type)
+{
+	// NumPy type strings: byte order, kind and size in bytes
+	if(strlen(type) < 3) return 0;
+	return atoi(type + 2);
+}
+
+static void corrupt(const char *fileName, const char *what)
+{
+	fprintf(stderr, "ERROR: '%s' is not a complete columnar event file (%s)\n", fileName, what);
+	exit(1);
+}
+
+ColumnarFileReader::ColumnarFileReader(const char *fileName)
+{
+	int fd = open(fileName, O_RDONLY);
+	if(fd == -1) {
+		fprintf(stderr, "Could not open '%s' for reading: %s\n", fileName, strerror(errno));
+		exit(1);
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		fprintf(stderr, "Could not open '%s' for reading: %s\n", fileName, strerror(errno));
+		exit(1);
+	}
+	size = st.st_size;
+	if(size < sizeof(ColumnarFileHeader) + sizeof(ColumnarFileTrailer)) corrupt(fileName, "too short");
+
+	data = (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		fprintf(stderr, "Could not map '%s': %s\n", fileName, strerror(errno));
+		exit(1);
+	}
+
+	header = (const ColumnarFileHeader *)data;
+	trailer = (const ColumnarFileTrailer *)(data + size - sizeof(ColumnarFileTrailer));
+	if(memcmp(header->magic, COLUMNAR_FILE_MAGIC, 8) != 0) corrupt(fileName, "bad header");
+	if(memcmp(trailer->magic, COLUMNAR_FILE_MAGIC, 8) != 0) corrupt(fileName, "no trailer");
+	if(header->version != COLUMNAR_FILE_VERSION) corrupt(fileName, "unknown version");
+
+	size_t directoryEnd = trailer->directoryOffset
+		+ trailer->nBlocks * sizeof(ColumnarBlockInfo)
+		+ trailer->nSteps * sizeof(ColumnarStepInfo);
+	if(directoryEnd != size - sizeof(ColumnarFileTrailer)) corrupt(fileName, "bad directory");
+
+	columns = (const ColumnarColumnInfo *)(data + sizeof(ColumnarFileHeader));
+	blocks = (const ColumnarBlockInfo *)(data + trailer->directoryOffset);
+	steps = (const ColumnarStepInfo *)(blocks + trailer->nBlocks);
+
+	size_t rowSize = 0;
+	columnSizes = new size_t[header->nColumns];
+	for(unsigned c = 0; c < header->nColumns; c++) {
+		columnSizes[c] = getColumnarTypeSize(columns[c].type);
+		if(columnSizes[c] == 0) corrupt(fileName, "bad column type");
+		rowSize += columnSizes[c];
+	}
+
+	totalRows = 0;
+	for(uint64_t b = 0; b < trailer->nBlocks; b++) {
+		if(blocks[b].offset + sizeof(ColumnarBlockHeader) + blocks[b].nRows * rowSize > trailer->directoryOffset)
+			corrupt(fileName, "bad block");
+		totalRows += blocks[b].nRows;
+	}
+}
+
+ColumnarFileReader::~ColumnarFileReader()
+{
+	delete [] columnSizes;
+	munmap(data, size);
+}
+
+int ColumnarFileReader::getColumnIndex(const char *name)
+{
+	for(unsigned c = 0; c < header->nColumns; c++) {
+		if(strncmp(columns[c].name, name, sizeof(columns[c].name)) == 0) return c;
+	}
+	return -1;
+}
+
+const void *ColumnarFileReader::getColumn(uint64_t block, unsigned column)
+{
+	uint64_t nRows = blocks[block].nRows;
+	const char *p = data + blocks[block].offset + sizeof(ColumnarBlockHeader);
+	for(unsigned c = 0; c < column; c++) {
+		size_t n = nRows * columnSizes[c];
+		p += (n + COLUMNAR_ALIGNMENT - 1) / COLUMNAR_ALIGNMENT * COLUMNAR_ALIGNMENT;
+	}
+	return p;
+}
+
+void ColumnarFileReader::prefetchColumn(uint64_t block, unsigned column)
+{
+	long pageSize = sysconf(_SC_PAGESIZE);
+	const char *p = (const char *)getColumn(block, column);
+	const char *pageBegin = data + (p - data) / pageSize * pageSize;
+	madvise((void *)pageBegin, p - pageBegin + blocks[block].nRows * columnSizes[column], MADV_WILLNEED);
+}
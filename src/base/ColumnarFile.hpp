@@ -0,0 +1,106 @@
+#ifndef __PETSYS_COLUMNARFILE_HPP__DEFINED__
+#define __PETSYS_COLUMNARFILE_HPP__DEFINED__
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace PETSYS {
+
+/*
+ * Columnar event file (.lcol), laid out to be used in place from a memory mapping:
+ *   ColumnarFileHeader, followed by nColumns ColumnarColumnInfo
+ *   Blocks, one per written buffer: a ColumnarBlockHeader followed by one array per column,
+ *   each padded to a multiple of COLUMNAR_ALIGNMENT bytes
+ *   Block directory: nBlocks ColumnarBlockInfo, followed by nSteps ColumnarStepInfo
+ *   ColumnarFileTrailer, at the end of the file
+ * Values are little endian. Column types are given as NumPy type strings ("<i8", "<f4", "|u1", ...).
+ */
+
+static const char COLUMNAR_FILE_MAGIC[8] = { 'P', 'S', 'C', 'O', 'L', 'U', 'M', 'N' };
+static const uint32_t COLUMNAR_FILE_VERSION = 1;
+static const size_t COLUMNAR_ALIGNMENT = 8;
+
+struct ColumnarFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t eventType;
+	uint32_t nColumns;
+	uint32_t reserved;
+};
+
+struct ColumnarColumnInfo {
+	char name[24];
+	char type[8];
+};
+
+struct ColumnarBlockHeader {
+	uint64_t nRows;
+	uint64_t reserved;
+};
+
+struct ColumnarBlockInfo {
+	uint64_t offset;	// Of the ColumnarBlockHeader
+	uint64_t nRows;
+};
+
+struct ColumnarStepInfo {
+	float step1;
+	float step2;
+	uint64_t firstBlock;
+	uint64_t endBlock;
+};
+
+struct ColumnarFileTrailer {
+	uint64_t directoryOffset;
+	uint64_t nBlocks;
+	uint64_t nSteps;
+	char magic[8];
+};
+
+// Size in bytes of a value of a column type
+size_t getColumnarTypeSize(const char *type);
+
+/*
+ * Reads a columnar event file through a read-only memory mapping.
+ * Column arrays are returned in place, so only the pages of the columns which are used get read.
+ */
+class ColumnarFileReader {
+public:
+	// Exits if the file can not be read or is not a complete columnar file
+	ColumnarFileReader(const char *fileName);
+	~ColumnarFileReader();
+
+	unsigned getEventType() { return header->eventType; };
+
+	unsigned getNumberOfColumns() { return header->nColumns; };
+	const char *getColumnName(unsigned column) { return columns[column].name; };
+	const char *getColumnType(unsigned column) { return columns[column].type; };
+	size_t getColumnSize(unsigned column) { return columnSizes[column]; };
+	// Index of the named column, -1 if there is none
+	int getColumnIndex(const char *name);
+
+	uint64_t getNumberOfBlocks() { return trailer->nBlocks; };
+	uint64_t getNumberOfRows(uint64_t block) { return blocks[block].nRows; };
+	uint64_t getTotalRows() { return totalRows; };
+	const void *getColumn(uint64_t block, unsigned column);
+	// Ask the kernel to start reading a column of a block ahead of its use
+	void prefetchColumn(uint64_t block, unsigned column);
+
+	uint64_t getNumberOfSteps() { return trailer->nSteps; };
+	const ColumnarStepInfo &getStep(uint64_t n) { return steps[n]; };
+
+private:
+	char *data;
+	size_t size;
+	const ColumnarFileHeader *header;
+	const ColumnarColumnInfo *columns;
+	const ColumnarBlockInfo *blocks;
+	const ColumnarStepInfo *steps;
+	const ColumnarFileTrailer *trailer;
+	size_t *columnSizes;
+	uint64_t totalRows;
+};
+
+}
+
+#endif // __PETSYS_COLUMNARFILE_HPP__DEFINED__
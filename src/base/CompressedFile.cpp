@@ -0,0 +1,153 @@
+#include "CompressedFile.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zstd.h>
+
+using namespace PETSYS;
+
+// Sizes and time field offsets of the records in DataFileWriter.hpp
+static const size_t EVENT_SIZE = 16;			// Event, time at 0
+static const size_t GROUP_EVENT_SIZE = 18;		// GroupEvent, time at 2
+static const size_t COINCIDENCE_EVENT_SIZE = 36;	// CoincidenceEvent, times at 2 and 20
+
+// Replace each time field by its difference to the previous one (encode), or undo that
+static void transformTimes(char *data, size_t size, unsigned layout, bool encode)
+{
+	uint64_t previous = 0;
+	auto apply = [&](char *p) {
+		uint64_t t;
+		memcpy(&t, p, sizeof(t));
+		if(encode) {
+			uint64_t d = t - previous;
+			previous = t;
+			t = d;
+		}
+		else {
+			t += previous;
+			previous = t;
+		}
+		memcpy(p, &t, sizeof(t));
+	};
+
+	size_t offset = 0;
+	switch(layout) {
+		case LAYOUT_SINGLE:
+			for(; offset + EVENT_SIZE <= size; offset += EVENT_SIZE)
+				apply(data + offset);
+			break;
+		case LAYOUT_GROUP:
+			for(; offset + GROUP_EVENT_SIZE <= size; offset += GROUP_EVENT_SIZE)
+				apply(data + offset + 2);
+			break;
+		case LAYOUT_COINCIDENCE:
+			for(; offset + COINCIDENCE_EVENT_SIZE <= size; offset += COINCIDENCE_EVENT_SIZE) {
+				apply(data + offset + 2);
+				apply(data + offset + 20);
+			}
+			break;
+		case LAYOUT_GROUP_COMPACT:
+		case LAYOUT_COINCIDENCE_COMPACT:
+			while(offset < size) {
+				unsigned nHits = (uint8_t)data[offset++];
+				if(layout == LAYOUT_COINCIDENCE_COMPACT && offset < size) nHits += (uint8_t)data[offset++];
+				for(unsigned n = 0; n < nHits && offset + EVENT_SIZE <= size; n++, offset += EVENT_SIZE)
+					apply(data + offset);
+			}
+			break;
+	}
+}
+
+void PETSYS::compressBlock(const char *data, size_t size, unsigned layout, int level, std::vector<char> &out)
+{
+	if(size == 0) return;
+
+	std::vector<char> tmp(data, data + size);
+	transformTimes(tmp.data(), size, layout, true);
+
+	size_t begin = out.size();
+	size_t bound = ZSTD_compressBound(size);
+	out.resize(begin + sizeof(CompressedBlockHeader) + bound);
+	size_t r = ZSTD_compress(out.data() + begin + sizeof(CompressedBlockHeader), bound, tmp.data(), size, level);
+	if(ZSTD_isError(r)) {
+		fprintf(stderr, "ERROR: could not compress output block: %s\n", ZSTD_getErrorName(r));
+		exit(1);
+	}
+
+	CompressedBlockHeader header = { size, r };
+	memcpy(out.data() + begin, &header, sizeof(header));
+	out.resize(begin + sizeof(CompressedBlockHeader) + r);
+}
+
+CompressedFileReader::CompressedFileReader(const char *prefix)
+{
+	fileName = std::string(prefix) + ".ldatz";
+	dataFile = fopen(fileName.c_str(), "rb");
+	if(dataFile == NULL) {
+		fprintf(stderr, "Could not open '%s' for reading: %s\n", fileName.c_str(), strerror(errno));
+		exit(1);
+	}
+	if(fread(&header, sizeof(header), 1, dataFile) != 1 || memcmp(header.magic, COMPRESSED_FILE_MAGIC, 8) != 0) {
+		fprintf(stderr, "ERROR: '%s' is not a compressed binary event file\n", fileName.c_str());
+		exit(1);
+	}
+
+	std::string indexFileName = std::string(prefix) + ".lidx";
+	FILE *indexFile = fopen(indexFileName.c_str(), "r");
+	if(indexFile == NULL) {
+		fprintf(stderr, "Could not open '%s' for reading: %s\n", indexFileName.c_str(), strerror(errno));
+		exit(1);
+	}
+	Step s;
+	while(fscanf(indexFile, "%lld %lld %f %f %lld %lld", &s.rawBegin, &s.rawEnd, &s.step1, &s.step2, &s.fileBegin, &s.fileEnd) == 6) {
+		steps.push_back(s);
+	}
+	fclose(indexFile);
+
+	blockUsed = 0;
+}
+
+CompressedFileReader::~CompressedFileReader()
+{
+	fclose(dataFile);
+}
+
+void CompressedFileReader::seekStep(unsigned n)
+{
+	fseek(dataFile, steps[n].fileBegin, SEEK_SET);
+	block.clear();
+	blockUsed = 0;
+}
+
+bool CompressedFileReader::readBlock()
+{
+	CompressedBlockHeader blockHeader;
+	if(fread(&blockHeader, sizeof(blockHeader), 1, dataFile) != 1) return false;
+
+	compressed.resize(blockHeader.compressedSize);
+	block.resize(blockHeader.rawSize);
+	size_t r = 0;
+	if(fread(compressed.data(), 1, compressed.size(), dataFile) == compressed.size())
+		r = ZSTD_decompress(block.data(), block.size(), compressed.data(), compressed.size());
+	if(ZSTD_isError(r) || r != block.size()) {
+		fprintf(stderr, "ERROR: '%s' has a truncated or corrupted block\n", fileName.c_str());
+		exit(1);
+	}
+	transformTimes(block.data(), block.size(), header.layout, false);
+	blockUsed = 0;
+	return true;
+}
+
+size_t CompressedFileReader::read(void *buffer, size_t count)
+{
+	size_t done = 0;
+	while(done < count) {
+		if(blockUsed == block.size() && !readBlock()) break;
+		size_t n = block.size() - blockUsed;
+		if(n > count - done) n = count - done;
+		memcpy((char *)buffer + done, block.data() + blockUsed, n);
+		blockUsed += n;
+		done += n;
+	}
+	return done;
+}
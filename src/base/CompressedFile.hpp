@@ -0,0 +1,91 @@
+#ifndef __PETSYS_COMPRESSEDFILE_HPP__DEFINED__
+#define __PETSYS_COMPRESSEDFILE_HPP__DEFINED__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace PETSYS {
+
+/*
+ * Compressed binary event file (.ldatz): the record stream of a .ldat file cut into blocks,
+ * one per written buffer, each compressed on its own with zstd:
+ *   CompressedFileHeader
+ *   Blocks: a CompressedBlockHeader followed by one zstd frame
+ * Before compression the time fields of the records of a block are replaced by the
+ * difference to the previous time field in the same block, which makes them small and repetitive.
+ * The .lidx next to it has two more columns than the one of a .ldat file:
+ *   begin and end of the step in the decompressed stream, step1, step2,
+ *   begin and end of the step in the .ldatz file
+ */
+
+static const char COMPRESSED_FILE_MAGIC[8] = { 'P', 'S', 'L', 'D', 'A', 'T', 'Z', '1' };
+
+// Record layouts of the binary formats
+enum COMPRESSED_LAYOUT {
+	LAYOUT_SINGLE,			// Event
+	LAYOUT_GROUP,			// GroupEvent
+	LAYOUT_COINCIDENCE,		// CoincidenceEvent
+	LAYOUT_GROUP_COMPACT,		// GroupHeader followed by its Event
+	LAYOUT_COINCIDENCE_COMPACT	// CoincidenceGroupHeader followed by its Event
+};
+
+struct CompressedFileHeader {
+	char magic[8];
+	uint32_t layout;
+	uint32_t reserved;
+};
+
+struct CompressedBlockHeader {
+	uint64_t rawSize;
+	uint64_t compressedSize;
+};
+
+// Append the block header and the compressed data of a whole number of events to out
+void compressBlock(const char *data, size_t size, unsigned layout, int level, std::vector<char> &out);
+
+/*
+ * Reads a compressed binary event file back as the record stream of the .ldat file.
+ */
+class CompressedFileReader {
+public:
+	struct Step {
+		long long rawBegin;
+		long long rawEnd;
+		float step1;
+		float step2;
+		long long fileBegin;
+		long long fileEnd;
+	};
+
+	// Opens <prefix>.ldatz and <prefix>.lidx, exits if they can not be read
+	CompressedFileReader(const char *prefix);
+	~CompressedFileReader();
+
+	unsigned getLayout() { return header.layout; };
+
+	unsigned getNumberOfSteps() { return steps.size(); };
+	const Step &getStep(unsigned n) { return steps[n]; };
+	// Continue reading from the beginning of a step
+	void seekStep(unsigned n);
+
+	// Same as fread() of count bytes from the .ldat file
+	size_t read(void *buffer, size_t count);
+
+private:
+	std::string fileName;
+	FILE *dataFile;
+	CompressedFileHeader header;
+	std::vector<Step> steps;
+	std::vector<char> compressed;
+	std::vector<char> block;
+	size_t blockUsed;
+
+	bool readBlock();
+};
+
+}
+
+#endif // __PETSYS_COMPRESSEDFILE_HPP__DEFINED__
@@ -0,0 +1,154 @@
+#include "ConfigReloader.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <libgen.h>
+#include <limits.h>
+
+using namespace PETSYS;
+
+static int signalPipeFd = -1;
+
+ConfigReloader::ConfigReloader(const char *configFileName, u_int64_t mask) :
+	configFileName(configFileName), mask(mask)
+{
+	pendingConfig = NULL;
+
+	// The checker is installed next to the program which reloads
+	char exePath[PATH_MAX];
+	ssize_t exePathLength = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+	if(exePathLength == -1) {
+		fprintf(stderr, "ERROR: could not find the path of this program: %s\n", strerror(errno));
+		exit(1);
+	}
+	exePath[exePathLength] = '\0';
+	checkerFileName = std::string(dirname(exePath)) + "/check_config";
+
+	if(pipe2(pipeFd, O_CLOEXEC) != 0) {
+		fprintf(stderr, "ERROR: could not create configuration reload pipe: %s\n", strerror(errno));
+		exit(1);
+	}
+	signalPipeFd = pipeFd[1];
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signalHandler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGHUP, &sa, NULL);
+
+	pthread_create(&thread, NULL, threadRoutine, (void *)this);
+}
+
+ConfigReloader::~ConfigReloader()
+{
+	signal(SIGHUP, SIG_DFL);
+	signalPipeFd = -1;
+
+	char c = 'q';
+	while((write(pipeFd[1], &c, 1) == -1) && (errno == EINTR));
+	pthread_join(thread, NULL);
+	close(pipeFd[0]);
+	close(pipeFd[1]);
+
+	delete takeConfig();
+}
+
+void ConfigReloader::signalHandler(int sig)
+{
+	// Only async signal safe calls here
+	int savedErrno = errno;
+	char c = 'r';
+	if(signalPipeFd != -1) write(signalPipeFd, &c, 1);
+	errno = savedErrno;
+}
+
+void ConfigReloader::requestReload()
+{
+	char c = 'r';
+	while((write(pipeFd[1], &c, 1) == -1) && (errno == EINTR));
+}
+
+SystemConfig *ConfigReloader::takeConfig()
+{
+	return __atomic_exchange_n(&pendingConfig, (SystemConfig *)NULL, __ATOMIC_ACQ_REL);
+}
+
+// SystemConfig::fromFile() exits on any error in the configuration, so check it first in
+// the check_config program, which also refreshes the binary cache of the tables
+// The process is multithreaded by now, so the checker is spawned rather than forked
+bool ConfigReloader::isLoadable()
+{
+	char maskString[32];
+	sprintf(maskString, "%llx", (unsigned long long)mask);
+	char *argv[] = { (char *)checkerFileName.c_str(), (char *)configFileName.c_str(), maskString, NULL };
+
+	// Only the verdict and any error messages are of interest
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+	fflush(stderr);
+	pid_t pid;
+	int r = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if(r != 0) {
+		fprintf(stderr, "ERROR: could not run '%s' to check configuration '%s': %s\n", argv[0], configFileName.c_str(), strerror(r));
+		return false;
+	}
+
+	int status;
+	while((waitpid(pid, &status, 0) == -1) && (errno == EINTR));
+	return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+void *ConfigReloader::threadRoutine(void *arg)
+{
+	ConfigReloader *r = (ConfigReloader *)arg;
+	while(true) {
+		char c;
+		ssize_t n = read(r->pipeFd[0], &c, 1);
+		if((n == -1) && (errno == EINTR)) continue;
+		if((n != 1) || (c == 'q')) break;
+
+		// Requests which arrived in the meantime are served by the same reload
+		bool quit = false;
+		struct pollfd pfd = { r->pipeFd[0], POLLIN, 0 };
+		while((poll(&pfd, 1, 0) == 1) && (read(r->pipeFd[0], &c, 1) == 1)) {
+			if(c == 'q') quit = true;
+		}
+		if(quit) break;
+
+		// With main:config_cache set, take the tables only from the cache which the check has
+		// just written, so that tables edited after the check are not parsed here
+		// Without it, parse the tables again; a table broken between the check and this load
+		// then still stops the program
+		if(!r->isLoadable()) {
+			fprintf(stderr, "ERROR: configuration '%s' could not be reloaded, keeping the current one\n", r->configFileName.c_str());
+			continue;
+		}
+		SystemConfig *config = NULL;
+		if(SystemConfig::hasCache(r->configFileName.c_str())) {
+			config = SystemConfig::fromCache(r->configFileName.c_str(), r->mask);
+		}
+		else {
+			config = SystemConfig::fromFile(r->configFileName.c_str(), r->mask);
+		}
+		if(config == NULL) {
+			fprintf(stderr, "ERROR: configuration '%s' could not be reloaded, keeping the current one\n", r->configFileName.c_str());
+			continue;
+		}
+
+		// A configuration which was never picked up is superseded by this one
+		SystemConfig *old = __atomic_exchange_n(&r->pendingConfig, config, __ATOMIC_ACQ_REL);
+		delete old;
+	}
+	return NULL;
+}
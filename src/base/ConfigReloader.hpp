@@ -0,0 +1,46 @@
+#ifndef __PETSYS_CONFIGRELOADER_HPP__DEFINED__
+#define __PETSYS_CONFIGRELOADER_HPP__DEFINED__
+
+#include <SystemConfig.hpp>
+#include <string>
+#include <pthread.h>
+
+namespace PETSYS {
+
+/*
+ * Reloads a configuration in a background thread on each SIGHUP (or requestReload()).
+ * Each configuration is first checked by the check_config program, which must be installed
+ * next to the calling program; one which fails to load is rejected and the previous one stays in use.
+ * With the binary cache of the tables (main:config_cache), the reload only reads the cache
+ * written by the check; without it, the tables are parsed again.
+ * The newest loaded configuration is published through an atomic pointer, for the
+ * processing loop to pick up with takeConfig() at a point where no buffers are in flight.
+ * Only one instance may exist at a time.
+ */
+class ConfigReloader {
+public:
+	ConfigReloader(const char *configFileName, u_int64_t mask);
+	~ConfigReloader();
+
+	void requestReload();
+
+	// Newest configuration loaded since the previous call, or NULL
+	// The caller takes ownership
+	SystemConfig *takeConfig();
+
+private:
+	std::string configFileName;
+	std::string checkerFileName;
+	u_int64_t mask;
+	SystemConfig *pendingConfig;
+	int pipeFd[2];
+	pthread_t thread;
+
+	bool isLoadable();
+	static void *threadRoutine(void *arg);
+	static void signalHandler(int sig);
+};
+
+}
+
+#endif // __PETSYS_CONFIGRELOADER_HPP__DEFINED__
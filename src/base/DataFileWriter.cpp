@@ -3,13 +3,80 @@
 #include <stdio.h>
 #include <TFile.h>
 #include <TNtuple.h>
+#include <TMemFile.h>
+#include <TROOT.h>
 #include <iostream>
 #include <math.h>
 #include <limits.h>
+#include <stddef.h>
+#include <unistd.h>
 
 using namespace PETSYS;
 
-DataFileWriter::DataFileWriter(char *fName, bool useAsyncWriting, double frequency = 200E6, EVENT_TYPE eventType = RAW, FILE_TYPE fileType = FILE_TEXT, double userTimeRef = 0.0, int hitLimitToWrite = 1, int eventFractionToWrite = 1024, float splitTime = 1.0){
+// Basket size of the branches of the ROOT data trees
+static const int ROOT_BASKET_SIZE = 512*1024;
+// Entries of a batch of ROOT output: the baskets of the 4 byte branches are filled once,
+// and those of the 8 byte branches twice
+static const size_t ROOT_BATCH_ENTRIES = 128000;
+// Compressor threads for ROOT output
+static const long ROOT_MAX_THREADS = 4;
+
+// Columns of a columnar file, taken from the fields of the binary records
+struct ColumnDefinition {
+    const char *name;
+    const char *type;
+    size_t offset;
+};
+
+static const ColumnDefinition singleColumns[] = {
+    { "time", "<i8", offsetof(Event, time) },
+    { "energy", "<f4", offsetof(Event, e) },
+    { "channelID", "<i4", offsetof(Event, id) }
+};
+
+static const ColumnDefinition groupColumns[] = {
+    { "mh_n", "|u1", offsetof(GroupEvent, mh_n) },
+    { "mh_j", "|u1", offsetof(GroupEvent, mh_j) },
+    { "time", "<i8", offsetof(GroupEvent, time) },
+    { "energy", "<f4", offsetof(GroupEvent, e) },
+    { "channelID", "<i4", offsetof(GroupEvent, id) }
+};
+
+static const ColumnDefinition coincidenceColumns[] = {
+    { "mh_n1", "|u1", offsetof(CoincidenceEvent, mh_n1) },
+    { "mh_j1", "|u1", offsetof(CoincidenceEvent, mh_j1) },
+    { "time1", "<i8", offsetof(CoincidenceEvent, time1) },
+    { "energy1", "<f4", offsetof(CoincidenceEvent, e1) },
+    { "channelID1", "<i4", offsetof(CoincidenceEvent, id1) },
+    { "mh_n2", "|u1", offsetof(CoincidenceEvent, mh_n2) },
+    { "mh_j2", "|u1", offsetof(CoincidenceEvent, mh_j2) },
+    { "time2", "<i8", offsetof(CoincidenceEvent, time2) },
+    { "energy2", "<f4", offsetof(CoincidenceEvent, e2) },
+    { "channelID2", "<i4", offsetof(CoincidenceEvent, id2) }
+};
+
+static const ColumnDefinition *getColumnDefinitions(EVENT_TYPE eventType, unsigned &nColumns, size_t &recordSize)
+{
+    switch(eventType) {
+        case SINGLE:
+            nColumns = sizeof(singleColumns) / sizeof(ColumnDefinition);
+            recordSize = sizeof(Event);
+            return singleColumns;
+        case GROUP:
+            nColumns = sizeof(groupColumns) / sizeof(ColumnDefinition);
+            recordSize = sizeof(GroupEvent);
+            return groupColumns;
+        case COINCIDENCE:
+            nColumns = sizeof(coincidenceColumns) / sizeof(ColumnDefinition);
+            recordSize = sizeof(CoincidenceEvent);
+            return coincidenceColumns;
+        default:
+            fprintf(stderr, "ERROR: raw events can not be written in the columnar format\n");
+            exit(1);
+    }
+}
+
+DataFileWriter::DataFileWriter(char *fName, bool useAsyncWriting, double frequency = 200E6, EVENT_TYPE eventType = RAW, FILE_TYPE fileType = FILE_TEXT, double userTimeRef = 0.0, int hitLimitToWrite = 1, int eventFractionToWrite = 1024, float splitTime = 1.0, int compressionLevel = 0, SystemConfig *histogramConfig){
     this->fName = std::string(fName);
     this->fileType = (strcmp(fName, "/dev/null") != 0) ? fileType : FILE_NULL;
     this->userTimeRef = userTimeRef * frequency;
@@ -27,151 +94,315 @@ DataFileWriter::DataFileWriter(char *fName, bool useAsyncWriting, double frequen
     this->Tns = Tps / 1000.;
 
     this->useAsyncWriting = useAsyncWriting;   
+    // Only the binary formats are compressed; raw events are always written as text records
+    this->compressionLevel = (eventType != RAW && (this->fileType == FILE_BINARY || this->fileType == FILE_BINARY_COMPACT)) ? compressionLevel : 0;
+    this->lorHistogram = NULL;
+    if(this->fileType == FILE_LOR_HISTOGRAM) {
+        if(eventType != COINCIDENCE || histogramConfig == NULL) {
+            fprintf(stderr, "ERROR: only coincidences can be written as a LOR histogram\n");
+            exit(1);
+        }
+        lorHistogram = new LORHistogram(histogramConfig, Tns);
+        // The histogram is written at the end of each step, it is not split in time
+        this->fileSplitTime = 0;
+    }
+    this->channelSpectra = NULL;
+    if(this->fileType == FILE_CHANNEL_SPECTRA || this->fileType == FILE_CHANNEL_SPECTRA_ROOT) {
+        if(eventType != SINGLE || histogramConfig == NULL) {
+            fprintf(stderr, "ERROR: only singles can be written as channel spectra\n");
+            exit(1);
+        }
+        channelSpectra = new ChannelSpectra(histogramConfig, Tps);
+        brEnergySpectrum.resize(channelSpectra->getEnergyBins());
+        brTimeSpectrum.resize(channelSpectra->getTimeBins());
+        // As the LOR histogram, the spectra are written at the end of each step
+        this->fileSplitTime = 0;
+    }
     openFile();
+
+    if(fileSplitTime > 0 && this->fileType != FILE_NULL) {
+        openSegment(getPartName("next"), nextSegment);
+        nextSegmentReady = true;
+        rolloverDie = false;
+        pthread_mutex_init(&rolloverLock, NULL);
+        pthread_cond_init(&rolloverCondition, NULL);
+        pthread_create(&rolloverThread, NULL, rolloverThreadRoutine, (void *)this);
+    }
 };
 
 void DataFileWriter::openFile() {
-    stepBegin = 0;
-    
+    OutputSegment segment;
+    openSegment(fName, segment);
+    setSegment(segment);
+    beginSegment();
+}
+
+// Open the files of an output part, without writing to them
+void DataFileWriter::openSegment(const std::string &name, OutputSegment &segment) {
+    memset(&segment, 0, sizeof(segment));
+    std::vector<std::string> fileNames = getSegmentFileNames(name);
+
     if (fileType == FILE_ROOT){
-        hFile = new TFile(fName.c_str(), "RECREATE");
+        segment.hFile = new TFile(name.c_str(), "RECREATE");
+        int bs = ROOT_BASKET_SIZE;
+
+        segment.hData = new TTree("data", "Event List", 2);
+        createDataBranches(segment.hData, brData, bs);
+
+        segment.hIndex = new TTree("index", "Step Index", 2);
+        segment.hIndex->Branch("step1", &brStep1, bs);
+        segment.hIndex->Branch("step2", &brStep2, bs);
+        segment.hIndex->Branch("stepBegin", &brStepBegin, bs);
+        segment.hIndex->Branch("stepEnd", &brStepEnd, bs);
+    }
+    else if(fileType == FILE_CHANNEL_SPECTRA_ROOT) {
+        segment.hFile = new TFile(name.c_str(), "RECREATE");
         int bs = 512*1024;
+        char leafList[32];
 
-        hData = new TTree("data", "Event List", 2);
-        hData->Branch("step1", &brStep1, bs);
-        hData->Branch("step2", &brStep2, bs);
-
-        if(eventType == RAW){
-            hData->Branch("frameID", &brFrameID, bs);
-			hData->Branch("channelID", &brChannelID, bs);
-			hData->Branch("tacID", &brTacID, bs);
-			hData->Branch("tcoarse", &brTCoarse, bs);
-			hData->Branch("ecoarse", &brECoarse, bs);
-			hData->Branch("tfine", &brTFine, bs);
-			hData->Branch("efine", &brEFine, bs);
-        }
-        if(eventType == SINGLE || eventType == GROUP){  
-            
-            hData->Branch("time", &brTime, bs);
-            hData->Branch("channelID", &brChannelID, bs);
-            hData->Branch("tot", &brToT, bs);
-            hData->Branch("energy", &brEnergy, bs);
-	    hData->Branch("totalEnergy", &brTotalEnergy, bs);
-            hData->Branch("tacID", &brTacID, bs);
-            hData->Branch("xi", &brXi, bs);
-            hData->Branch("yi", &brYi, bs);
-            hData->Branch("x", &brX, bs);
-            hData->Branch("y", &brY, bs);
-            hData->Branch("z", &brZ, bs);
-            hData->Branch("tqT", &brTQT, bs);
-            hData->Branch("tqE", &brTQE, bs);
+        segment.hData = new TTree("spectra", "Channel Spectra", 2);
+        segment.hData->Branch("step1", &brStep1, bs);
+        segment.hData->Branch("step2", &brStep2, bs);
+        segment.hData->Branch("channelID", &brSpectraChannelID, bs);
+        segment.hData->Branch("energyUnderflow", &brEnergyUnderflow, bs);
+        segment.hData->Branch("energyOverflow", &brEnergyOverflow, bs);
+        sprintf(leafList, "energy[%u]/i", channelSpectra->getEnergyBins());
+        segment.hData->Branch("energy", brEnergySpectrum.data(), leafList, bs);
+        sprintf(leafList, "time[%u]/i", channelSpectra->getTimeBins());
+        segment.hData->Branch("time", brTimeSpectrum.data(), leafList, bs);
+    }
+    else if(fileType != FILE_NULL) {
+        if(useAsyncWriting){
+            segment.dataWriter =  new DataWriter(fileNames[0], true);
         }
-        if(eventType == GROUP){
-            hData->Branch("timeDelta", &brTimeDelta, bs);
-            hData->Branch("mh_n", &brN, bs);
-            hData->Branch("mh_j", &brJ, bs);
+        else{
+            segment.dataFile = fopen(fileNames[0].c_str(), "w");
+            assert(segment.dataFile != NULL);
         }
-        if(eventType == COINCIDENCE){
-            hData->Branch("mh_n1", &br1N, bs);
-            hData->Branch("mh_j1", &br1J, bs);
-            hData->Branch("tot1", &br1ToT, bs);
-            hData->Branch("time1", &br1Time, bs);
-            hData->Branch("channelID1", &br1ChannelID, bs);
-            hData->Branch("energy1", &br1Energy, bs);
-	    hData->Branch("totalEnergy1", &br1TotalEnergy, bs);
-            hData->Branch("tacID1", &br1TacID, bs);
-            hData->Branch("xi1", &br1Xi, bs);
-            hData->Branch("yi1", &br1Yi, bs);
-            hData->Branch("x1", &br1X, bs);
-            hData->Branch("y1", &br1Y, bs);
-            hData->Branch("z1", &br1Z, bs);
-            hData->Branch("mh_n2", &br2N, bs);
-            hData->Branch("mh_j2", &br2J, bs);
-            hData->Branch("time2", &br2Time, bs);
-            hData->Branch("channelID2", &br2ChannelID, bs);
-            hData->Branch("tot2", &br2ToT, bs);
-            hData->Branch("energy2", &br2Energy, bs);
-	    hData->Branch("totalEnergy2", &br2TotalEnergy, bs);
-            hData->Branch("tacID2", &br2TacID, bs);
-            hData->Branch("xi2", &br2Xi, bs);
-            hData->Branch("yi2", &br2Yi, bs);
-            hData->Branch("x2", &br2X, bs);
-            hData->Branch("y2", &br2Y, bs);
-            hData->Branch("z2", &br2Z, bs);
+        if(fileNames.size() > 1) {
+            segment.indexFile = fopen(fileNames[1].c_str(), "w");
+            assert(segment.indexFile != NULL);
         }
+    }
+}
 
-        hIndex = new TTree("index", "Step Index", 2);
-        hIndex->Branch("step1", &brStep1, bs);
-        hIndex->Branch("step2", &brStep2, bs);
-        hIndex->Branch("stepBegin", &brStepBegin, bs);
-        hIndex->Branch("stepEnd", &brStepEnd, bs);
+void DataFileWriter::closeSegment(OutputSegment &segment) {
+    if(segment.hFile != NULL) {
+        segment.hFile->Write();
+        segment.hFile->Close();
     }
-    else if(fileType == FILE_BINARY || fileType == FILE_BINARY_COMPACT) {
-        char fName2[1024];
+    if(segment.dataWriter != NULL) delete segment.dataWriter;
+    if(segment.dataFile != NULL) fclose(segment.dataFile);
+    if(segment.indexFile != NULL) fclose(segment.indexFile);
+}
 
-        sprintf(fName2, "%s.ldat", fName.c_str());
-        if(useAsyncWriting){
-            dataWriter =  new DataWriter(fName2, true);
-        }
-        else{  
-            dataFile = fopen(fName2, "w");  
-            assert(dataFile != NULL);
-        }
-        sprintf(fName2, "%s.lidx", fName.c_str());
-        indexFile = fopen(fName2, "w");
-        assert(indexFile != NULL);
+OutputSegment DataFileWriter::getSegment() {
+    OutputSegment segment = { dataWriter, dataFile, indexFile, hFile, hData, hIndex };
+    return segment;
+}
+
+void DataFileWriter::setSegment(const OutputSegment &segment) {
+    dataWriter = segment.dataWriter;
+    dataFile = segment.dataFile;
+    indexFile = segment.indexFile;
+    hFile = segment.hFile;
+    hData = segment.hData;
+    hIndex = segment.hIndex;
+}
+
+// Reset the positions and write the file headers of the current part
+void DataFileWriter::beginSegment() {
+    stepBegin = 0;
+    dataPosition = 0;
+    columnarBlocks.clear();
+    columnarSteps.clear();
+    rawPosition = 0;
+    rawStepBegin = 0;
+
+    if(compressionLevel > 0) {
+        CompressedFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, COMPRESSED_FILE_MAGIC, sizeof(header.magic));
+        header.layout = getCompressedLayout();
+        writeData(&header, sizeof(header));
+        stepBegin = dataPosition;
+    }
+    else if(fileType == FILE_COLUMNAR) {
+        writeColumnarHeader();
+    }
+    else if(fileType == FILE_LOR_HISTOGRAM) {
+        LORHistogramHeader header;
+        lorHistogram->getHeader(header);
+        writeData(&header, sizeof(header));
+    }
+    else if(fileType == FILE_CHANNEL_SPECTRA) {
+        ChannelSpectraHeader header;
+        channelSpectra->getHeader(header);
+        writeData(&header, sizeof(header));
     }
+}
 
-    else if(fileType == FILE_TEXT || fileType == FILE_TEXT_COMPACT) {
-        if(useAsyncWriting){
-            dataWriter =  new DataWriter(fName.c_str(), true);
-        }
-        else{
-            dataFile = fopen(fName.c_str(), "w");
-             assert(dataFile != NULL);
-        }
-        indexFile = NULL;
+// Write what goes at the end of the current part
+void DataFileWriter::endSegment() {
+    if(fileType == FILE_ROOT) {
+        flushRootEntries();
     }
-};
+    else if(fileType == FILE_COLUMNAR) {
+        writeColumnarDirectory();
+    }
+}
 	
+void DataFileWriter::createDataBranches(TTree *tree, RootEventFields &f, int bs) {
+    tree->Branch("step1", &f.brStep1, bs);
+    tree->Branch("step2", &f.brStep2, bs);
+
+    if(eventType == RAW){
+        tree->Branch("frameID", &f.brFrameID, bs);
+        tree->Branch("channelID", &f.brChannelID, bs);
+        tree->Branch("tacID", &f.brTacID, bs);
+        tree->Branch("tcoarse", &f.brTCoarse, bs);
+        tree->Branch("ecoarse", &f.brECoarse, bs);
+        tree->Branch("tfine", &f.brTFine, bs);
+        tree->Branch("efine", &f.brEFine, bs);
+    }
+    if(eventType == SINGLE || eventType == GROUP){  
+        
+        tree->Branch("time", &f.brTime, bs);
+        tree->Branch("channelID", &f.brChannelID, bs);
+        tree->Branch("tot", &f.brToT, bs);
+        tree->Branch("energy", &f.brEnergy, bs);
+        tree->Branch("totalEnergy", &f.brTotalEnergy, bs);
+        tree->Branch("tacID", &f.brTacID, bs);
+        tree->Branch("xi", &f.brXi, bs);
+        tree->Branch("yi", &f.brYi, bs);
+        tree->Branch("x", &f.brX, bs);
+        tree->Branch("y", &f.brY, bs);
+        tree->Branch("z", &f.brZ, bs);
+        tree->Branch("tqT", &f.brTQT, bs);
+        tree->Branch("tqE", &f.brTQE, bs);
+    }
+    if(eventType == GROUP){
+        tree->Branch("timeDelta", &f.brTimeDelta, bs);
+        tree->Branch("mh_n", &f.brN, bs);
+        tree->Branch("mh_j", &f.brJ, bs);
+    }
+    if(eventType == COINCIDENCE){
+        tree->Branch("mh_n1", &f.br1N, bs);
+        tree->Branch("mh_j1", &f.br1J, bs);
+        tree->Branch("tot1", &f.br1ToT, bs);
+        tree->Branch("time1", &f.br1Time, bs);
+        tree->Branch("channelID1", &f.br1ChannelID, bs);
+        tree->Branch("energy1", &f.br1Energy, bs);
+        tree->Branch("totalEnergy1", &f.br1TotalEnergy, bs);
+        tree->Branch("tacID1", &f.br1TacID, bs);
+        tree->Branch("xi1", &f.br1Xi, bs);
+        tree->Branch("yi1", &f.br1Yi, bs);
+        tree->Branch("x1", &f.br1X, bs);
+        tree->Branch("y1", &f.br1Y, bs);
+        tree->Branch("z1", &f.br1Z, bs);
+        tree->Branch("mh_n2", &f.br2N, bs);
+        tree->Branch("mh_j2", &f.br2J, bs);
+        tree->Branch("time2", &f.br2Time, bs);
+        tree->Branch("channelID2", &f.br2ChannelID, bs);
+        tree->Branch("tot2", &f.br2ToT, bs);
+        tree->Branch("energy2", &f.br2Energy, bs);
+        tree->Branch("totalEnergy2", &f.br2TotalEnergy, bs);
+        tree->Branch("tacID2", &f.br2TacID, bs);
+        tree->Branch("xi2", &f.br2Xi, bs);
+        tree->Branch("yi2", &f.br2Yi, bs);
+        tree->Branch("x2", &f.br2X, bs);
+        tree->Branch("y2", &f.br2Y, bs);
+        tree->Branch("z2", &f.br2Z, bs);
+    }
+}
+
 DataFileWriter::~DataFileWriter() {
-    if(useAsyncWriting){
-        delete dataWriter;
+    closeFile();
+    if(!rootThreads.empty()) {
+        pthread_mutex_lock(&rootLock);
+        rootDie = true;
+        pthread_cond_broadcast(&rootCondition);
+        pthread_mutex_unlock(&rootLock);
+        for(unsigned n = 0; n < rootThreads.size(); n++) {
+            pthread_join(rootThreads[n], NULL);
+        }
+        pthread_cond_destroy(&rootCondition);
+        pthread_mutex_destroy(&rootLock);
     }
-    else closeFile();
-    if(fileSplitTime > 0) {
+    if(fileSplitTime > 0 && fileType != FILE_NULL) {
+        // Let the finished parts be renamed before the last one
+        pthread_mutex_lock(&rolloverLock);
+        rolloverDie = true;
+        pthread_cond_broadcast(&rolloverCondition);
+        pthread_mutex_unlock(&rolloverLock);
+        pthread_join(rolloverThread, NULL);
+        pthread_cond_destroy(&rolloverCondition);
+        pthread_mutex_destroy(&rolloverLock);
+
+        // The part opened in advance was not used
+        closeSegment(nextSegment);
+        std::vector<std::string> fileNames = getSegmentFileNames(getPartName("next"));
+        for(unsigned n = 0; n < fileNames.size(); n++) unlink(fileNames[n].c_str());
+
         renameFile();
     }
+    delete lorHistogram;
+    delete channelSpectra;
 };
 
+// ROOT entries are filled into the output tree one by one unless batches are enabled
+void DataFileWriter::enableRootBatches() {
+    // The event fraction selects on the event counter, which is only known in buffer order
+    if(fileType != FILE_ROOT || eventFractionToWrite < 1024 || !rootThreads.empty()) return;
+
+    // Batches are compressed concurrently
+    ROOT::EnableThreadSafety();
+    long nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(nThreads > ROOT_MAX_THREADS) nThreads = ROOT_MAX_THREADS;
+    if(nThreads < 1) nThreads = 1;
+    rootEntries.reserve(ROOT_BATCH_ENTRIES);
+    rootDie = false;
+    pthread_mutex_init(&rootLock, NULL);
+    pthread_cond_init(&rootCondition, NULL);
+    rootThreads.resize(nThreads);
+    for(long n = 0; n < nThreads; n++) {
+        pthread_create(&rootThreads[n], NULL, rootThreadRoutine, (void *)this);
+    }
+}
+
 void DataFileWriter::setStepValues(float step1, float step2){
 	this->step1 = step1;
     this->step2 = step2;
 }
 
 void DataFileWriter::closeFile() {
-    if (fileType == FILE_ROOT){
+    endSegment();
+    OutputSegment segment = getSegment();
+    closeSegment(segment);
+}
+
+void DataFileWriter::closeStep(){
+    writeStepIndex();
+    if (fileType == FILE_ROOT || fileType == FILE_CHANNEL_SPECTRA_ROOT){
         hFile->Write();
-        hFile->Close();
-    }
-    else if(fileType == FILE_BINARY || fileType == FILE_BINARY_COMPACT) {
-        fclose(dataFile);
-        fclose(indexFile);
-    }
-    else if(fileType == FILE_TEXT || fileType == FILE_TEXT_COMPACT) {
-        fclose(dataFile);
     }
 }
 
-void DataFileWriter::closeStep(){
+void DataFileWriter::writeStepIndex(){
     if (fileType == FILE_ROOT){
+        flushRootEntries();
         brStepBegin = stepBegin;
         brStepEnd = hData->GetEntries();
         brStep1 = this->step1;
         brStep2 = this->step2;
         hIndex->Fill();
         stepBegin = hData->GetEntries();
-        hFile->Write();
+    }
+    else if(compressionLevel > 0) {
+        // Step boundaries in the decompressed stream and in the compressed file
+        fprintf(indexFile, "%lld\t%lld\t%e\t%e\t%lld\t%lld\n", rawStepBegin, rawPosition, this->step1, this->step2, (long long)stepBegin, dataPosition);
+        rawStepBegin = rawPosition;
+        stepBegin = dataPosition;
     }
     else if(fileType == FILE_BINARY || fileType == FILE_BINARY_COMPACT) {
         if(useAsyncWriting){
@@ -183,421 +414,1011 @@ void DataFileWriter::closeStep(){
             stepBegin = ftell(dataFile);
         }
     }
+    else if(fileType == FILE_COLUMNAR) {
+        ColumnarStepInfo step = { this->step1, this->step2, (uint64_t)stepBegin, columnarBlocks.size() };
+        columnarSteps.push_back(step);
+        stepBegin = columnarBlocks.size();
+    }
+    else if(fileType == FILE_LOR_HISTOGRAM) {
+        std::vector<LORHistogramEntry> entries;
+        lorHistogram->takeStep(entries);
+        LORHistogramStep step = { this->step1, this->step2, entries.size() };
+        writeData(&step, sizeof(step));
+        writeData(entries.data(), entries.size() * sizeof(LORHistogramEntry));
+    }
+    else if(fileType == FILE_CHANNEL_SPECTRA || fileType == FILE_CHANNEL_SPECTRA_ROOT) {
+        writeChannelSpectra();
+    }
     else {
         // Do nothing
     }
 }
 
+// Merge the spectra of the step and write one record, or one tree entry, per channel
+void DataFileWriter::writeChannelSpectra(){
+    std::vector<uint32_t> records;
+    uint64_t nChannels;
+    channelSpectra->takeStep(records, nChannels);
+
+    if(fileType == FILE_CHANNEL_SPECTRA) {
+        ChannelSpectraStep step = { this->step1, this->step2, nChannels };
+        writeData(&step, sizeof(step));
+        writeData(records.data(), records.size() * sizeof(uint32_t));
+        return;
+    }
+
+    size_t recordSize = channelSpectra->getRecordSize();
+    size_t headerSize = sizeof(ChannelSpectraChannel) / sizeof(uint32_t);
+    unsigned energyBins = channelSpectra->getEnergyBins();
+    unsigned timeBins = channelSpectra->getTimeBins();
+    brStep1 = this->step1;
+    brStep2 = this->step2;
+    for(size_t begin = 0; begin < records.size(); begin += recordSize) {
+        ChannelSpectraChannel *channel = (ChannelSpectraChannel *)&records[begin];
+        brSpectraChannelID = channel->channelID;
+        brEnergyUnderflow = channel->energyUnderflow;
+        brEnergyOverflow = channel->energyOverflow;
+        memcpy(brEnergySpectrum.data(), &records[begin + headerSize], energyBins * sizeof(uint32_t));
+        memcpy(brTimeSpectrum.data(), &records[begin + headerSize + energyBins], timeBins * sizeof(uint32_t));
+        hData->Fill();
+    }
+}
+
 void DataFileWriter::checkFilePartForSplit(long long filePartIndex) {
-    if((fileSplitTime > 0) && (filePartIndex > currentFilePartIndex)) {
-        closeStep();
-        closeFile();
-        renameFile();
-        openFile();
+    if((fileSplitTime > 0) && (fileType != FILE_NULL) && (filePartIndex > currentFilePartIndex)) {
+        writeStepIndex();
+        endSegment();
+        OutputSegment finished = getSegment();
+
+        // Switch to the part which was opened in advance; waits only if parts are shorter than it takes to close one
+        pthread_mutex_lock(&rolloverLock);
+        while(!nextSegmentReady) {
+            pthread_cond_wait(&rolloverCondition, &rolloverLock);
+        }
+        setSegment(nextSegment);
+        nextSegmentReady = false;
+        char suffix[32];
+        sprintf(suffix, "%08lld", currentFilePartIndex);
+        finishedSegments.push_back(std::make_pair(finished, getPartName(suffix)));
+        pthread_cond_broadcast(&rolloverCondition);
+        pthread_mutex_unlock(&rolloverLock);
+
+        beginSegment();
         currentFilePartIndex = filePartIndex;
     }
 }   
 
-void DataFileWriter::renameFile() {
-    char *fName1 = new char[1024];
-    char *fName2 = new char[1024];
-    if(fileType == FILE_BINARY || fileType == FILE_BINARY_COMPACT) {
-        // Binary output consists of two files and fName is their common prefix
-
-        sprintf(fName1, "%s.ldat", fName.c_str());
-        sprintf(fName2, "%s_%08lld.ldat", fName.c_str(), currentFilePartIndex);
-        int r = rename(fName1, fName2);
-        assert(r == 0);
+void *DataFileWriter::rolloverThreadRoutine(void *arg) {
+    DataFileWriter *w = (DataFileWriter *)arg;
+    std::string nextName = w->getPartName("next");
 
-        sprintf(fName1, "%s.lidx", fName.c_str());
-        sprintf(fName2, "%s_%08lld.lidx", fName.c_str(), currentFilePartIndex);
-        r = rename(fName1, fName2);
-        assert(r == 0);
+    pthread_mutex_lock(&w->rolloverLock);
+    while(true) {
+        while(!w->rolloverDie && w->finishedSegments.empty()) {
+            pthread_cond_wait(&w->rolloverCondition, &w->rolloverLock);
+        }
+        if(w->finishedSegments.empty()) break;
+
+        std::pair<OutputSegment, std::string> finished = w->finishedSegments.front();
+        w->finishedSegments.pop_front();
+        pthread_mutex_unlock(&w->rolloverLock);
+
+        // The part takes its final name once complete, and then the part being written, which
+        // was opened as nextName, takes fName
+        w->closeSegment(finished.first);
+        w->renameSegment(w->fName, finished.second);
+        w->renameSegment(nextName, w->fName);
+        OutputSegment segment;
+        w->openSegment(nextName, segment);
+
+        pthread_mutex_lock(&w->rolloverLock);
+        w->nextSegment = segment;
+        w->nextSegmentReady = true;
+        pthread_cond_broadcast(&w->rolloverCondition);
+    }
+    pthread_mutex_unlock(&w->rolloverLock);
+    return NULL;
+}
+
+// Files of the output part with the given name: the data file first, followed by the index file if there is one
+std::vector<std::string> DataFileWriter::getSegmentFileNames(const std::string &name) {
+    std::vector<std::string> fileNames;
+    if(fileType == FILE_COLUMNAR) {
+        // The name is the prefix of the columnar file
+        fileNames.push_back(name + ".lcol");
+    }
+    else if(fileType == FILE_LOR_HISTOGRAM) {
+        fileNames.push_back(name + ".llor");
+    }
+    else if(fileType == FILE_CHANNEL_SPECTRA) {
+        fileNames.push_back(name + ".lspc");
+    }
+    else if(fileType == FILE_BINARY || fileType == FILE_BINARY_COMPACT) {
+        // Binary output consists of two files and the name is their common prefix
+        fileNames.push_back(name + ((compressionLevel > 0) ? ".ldatz" : ".ldat"));
+        fileNames.push_back(name + ".lidx");
+    }
+    else {
+        // ROOT or text output consists of a single file and the name is the complete file name
+        fileNames.push_back(name);
+    }
+    return fileNames;
+}
 
+// Name of the output part with the given suffix
+std::string DataFileWriter::getPartName(const char *suffix) {
+    if(fileType == FILE_COLUMNAR || fileType == FILE_BINARY || fileType == FILE_BINARY_COMPACT || fileType == FILE_LOR_HISTOGRAM || fileType == FILE_CHANNEL_SPECTRA) {
+        return fName + "_" + suffix;
+    }
+
+    size_t p = fName.rfind('.');
+    if(p == std::string::npos || fName.find('/', p) != std::string::npos) {
+        // If fName lacks a "." append the suffix at the end of the file name
+        return fName + "_" + suffix;
     }
     else {
-        // ROOT or text output consists of a single file and fName is the complete fileName
-        strcpy(fName1, fName.c_str());
-        char *p = rindex(fName1, '.');
-
-        if(p == NULL) {
-            // If fName lacks a "." append the file part number at the end of the file name
-            sprintf(fName2, "%s_%08lld", fName1, currentFilePartIndex);
-            int r = rename(fName1, fName2);
-            assert(r == 0);
+        // Insert the suffix before the extension
+        return fName.substr(0, p) + "_" + suffix + fName.substr(p);
+    }
+}
+
+void DataFileWriter::renameSegment(const std::string &from, const std::string &to) {
+    std::vector<std::string> fileNames1 = getSegmentFileNames(from);
+    std::vector<std::string> fileNames2 = getSegmentFileNames(to);
+    for(unsigned n = 0; n < fileNames1.size(); n++) {
+        int r = rename(fileNames1[n].c_str(), fileNames2[n].c_str());
+        assert(r == 0);
+    }
+}
+
+void DataFileWriter::renameFile() {
+    char suffix[32];
+    sprintf(suffix, "%08lld", currentFilePartIndex);
+    renameSegment(fName, getPartName(suffix));
+};
+
+
+// Offset to add to the buffer's event times, in picoseconds
+long long DataFileWriter::getTimeOffset(AbstractEventBuffer *buffer, double t0) {
+    long long tMin = (buffer->getTMin() + t0 - userTimeRef);
+    if (tMin > 0 && tMin > LLONG_MAX / 5000){
+        fprintf(stderr,"Error: User time reference exceeds available data precision for timestamps (tRef = %.0f s since UNIX epoch). Please choose a time reference within less than 100 days before data acquisition start\n", userTimeRef/frequency);
+        exit(1);
+    }
+    tMin *= (long long)Tps;
+    return tMin;
+}
+
+void DataFileWriter::writeData(const void *data, size_t count) {
+    if(count == 0) return;
+    dataPosition += count;
+    if(useAsyncWriting){
+        dataWriter->appendData((void *)data, count);
+    }
+    else{
+        fwrite(data, 1, count, dataFile);
+    }
+}
+
+void DataFileWriter::writeColumnarHeader() {
+    unsigned nColumns;
+    size_t recordSize;
+    const ColumnDefinition *definitions = getColumnDefinitions(eventType, nColumns, recordSize);
+
+    ColumnarFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLUMNAR_FILE_MAGIC, sizeof(header.magic));
+    header.version = COLUMNAR_FILE_VERSION;
+    header.eventType = eventType;
+    header.nColumns = nColumns;
+    writeData(&header, sizeof(header));
+
+    for(unsigned c = 0; c < nColumns; c++) {
+        ColumnarColumnInfo info;
+        memset(&info, 0, sizeof(info));
+        strncpy(info.name, definitions[c].name, sizeof(info.name) - 1);
+        strncpy(info.type, definitions[c].type, sizeof(info.type) - 1);
+        writeData(&info, sizeof(info));
+    }
+}
+
+// Transpose a block of binary records
+ColumnarOutputBlock *DataFileWriter::toColumns(OutputBlock *records) {
+    unsigned nColumns;
+    size_t recordSize;
+    const ColumnDefinition *definitions = getColumnDefinitions(eventType, nColumns, recordSize);
+
+    ColumnarOutputBlock *block = new ColumnarOutputBlock(records->getFilePartIndex());
+    size_t nRows = records->getSize() / recordSize;
+    block->nRows = nRows;
+    block->columns.resize(nColumns);
+    for(unsigned c = 0; c < nColumns; c++) {
+        size_t size = getColumnarTypeSize(definitions[c].type);
+        std::vector<char> &column = block->columns[c];
+        column.resize(nRows * size);
+        const char *src = records->getData() + definitions[c].offset;
+        char *dst = column.data();
+        for(size_t r = 0; r < nRows; r++) {
+            memcpy(dst, src, size);
+            src += recordSize;
+            dst += size;
         }
-        else {
-            // Insert the file part number before the extension
-            char tmp = *p;
-            *p = '\0';
-            sprintf(fName2, "%s_%08lld.%s", fName1, currentFilePartIndex, p+1);
-            *p = tmp;
-            int r = rename(fName1, fName2);
-            assert(r == 0);
+    }
+    for(size_t i = 0; i < records->getNumberOfEvents(); i++)
+        block->eventEndRow.push_back(records->getEventEnd(i) / recordSize);
+
+    delete records;
+    return block;
+}
+
+void DataFileWriter::writeColumnarBlock(ColumnarOutputBlock *block) {
+    // Keep the rows of the events selected by the event fraction
+    std::vector<std::pair<size_t, size_t> > runs;
+    size_t nEvents = block->eventEndRow.size();
+    if(eventFractionToWrite >= 1024) {
+        runs.push_back(std::make_pair(0, block->nRows));
+        eventCounter += nEvents;
+    }
+    else {
+        size_t eventBegin = 0;
+        for(size_t i = 0; i < nEvents; i++) {
+            long long tmpCounter = eventCounter;
+            eventCounter += 1;
+            size_t eventEnd = block->eventEndRow[i];
+            if((tmpCounter % 1024) < eventFractionToWrite && eventEnd > eventBegin) {
+                if(!runs.empty() && runs.back().second == eventBegin)
+                    runs.back().second = eventEnd;
+                else
+                    runs.push_back(std::make_pair(eventBegin, eventEnd));
+            }
+            eventBegin = eventEnd;
         }
+    }
+
+    uint64_t nRows = 0;
+    for(unsigned k = 0; k < runs.size(); k++) nRows += runs[k].second - runs[k].first;
+    if(nRows == 0) return;
 
+    ColumnarBlockInfo info = { (uint64_t)dataPosition, nRows };
+    columnarBlocks.push_back(info);
+
+    ColumnarBlockHeader header = { nRows, 0 };
+    writeData(&header, sizeof(header));
+
+    unsigned nColumns;
+    size_t recordSize;
+    const ColumnDefinition *definitions = getColumnDefinitions(eventType, nColumns, recordSize);
+    static const char padding[COLUMNAR_ALIGNMENT] = { 0 };
+    for(unsigned c = 0; c < nColumns; c++) {
+        size_t size = getColumnarTypeSize(definitions[c].type);
+        for(unsigned k = 0; k < runs.size(); k++) {
+            writeData(block->columns[c].data() + runs[k].first * size, (runs[k].second - runs[k].first) * size);
+        }
+        size_t n = nRows * size;
+        writeData(padding, (COLUMNAR_ALIGNMENT - n % COLUMNAR_ALIGNMENT) % COLUMNAR_ALIGNMENT);
     }
-    delete [] fName2;
-    delete [] fName1;
-};
+}
 
+void DataFileWriter::writeColumnarDirectory() {
+    ColumnarFileTrailer trailer;
+    trailer.directoryOffset = dataPosition;
+    trailer.nBlocks = columnarBlocks.size();
+    trailer.nSteps = columnarSteps.size();
+    memcpy(trailer.magic, COLUMNAR_FILE_MAGIC, sizeof(trailer.magic));
 
-void DataFileWriter::writeRawEvents(EventBuffer<RawHit> *buffer, double t0) {
-    
-    long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
-    checkFilePartForSplit(filePartIndex);
-    
-    int N = buffer->getSize();
+    writeData(columnarBlocks.data(), columnarBlocks.size() * sizeof(ColumnarBlockInfo));
+    writeData(columnarSteps.data(), columnarSteps.size() * sizeof(ColumnarStepInfo));
+    writeData(&trailer, sizeof(trailer));
+}
 
-    long long bufferMinFrameID = buffer->getTMin() / 1024;
+static_assert(sizeof(Event) == 16 && sizeof(GroupEvent) == 18 && sizeof(CoincidenceEvent) == 36,
+    "The record layouts are also known to CompressedFile.cpp");
 
-    for (int i = 0; i < N; i++) {
-        long long tmpCounter = eventCounter;
-        eventCounter += 1;
-        if((tmpCounter % 1024) >= eventFractionToWrite) continue;
+unsigned DataFileWriter::getCompressedLayout() {
+    if(eventType == GROUP)
+        return (fileType == FILE_BINARY_COMPACT) ? LAYOUT_GROUP_COMPACT : LAYOUT_GROUP;
+    else if(eventType == COINCIDENCE)
+        return (fileType == FILE_BINARY_COMPACT) ? LAYOUT_COINCIDENCE_COMPACT : LAYOUT_COINCIDENCE;
+    else
+        return LAYOUT_SINGLE;
+}
 
-        RawHit &hit = buffer->get(i);
-        if (fileType == FILE_ROOT){
-            brStep1 = step1;
-            brStep2 = step2;
-            
-            brFrameID = hit.frameID + bufferMinFrameID;
-            brChannelID = hit.channelID;
-            brTacID = hit.tacID;
-            brTCoarse = hit.tcoarse;
-            brECoarse = hit.ecoarse;
-            brTFine = hit.tfine;
-            brEFine = hit.efine;
-            hData->Fill();
+// Compress a block of binary records in the worker, unless the event fraction
+// has to select from it first, which can only be done in buffer order
+OutputBlock *DataFileWriter::compress(OutputBlock *records) {
+    if(eventFractionToWrite < 1024) return records;
+
+    CompressedOutputBlock *block = new CompressedOutputBlock(records->getFilePartIndex());
+    compressBlock(records->getData(), records->getSize(), getCompressedLayout(), compressionLevel, block->compressed);
+    block->rawSize = records->getSize();
+    block->nEvents = records->getNumberOfEvents();
+    delete records;
+    return block;
+}
+
+void DataFileWriter::writeCompressed(const char *data, size_t size) {
+    std::vector<char> compressed;
+    compressBlock(data, size, getCompressedLayout(), compressionLevel, compressed);
+    writeData(compressed.data(), compressed.size());
+    rawPosition += size;
+}
+
+void DataFileWriter::writeBlock(OutputBlock *block) {
+    checkFilePartForSplit(block->getFilePartIndex());
+
+    size_t N = block->getNumberOfEvents();
+    if(fileType == FILE_COLUMNAR) {
+        writeColumnarBlock((ColumnarOutputBlock *)block);
+    }
+    else if(fileType == FILE_ROOT) {
+        RootOutputBlock *rootBlock = (RootOutputBlock *)block;
+        // The block may have been formatted before the step was set, as the serial fill takes the step when writing
+        for(size_t n = 0; n < rootBlock->entries.size(); n++) {
+            rootBlock->entries[n].brStep1 = step1;
+            rootBlock->entries[n].brStep2 = step2;
         }
-        else {
-            fprintf(dataFile, "%lu\t%u\t%hu\t%hu\t%hu\t%hu\t%hu\n",
-                hit.frameID,
-                hit.channelID, hit.tacID,
-                hit.tcoarse, hit.ecoarse,
-                hit.tfine, hit.efine
-            );
+        rootEntries.insert(rootEntries.end(), rootBlock->entries.begin(), rootBlock->entries.end());
+        eventCounter += rootBlock->nEvents;
+        if(rootEntries.size() >= ROOT_BATCH_ENTRIES) submitRootBatch();
+        appendRootBatches(2 * rootThreads.size());
+    }
+    else if(fileType == FILE_LOR_HISTOGRAM || fileType == FILE_CHANNEL_SPECTRA || fileType == FILE_CHANNEL_SPECTRA_ROOT) {
+        // Counted by format*Events(), the histograms are written by closeStep()
+    }
+    else if(compressionLevel > 0 && eventFractionToWrite >= 1024) {
+        CompressedOutputBlock *compressedBlock = (CompressedOutputBlock *)block;
+        writeData(compressedBlock->compressed.data(), compressedBlock->compressed.size());
+        rawPosition += compressedBlock->rawSize;
+        eventCounter += compressedBlock->nEvents;
+    }
+    else if(eventFractionToWrite >= 1024) {
+        writeData(block->getData(), block->getSize());
+        eventCounter += N;
+    }
+    else {
+        // Write each run of consecutive events which are selected by the event fraction at once
+        // When compressing, the selected events are compressed together as one block
+        std::vector<char> selected;
+        auto writeRun = [&](size_t begin, size_t end) {
+            if(compressionLevel > 0)
+                selected.insert(selected.end(), block->getData() + begin, block->getData() + end);
+            else
+                writeData(block->getData() + begin, end - begin);
+        };
+        size_t runBegin = 0;
+        size_t eventBegin = 0;
+        for(size_t i = 0; i < N; i++) {
+            long long tmpCounter = eventCounter;
+            eventCounter += 1;
+            size_t eventEnd = block->getEventEnd(i);
+            if((tmpCounter % 1024) >= eventFractionToWrite) {
+                writeRun(runBegin, eventBegin);
+                runBegin = eventEnd;
+            }
+            eventBegin = eventEnd;
         }
-    }	
+        writeRun(runBegin, eventBegin);
+        if(compressionLevel > 0) writeCompressed(selected.data(), selected.size());
+    }
+    delete block;
 }
 
+OutputBlock *DataFileWriter::formatRawEvents(EventBuffer<RawHit> *buffer, double t0) {
+    // Without batches, ROOT entries are filled into the output tree by writeRawEvents()
+    bool rootBlock = (fileType == FILE_ROOT) && !rootThreads.empty();
+    if(fileType == FILE_NULL || (fileType == FILE_ROOT && !rootBlock)) return NULL;
 
-void DataFileWriter::writeSingleEvents(EventBuffer<Hit> *buffer, double t0) {
     long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
-    checkFilePartForSplit(filePartIndex);
+    int N = buffer->getSize();
+    if(rootBlock) {
+        RootOutputBlock *block = new RootOutputBlock(filePartIndex);
+        fillRawEntries(buffer, block->entries, block->nEvents);
+        return block;
+    }
+    OutputBlock *block = new OutputBlock(filePartIndex, N * 32);
 
-    long long tMin = (buffer->getTMin() + t0 - userTimeRef);
-    if (tMin > 0 && tMin > LLONG_MAX / 5000){
-        fprintf(stderr,"Error: User time reference exceeds available data precision for timestamps (tRef = %.0f s since UNIX epoch). Please choose a time reference within less than 100 days before data acquisition start\n", userTimeRef/frequency);
-        exit(1);
+    for (int i = 0; i < N; i++) {
+        RawHit &hit = buffer->get(i);
+        block->reserveRecord();
+        block->putUnsigned(hit.frameID);
+        block->putChar('\t');
+        block->putUnsigned(hit.channelID);
+        block->putChar('\t');
+        block->putUnsigned(hit.tacID);
+        block->putChar('\t');
+        block->putUnsigned(hit.tcoarse);
+        block->putChar('\t');
+        block->putUnsigned(hit.ecoarse);
+        block->putChar('\t');
+        block->putUnsigned(hit.tfine);
+        block->putChar('\t');
+        block->putUnsigned(hit.efine);
+        block->putChar('\n');
+        block->endEvent();
+    }
+    return block;
+}
+
+OutputBlock *DataFileWriter::formatSingleEvents(EventBuffer<Hit> *buffer, double t0) {
+    bool rootBlock = (fileType == FILE_ROOT) && !rootThreads.empty();
+    if(fileType == FILE_NULL || (fileType == FILE_ROOT && !rootBlock)) return NULL;
+    if(fileType == FILE_CHANNEL_SPECTRA || fileType == FILE_CHANNEL_SPECTRA_ROOT) {
+        channelSpectra->fill(buffer);
+        return new OutputBlock(0, 0);
     }
-    tMin *= (long long)Tps;
 
+    long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
+    long long tMin = getTimeOffset(buffer, t0);
     int N = buffer->getSize();
-    for (int i = 0; i < N; i++) {
-        long long tmpCounter = eventCounter;
-        eventCounter += 1;
-        if((tmpCounter % 1024) >= eventFractionToWrite) continue;
+    if(rootBlock) {
+        RootOutputBlock *block = new RootOutputBlock(filePartIndex);
+        fillSingleEntries(buffer, tMin, block->entries, block->nEvents);
+        return block;
+    }
+    OutputBlock *block = new OutputBlock(filePartIndex, N * 32);
+    // Columnar files are transposed from the binary records
+    FILE_TYPE recordType = (fileType == FILE_COLUMNAR) ? FILE_BINARY : fileType;
 
+    for (int i = 0; i < N; i++) {
         Hit &hit = buffer->get(i);
-        if(!hit.valid) continue;
-
-        float Eunit = hit.raw->qdcMode ? 1.0 : Tns;
-        
-        if (fileType == FILE_ROOT){
-            brStep1 = step1;
-            brStep2 = step2;
-            
-            brTime = ((long long)(hit.time * Tps)) + tMin;
-            brChannelID = hit.raw->channelID;
-            brToT = (hit.timeEnd - hit.time) * Tps;
-            brEnergy = hit.energy * Eunit;
-            brTacID = hit.raw->tacID;
-            brTQT = hit.raw->time - hit.time;
-            brTQE = (hit.raw->timeEnd - hit.timeEnd);
-            brX = hit.x;
-            brY = hit.y;
-            brZ = hit.z;
-            brXi = hit.xi;
-            brYi = hit.yi;
-            
-            hData->Fill();
+        // Singles have no compact formats
+        if(!hit.valid || (recordType != FILE_TEXT && recordType != FILE_BINARY)) {
+            block->endEvent();
+            continue;
         }
-        else if(fileType == FILE_BINARY) {
+
+        float Eunit = hit.qdcMode ? 1.0 : Tns;
+        block->reserveRecord();
+        if(recordType == FILE_BINARY) {
             Event eo = {
-                ((long long)(hit.time * Tps)) + tMin,
+                hit.time + tMin,
                 hit.energy * Eunit,
-                (int)hit.raw->channelID
+                (int)hit.channelID
             };
-            if(useAsyncWriting){
-                dataWriter->appendData(static_cast<void*>(&eo) ,sizeof(eo));
-            }
-            else{
-                fwrite(&eo, sizeof(eo), 1, dataFile);
-            }
+            block->putData(&eo, sizeof(eo));
         }
-        else if (fileType == FILE_TEXT) {
-            fprintf(dataFile, "%lld\t%f\t%d\n",
-                ((long long)(hit.time * Tps)) + tMin,
-                hit.energy * Eunit,
-                (int)hit.raw->channelID
-                );
+        else {
+            block->putInt(hit.time + tMin);
+            block->putChar('\t');
+            block->putFixed(hit.energy * Eunit);
+            block->putChar('\t');
+            block->putInt((int)hit.channelID);
+            block->putChar('\n');
         }
-    }	
+        block->endEvent();
+    }
+    if(fileType == FILE_COLUMNAR) return toColumns(block);
+    if(compressionLevel > 0) return compress(block);
+    return block;
 }
 
+OutputBlock *DataFileWriter::formatGroupEvents(EventBuffer<GammaPhoton> *buffer, double t0) {
+    bool rootBlock = (fileType == FILE_ROOT) && !rootThreads.empty();
+    if(fileType == FILE_NULL || (fileType == FILE_ROOT && !rootBlock)) return NULL;
 
-void DataFileWriter::writeGroupEvents(EventBuffer<GammaPhoton> *buffer, double t0) {
     long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
-    checkFilePartForSplit(filePartIndex);
-
-    long long tMin = (buffer->getTMin() + t0 - userTimeRef);
-    if (tMin > 0 && tMin > LLONG_MAX / 5000){
-        fprintf(stderr,"Error: User time reference exceeds available data precision for timestamps (tRef = %.0f s since UNIX epoch). Please choose a time reference within less than 100 days before data acquisition start\n", userTimeRef/frequency);
-        exit(1);
+    long long tMin = getTimeOffset(buffer, t0);
+    int N = buffer->getSize();
+    if(rootBlock) {
+        RootOutputBlock *block = new RootOutputBlock(filePartIndex);
+        fillGroupEntries(buffer, tMin, block->entries, block->nEvents);
+        return block;
     }
-    tMin *= (long long)Tps;
+    OutputBlock *block = new OutputBlock(filePartIndex, N * 40);
+    FILE_TYPE recordType = (fileType == FILE_COLUMNAR) ? FILE_BINARY : fileType;
 
-    int N = buffer->getSize();
     for (int i = 0; i < N; i++) {
-        long long tmpCounter = eventCounter;
-        eventCounter += 1;
-        if((tmpCounter % 1024) >= eventFractionToWrite) continue;
-
         GammaPhoton &p = buffer->get(i);
-        
-        if(!p.valid) continue;
+        if(!p.valid) {
+            block->endEvent();
+            continue;
+        }
 
-        Hit &h0 = *p.hits[0];
         int limit = (hitLimitToWrite < p.nHits) ? hitLimitToWrite : p.nHits;
 
-        if(fileType == FILE_TEXT_COMPACT) {
-            fprintf(dataFile, "%d\n", limit);
+        block->reserveRecord();
+        if(recordType == FILE_TEXT_COMPACT) {
+            block->putInt(limit);
+            block->putChar('\n');
         }
-        else if(fileType == FILE_BINARY_COMPACT) {
+        else if(recordType == FILE_BINARY_COMPACT) {
             GroupHeader header = {(uint8_t)limit};
-            if(useAsyncWriting){
-                dataWriter->appendData(static_cast<void*>(&header) ,sizeof(header));
-            }
-            else{
-                fwrite(&header, sizeof(header), 1, dataFile);
-            }
+            block->putData(&header, sizeof(header));
         }
 
         for(int m = 0; m < limit; m++) {
             Hit &h = *p.hits[m];
-            float Eunit = h.raw->qdcMode ? 1.0 : Tns;
-
-
-            if (fileType == FILE_ROOT){
-                brStep1 = step1;
-                brStep2 = step2;
-
-                brN  = p.nHits;
-                brJ = m;
-                brTime = ((long long)(h.time * Tps)) + tMin;
-                brTimeDelta = (long long)((h.time - h0.time) * Tps);
-                brChannelID = h.raw->channelID;
-                brToT = (h.timeEnd - h.time) * Tps;
-                brEnergy = h.energy * Eunit;
-		brTotalEnergy = p.energy * Eunit;
-                brTacID = h.raw->tacID;
-                brX = h.x;
-                brY = h.y;
-                brZ = h.z;
-                brXi = h.xi;
-                brYi = h.yi;
-                
-                hData->Fill();
-            }
-            else if(fileType == FILE_BINARY) {
-                GroupEvent eo = { 
+            float Eunit = h.qdcMode ? 1.0 : Tns;
+
+            block->reserveRecord();
+            if(recordType == FILE_BINARY) {
+                GroupEvent eo = {
                     (uint8_t)p.nHits, (uint8_t)m,
-                    ((long long)(h.time * Tps)) + tMin,
+                    h.time + tMin,
                     h.energy * Eunit,
-                    (int)h.raw->channelID
+                    (int)h.channelID
                 };
-                if(useAsyncWriting){
-                    dataWriter->appendData(static_cast<void*>(&eo) ,sizeof(eo));
-                }
-                else{
-                    fwrite(&eo, sizeof(eo), 1, dataFile);
-                }
+                block->putData(&eo, sizeof(eo));
             }
-            else if(fileType == FILE_BINARY_COMPACT) {
+            else if(recordType == FILE_BINARY_COMPACT) {
                 Event eo = {
-                    ((long long)(h.time * Tps)) + tMin,
+                    h.time + tMin,
                     h.energy * Eunit,
-                    (int)h.raw->channelID
+                    (int)h.channelID
                 };
-                if(useAsyncWriting){
-                    dataWriter->appendData(static_cast<void*>(&eo) ,sizeof(eo));
-                }
-                else{
-                    fwrite(&eo, sizeof(eo), 1, dataFile);
-                }
+                block->putData(&eo, sizeof(eo));
             }
-            else if (fileType == FILE_TEXT) {
-                fprintf(dataFile, "%d\t%d\t%lld\t%f\t%d\n",
-                    p.nHits, m,
-                    ((long long)(h.time * Tps)) + tMin,
-                    h.energy * Eunit,
-                    h.raw->channelID
-                );
-            }
-            else if (fileType == FILE_TEXT_COMPACT) {
-                fprintf(dataFile, "%lld\t%f\t%d\n",
-                    ((long long)(h.time * Tps)) + tMin,
-                    h.energy * Eunit,
-                    h.raw->channelID
-                );
+            else {
+                if(recordType == FILE_TEXT) {
+                    block->putInt(p.nHits);
+                    block->putChar('\t');
+                    block->putInt(m);
+                    block->putChar('\t');
+                }
+                block->putInt(h.time + tMin);
+                block->putChar('\t');
+                block->putFixed(h.energy * Eunit);
+                block->putChar('\t');
+                block->putInt((int)h.channelID);
+                block->putChar('\n');
             }
         }
-    }	   
+        block->endEvent();
+    }
+    if(fileType == FILE_COLUMNAR) return toColumns(block);
+    if(compressionLevel > 0) return compress(block);
+    return block;
 }
 
+OutputBlock *DataFileWriter::formatCoincidenceEvents(EventBuffer<Coincidence> *buffer, double t0, short delayed) {
+    bool rootBlock = (fileType == FILE_ROOT) && !rootThreads.empty();
+    if(fileType == FILE_NULL || (fileType == FILE_ROOT && !rootBlock)) return NULL;
+    if(fileType == FILE_LOR_HISTOGRAM) {
+        lorHistogram->fill(buffer, delayed);
+        return new OutputBlock(0, 0);
+    }
 
-void DataFileWriter::writeCoincidenceEvents(EventBuffer<Coincidence> *buffer, double t0) {
     long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
-    checkFilePartForSplit(filePartIndex);
-     
-    long long tMin = (buffer->getTMin() + t0 - userTimeRef);
-    if (tMin > 0 && tMin > LLONG_MAX / 5000){
-        fprintf(stderr,"Error: User time reference exceeds available data precision for timestamps (tRef = %.0f s since UNIX epoch). Please choose a time reference within less than 100 days before data acquisition start\n", userTimeRef/frequency);
-        exit(1);
-    }
-    tMin *= (long long)Tps;
-    
+    long long tMin = getTimeOffset(buffer, t0);
     int N = buffer->getSize();
-    for (int i = 0; i < N; i++) {
-        long long tmpCounter = eventCounter;
-        eventCounter += 1;
-        if((tmpCounter % 1024) >= eventFractionToWrite) continue;
+    if(rootBlock) {
+        RootOutputBlock *block = new RootOutputBlock(filePartIndex);
+        fillCoincidenceEntries(buffer, tMin, delayed, block->entries, block->nEvents);
+        return block;
+    }
+    OutputBlock *block = new OutputBlock(filePartIndex, N * 64);
+    FILE_TYPE recordType = (fileType == FILE_COLUMNAR) ? FILE_BINARY : fileType;
 
+    for (int i = 0; i < N; i++) {
         Coincidence &e = buffer->get(i);
-        if(!e.valid) continue;
-        if(e.nPhotons != 2) continue;
-        
+        if(e.delayed != delayed) continue;
+
+        if(!e.valid || e.nPhotons != 2) {
+            block->endEvent();
+            continue;
+        }
+
         GammaPhoton &p1 = *e.photons[0];
         GammaPhoton &p2 = *e.photons[1];
-        
+
         int limit1 = (hitLimitToWrite < p1.nHits) ? hitLimitToWrite : p1.nHits;
         int limit2 = (hitLimitToWrite < p2.nHits) ? hitLimitToWrite : p2.nHits;
 
-        int coincHitIndex = 0;
-        
-        if(fileType == FILE_TEXT_COMPACT) {	
-            fprintf(dataFile, "%d\t%d\n", limit1, limit2);
-            for(int i = 0; i < limit1 + limit2; i++) {
-                Hit &h = i < limit1 ? *p1.hits[i] : *p2.hits[i-limit1];
-                float Eunit = h.raw->qdcMode ? 1.0 : Tns;
-                fprintf(dataFile, "%lld\t%f\t%d\n",
-                ((long long)(h.time * Tps)) + tMin,
-                h.energy * Eunit,
-                h.raw->channelID);
+        if(recordType == FILE_TEXT_COMPACT || recordType == FILE_BINARY_COMPACT) {
+            block->reserveRecord();
+            if(recordType == FILE_BINARY_COMPACT) {
+                CoincidenceGroupHeader header = {(uint8_t)limit1, (uint8_t)limit2};
+                block->putData(&header, sizeof(header));
             }
-        }
-        else if(fileType == FILE_BINARY_COMPACT) {
-            CoincidenceGroupHeader header = {(uint8_t)limit1, (uint8_t)limit2};
-            if(useAsyncWriting){
-                dataWriter->appendData(static_cast<void*>(&header) ,sizeof(header));
-            }
-            else{
-                fwrite(&header, sizeof(header), 1, dataFile);
+            else {
+                block->putInt(limit1);
+                block->putChar('\t');
+                block->putInt(limit2);
+                block->putChar('\n');
             }
             for(int i = 0; i < limit1 + limit2; i++) {
                 Hit &h = i < limit1 ? *p1.hits[i] : *p2.hits[i-limit1];
-                float Eunit = h.raw->qdcMode ? 1.0 : Tns;
-                Event eo = { 
-                    ((long long)(h.time * Tps)) + tMin,
-                    h.energy * Eunit,
-                    (int)h.raw->channelID
-                };
-                if(useAsyncWriting){
-                    dataWriter->appendData(static_cast<void*>(&eo) ,sizeof(eo));
+                float Eunit = h.qdcMode ? 1.0 : Tns;
+                block->reserveRecord();
+                if(recordType == FILE_BINARY_COMPACT) {
+                    Event eo = {
+                        h.time + tMin,
+                        h.energy * Eunit,
+                        (int)h.channelID
+                    };
+                    block->putData(&eo, sizeof(eo));
                 }
-                else{
-                    fwrite(&eo, sizeof(eo), 1, dataFile);
+                else {
+                    block->putInt(h.time + tMin);
+                    block->putChar('\t');
+                    block->putFixed(h.energy * Eunit);
+                    block->putChar('\t');
+                    block->putInt((int)h.channelID);
+                    block->putChar('\n');
                 }
             }
         }
-        else{
+        else {
             for(int m = 0; m < limit1; m++) for(int n = 0; n < limit2; n++) {
                 if(m != 0 && n != 0) continue;
-                
+
                 Hit &h1 = *p1.hits[m];
                 Hit &h2 = *p2.hits[n];
-                
-                float Eunit1 = h1.raw->qdcMode ? 1.0 : Tns;
-                float Eunit2 = h2.raw->qdcMode ? 1.0 : Tns;
-
-                if (fileType == FILE_ROOT){
-                    brStep1 = this->step1;
-                    brStep2 = this->step2;
-
-                    br1N  = p1.nHits;
-                    br1J = m;
-                    br1Time = ((long long)(h1.time * Tps)) + tMin;
-                    br1ChannelID = h1.raw->channelID;
-                    br1ToT = (h1.timeEnd - h1.time) * Tps;
-                    br1Energy = h1.energy * Eunit1;
-		    br1TotalEnergy = p1.energy * Eunit1;
-                    br1TacID = h1.raw->tacID;
-                    br1X = h1.x;
-                    br1Y = h1.y;
-                    br1Z = h1.z;
-                    br1Xi = h1.xi;
-                    br1Yi = h1.yi;
-
-                    br2N  = p2.nHits;
-                    br2J = n;
-                    br2Time = ((long long)(h2.time * Tps)) + tMin;
-                    br2ChannelID = h2.raw->channelID;
-                    br2ToT = (h2.timeEnd - h2.time) * Tps;
-                    br2Energy = h2.energy * Eunit2;
-		    br2TotalEnergy = p2.energy * Eunit2;
-                    br2TacID = h2.raw->tacID;
-                    br2X = h2.x;
-                    br2Y = h2.y;
-                    br2Z = h2.z;
-                    br2Xi = h2.xi;
-                    br2Yi = h2.yi;
-
-                    hData->Fill();
-                }
-                else if(fileType == FILE_BINARY) {
-                    CoincidenceEvent eo = { 
+
+                float Eunit1 = h1.qdcMode ? 1.0 : Tns;
+                float Eunit2 = h2.qdcMode ? 1.0 : Tns;
+
+                block->reserveRecord();
+                if(recordType == FILE_BINARY) {
+                    CoincidenceEvent eo = {
                         (uint8_t)p1.nHits, (uint8_t)m,
-                        ((long long)(h1.time * Tps)) + tMin,
+                        h1.time + tMin,
                         h1.energy * Eunit1,
-                        (int)h1.raw->channelID,
+                        (int)h1.channelID,
                         (uint8_t)p2.nHits, (uint8_t)n,
-                        ((long long)(h2.time * Tps)) + tMin,
+                        h2.time + tMin,
                         h2.energy * Eunit2,
-                        (int)h2.raw->channelID		
+                        (int)h2.channelID
                     };
-                    if(useAsyncWriting){
-                        dataWriter->appendData(static_cast<void*>(&eo) ,sizeof(eo));
-                    }
-                    else{
-                        fwrite(&eo, sizeof(eo), 1, dataFile);
-                    }
+                    block->putData(&eo, sizeof(eo));
                 }
-                else if(fileType == FILE_TEXT) {
-                    fprintf(dataFile, "%d\t%d\t%lld\t%f\t%d\t%d\t%d\t%lld\t%f\t%d\n",
-                        p1.nHits, m,
-                        ((long long)(h1.time * Tps)) + tMin,
-                        h1.energy * Eunit1,
-                        h1.raw->channelID,
-
-                        p2.nHits, n,
-                        ((long long)(h2.time * Tps)) + tMin,
-                        h2.energy * Eunit2,
-                        h2.raw->channelID
-                    );
+                else {
+                    block->putInt(p1.nHits);
+                    block->putChar('\t');
+                    block->putInt(m);
+                    block->putChar('\t');
+                    block->putInt(h1.time + tMin);
+                    block->putChar('\t');
+                    block->putFixed(h1.energy * Eunit1);
+                    block->putChar('\t');
+                    block->putInt((int)h1.channelID);
+                    block->putChar('\t');
+                    block->putInt(p2.nHits);
+                    block->putChar('\t');
+                    block->putInt(n);
+                    block->putChar('\t');
+                    block->putInt(h2.time + tMin);
+                    block->putChar('\t');
+                    block->putFixed(h2.energy * Eunit2);
+                    block->putChar('\t');
+                    block->putInt((int)h2.channelID);
+                    block->putChar('\n');
                 }
             }
         }
-    }	
+        block->endEvent();
+    }
+    if(fileType == FILE_COLUMNAR) return toColumns(block);
+    if(compressionLevel > 0) return compress(block);
+    return block;
+}
+
+void DataFileWriter::writeRawEvents(EventBuffer<RawHit> *buffer, double t0) {
+    OutputBlock *block = formatRawEvents(buffer, t0);
+    if(block != NULL) {
+        writeBlock(block);
+        return;
+    }
+
+    long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
+    checkFilePartForSplit(filePartIndex);
+
+    if (fileType == FILE_ROOT){
+        // The event fraction is selected here in buffer order, so the entries go directly into the output tree
+        std::vector<RootEventFields> entries;
+        fillRawEntries(buffer, entries, eventCounter);
+        fillTree(hData, brData, entries);
+    }
+}
+
+
+void DataFileWriter::writeSingleEvents(EventBuffer<Hit> *buffer, double t0) {
+    OutputBlock *block = formatSingleEvents(buffer, t0);
+    if(block != NULL) {
+        writeBlock(block);
+        return;
+    }
+
+    long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
+    checkFilePartForSplit(filePartIndex);
+
+    if (fileType == FILE_ROOT){
+        std::vector<RootEventFields> entries;
+        fillSingleEntries(buffer, getTimeOffset(buffer, t0), entries, eventCounter);
+        fillTree(hData, brData, entries);
+    }
 }
 
+
+void DataFileWriter::writeGroupEvents(EventBuffer<GammaPhoton> *buffer, double t0) {
+    OutputBlock *block = formatGroupEvents(buffer, t0);
+    if(block != NULL) {
+        writeBlock(block);
+        return;
+    }
+
+    long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
+    checkFilePartForSplit(filePartIndex);
+
+    if (fileType == FILE_ROOT){
+        std::vector<RootEventFields> entries;
+        fillGroupEntries(buffer, getTimeOffset(buffer, t0), entries, eventCounter);
+        fillTree(hData, brData, entries);
+    }
+}
+
+
+void DataFileWriter::writeCoincidenceEvents(EventBuffer<Coincidence> *buffer, double t0, short delayed) {
+    OutputBlock *block = formatCoincidenceEvents(buffer, t0, delayed);
+    if(block != NULL) {
+        writeBlock(block);
+        return;
+    }
+
+    long long filePartIndex = (int)floor(buffer->getTMin() / fileSplitTime);
+    checkFilePartForSplit(filePartIndex);
+
+    if (fileType == FILE_ROOT){
+        std::vector<RootEventFields> entries;
+        fillCoincidenceEntries(buffer, getTimeOffset(buffer, t0), delayed, entries, eventCounter);
+        fillTree(hData, brData, entries);
+    }
+}
+
+
+// Hand the gathered entries to the compressor threads
+void DataFileWriter::submitRootBatch() {
+    if(rootEntries.empty()) return;
+    RootBatch *batch = new RootBatch();
+    batch->entries.swap(rootEntries);
+    batch->file = NULL;
+    batch->tree = NULL;
+    batch->done = false;
+    rootEntries.reserve(ROOT_BATCH_ENTRIES);
+
+    pthread_mutex_lock(&rootLock);
+    rootBatches.push_back(batch);
+    rootQueue.push_back(batch);
+    pthread_cond_broadcast(&rootCondition);
+    pthread_mutex_unlock(&rootLock);
+}
+
+// Append the compressed batches to the output tree in order, waiting while more than maxPending remain
+void DataFileWriter::appendRootBatches(size_t maxPending) {
+    pthread_mutex_lock(&rootLock);
+    while(!rootBatches.empty()) {
+        RootBatch *batch = rootBatches.front();
+        if(!batch->done) {
+            if(rootBatches.size() <= maxPending) break;
+            pthread_cond_wait(&rootCondition, &rootLock);
+            continue;
+        }
+        rootBatches.pop_front();
+        pthread_mutex_unlock(&rootLock);
+
+        // The compressed baskets are appended as they are
+        hData->CopyEntries(batch->tree, -1, "fast");
+        // Also deletes the tree
+        delete batch->file;
+        delete batch;
+
+        pthread_mutex_lock(&rootLock);
+    }
+    pthread_mutex_unlock(&rootLock);
+}
+
+// Write all gathered entries, before the step index or the end of the file
+void DataFileWriter::flushRootEntries() {
+    if(rootThreads.empty()) return;
+    submitRootBatch();
+    appendRootBatches(0);
+}
+
+void *DataFileWriter::rootThreadRoutine(void *arg) {
+    DataFileWriter *w = (DataFileWriter *)arg;
+
+    pthread_mutex_lock(&w->rootLock);
+    while(true) {
+        while(!w->rootDie && w->rootQueue.empty()) {
+            pthread_cond_wait(&w->rootCondition, &w->rootLock);
+        }
+        if(w->rootQueue.empty()) break;
+
+        RootBatch *batch = w->rootQueue.front();
+        w->rootQueue.pop_front();
+        pthread_mutex_unlock(&w->rootLock);
+
+        batch->file = new TMemFile("batch", "RECREATE");
+        batch->file->cd();
+        batch->tree = new TTree("data", "Event List", 2);
+        // Baskets are written when they are full and by Write(), as in the output tree
+        batch->tree->SetAutoFlush(0);
+        w->createDataBranches(batch->tree, batch->fields, ROOT_BASKET_SIZE);
+        w->fillTree(batch->tree, batch->fields, batch->entries);
+        batch->tree->Write();
+        std::vector<RootEventFields>().swap(batch->entries);
+
+        pthread_mutex_lock(&w->rootLock);
+        batch->done = true;
+        pthread_cond_broadcast(&w->rootCondition);
+    }
+    pthread_mutex_unlock(&w->rootLock);
+    return NULL;
+}
+
+void DataFileWriter::fillTree(TTree *tree, RootEventFields &f, std::vector<RootEventFields> &entries) {
+    for(size_t n = 0; n < entries.size(); n++) {
+        f = entries[n];
+        tree->Fill();
+    }
+}
+
+void DataFileWriter::fillRawEntries(EventBuffer<RawHit> *buffer, std::vector<RootEventFields> &entries, long long &counter) {
+    RootEventFields f;
+    memset(&f, 0, sizeof(f));
+    int N = buffer->getSize();
+
+    long long bufferMinFrameID = buffer->getTMin() / 1024;
+
+    for (int i = 0; i < N; i++) {
+        long long tmpCounter = counter;
+        counter += 1;
+        if((tmpCounter % 1024) >= eventFractionToWrite) continue;
+
+        RawHit &hit = buffer->get(i);
+        f.brStep1 = step1;
+        f.brStep2 = step2;
+        
+        f.brFrameID = hit.frameID + bufferMinFrameID;
+        f.brChannelID = hit.channelID;
+        f.brTacID = hit.tacID;
+        f.brTCoarse = hit.tcoarse;
+        f.brECoarse = hit.ecoarse;
+        f.brTFine = hit.tfine;
+        f.brEFine = hit.efine;
+        entries.push_back(f);
+    }
+}
+
+void DataFileWriter::fillSingleEntries(EventBuffer<Hit> *buffer, long long tMin, std::vector<RootEventFields> &entries, long long &counter) {
+    RootEventFields f;
+    memset(&f, 0, sizeof(f));
+    int N = buffer->getSize();
+    for (int i = 0; i < N; i++) {
+        long long tmpCounter = counter;
+        counter += 1;
+        if((tmpCounter % 1024) >= eventFractionToWrite) continue;
+
+        Hit &hit = buffer->get(i);
+        if(!hit.valid) continue;
+
+        float Eunit = hit.qdcMode ? 1.0 : Tns;
+        
+        f.brStep1 = step1;
+        f.brStep2 = step2;
+        
+        f.brTime = hit.time + tMin;
+        f.brChannelID = hit.channelID;
+        f.brToT = (hit.timeEnd - hit.time);
+        f.brEnergy = hit.energy * Eunit;
+        f.brTacID = hit.tacID;
+        f.brTQT = hit.rawTime - hit.time / Tps;
+        f.brTQE = (hit.rawTimeEnd - hit.timeEnd / Tps);
+        f.brX = hit.x;
+        f.brY = hit.y;
+        f.brZ = hit.z;
+        f.brXi = hit.xi;
+        f.brYi = hit.yi;
+        
+        entries.push_back(f);
+    }
+}
+
+void DataFileWriter::fillGroupEntries(EventBuffer<GammaPhoton> *buffer, long long tMin, std::vector<RootEventFields> &entries, long long &counter) {
+    RootEventFields f;
+    memset(&f, 0, sizeof(f));
+    int N = buffer->getSize();
+    for (int i = 0; i < N; i++) {
+        long long tmpCounter = counter;
+        counter += 1;
+        if((tmpCounter % 1024) >= eventFractionToWrite) continue;
+
+        GammaPhoton &p = buffer->get(i);
+        
+        if(!p.valid) continue;
+
+        Hit &h0 = *p.hits[0];
+        int limit = (hitLimitToWrite < p.nHits) ? hitLimitToWrite : p.nHits;
+
+        for(int m = 0; m < limit; m++) {
+            Hit &h = *p.hits[m];
+            float Eunit = h.qdcMode ? 1.0 : Tns;
+
+            f.brStep1 = step1;
+            f.brStep2 = step2;
+
+            f.brN  = p.nHits;
+            f.brJ = m;
+            f.brTime = h.time + tMin;
+            f.brTimeDelta = h.time - h0.time;
+            f.brChannelID = h.channelID;
+            f.brToT = (h.timeEnd - h.time);
+            f.brEnergy = h.energy * Eunit;
+            f.brTotalEnergy = p.energy * Eunit;
+            f.brTacID = h.tacID;
+            f.brX = h.x;
+            f.brY = h.y;
+            f.brZ = h.z;
+            f.brXi = h.xi;
+            f.brYi = h.yi;
+            
+            entries.push_back(f);
+        }
+    }
+}
+
+void DataFileWriter::fillCoincidenceEntries(EventBuffer<Coincidence> *buffer, long long tMin, short delayed, std::vector<RootEventFields> &entries, long long &counter) {
+    RootEventFields f;
+    memset(&f, 0, sizeof(f));
+    int N = buffer->getSize();
+    for (int i = 0; i < N; i++) {
+        Coincidence &e = buffer->get(i);
+        if(e.delayed != delayed) continue;
+
+        long long tmpCounter = counter;
+        counter += 1;
+        if((tmpCounter % 1024) >= eventFractionToWrite) continue;
+
+        if(!e.valid) continue;
+        if(e.nPhotons != 2) continue;
+        
+        GammaPhoton &p1 = *e.photons[0];
+        GammaPhoton &p2 = *e.photons[1];
+        
+        int limit1 = (hitLimitToWrite < p1.nHits) ? hitLimitToWrite : p1.nHits;
+        int limit2 = (hitLimitToWrite < p2.nHits) ? hitLimitToWrite : p2.nHits;
+
+        for(int m = 0; m < limit1; m++) for(int n = 0; n < limit2; n++) {
+            if(m != 0 && n != 0) continue;
+            
+            Hit &h1 = *p1.hits[m];
+            Hit &h2 = *p2.hits[n];
+            
+            float Eunit1 = h1.qdcMode ? 1.0 : Tns;
+            float Eunit2 = h2.qdcMode ? 1.0 : Tns;
+
+            f.brStep1 = this->step1;
+            f.brStep2 = this->step2;
+
+            f.br1N  = p1.nHits;
+            f.br1J = m;
+            f.br1Time = h1.time + tMin;
+            f.br1ChannelID = h1.channelID;
+            f.br1ToT = (h1.timeEnd - h1.time);
+            f.br1Energy = h1.energy * Eunit1;
+            f.br1TotalEnergy = p1.energy * Eunit1;
+            f.br1TacID = h1.tacID;
+            f.br1X = h1.x;
+            f.br1Y = h1.y;
+            f.br1Z = h1.z;
+            f.br1Xi = h1.xi;
+            f.br1Yi = h1.yi;
+
+            f.br2N  = p2.nHits;
+            f.br2J = n;
+            f.br2Time = h2.time + tMin;
+            f.br2ChannelID = h2.channelID;
+            f.br2ToT = (h2.timeEnd - h2.time);
+            f.br2Energy = h2.energy * Eunit2;
+            f.br2TotalEnergy = p2.energy * Eunit2;
+            f.br2TacID = h2.tacID;
+            f.br2X = h2.x;
+            f.br2Y = h2.y;
+            f.br2Z = h2.z;
+            f.br2Xi = h2.xi;
+            f.br2Yi = h2.yi;
+
+            entries.push_back(f);
+        }
+    }
+}
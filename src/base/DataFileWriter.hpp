@@ -4,13 +4,22 @@
 #include <Event.hpp>
 #include <EventBuffer.hpp>
 #include <string.h>
+#include <vector>
+#include <deque>
+#include <pthread.h>
 #include <TFile.h>
 #include <TNtuple.h>
+#include <TMemFile.h>
 #include <OrderedEventHandler.hpp>
+#include <OutputBlock.hpp>
+#include <ColumnarFile.hpp>
+#include <CompressedFile.hpp>
+#include <LORHistogram.hpp>
+#include <ChannelSpectra.hpp>
 #include"AsyncWriter.hpp"
 namespace PETSYS {
 	
-enum FILE_TYPE { FILE_TEXT, FILE_BINARY, FILE_ROOT, FILE_NULL, FILE_TEXT_COMPACT, FILE_BINARY_COMPACT};
+enum FILE_TYPE { FILE_TEXT, FILE_BINARY, FILE_ROOT, FILE_NULL, FILE_TEXT_COMPACT, FILE_BINARY_COMPACT, FILE_COLUMNAR, FILE_LOR_HISTOGRAM, FILE_CHANNEL_SPECTRA, FILE_CHANNEL_SPECTRA_ROOT};
 
 enum EVENT_TYPE { RAW, SINGLE, GROUP, COINCIDENCE};
 
@@ -51,40 +60,10 @@ struct CoincidenceGroupHeader {
 typedef uint8_t GroupHeader;
 
 
-class DataFileWriter{
-private:
-	std::string fName;
-	FILE_TYPE fileType;
-	EVENT_TYPE eventType;
-	double userTimeRef;
-	int eventFractionToWrite;
-	long long eventCounter;
-	double fileSplitTime;
-	long long currentFilePartIndex;
-	double frequency;
-	int hitLimitToWrite;
-
-	float step1;
-	float step2;
-
-	bool useAsyncWriting;
-	DataWriter *dataWriter;
-	FILE *dataFile;
-	FILE *indexFile;
-	off_t stepBegin;
-	
-	TTree *hData;
-	TTree *hIndex;
-	TFile *hFile;
-
-	double Tps;
-	float Tns;
-
-	// ROOT Tree fields
+// Values of the branches of a ROOT data tree
+struct RootEventFields {
 	float		brStep1;
 	float		brStep2;
-	long long 	brStepBegin;
-	long long 	brStepEnd;
 	
 	unsigned short	brN;
 	unsigned short	brJ;
@@ -123,13 +102,190 @@ private:
 	unsigned short	brECoarse;
 	unsigned short	brTFine;
 	unsigned short	brEFine;
+};
+
+// Entries of one buffer, for the writer to gather into batches
+class RootOutputBlock : public OutputBlock {
+public:
+	RootOutputBlock(long long filePartIndex) :
+		OutputBlock(filePartIndex, 0)
+	{
+		nEvents = 0;
+	};
+
+	std::vector<RootEventFields> entries;
+	long long nEvents;
+};
+
+// Entries of consecutive buffers, filled into a tree of an in-memory file by a compressor thread
+struct RootBatch {
+	std::vector<RootEventFields> entries;
+	RootEventFields fields;
+	TMemFile *file;
+	TTree *tree;
+	bool done;
+};
+
+// Binary records of one buffer, transposed into the columns of a columnar file
+class ColumnarOutputBlock : public OutputBlock {
+public:
+	ColumnarOutputBlock(long long filePartIndex) :
+		OutputBlock(filePartIndex, 0)
+	{
+		nRows = 0;
+	};
+
+	std::vector<std::vector<char> > columns;
+	size_t nRows;
+	// End row of each counted event
+	std::vector<size_t> eventEndRow;
+};
+
+// Binary records of one buffer, compressed as one block of a compressed file
+class CompressedOutputBlock : public OutputBlock {
+public:
+	CompressedOutputBlock(long long filePartIndex) :
+		OutputBlock(filePartIndex, 0)
+	{
+		rawSize = 0;
+		nEvents = 0;
+	};
+
+	std::vector<char> compressed;
+	long long rawSize;
+	long long nEvents;
+};
+
+// Open files of one part of the output
+struct OutputSegment {
+	DataWriter *dataWriter;
+	FILE *dataFile;
+	FILE *indexFile;
+	TFile *hFile;
+	TTree *hData;
+	TTree *hIndex;
+};
+
+class DataFileWriter{
+private:
+	std::string fName;
+	FILE_TYPE fileType;
+	EVENT_TYPE eventType;
+	double userTimeRef;
+	int eventFractionToWrite;
+	long long eventCounter;
+	double fileSplitTime;
+	long long currentFilePartIndex;
+	double frequency;
+	int hitLimitToWrite;
+
+	float step1;
+	float step2;
+
+	bool useAsyncWriting;
+	DataWriter *dataWriter;
+	FILE *dataFile;
+	FILE *indexFile;
+	off_t stepBegin;
+	long long dataPosition;
+	std::vector<ColumnarBlockInfo> columnarBlocks;
+	std::vector<ColumnarStepInfo> columnarSteps;
+	// zstd level of the binary formats, 0 to write them uncompressed
+	int compressionLevel;
+	long long rawPosition;
+	long long rawStepBegin;
+	// Coincidence counts of the current step, with FILE_LOR_HISTOGRAM
+	LORHistogram *lorHistogram;
+	// Singles spectra of the current step, with FILE_CHANNEL_SPECTRA and FILE_CHANNEL_SPECTRA_ROOT
+	ChannelSpectra *channelSpectra;
+	
+	TTree *hData;
+	TTree *hIndex;
+	TFile *hFile;
+
+	double Tps;
+	float Tns;
+
+	// With split output, the next part is opened ahead of time and the finished parts
+	// are closed and renamed by rolloverThread, so that the ordered writer only swaps files
+	pthread_t rolloverThread;
+	pthread_mutex_t rolloverLock;
+	pthread_cond_t rolloverCondition;
+	bool rolloverDie;
+	bool nextSegmentReady;
+	OutputSegment nextSegment;
+	std::deque<std::pair<OutputSegment, std::string> > finishedSegments;
+	static void *rolloverThreadRoutine(void *arg);
+
+	// With ROOT output, the entries of consecutive buffers are gathered into batches which fill
+	// the baskets of the output tree, and compressed by rootThreads; the fast copy into the output
+	// tree then appends baskets of the output size, rather than one small basket per buffer
+	std::vector<RootEventFields> rootEntries;
+	std::deque<RootBatch *> rootBatches;		// Submitted, in output order
+	std::deque<RootBatch *> rootQueue;		// Waiting for a compressor thread
+	std::vector<pthread_t> rootThreads;
+	pthread_mutex_t rootLock;
+	pthread_cond_t rootCondition;
+	bool rootDie;
+	static void *rootThreadRoutine(void *arg);
+	void submitRootBatch();
+	void appendRootBatches(size_t maxPending);
+	void flushRootEntries();
+
+	// ROOT index tree fields
+	float		brStep1;
+	float		brStep2;
+	long long 	brStepBegin;
+	long long 	brStepEnd;
+
+	RootEventFields	brData;
+
+	// ROOT spectra tree fields, which also use brStep1 and brStep2
+	unsigned int	brSpectraChannelID;
+	unsigned int	brEnergyUnderflow;
+	unsigned int	brEnergyOverflow;
+	std::vector<unsigned int> brEnergySpectrum;
+	std::vector<unsigned int> brTimeSpectrum;
+
+	void openSegment(const std::string &name, OutputSegment &segment);
+	void closeSegment(OutputSegment &segment);
+	OutputSegment getSegment();
+	void setSegment(const OutputSegment &segment);
+	void beginSegment();
+	void endSegment();
+	std::vector<std::string> getSegmentFileNames(const std::string &name);
+	std::string getPartName(const char *suffix);
+	void renameSegment(const std::string &from, const std::string &to);
+	void writeStepIndex();
+	void writeChannelSpectra();
+
+	long long getTimeOffset(AbstractEventBuffer *buffer, double t0);
+	void writeData(const void *data, size_t count);
+	void writeColumnarHeader();
+	void writeColumnarBlock(ColumnarOutputBlock *block);
+	void writeColumnarDirectory();
+	ColumnarOutputBlock *toColumns(OutputBlock *records);
+	unsigned getCompressedLayout();
+	OutputBlock *compress(OutputBlock *records);
+	void writeCompressed(const char *data, size_t size);
+
+	void createDataBranches(TTree *tree, RootEventFields &f, int bs);
+	void fillTree(TTree *tree, RootEventFields &f, std::vector<RootEventFields> &entries);
+	void fillRawEntries(EventBuffer<RawHit> *buffer, std::vector<RootEventFields> &entries, long long &counter);
+	void fillSingleEntries(EventBuffer<Hit> *buffer, long long tMin, std::vector<RootEventFields> &entries, long long &counter);
+	void fillGroupEntries(EventBuffer<GammaPhoton> *buffer, long long tMin, std::vector<RootEventFields> &entries, long long &counter);
+	void fillCoincidenceEntries(EventBuffer<Coincidence> *buffer, long long tMin, short delayed, std::vector<RootEventFields> &entries, long long &counter);
 
 public:
-	DataFileWriter(char *fName,  bool useAsyncWriting, double frequency, EVENT_TYPE eventType, FILE_TYPE fileType, double fileEpoch, int hitLimitToWrite, int eventFractionToWrite, float splitTime);
+	// histogramConfig gives the binning of the histogram formats and is not used by the others
+	DataFileWriter(char *fName,  bool useAsyncWriting, double frequency, EVENT_TYPE eventType, FILE_TYPE fileType, double fileEpoch, int hitLimitToWrite, int eventFractionToWrite, float splitTime, int compressionLevel, SystemConfig *histogramConfig = NULL);
 	~DataFileWriter(); 
 	
 	void openFile(); 
 	void closeFile();
+	// Gather the ROOT entries of consecutive buffers into batches compressed by worker threads,
+	// rather than filling the output tree entry by entry; call before writing any events
+	void enableRootBatches();
 	void setStepValues(float step1, float step2);
 	void checkFilePartForSplit(long long filePartIndex);
 	void closeStep();
@@ -137,7 +293,17 @@ public:
 	void writeRawEvents(EventBuffer<RawHit> *buffer, double t0);
 	void writeSingleEvents(EventBuffer<Hit> *buffer, double t0);
 	void writeGroupEvents(EventBuffer<GammaPhoton> *buffer, double t0);
-	void writeCoincidenceEvents(EventBuffer<Coincidence> *buffer, double t0);
+	// Writes the prompts, or the coincidences of the given delayed window
+	void writeCoincidenceEvents(EventBuffer<Coincidence> *buffer, double t0, short delayed = 0);
+
+	// Render, serialise or fill the tree entries of a buffer; these may be called concurrently
+	// and return NULL when the buffer must be written by write*Events()
+	OutputBlock *formatRawEvents(EventBuffer<RawHit> *buffer, double t0);
+	OutputBlock *formatSingleEvents(EventBuffer<Hit> *buffer, double t0);
+	OutputBlock *formatGroupEvents(EventBuffer<GammaPhoton> *buffer, double t0);
+	OutputBlock *formatCoincidenceEvents(EventBuffer<Coincidence> *buffer, double t0, short delayed = 0);
+	// Append a rendered buffer, in buffer order, and delete it
+	void writeBlock(OutputBlock *block);
 };
 
 
@@ -155,6 +321,16 @@ public:
 		dataFileWriter->writeRawEvents(buffer, getT0());
 		return buffer;
 	};
+
+	void *prepareEvents(EventBuffer<RawHit> *buffer) {
+		return dataFileWriter->formatRawEvents(buffer, getT0());
+	};
+
+	EventBuffer<RawHit> * handlePreparedEvents(EventBuffer<RawHit> *buffer, void *prepared) {
+		if(prepared == NULL) return handleEvents(buffer);
+		dataFileWriter->writeBlock((OutputBlock *)prepared);
+		return buffer;
+	};
 };
 
 
@@ -172,6 +348,16 @@ public:
 		dataFileWriter->writeSingleEvents(buffer, getT0());
 		return buffer;
 	};
+
+	void *prepareEvents(EventBuffer<Hit> *buffer) {
+		return dataFileWriter->formatSingleEvents(buffer, getT0());
+	};
+
+	EventBuffer<Hit> * handlePreparedEvents(EventBuffer<Hit> *buffer, void *prepared) {
+		if(prepared == NULL) return handleEvents(buffer);
+		dataFileWriter->writeBlock((OutputBlock *)prepared);
+		return buffer;
+	};
 };
 
 
@@ -189,12 +375,23 @@ public:
 		dataFileWriter->writeGroupEvents(buffer, getT0());
 		return buffer;
 	};
+
+	void *prepareEvents(EventBuffer<GammaPhoton> *buffer) {
+		return dataFileWriter->formatGroupEvents(buffer, getT0());
+	};
+
+	EventBuffer<GammaPhoton> * handlePreparedEvents(EventBuffer<GammaPhoton> *buffer, void *prepared) {
+		if(prepared == NULL) return handleEvents(buffer);
+		dataFileWriter->writeBlock((OutputBlock *)prepared);
+		return buffer;
+	};
 };
 
 
 class WriteCoincidencesHelper : public OrderedEventHandler<Coincidence, Coincidence> {
 private: 
 	DataFileWriter *dataFileWriter;
+	std::vector<DataFileWriter *> delayedFileWriters;
 
 public:
 	WriteCoincidencesHelper(DataFileWriter *dataFileWriter,  EventSink<Coincidence> *sink) :
@@ -203,8 +400,38 @@ public:
 	{
 	};
 
+	// delayedFileWriters[k] receives the coincidences of delayed window k+1
+	WriteCoincidencesHelper(DataFileWriter *dataFileWriter, std::vector<DataFileWriter *> delayedFileWriters, EventSink<Coincidence> *sink) :
+		OrderedEventHandler<Coincidence, Coincidence>(sink),
+		dataFileWriter(dataFileWriter), delayedFileWriters(delayedFileWriters)
+	{
+	};
+
 	EventBuffer<Coincidence> * handleEvents(EventBuffer<Coincidence> *buffer) {
 		dataFileWriter->writeCoincidenceEvents(buffer, getT0());
+		for(unsigned k = 0; k < delayedFileWriters.size(); k++)
+			delayedFileWriters[k]->writeCoincidenceEvents(buffer, getT0(), k + 1);
+		return buffer;
+	};
+
+	void *prepareEvents(EventBuffer<Coincidence> *buffer) {
+		std::vector<OutputBlock *> *blocks = new std::vector<OutputBlock *>();
+		blocks->push_back(dataFileWriter->formatCoincidenceEvents(buffer, getT0()));
+		for(unsigned k = 0; k < delayedFileWriters.size(); k++)
+			blocks->push_back(delayedFileWriters[k]->formatCoincidenceEvents(buffer, getT0(), k + 1));
+		return blocks;
+	};
+
+	EventBuffer<Coincidence> * handlePreparedEvents(EventBuffer<Coincidence> *buffer, void *prepared) {
+		std::vector<OutputBlock *> *blocks = (std::vector<OutputBlock *> *)prepared;
+		for(unsigned k = 0; k < blocks->size(); k++) {
+			DataFileWriter *writer = (k == 0) ? dataFileWriter : delayedFileWriters[k - 1];
+			if(blocks->at(k) != NULL)
+				writer->writeBlock(blocks->at(k));
+			else
+				writer->writeCoincidenceEvents(buffer, getT0(), k);
+		}
+		delete blocks;
 		return buffer;
 	};
 };        
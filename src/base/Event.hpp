@@ -17,6 +17,7 @@ namespace PETSYS {
 		long long time;
 		long long timeEnd;
 		unsigned int channelID;
+		unsigned int channelIndex;	// Dense index into SystemConfig tables
 
 		unsigned long frameID;
 		unsigned short tcoarse;
@@ -30,14 +31,23 @@ namespace PETSYS {
 		};
 	};
 
+	// Hits carry the RawHit fields which later stages need,
+	// so that the RawHit buffer can be released as soon as the hits are built
 	struct Hit {
 		bool valid;
-		RawHit *raw;
-		double time;
-		double timeEnd;
+		bool qdcMode;
+		unsigned short tacID;
+		unsigned short efine;
+		unsigned int channelID;
+		unsigned int channelIndex;	// Dense index into SystemConfig tables
+		long long rawTime;		// Uncalibrated times, in clock cycles
+		long long rawTimeEnd;
+		long long time;		// Calibrated time, in picoseconds since the buffer start
+		long long timeEnd;
 		float energy;
 
 		short region;
+		short denseRegion;	// SystemConfig dense trigger region ID
 		short xi;
 		short yi;
 		float x;
@@ -46,16 +56,16 @@ namespace PETSYS {
 		
 		Hit() {
 			valid = false;
-			raw = NULL;
 		};
 	};
 
 	struct GammaPhoton {
 		static const int maxHits = 256;
 		bool valid;
-		double time;
+		long long time;		// Picoseconds since the buffer start
 		float energy;
 		short region;
+		short denseRegion;
 		float x, y, z;
 		int nHits;
 		Hit *hits[maxHits];
@@ -70,12 +80,14 @@ namespace PETSYS {
 	struct Coincidence {
 		static const int maxPhotons = 2;
 		bool valid;
-		double time;
+		long long time;		// Picoseconds since the buffer start
+		short delayed;		// 0 for prompts, N for the Nth delayed window
 		int nPhotons;
 		GammaPhoton *photons[maxPhotons];
 		
 		Coincidence() {
 			valid = false;
+			delayed = 0;
 			for(int i = 0; i < maxPhotons; i++)
 				photons[i] = NULL;
 		};
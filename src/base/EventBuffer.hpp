@@ -38,6 +38,12 @@ namespace PETSYS {
 			bufferTMax = t;
 		}
 
+		// Delete the parent chain early, once this buffer holds no references into it
+		void releaseParent() {
+			delete parent;
+			parent = NULL;
+		}
+
 		private:
 		AbstractEventBuffer * parent;
 		u_int64_t bufferSeqN;
@@ -14,6 +14,23 @@ HwTriggerSimulator::HwTriggerSimulator(SystemConfig *systemConfig, EventSink<Raw
 {
 	nReceived = 0;
 	nSent = 0;
+
+	// Dense trigger regions are numbered in increasing region order,
+	// so the regions of a group of 4 have consecutive dense IDs
+	unsigned nRegions = systemConfig->getNumberOfDenseRegions();
+	coincidentRegions.resize(nRegions);
+	regionGroup.resize(nRegions);
+	nRegionGroups = 0;
+	for(unsigned r1 = 0; r1 < nRegions; r1++) {
+		int group = systemConfig->getRegionFromDense(r1) / 4;
+		if(r1 == 0 || group != systemConfig->getRegionFromDense(r1 - 1) / 4) nRegionGroups++;
+		regionGroup[r1] = nRegionGroups - 1;
+
+		for(unsigned r2 = 0; r2 < nRegions; r2++) {
+			if(systemConfig->isCoincidenceAllowedDense(r1, r2))
+				coincidentRegions[r1].push_back(r2);
+		}
+	}
 }
 
 struct SortEntry {
@@ -23,45 +40,42 @@ struct SortEntry {
 
 static bool operator< (SortEntry lhs, SortEntry rhs) { return lhs.time < rhs.time; }
 
-
-EventBuffer<RawHit> * HwTriggerSimulator::handleEvents (EventBuffer<RawHit> *inBuffer)
+// Time walk corrected trigger time of a hit, as a bin of the buffer's trigger time axis
+static long long getTriggerBin(SystemConfig *systemConfig, RawHit *p, long long timeMin, double &energy)
 {
-	unsigned N =  inBuffer->getSize();
-	
-	long long firstFrameID = inBuffer->getTMin()/1024;
+	SystemConfig::FirmwareConfig &cf = systemConfig->getFirmwareConfig(p->channelIndex, p->tacID);
 
-	EventBuffer<RawHit> * outBuffer = new EventBuffer<RawHit>(N, inBuffer);
-	u_int64_t lReceived = 0;
-	u_int64_t lSent = 0;
-	
-	int count = 0;
-
-	vector<SortEntry> sortList;
-	sortList.reserve(N);
+	energy = cf.p0 + cf.p1 * p->efine + cf.p2 * p->efine * p->efine;
+	if(energy < 0.1875) energy = 0.1875;
 
-	auto pi = inBuffer->getPtr();
-	auto pe = pi + N;
+	double timeWalkCorrection =  0.06 + cf.k0 / energy ;
+	long long timeCorrected = p->time - (long long)(timeWalkCorrection);
+	return timeCorrected - timeMin;
+}
 
-	for(; pi < pe; pi++) {
-		SortEntry entry = {
-			.time = pi->time,
-			.p = pi
-		};
-		sortList.push_back(entry);
-	}
-	
-	sort(sortList.begin(), sortList.end());
-	
-	long long timeMin = sortList.front().time - 100;
-	long long timeMax = sortList.back().time + 100;
+static bool isTriggerRequest(SystemConfig *systemConfig, double energySum, int multiplicity)
+{
+	if(energySum <= systemConfig->sw_fw_trigger_group_min_energy || energySum >= systemConfig->sw_fw_trigger_group_max_energy) return false;
+	if(multiplicity < systemConfig->sw_fw_trigger_group_min_nhits || multiplicity > systemConfig->sw_fw_trigger_group_max_nhits) return false;
+	return true;
+}
 
-	unsigned triggerArraySize = timeMax - timeMin;
+bool PETSYS::operator< (const TriggerHit &lhs, const TriggerHit &rhs) {
+	if(lhs.region != rhs.region) return lhs.region < rhs.region;
+	if(lhs.bin != rhs.bin) return lhs.bin < rhs.bin;
+	return lhs.order < rhs.order;
+}
 
-	const unsigned nTriggerRegions = systemConfig->mapTriggerRegions.size();
-	
-	float** energyArray = new float*[nTriggerRegions];
-	short** multiplicityArray = new short*[nTriggerRegions];
-	for (int i = 0; i < nTriggerRegions; i++) {
+/*
+ * Trigger requests from per region arrays of energy and multiplicity spanning every clock of the buffer,
+ * summed over a 5 clock sliding window.
+ * Only needed when empty clocks are trigger requests themselves.
+ */
+void PETSYS::findTriggerRequestsDense(SystemConfig *systemConfig, vector<TriggerHit> &hits, unsigned triggerArraySize, unsigned nRegions, vector<int> *triggerRequestTimeBins)
+{
+	float** energyArray = new float*[nRegions];
+	short** multiplicityArray = new short*[nRegions];
+	for (int i = 0; i < nRegions; i++) {
 		energyArray[i] = new float[triggerArraySize];
 		multiplicityArray[i] = new short[triggerArraySize];
 		for (int j = 0; j < triggerArraySize; j++) {
@@ -70,154 +84,230 @@ EventBuffer<RawHit> * HwTriggerSimulator::handleEvents (EventBuffer<RawHit> *inB
 		}
 	}
 
-	long long t0;
-	long long t1;
-
-	bool isFirst = true;
-	bool printMore = false;
-
-	for(auto iter = sortList.begin(); iter != sortList.end(); iter++) {
-
-		auto p = (*iter).p;
-
-		SystemConfig::ChannelConfig &cc = systemConfig->getChannelConfig(p->channelID);
-		SystemConfig::FirmwareConfig &cf = cc.empConfig[p->tacID];
-	
-		double energy1 = cf.p0 + cf.p1 * p->efine + cf.p2 * p->efine * p->efine;
-		double energy = energy1;
-		if(energy1 < 0.1875) energy = 0.1875;
-
-		double timeWalkCorrection =  0.06 + cf.k0 / energy ;
-		long long timeCorrected = p->time - (long long)(timeWalkCorrection);
-		long long bufferBinnedTime = timeCorrected - timeMin;
-		unsigned reducedTriggerRegion = systemConfig->mapTriggerRegions[cc.triggerRegion];
-		
-
-		if(bufferBinnedTime <  -100) continue;
-		if(bufferBinnedTime >  triggerArraySize + 100) continue;
-	
-		energyArray[reducedTriggerRegion][bufferBinnedTime] += energy;
-		multiplicityArray[reducedTriggerRegion][bufferBinnedTime] += 1;
-
+	for(auto iter = hits.begin(); iter != hits.end(); iter++) {
+		if(iter->region == -1) continue;
+		if(iter->bin < 0 || iter->bin >= triggerArraySize) continue;
+		energyArray[iter->region][iter->bin] += iter->energy;
+		multiplicityArray[iter->region][iter->bin] += 1;
 	}
-	
-	
-
 
-	vector<int> *triggerRequestTimeBins = new vector<int>[nTriggerRegions];
-	for (int i = 0; i < nTriggerRegions ; i++) {
+	for (int i = 0; i < nRegions ; i++) {
 		for (int j = 0; j < triggerArraySize; j++) {
-			long long t = inBuffer->getTMin()+timeMin+j;
 			int multiplicity = 0;
 			double energySum = 0;
 			for (int k = -2 ; k <= 2 ; k++){
+				if(j+k < 0 || j+k >= triggerArraySize) continue;
 				energySum += energyArray[i][j+k];
 				multiplicity += multiplicityArray[i][j+k];
 			}
-			if( energySum > systemConfig->sw_fw_trigger_group_min_energy && energySum < systemConfig->sw_fw_trigger_group_max_energy) { 	
-				if(multiplicity >= systemConfig->sw_fw_trigger_group_min_nhits && multiplicity <= systemConfig->sw_fw_trigger_group_max_nhits){
-					triggerRequestTimeBins[i].push_back(j);
-					count++;
-				}						
-			}	
+			if(isTriggerRequest(systemConfig, energySum, multiplicity)) {
+				triggerRequestTimeBins[i].push_back(j);
+			}
 		}
 	}
 
-	vector<int> *coincidenceRegionsAllowed = new vector<int>[nTriggerRegions];
-	vector<int> *triggerRequestCoincidenceTimeBins = new vector<int>[nTriggerRegions];
-	vector<int> *triggerAcceptedTimeBins = new vector<int>[nTriggerRegions];
-	vector<int> *triggerExtendedAcceptedTimeBins = new vector<int>[nTriggerRegions/4];
-	vector<int> *triggerFilteredAcceptedTimeBins = new vector<int>[nTriggerRegions];
-
-	for (int i = 0; i < nTriggerRegions ; i++) {
-		for (int j = i; j < nTriggerRegions ; j++){
-			unsigned userTriggerRegion1 = systemConfig->mapTriggerRegionsInverted[i];
-			unsigned userTriggerRegion2 = systemConfig->mapTriggerRegionsInverted[j];
-			if(systemConfig->isCoincidenceAllowed(userTriggerRegion1, userTriggerRegion2)){
-				coincidenceRegionsAllowed[j].push_back(i);
-				coincidenceRegionsAllowed[i].push_back(j);
-			};
-		}	
+	for (int i = 0; i < nRegions; i++){ 
+		delete[] energyArray[i]; 
+		delete[] multiplicityArray[i]; 
 	}
+	delete[] energyArray;
+	delete[] multiplicityArray;
+}
 
-	for (int i = 0; i < nTriggerRegions ; i++) {
-		for (int r : coincidenceRegionsAllowed[i]){
-			for (int tBin : triggerRequestTimeBins[r]){
-				triggerRequestCoincidenceTimeBins[i].push_back(tBin);
-			}
-		}	
-	
-		for (int tBin1 : triggerRequestTimeBins[i]){
-			for (int tBin2 : triggerRequestCoincidenceTimeBins[i]){
-				if (fabs(float(tBin1-tBin2)) <= systemConfig->sw_fw_trigger_coinc_window){
-					triggerExtendedAcceptedTimeBins[i/4].push_back(tBin1);
-					continue;		
-				}
+struct TriggerBin {
+	long long bin;
+	float energy;
+	short multiplicity;
+};
+
+/*
+ * Same trigger requests as findTriggerRequestsDense(), from the occupied clocks only.
+ * The hits, sorted by region and clock, are merged into clocks, accumulating in the
+ * same order and precision as the dense arrays. The 5 clock window then only
+ * visits the clocks which have a hit within 2 clocks.
+ */
+void PETSYS::findTriggerRequestsSparse(SystemConfig *systemConfig, vector<TriggerHit> &hits, unsigned triggerArraySize, vector<int> *triggerRequestTimeBins)
+{
+	vector<TriggerBin> bins;
+	unsigned h0 = 0;
+	while(h0 < hits.size()) {
+		int region = hits[h0].region;
+
+		// Merge the hits of this region into occupied clocks
+		bins.clear();
+		unsigned h = h0;
+		for(; h < hits.size() && hits[h].region == region; h++) {
+			if(hits[h].bin < 0 || hits[h].bin >= triggerArraySize) continue;
+			if(bins.empty() || bins.back().bin != hits[h].bin) {
+				TriggerBin bin = { hits[h].bin, 0, 0 };
+				bins.push_back(bin);
 			}
+			bins.back().energy += hits[h].energy;
+			bins.back().multiplicity += 1;
 		}
-		for (int tBin1 : triggerRequestTimeBins[i]){
-			for (int tBin2 : triggerExtendedAcceptedTimeBins[i/4]){
-				if (fabs(float(tBin1-tBin2)) <= systemConfig->sw_fw_trigger_coinc_window){
-					triggerFilteredAcceptedTimeBins[i].push_back(tBin1);
-					continue;			
+		h0 = h;
+		if(region == -1) continue;
+
+		// Slide the 5 clock window over the clocks near occupied clocks
+		long long nextBin = 0;
+		unsigned first = 0;
+		for(unsigned k = 0; k < bins.size(); k++) {
+			long long j = max(nextBin, bins[k].bin - 2);
+			long long jEnd = min(bins[k].bin + 2, (long long)triggerArraySize - 1);
+			for(; j <= jEnd; j++) {
+				while(bins[first].bin < j - 2) first++;
+
+				// Sum in clock order, as the dense window does
+				int multiplicity = 0;
+				double energySum = 0;
+				for(unsigned m = first; m < bins.size() && bins[m].bin <= j + 2; m++) {
+					energySum += bins[m].energy;
+					multiplicity += bins[m].multiplicity;
+				}
+				if(isTriggerRequest(systemConfig, energySum, multiplicity)) {
+					triggerRequestTimeBins[region].push_back(j);
 				}
 			}
+			nextBin = jEnd + 1;
 		}
 	}
+}
+
+// Marks the entries of the sorted list a which are within w of an entry of the sorted list b
+static void markCoincident(vector<int> &a, vector<int> &b, long long w, vector<char> &mark)
+{
+	unsigned k = 0;
+	for(unsigned n = 0; n < a.size(); n++) {
+		while(k < b.size() && b[k] < a[n] - w) k++;
+		if(k < b.size() && b[k] <= a[n] + w) mark[n] = 1;
+	}
+}
+
+EventBuffer<RawHit> * HwTriggerSimulator::handleEvents (EventBuffer<RawHit> *inBuffer)
+{
+	unsigned N =  inBuffer->getSize();
 	
-	auto po = outBuffer->getPtr();
+	EventBuffer<RawHit> * outBuffer = new EventBuffer<RawHit>(N, inBuffer);
+	u_int64_t lReceived = 0;
+	u_int64_t lSent = 0;
 	
-	for(auto iter = sortList.begin(); iter != sortList.end(); iter++){
+	vector<SortEntry> sortList;
+	sortList.reserve(N);
 
-		auto p = (*iter).p;
+	auto pi = inBuffer->getPtr();
+	auto pe = pi + N;
 
-		SystemConfig::ChannelConfig &cc = systemConfig->getChannelConfig(p->channelID);
-		SystemConfig::FirmwareConfig &cf = cc.empConfig[p->tacID];
+	for(; pi < pe; pi++) {
+		SortEntry entry = {
+			.time = pi->time,
+			.p = pi
+		};
+		sortList.push_back(entry);
+	}
 	
-		double energy = cf.p0 + cf.p1 * p->efine + cf.p2 * p->efine * p->efine;
+	sort(sortList.begin(), sortList.end());
+	
+	long long timeMin = sortList.front().time - 100;
+	long long timeMax = sortList.back().time + 100;
 
-		if(energy < 0.1875) energy = 0.1875;
+	unsigned triggerArraySize = timeMax - timeMin;
 
-		double timeWalkCorrection =  0.06 + cf.k0 / energy ;
+	const unsigned nRegions = coincidentRegions.size();
 
-		long long timeCorrected = p->time - (long long)(timeWalkCorrection);
+	// Trigger time and region of the hits, sorted by region and time
+	vector<TriggerHit> hits;
+	hits.reserve(N);
+	for(unsigned n = 0; n < sortList.size(); n++) {
+		auto p = sortList[n].p;
+		double energy;
+		long long bufferBinnedTime = getTriggerBin(systemConfig, p, timeMin, energy);
+		if(bufferBinnedTime < -100) continue;
+		if(bufferBinnedTime > triggerArraySize + 100) continue;
 
-		long long bufferBinnedTime = timeCorrected - timeMin;
+		TriggerHit hit = { systemConfig->getDenseTriggerRegion(p->channelIndex), bufferBinnedTime, n, energy };
+		hits.push_back(hit);
+	}
+	lReceived = hits.size();
+	sort(hits.begin(), hits.end());
 
-		if(bufferBinnedTime < -100){continue;}
-		if(bufferBinnedTime > triggerArraySize + 100){continue;}	
+	vector<int> *triggerRequestTimeBins = new vector<int>[nRegions];
+	if(isTriggerRequest(systemConfig, 0, 0)) {
+		findTriggerRequestsDense(systemConfig, hits, triggerArraySize, nRegions, triggerRequestTimeBins);
+	}
+	else {
+		findTriggerRequestsSparse(systemConfig, hits, triggerArraySize, triggerRequestTimeBins);
+	}
 
-		unsigned reducedTriggerRegion = systemConfig->mapTriggerRegions[cc.triggerRegion];
+	// All windows are whole clocks
+	long long coincWindow = floor(systemConfig->sw_fw_trigger_coinc_window);
+	long long preWindow = floor(systemConfig->sw_fw_trigger_pre_window);
+	long long postWindow = floor(systemConfig->sw_fw_trigger_post_window);
+
+	// Requests in coincidence with a request of an allowed region are accepted for their group of regions
+	vector<int> *groupAcceptedTimeBins = new vector<int>[nRegionGroups];
+	vector<char> mark;
+	for (int i = 0; i < nRegions ; i++) {
+		vector<int> &requests = triggerRequestTimeBins[i];
+		if(requests.empty()) continue;
+
+		mark.assign(requests.size(), 0);
+		for (int r : coincidentRegions[i]) {
+			markCoincident(requests, triggerRequestTimeBins[r], coincWindow, mark);
+		}
 
-		lReceived++;
-		for(int tBin : triggerFilteredAcceptedTimeBins[reducedTriggerRegion]){
-			if (((bufferBinnedTime - tBin) <= systemConfig->sw_fw_trigger_post_window) && ((bufferBinnedTime-tBin) >= -systemConfig->sw_fw_trigger_pre_window)){
-				*po = *p;
-				po++;
-				lSent++;
-				break;	
-			}		
+		vector<int> &accepted = groupAcceptedTimeBins[regionGroup[i]];
+		unsigned nBefore = accepted.size();
+		for(unsigned n = 0; n < requests.size(); n++) {
+			if(mark[n]) accepted.push_back(requests[n]);
 		}
+		inplace_merge(accepted.begin(), accepted.begin() + nBefore, accepted.end());
 	}
 
-	for (int i = 0; i < nTriggerRegions; i++){ 
-		delete[] energyArray[i]; 
-		delete[] multiplicityArray[i]; 
+	// Requests in coincidence with an accepted request of their group are kept
+	vector<int> *triggerFilteredAcceptedTimeBins = new vector<int>[nRegions];
+	for (int i = 0; i < nRegions ; i++) {
+		vector<int> &requests = triggerRequestTimeBins[i];
+		vector<int> &accepted = groupAcceptedTimeBins[regionGroup[i]];
+		if(requests.empty() || accepted.empty()) continue;
+
+		mark.assign(requests.size(), 0);
+		markCoincident(requests, accepted, coincWindow, mark);
+		for(unsigned n = 0; n < requests.size(); n++) {
+			if(mark[n]) triggerFilteredAcceptedTimeBins[i].push_back(requests[n]);
+		}
+	}
+
+	// Accept the hits within the pre and post windows of a kept request of their region,
+	// sweeping both in time order for each region
+	vector<char> sendHit(sortList.size(), 0);
+	unsigned k = 0;
+	for(unsigned h = 0; h < hits.size(); h++) {
+		TriggerHit &hit = hits[h];
+		if(hit.region == -1) continue;
+		if(h == 0 || hit.region != hits[h-1].region) k = 0;
+
+		vector<int> &filtered = triggerFilteredAcceptedTimeBins[hit.region];
+		while(k < filtered.size() && filtered[k] + postWindow < hit.bin) k++;
+		if(k < filtered.size() && filtered[k] - preWindow <= hit.bin) sendHit[hit.order] = 1;
+	}
+
+	auto po = outBuffer->getPtr();
+	for(unsigned n = 0; n < sortList.size(); n++) {
+		if(!sendHit[n]) continue;
+		*po = *sortList[n].p;
+		po++;
+		lSent++;
 	}
 
-	delete[] energyArray;
-	delete[] multiplicityArray;
 	delete[] triggerRequestTimeBins;
-	delete[] coincidenceRegionsAllowed;
-	delete[] triggerRequestCoincidenceTimeBins; 
-	delete[] triggerAcceptedTimeBins; 
-	delete[] triggerExtendedAcceptedTimeBins; 
+	delete[] groupAcceptedTimeBins;
 	delete[] triggerFilteredAcceptedTimeBins;
 
 	atomicAdd(nReceived, lReceived);
 	atomicAdd(nSent, lSent);
 
 	outBuffer->setUsed(lSent);
+	outBuffer->releaseParent();
 	return outBuffer;
 }
 
@@ -8,6 +8,21 @@
 
 namespace PETSYS {
 
+	// Trigger time of a hit, as a clock of the buffer's trigger time axis
+	struct TriggerHit {
+		int region;		// Dense trigger region
+		long long bin;
+		unsigned order;		// Index in time order
+		double energy;
+	};
+
+	// Orders hits by region, then clock, then time order
+	bool operator< (const TriggerHit &lhs, const TriggerHit &rhs);
+
+	// Trigger request clocks of each dense region, from hits sorted by region and clock
+	// findTriggerRequestsSparse() finds the same requests unless empty clocks are requests themselves
+	void findTriggerRequestsDense(SystemConfig *systemConfig, std::vector<TriggerHit> &hits, unsigned triggerArraySize, unsigned nRegions, std::vector<int> *triggerRequestTimeBins);
+	void findTriggerRequestsSparse(SystemConfig *systemConfig, std::vector<TriggerHit> &hits, unsigned triggerArraySize, std::vector<int> *triggerRequestTimeBins);
 	 
 	class HwTriggerSimulator : public UnorderedEventHandler<RawHit, RawHit> {
 	public:
@@ -20,6 +35,11 @@ namespace PETSYS {
 		u_int64_t nSent;
 		SystemConfig *systemConfig;
 		EventStream *eventStream;
+		// For each dense trigger region, the dense regions it can be in coincidence with
+		std::vector<std::vector<int> > coincidentRegions;
+		// Group of 4 trigger regions which shares accepted trigger requests
+		std::vector<int> regionGroup;
+		unsigned nRegionGroups;
 	};
 }
 #endif 
@@ -0,0 +1,160 @@
+#include "LORHistogram.hpp"
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace PETSYS;
+
+LORHistogram::LORHistogram(SystemConfig *config, float Tns)
+{
+	timeBinWidth = config->lor_histogram_time_bin_width;
+	timeBins = config->lor_histogram_time_bins;
+	energyBins = config->lor_histogram_energy_bins;
+	energyMin = config->lor_histogram_energy_min;
+	energyMax = config->lor_histogram_energy_max;
+	this->Tns = Tns;
+	pthread_mutex_init(&shardsLock, NULL);
+}
+
+LORHistogram::~LORHistogram()
+{
+	for(auto it = shards.begin(); it != shards.end(); it++) {
+		pthread_mutex_destroy(&it->second->lock);
+		delete it->second;
+	}
+	pthread_mutex_destroy(&shardsLock);
+}
+
+void LORHistogram::getHeader(LORHistogramHeader &header)
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LOR_HISTOGRAM_MAGIC, sizeof(header.magic));
+	header.timeBinWidth = timeBinWidth;
+	header.timeBins = timeBins;
+	header.energyMin = energyMin;
+	header.energyMax = energyMax;
+	header.energyBins = energyBins;
+}
+
+LORHistogram::Shard *LORHistogram::getShard()
+{
+	pthread_t self = pthread_self();
+	pthread_mutex_lock(&shardsLock);
+	Shard *&shard = shards[self];
+	if(shard == NULL) {
+		shard = new Shard();
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->used = 0;
+	}
+	pthread_mutex_unlock(&shardsLock);
+	return shard;
+}
+
+int LORHistogram::getEnergyBin(GammaPhoton &photon)
+{
+	// Scaled as the photon energy of the coincidence output, by the mode of its first hit
+	double energy = photon.energy * (photon.hits[0]->qdcMode ? 1.0 : Tns);
+	double bin = floor((energy - energyMin) / (energyMax - energyMin) * energyBins);
+	return (bin >= 0 && bin < energyBins) ? (int)bin : -1;
+}
+
+LORHistogram::Slot &LORHistogram::findSlot(std::vector<Slot> &slots, uint64_t channels, uint32_t bins)
+{
+	size_t mask = slots.size() - 1;
+	uint64_t h = channels * 0x9E3779B97F4A7C15ULL ^ bins * 0xC2B2AE3D27D4EB4FULL;
+	size_t n = (h ^ (h >> 29)) & mask;
+	while(slots[n].counts != 0 && (slots[n].channels != channels || slots[n].bins != bins)) {
+		n = (n + 1) & mask;
+	}
+	return slots[n];
+}
+
+void LORHistogram::count(Shard *shard, uint64_t channels, uint32_t bins)
+{
+	if(2 * (shard->used + 1) > shard->slots.size()) {
+		// Grow to twice the size, placing the used slots again
+		std::vector<Slot> old;
+		old.swap(shard->slots);
+		Slot empty = { 0, 0, 0 };
+		shard->slots.assign(old.empty() ? 4096 : 2 * old.size(), empty);
+		for(size_t n = 0; n < old.size(); n++) {
+			if(old[n].counts != 0) findSlot(shard->slots, old[n].channels, old[n].bins) = old[n];
+		}
+	}
+
+	Slot &slot = findSlot(shard->slots, channels, bins);
+	if(slot.counts == 0) {
+		slot.channels = channels;
+		slot.bins = bins;
+		shard->used += 1;
+	}
+	slot.counts += 1;
+}
+
+void LORHistogram::fill(EventBuffer<Coincidence> *buffer, short delayed)
+{
+	Shard *shard = getShard();
+	pthread_mutex_lock(&shard->lock);
+
+	int N = buffer->getSize();
+	for(int i = 0; i < N; i++) {
+		Coincidence &e = buffer->get(i);
+		if(e.delayed != delayed || !e.valid || e.nPhotons != 2) continue;
+
+		GammaPhoton *p1 = e.photons[0];
+		GammaPhoton *p2 = e.photons[1];
+		if(p2->hits[0]->channelID < p1->hits[0]->channelID) std::swap(p1, p2);
+		Hit *h1 = p1->hits[0];
+		Hit *h2 = p2->hits[0];
+
+		int timeBin = 0;
+		if(timeBinWidth > 0) {
+			double bin = floor((h2->time - h1->time) / timeBinWidth) + timeBins / 2;
+			if(bin < 0 || bin >= timeBins) continue;
+			timeBin = bin;
+		}
+		int energyBin1 = getEnergyBin(*p1);
+		int energyBin2 = getEnergyBin(*p2);
+		if(energyBin1 < 0 || energyBin2 < 0) continue;
+
+		count(shard, ((uint64_t)h1->channelID << 32) | h2->channelID, ((uint32_t)timeBin << 16) | (energyBin1 << 8) | energyBin2);
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void LORHistogram::takeStep(std::vector<LORHistogramEntry> &entries)
+{
+	// Gather the used slots of all shards, emptying them, and add up the counts of equal bins once sorted
+	std::vector<Slot> merged;
+	pthread_mutex_lock(&shardsLock);
+	for(auto it = shards.begin(); it != shards.end(); it++) {
+		Shard *shard = it->second;
+		pthread_mutex_lock(&shard->lock);
+		for(size_t n = 0; n < shard->slots.size(); n++) {
+			if(shard->slots[n].counts != 0) merged.push_back(shard->slots[n]);
+		}
+		std::vector<Slot>().swap(shard->slots);
+		shard->used = 0;
+		pthread_mutex_unlock(&shard->lock);
+	}
+	pthread_mutex_unlock(&shardsLock);
+	std::sort(merged.begin(), merged.end());
+
+	entries.clear();
+	for(size_t n = 0; n < merged.size(); n++) {
+		const Slot &slot = merged[n];
+		if(n > 0 && slot.channels == merged[n-1].channels && slot.bins == merged[n-1].bins) {
+			entries.back().counts += slot.counts;
+			continue;
+		}
+		LORHistogramEntry entry;
+		entry.channelID1 = slot.channels >> 32;
+		entry.channelID2 = slot.channels & 0xFFFFFFFF;
+		entry.timeBin = slot.bins >> 16;
+		entry.energyBin1 = (slot.bins >> 8) & 0xFF;
+		entry.energyBin2 = slot.bins & 0xFF;
+		entry.counts = slot.counts;
+		entries.push_back(entry);
+	}
+}
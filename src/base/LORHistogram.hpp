@@ -0,0 +1,111 @@
+#ifndef __PETSYS_LORHISTOGRAM_HPP__DEFINED__
+#define __PETSYS_LORHISTOGRAM_HPP__DEFINED__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <map>
+#include <vector>
+#include <Event.hpp>
+#include <EventBuffer.hpp>
+#include <SystemConfig.hpp>
+
+namespace PETSYS {
+
+/*
+ * LOR histogram file (.llor): coincidence counts per line of response (pair of channels),
+ * binned in time difference and in the energy of both photons:
+ *   LORHistogramHeader
+ *   For each step: a LORHistogramStep followed by nEntries LORHistogramEntry, sorted by
+ *   channelID1, channelID2, timeBin, energyBin1, energyBin2
+ * Only the bins with counts are written. The photons of an entry are ordered by channel,
+ * channelID1 <= channelID2, and the time difference is time2 - time1, taken from the
+ * first hit of each photon as in the binary coincidence output. The energy of a photon is
+ * the sum over its hits, in the units of the coincidence output.
+ * The hit limit and the event fraction of the other outputs do not apply: every coincidence is counted.
+ * With h = timeBins / 2 rounded down, time bin n covers [(n - h) * timeBinWidth, (n - h + 1) * timeBinWidth) picoseconds,
+ * or any time difference when timeBinWidth is 0. Energy bins split [energyMin, energyMax) evenly.
+ * Coincidences outside of the bins are not counted.
+ */
+
+static const char LOR_HISTOGRAM_MAGIC[8] = { 'P', 'S', 'L', 'O', 'R', 'H', 'S', 'T' };
+
+struct LORHistogramHeader {
+	char magic[8];
+	float timeBinWidth;
+	uint32_t timeBins;
+	float energyMin;
+	float energyMax;
+	uint32_t energyBins;
+	uint32_t reserved;
+};
+
+struct LORHistogramStep {
+	float step1;
+	float step2;
+	uint64_t nEntries;
+};
+
+struct LORHistogramEntry {
+	uint32_t channelID1;
+	uint32_t channelID2;
+	uint16_t timeBin;
+	uint8_t energyBin1;
+	uint8_t energyBin2;
+	uint32_t counts;
+};
+
+/*
+ * Accumulates the LOR histogram of a step.
+ * Each filling thread counts into its own shard, which are merged when the step is taken.
+ */
+class LORHistogram {
+public:
+	// Binning from the lor_histogram section of the configuration; Tns converts the ToT energies to ns
+	LORHistogram(SystemConfig *config, float Tns);
+	~LORHistogram();
+
+	void getHeader(LORHistogramHeader &header);
+
+	// Count the prompts, or the coincidences of the given delayed window; may be called concurrently
+	void fill(EventBuffer<Coincidence> *buffer, short delayed);
+
+	// Merge the counts of all threads into sorted entries and start counting the next step
+	void takeStep(std::vector<LORHistogramEntry> &entries);
+
+private:
+	// One bin of a shard: the packed entry key and its counts, 0 for an empty slot
+	struct Slot {
+		uint64_t channels;	// channelID1 << 32 | channelID2
+		uint32_t bins;		// timeBin << 16 | energyBin1 << 8 | energyBin2
+		uint32_t counts;
+
+		bool operator<(const Slot &other) const { return channels < other.channels || (channels == other.channels && bins < other.bins); };
+	};
+	// Open addressing table of a power of two slots, at most half of them used
+	struct Shard {
+		// Only held against takeStep(), a shard is filled by one thread
+		pthread_mutex_t lock;
+		std::vector<Slot> slots;
+		size_t used;
+	};
+
+	double timeBinWidth;
+	int timeBins;
+	int energyBins;
+	double energyMin;
+	double energyMax;
+	float Tns;
+
+	pthread_mutex_t shardsLock;
+	std::map<pthread_t, Shard *> shards;
+
+	Shard *getShard();
+	int getEnergyBin(GammaPhoton &photon);
+	static Slot &findSlot(std::vector<Slot> &slots, uint64_t channels, uint32_t bins);
+	static void count(Shard *shard, uint64_t channels, uint32_t bins);
+};
+
+}
+
+#endif // __PETSYS_LORHISTOGRAM_HPP__DEFINED__
@@ -30,6 +30,9 @@ namespace PETSYS {
 		
 		virtual void pushEvents(EventBuffer<TEventInput> *buffer) {
 			size_t mySeqN = buffer->getSeqN();
+			// Work which does not depend on the order of the buffers
+			void *prepared = prepareEvents(buffer);
+
 			pthread_cond_t cond;
 			pthread_cond_init(&cond, NULL);
 			pthread_mutex_lock(&lock);
@@ -42,7 +45,7 @@ namespace PETSYS {
 			pthread_cond_destroy(&cond);
 			pthread_mutex_unlock(&lock);
 			// Process the data
-			auto newBuffer = handleEvents(buffer);
+			auto newBuffer = handlePreparedEvents(buffer, prepared);
 		
 			pthread_mutex_lock(&lock);
 			// Increment expected sequence number and signal any waiting workers
@@ -70,6 +73,11 @@ namespace PETSYS {
 		
 	protected:
 		virtual EventBuffer<TEventOutput> * handleEvents(EventBuffer<TEventInput> *inBuffer) = 0;
+		// Called concurrently, before the buffer's turn; the result is passed on to handlePreparedEvents()
+		virtual void *prepareEvents(EventBuffer<TEventInput> *inBuffer) { return NULL; };
+		virtual EventBuffer<TEventOutput> * handlePreparedEvents(EventBuffer<TEventInput> *inBuffer, void *prepared) {
+			return handleEvents(inBuffer);
+		};
 		double getT0() { return t0; };
 
 	private:
@@ -0,0 +1,105 @@
+#ifndef __PETSYS_OUTPUTBLOCK_HPP__DEFINED__
+#define __PETSYS_OUTPUTBLOCK_HPP__DEFINED__
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+
+namespace PETSYS {
+
+/*
+ * Output of one buffer, rendered as text or serialised as binary records by a worker
+ * before its turn to write comes, so that only appending it to the file is serialised.
+ * The end offset of each counted event is kept, for the writer to apply the event fraction.
+ * Text is rendered exactly as the printf formats which it replaces: integers in decimal
+ * and floats as "%f", i.e., fixed notation with 6 decimals.
+ */
+class OutputBlock {
+public:
+	// Upper bound for the size of one line of text or one binary record
+	static const size_t MAX_RECORD_SIZE = 256;
+
+	OutputBlock(long long filePartIndex, size_t sizeHint) :
+		filePartIndex(filePartIndex)
+	{
+		data.resize(sizeHint > MAX_RECORD_SIZE ? sizeHint : MAX_RECORD_SIZE);
+		used = 0;
+	};
+
+	virtual ~OutputBlock() { };
+
+	long long getFilePartIndex() { return filePartIndex; };
+	const char *getData() { return data.data(); };
+	size_t getSize() { return used; };
+	size_t getNumberOfEvents() { return eventEnd.size(); };
+	size_t getEventEnd(size_t n) { return eventEnd[n]; };
+
+	// Make room for one more line or record
+	void reserveRecord() {
+		if(data.size() - used < MAX_RECORD_SIZE) data.resize(2 * data.size());
+	};
+
+	void endEvent() { eventEnd.push_back(used); };
+
+	void putChar(char c) { data[used++] = c; };
+
+	void putData(const void *p, size_t count) {
+		memcpy(&data[used], p, count);
+		used += count;
+	};
+
+	void putInt(long long v) {
+		unsigned long long u = v;
+		if(v < 0) {
+			data[used++] = '-';
+			u = 0ULL - u;
+		}
+		putUnsigned(u);
+	};
+
+	void putUnsigned(unsigned long long u) {
+		char tmp[20];
+		int n = 0;
+		do {
+			tmp[n++] = '0' + (u % 10);
+			u /= 10;
+		} while(u != 0);
+		char *p = &data[used];
+		for(int i = 0; i < n; i++) p[i] = tmp[n - 1 - i];
+		used += n;
+	};
+
+	// Same as printf("%f", v)
+	void putFixed(double v) {
+#ifdef __cpp_lib_to_chars
+		putFixedToChars(v);
+#else
+		putFixedPrintf(v);
+#endif
+	};
+
+#ifdef __cpp_lib_to_chars
+	void putFixedToChars(double v) {
+		char *p = &data[used];
+		used = std::to_chars(p, data.data() + data.size(), v, std::chars_format::fixed, 6).ptr - data.data();
+	};
+#endif
+
+	// For standard libraries without floating point std::to_chars
+	void putFixedPrintf(double v) {
+		used += snprintf(&data[used], data.size() - used, "%f", v);
+	};
+
+private:
+	long long filePartIndex;
+	std::vector<char> data;
+	size_t used;
+	std::vector<size_t> eventEnd;
+};
+
+}
+
+#endif // __PETSYS_OUTPUTBLOCK_HPP__DEFINED__
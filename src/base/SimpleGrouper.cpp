@@ -1,66 +1,201 @@
 #include "SimpleGrouper.hpp"
 #include <vector>
 #include <math.h>
+#include <stdlib.h>
 #include <algorithm>
+#include <limits.h>
+#include <assert.h>
 
 using namespace PETSYS;
 using namespace std;
 
-SimpleGrouper::SimpleGrouper(SystemConfig *systemConfig, EventSink<GammaPhoton> *sink) :
-	systemConfig(systemConfig), UnorderedEventHandler<Hit, GammaPhoton>(sink)
+SimpleGrouper::SimpleGrouper(SystemConfig *systemConfig, EventStream *eventStream, EventSink<GammaPhoton> *sink) :
+	systemConfig(systemConfig), eventStream(eventStream), UnorderedEventHandler<Hit, GammaPhoton>(sink)
 {
+	// List, for each trigger region, the regions whose hits can join its photons
+	unsigned nRegions = systemConfig->getNumberOfDenseRegions();
+	compatibleRegions.resize(nRegions);
+	for(unsigned r1 = 0; r1 < nRegions; r1++) {
+		for(unsigned r2 = 0; r2 < nRegions; r2++) {
+			if(systemConfig->isMultiHitAllowedDense(r2, r1))
+				compatibleRegions[r1].push_back(r2);
+		}
+	}
+
+	pthread_mutex_init(&neighbourLock, NULL);
+	if(systemConfig->sw_trigger_group_engine == SystemConfig::GROUP_ENGINE_CLUSTER)
+		buildNeighbourLists();
+
 	resetCounters();
 }
 
 SimpleGrouper::~SimpleGrouper()
 {
+	pthread_mutex_destroy(&neighbourLock);
+}
+
+/*
+ * Two channels are neighbours if their regions allow multi-hit photons
+ * and they are within sw_trigger_group_max_distance of each other.
+ * A channel is its own neighbour if its region can group with itself.
+ */
+void SimpleGrouper::buildNeighbourLists()
+{
+	unsigned nChannels = systemConfig->getNumberOfChannels();
+	unsigned nRegions = compatibleRegions.size();
+	float radius2 = (systemConfig->sw_trigger_group_max_distance)*(systemConfig->sw_trigger_group_max_distance);
+
+	// Channels of each region
+	vector<vector<unsigned> > regionChannels(nRegions);
+	for(unsigned index = 1; index < nChannels; index++) {
+		int r = systemConfig->getDenseTriggerRegion(index);
+		if(r != -1) regionChannels[r].push_back(index);
+	}
+
+	neighbourStart.assign(nChannels + 1, 0);
+	neighbourList.clear();
+	for(unsigned index = 0; index < nChannels; index++) {
+		neighbourStart[index] = neighbourList.size();
+		int r1 = systemConfig->getDenseTriggerRegion(index);
+		if(r1 == -1) continue;
+
+		SystemConfig::ChannelPosition &p1 = systemConfig->getChannelPosition(index);
+		const vector<int> &compatible = compatibleRegions[r1];
+		for(unsigned n = 0; n < compatible.size(); n++) {
+			const vector<unsigned> &channels = regionChannels[compatible[n]];
+			for(unsigned k = 0; k < channels.size(); k++) {
+				SystemConfig::ChannelPosition &p2 = systemConfig->getChannelPosition(channels[k]);
+				float u = p1.x - p2.x;
+				float v = p1.y - p2.y;
+				float w = p1.z - p2.z;
+				float d2 = u*u + v*v + w*w;
+				if(d2 > radius2) continue;
+				neighbourList.push_back(channels[k]);
+			}
+		}
+	}
+	neighbourStart[nChannels] = neighbourList.size();
 }
 // Define a custom comparator to sort by energy in descending order
 auto comp = [](Hit* a, Hit* b) { return a->energy > b->energy; };
 
-EventBuffer<GammaPhoton> * SimpleGrouper::handleEvents(EventBuffer<Hit> *inBuffer)
+struct GroupArgs {
+	SystemConfig *systemConfig;
+	EventBuffer<Hit> *inBuffer;
+	EventBuffer<GammaPhoton> *outBuffer;
+
+	long long timeWindow1;
+	long long maxUnorder;
+	float radius2;
+	float minEnergy;
+	float maxEnergy;
+	int maxHits;
+	int minHits;
+
+	// Trigger region compatibility, see SimpleGrouper::SimpleGrouper()
+	const vector<vector<int> > *compatibleRegions;
+	// Channel neighbours, see SimpleGrouper::buildNeighbourLists()
+	const vector<unsigned> *neighbourStart;
+	const vector<unsigned> *neighbourList;
+
+	u_int64_t *lPhotonsHits;
+	u_int64_t lHitsReceived;
+	u_int64_t lHitsReceivedValid;
+	u_int64_t lPhotonsFound;
+	u_int64_t lPhotonsHitsOverflow;
+	u_int64_t lPhotonsHitsUnderflow;
+	u_int64_t lPhotonsLowEnergy;
+	u_int64_t lPhotonsHighEnergy;
+	u_int64_t lPhotonsPassed;
+};
+
+// Assemble and account a photon out of hits[0..nHits), where hits[0] is the seed
+// nHits may exceed maxHits, in which case only the first maxHits hits are stored
+static void buildPhoton(GroupArgs &a, Hit **hits, int nHits)
 {
+	uint8_t eventFlags = 0x0;
+
+	if(nHits > a.maxHits) {
+		// Flag this event has having excessive hits	
+		eventFlags |= 0x1;
+		// and set the number of hits to maximum hits, as code below depends on it
+		nHits = a.maxHits;
+	}
+	else if (nHits < a.minHits) {
+		eventFlags |= 0x8;
+	}
 	
-	double timeWindow1 = systemConfig->sw_trigger_group_time_window;
-	float radius2 = (systemConfig->sw_trigger_group_max_distance)*(systemConfig->sw_trigger_group_max_distance);
-	float minEnergy = systemConfig->sw_trigger_group_min_energy;
-	float maxEnergy = systemConfig->sw_trigger_group_max_energy;
-	int maxHits = systemConfig->sw_trigger_group_max_hits;
-	if (maxHits > GammaPhoton::maxHits) maxHits = maxHits;
-	int minHits = systemConfig->sw_trigger_group_min_hits;
+	//Sorting to put highest energy event first
+	std::sort(hits, hits + nHits, comp);
 
+	float totalEnergy = 0;
+	// Calculate total energy and assemble the output structure
+	GammaPhoton &photon = a.outBuffer->getWriteSlot();
+	for(int k = 0; k < nHits; k++) {
+		photon.hits[k] = hits[k];
+		totalEnergy += photon.hits[k]->energy;
+	}
 	
-	u_int64_t lPhotonsHits[maxHits];
-	for(int i = 0; i < maxHits; i++) {
-		lPhotonsHits[i] = 0;
+	photon.nHits = nHits;
+	photon.region = photon.hits[0]->region;
+	photon.denseRegion = photon.hits[0]->denseRegion;
+	photon.time = photon.hits[0]->time;
+	photon.x = photon.hits[0]->x;
+	photon.y = photon.hits[0]->y;
+	photon.z = photon.hits[0]->z;
+	photon.energy = totalEnergy;
+
+	if(photon.energy < a.minEnergy) eventFlags |= 0x2;
+	if(photon.energy > a.maxEnergy) eventFlags |= 0x4;
+
+	// Count photons
+	a.lPhotonsFound += 1;
+	if((eventFlags & 0x1) == 0) {
+		a.lPhotonsHits[photon.nHits-1] += 1;
+	}
+	else {
+		a.lPhotonsHitsOverflow += 1;
 	}
+
+	if((eventFlags & 0x8) != 0) a.lPhotonsHitsUnderflow += 1;
+	
+	if((eventFlags & 0x2) != 0) a.lPhotonsLowEnergy += 1;
+	if((eventFlags & 0x4) != 0) a.lPhotonsHighEnergy += 1;
 	
-	u_int64_t lHitsReceived = 0;
-	u_int64_t lHitsReceivedValid = 0;
-	u_int64_t lPhotonsFound = 0;
-	u_int64_t lPhotonsHitsOverflow = 0;
-	u_int64_t lPhotonsHitsUnderflow = 0;
-	u_int64_t lPhotonsLowEnergy = 0;
-	u_int64_t lPhotonsHighEnergy = 0;
-	u_int64_t lPhotonsPassed = 0;
+	if(eventFlags == 0) {
+		a.lPhotonsPassed += 1;
+		photon.valid = true;
+		a.outBuffer->pushWriteSlot();
+	}
+}
+
+/*
+ * Reference engine: from each seed, scan forward over all hits until the end of the time window
+ */
+static void groupScan(GroupArgs &a)
+{
+	SystemConfig *systemConfig = a.systemConfig;
+	EventBuffer<Hit> *inBuffer = a.inBuffer;
+	long long timeWindow1 = a.timeWindow1;
+	long long maxUnorder = a.maxUnorder;
+	float radius2 = a.radius2;
+	int maxHits = a.maxHits;
 
 	unsigned N =  inBuffer->getSize();
-	EventBuffer<GammaPhoton> * outBuffer = new EventBuffer<GammaPhoton>(N, inBuffer);
 	vector<bool> taken(N, false);
 	Hit * hits[maxHits];
 
 	for(unsigned i = 0; i < N; i++) {
 		// Do accounting first
 		Hit &hit = inBuffer->get(i);
-		lHitsReceived += 1;
+		a.lHitsReceived += 1;
 
 		if(!hit.valid) continue;
-		lHitsReceivedValid += 1;
+		a.lHitsReceivedValid += 1;
 
 		if (taken[i]) continue;
 		taken[i] = true;
 			
-		uint8_t eventFlags = 0x0;
 		hits[0] = &hit;
 		int nHits = 1;
 				
@@ -71,10 +206,10 @@ EventBuffer<GammaPhoton> * SimpleGrouper::handleEvents(EventBuffer<Hit> *inBuffe
 			if(taken[j]) continue;
 			
 			// Stop searching for more hits for this photon
-			if((hit2.time - hit.time) > (timeWindow1 + MAX_UNORDER)) break;
+			if((hit2.time - hit.time) > (timeWindow1 + maxUnorder)) break;
 			
-			if(!systemConfig->isMultiHitAllowed(hit2.region, hit.region)) continue;
-			if(fabs(hit.time - hit2.time) > timeWindow1) continue;
+			if(!systemConfig->isMultiHitAllowedDense(hit2.denseRegion, hit.denseRegion)) continue;
+			if(llabs(hit.time - hit2.time) > timeWindow1) continue;
 
 			float u = hit.x - hit2.x;
 			float v = hit.y - hit2.y;
@@ -93,73 +228,314 @@ EventBuffer<GammaPhoton> * SimpleGrouper::handleEvents(EventBuffer<Hit> *inBuffe
 			}
 		}
 		
-		if(nHits > maxHits) {
-			// Flag this event has having excessive hits	
-			eventFlags |= 0x1;
-			// and set the number of hits to maximum hits, as code below depends on it
-			nHits = maxHits;
-		}
-		else if (nHits < minHits) {
-			eventFlags |= 0x8;
-		}
-		
-		//Sorting to put highest energy event first
+		buildPhoton(a, hits, nHits);
+	}
+}
 
-		bool sorted = false;
+/*
+ * Region bucket engine, produces the same photons as groupScan().
+ *
+ * The valid hits of the buffer are bucketed by trigger region, in buffer order.
+ * For each seed, the end of the scan is found on a compact time column, in which
+ * invalid and already grouped hits are masked out; the region and distance tests
+ * are then only done for the hits in buckets of regions compatible with the seed.
+ */
+static void groupByRegion(GroupArgs &a)
+{
+	EventBuffer<Hit> *inBuffer = a.inBuffer;
+	const vector<vector<int> > &compatibleRegions = *a.compatibleRegions;
+	long long timeWindow1 = a.timeWindow1;
+	long long maxUnorder = a.maxUnorder;
+	float radius2 = a.radius2;
+	int maxHits = a.maxHits;
 
-		std::sort(hits, hits + nHits, comp);
+	unsigned N =  inBuffer->getSize();
+	unsigned nRegions = compatibleRegions.size();
 
-		float totalEnergy = 0;
-		// Calculate total energy and assemble the output structure
-		GammaPhoton &photon = outBuffer->getWriteSlot();
-		for(int k = 0; k < nHits; k++) {
-			photon.hits[k] = hits[k];
-			totalEnergy += photon.hits[k]->energy;
-		}
-		
-		photon.nHits = nHits;
-		photon.region = photon.hits[0]->region;
-		photon.time = photon.hits[0]->time;
-		photon.x = photon.hits[0]->x;
-		photon.y = photon.hits[0]->y;
-		photon.z = photon.hits[0]->z;
-		photon.energy = totalEnergy;
-
-		if(photon.energy < minEnergy) eventFlags |= 0x2;
-		if(photon.energy > maxEnergy) eventFlags |= 0x4;
-
-		// Count photons
-		lPhotonsFound += 1;
-		if((eventFlags & 0x1) == 0) {
-			lPhotonsHits[photon.nHits-1] += 1;
+	// Time column used to find the end of the scan; invalid and taken hits never end it
+	long long *scanTime = new long long[N];
+	int *hitRegion = new int[N];
+	unsigned *bucketStart = new unsigned[nRegions + 1];
+	unsigned *bucketCursor = new unsigned[nRegions];
+	for(unsigned r = 0; r <= nRegions; r++)
+		bucketStart[r] = 0;
+
+	for(unsigned i = 0; i < N; i++) {
+		Hit &hit = inBuffer->get(i);
+		int r = hit.valid ? hit.denseRegion : -1;
+		hitRegion[i] = r;
+		scanTime[i] = hit.valid ? hit.time : LLONG_MIN;
+		if(r != -1) bucketStart[r + 1] += 1;
+	}
+	for(unsigned r = 0; r < nRegions; r++) {
+		bucketStart[r + 1] += bucketStart[r];
+		bucketCursor[r] = bucketStart[r];
+	}
+	unsigned *bucketHits = new unsigned[bucketStart[nRegions]];
+	for(unsigned i = 0; i < N; i++) {
+		int r = hitRegion[i];
+		if(r != -1) bucketHits[bucketCursor[r]++] = i;
+	}
+	for(unsigned r = 0; r < nRegions; r++)
+		bucketCursor[r] = bucketStart[r];
+
+	vector<bool> taken(N, false);
+	vector<unsigned> candidates;
+	Hit * hits[maxHits];
+
+	for(unsigned i = 0; i < N; i++) {
+		// Do accounting first
+		Hit &hit = inBuffer->get(i);
+		a.lHitsReceived += 1;
+
+		if(!hit.valid) continue;
+		a.lHitsReceivedValid += 1;
+
+		if (taken[i]) continue;
+		taken[i] = true;
+		scanTime[i] = LLONG_MIN;
+
+		hits[0] = &hit;
+		int nHits = 1;
+
+		int r1 = hitRegion[i];
+		if(r1 != -1) {
+			// First valid, ungrouped hit beyond the window
+			long long tLimit = hit.time + timeWindow1 + maxUnorder;
+			unsigned jEnd = i + 1;
+			while((jEnd < N) && (scanTime[jEnd] <= tLimit)) jEnd++;
+
+			candidates.clear();
+			const vector<int> &compatible = compatibleRegions[r1];
+			for(unsigned n = 0; n < compatible.size(); n++) {
+				int r2 = compatible[n];
+				unsigned &k0 = bucketCursor[r2];
+				unsigned kEnd = bucketStart[r2 + 1];
+				// Seeds come in buffer order, so hits before this one are never visited again
+				while((k0 < kEnd) && (bucketHits[k0] <= i)) k0++;
+
+				for(unsigned k = k0; (k < kEnd) && (bucketHits[k] < jEnd); k++) {
+					unsigned j = bucketHits[k];
+					if(taken[j]) continue;
+
+					Hit &hit2 = inBuffer->get(j);
+					if(llabs(hit.time - hit2.time) > timeWindow1) continue;
+
+					float u = hit.x - hit2.x;
+					float v = hit.y - hit2.y;
+					float w = hit.z - hit2.z;
+					float d2 = u*u + v*v + w*w;
+					if(d2 > radius2) continue;
+
+					candidates.push_back(j);
+				}
+			}
+
+			// Add hits in buffer order, as groupScan() does
+			if(compatible.size() > 1)
+				std::sort(candidates.begin(), candidates.end());
+
+			for(unsigned n = 0; n < candidates.size(); n++) {
+				unsigned j = candidates[n];
+				taken[j] = true;
+				scanTime[j] = LLONG_MIN;
+				if(nHits >= maxHits) {
+					// Increase the hit count but don't actually add a hit
+					nHits++;
+				}
+				else {
+					hits[nHits] = &inBuffer->get(j);
+					nHits++;
+				}
+			}
 		}
-		else {
-			lPhotonsHitsOverflow += 1;
+
+		buildPhoton(a, hits, nHits);
+	}
+
+	delete [] bucketHits;
+	delete [] bucketCursor;
+	delete [] bucketStart;
+	delete [] hitRegion;
+	delete [] scanTime;
+}
+
+static unsigned findRoot(unsigned *parent, unsigned i)
+{
+	while(parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+/*
+ * Connected component engine: two hits are linked if their channels are neighbours
+ * and their times are within the group time window, and a photon is a set of linked hits.
+ * Unlike the seed based engines, hits join a photon through any of its hits.
+ *
+ * Each hit is only compared with the recent hits of the neighbour channels of its own,
+ * found by following, for each channel, a chain of its previous hits in the buffer.
+ */
+static void groupByCluster(GroupArgs &a)
+{
+	EventBuffer<Hit> *inBuffer = a.inBuffer;
+	const vector<unsigned> &neighbourStart = *a.neighbourStart;
+	const vector<unsigned> &neighbourList = *a.neighbourList;
+	long long timeWindow1 = a.timeWindow1;
+	long long maxUnorder = a.maxUnorder;
+	int maxHits = a.maxHits;
+
+	unsigned N =  inBuffer->getSize();
+	assert(!neighbourStart.empty());
+	unsigned nChannels = neighbourStart.size() - 1;
+
+	const unsigned NONE = UINT_MAX;
+	unsigned *lastHit = new unsigned[nChannels];
+	for(unsigned c = 0; c < nChannels; c++)
+		lastHit[c] = NONE;
+	unsigned *previousHit = new unsigned[N];
+	unsigned *parent = new unsigned[N];
+
+	for(unsigned i = 0; i < N; i++) {
+		parent[i] = i;
+		Hit &hit = inBuffer->get(i);
+		if(!hit.valid) continue;
+
+		unsigned channel = hit.channelIndex;
+		if(channel >= nChannels) continue;
+
+		long long tStop = hit.time - timeWindow1 - maxUnorder;
+		for(unsigned k = neighbourStart[channel]; k < neighbourStart[channel + 1]; k++) {
+			for(unsigned j = lastHit[neighbourList[k]]; j != NONE; j = previousHit[j]) {
+				Hit &hit2 = inBuffer->get(j);
+				// Older hits of this channel can't be in the window either
+				if(hit2.time < tStop) break;
+				if(llabs(hit.time - hit2.time) > timeWindow1) continue;
+
+				// Union, keeping the earliest hit as the root
+				unsigned r1 = findRoot(parent, i);
+				unsigned r2 = findRoot(parent, j);
+				if(r1 < r2) parent[r2] = r1;
+				else if(r2 < r1) parent[r1] = r2;
+			}
 		}
 
-		if((eventFlags & 0x8) != 0) lPhotonsHitsUnderflow += 1;
-		
-		if((eventFlags & 0x2) != 0) lPhotonsLowEnergy += 1;
-		if((eventFlags & 0x4) != 0) lPhotonsHighEnergy += 1;
-		
-		if(eventFlags == 0) {
-			lPhotonsPassed += 1;
-			photon.valid = true;
-			outBuffer->pushWriteSlot();
+		previousHit[i] = lastHit[channel];
+		lastHit[channel] = i;
+	}
+
+	// Hits of each photon, in buffer order
+	unsigned *memberStart = new unsigned[N + 1];
+	unsigned *memberCursor = new unsigned[N];
+	for(unsigned i = 0; i <= N; i++)
+		memberStart[i] = 0;
+	for(unsigned i = 0; i < N; i++) {
+		if(!inBuffer->get(i).valid) continue;
+		parent[i] = findRoot(parent, i);
+		memberStart[parent[i] + 1] += 1;
+	}
+	for(unsigned i = 0; i < N; i++) {
+		memberStart[i + 1] += memberStart[i];
+		memberCursor[i] = memberStart[i];
+	}
+	unsigned *members = new unsigned[memberStart[N]];
+	for(unsigned i = 0; i < N; i++) {
+		if(!inBuffer->get(i).valid) continue;
+		members[memberCursor[parent[i]]++] = i;
+	}
+
+	Hit * hits[maxHits];
+	for(unsigned i = 0; i < N; i++) {
+		// Do accounting first
+		Hit &hit = inBuffer->get(i);
+		a.lHitsReceived += 1;
+
+		if(!hit.valid) continue;
+		a.lHitsReceivedValid += 1;
+
+		// Photons are emitted at their earliest hit
+		if(parent[i] != i) continue;
+
+		int nHits = memberStart[i + 1] - memberStart[i];
+		for(int k = 0; (k < nHits) && (k < maxHits); k++) {
+			hits[k] = &inBuffer->get(members[memberStart[i] + k]);
 		}
+
+		buildPhoton(a, hits, nHits);
 	}
 
+	delete [] members;
+	delete [] memberCursor;
+	delete [] memberStart;
+	delete [] parent;
+	delete [] previousHit;
+	delete [] lastHit;
+}
+
+EventBuffer<GammaPhoton> * SimpleGrouper::handleEvents(EventBuffer<Hit> *inBuffer)
+{
+	// Hit times are in picoseconds; convert the windows once
+	double Tps = 1E12/eventStream->getFrequency();
+
+	GroupArgs a;
+	a.systemConfig = systemConfig;
+	a.inBuffer = inBuffer;
+	a.timeWindow1 = llround(systemConfig->sw_trigger_group_time_window * Tps);
+	a.maxUnorder = llround(MAX_UNORDER * Tps);
+	a.radius2 = (systemConfig->sw_trigger_group_max_distance)*(systemConfig->sw_trigger_group_max_distance);
+	a.minEnergy = systemConfig->sw_trigger_group_min_energy;
+	a.maxEnergy = systemConfig->sw_trigger_group_max_energy;
+	int maxHits = systemConfig->sw_trigger_group_max_hits;
+	if (maxHits > GammaPhoton::maxHits) maxHits = maxHits;
+	a.maxHits = maxHits;
+	a.minHits = systemConfig->sw_trigger_group_min_hits;
+	a.compatibleRegions = &compatibleRegions;
+	if(systemConfig->sw_trigger_group_engine == SystemConfig::GROUP_ENGINE_CLUSTER) {
+		// The engine may have been switched to CLUSTER after construction
+		pthread_mutex_lock(&neighbourLock);
+		if(neighbourStart.empty()) buildNeighbourLists();
+		pthread_mutex_unlock(&neighbourLock);
+	}
+	a.neighbourStart = &neighbourStart;
+	a.neighbourList = &neighbourList;
+
+	u_int64_t lPhotonsHits[maxHits];
+	for(int i = 0; i < maxHits; i++) {
+		lPhotonsHits[i] = 0;
+	}
+	a.lPhotonsHits = lPhotonsHits;
+	a.lHitsReceived = 0;
+	a.lHitsReceivedValid = 0;
+	a.lPhotonsFound = 0;
+	a.lPhotonsHitsOverflow = 0;
+	a.lPhotonsHitsUnderflow = 0;
+	a.lPhotonsLowEnergy = 0;
+	a.lPhotonsHighEnergy = 0;
+	a.lPhotonsPassed = 0;
+
+	unsigned N =  inBuffer->getSize();
+	EventBuffer<GammaPhoton> * outBuffer = new EventBuffer<GammaPhoton>(N, inBuffer);
+	a.outBuffer = outBuffer;
+
+	if(systemConfig->sw_trigger_group_engine == SystemConfig::GROUP_ENGINE_SCAN)
+		groupScan(a);
+	else if(systemConfig->sw_trigger_group_engine == SystemConfig::GROUP_ENGINE_CLUSTER)
+		groupByCluster(a);
+	else
+		groupByRegion(a);
+
 	for(int i = 0; i < maxHits; i++)
 		atomicAdd(nPhotonsHits[i], lPhotonsHits[i]);
 	
-	atomicAdd(nHitsReceived, lHitsReceived);
-	atomicAdd(nHitsReceivedValid, lHitsReceivedValid);
-	atomicAdd(nPhotonsFound, lPhotonsFound);
-	atomicAdd(nPhotonsHitsOverflow, lPhotonsHitsOverflow);
-	atomicAdd(nPhotonsHitsUnderflow, lPhotonsHitsUnderflow);
-	atomicAdd(nPhotonsLowEnergy, lPhotonsLowEnergy);
-	atomicAdd(nPhotonsHighEnergy, lPhotonsHighEnergy);
-	atomicAdd(nPhotonsPassed, lPhotonsPassed);
+	atomicAdd(nHitsReceived, a.lHitsReceived);
+	atomicAdd(nHitsReceivedValid, a.lHitsReceivedValid);
+	atomicAdd(nPhotonsFound, a.lPhotonsFound);
+	atomicAdd(nPhotonsHitsOverflow, a.lPhotonsHitsOverflow);
+	atomicAdd(nPhotonsHitsUnderflow, a.lPhotonsHitsUnderflow);
+	atomicAdd(nPhotonsLowEnergy, a.lPhotonsLowEnergy);
+	atomicAdd(nPhotonsHighEnergy, a.lPhotonsHighEnergy);
+	atomicAdd(nPhotonsPassed, a.lPhotonsPassed);
 	
 	return outBuffer;
 }
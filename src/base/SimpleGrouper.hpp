@@ -5,12 +5,14 @@
 #include <UnorderedEventHandler.hpp>
 #include <Event.hpp>
 #include <Instrumentation.hpp>
+#include <vector>
+#include <pthread.h>
 
 namespace PETSYS {
 	
 class SimpleGrouper : public UnorderedEventHandler<Hit, GammaPhoton> {
 public:
-	SimpleGrouper(SystemConfig *systemConfig, EventSink<GammaPhoton> *sink);
+	SimpleGrouper(SystemConfig *systemConfig, EventStream *eventStream, EventSink<GammaPhoton> *sink);
 	~SimpleGrouper();
 	
 	virtual void report();
@@ -20,6 +22,17 @@ protected:
 		
 private:
 	SystemConfig *systemConfig;
+	EventStream *eventStream;
+
+	// For each dense trigger region, the dense regions whose hits can join its photons
+	std::vector<std::vector<int> > compatibleRegions;
+
+	// Neighbour channels of each channel index, as ranges of neighbourList
+	// Only built for the cluster engine, by the first buffer if it was chosen after construction
+	std::vector<unsigned> neighbourStart;
+	std::vector<unsigned> neighbourList;
+	pthread_mutex_t neighbourLock;
+	void buildNeighbourLists();
 	
 	u_int64_t nHitsReceived;
 	u_int64_t nHitsReceivedValid;
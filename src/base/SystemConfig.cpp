@@ -1,14 +1,19 @@
 #include "SystemConfig.hpp"
+#include "TableFile.hpp"
 #include <stdio.h>
 #include <assert.h>
 #include <errno.h>
-#include <boost/regex.hpp>
 #include <string.h>
 #include <libgen.h>
 #include <limits.h>
 #include <string>
 #include <boost/algorithm/string/replace.hpp>
 #include <iostream>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 extern "C" {
@@ -35,20 +40,280 @@ static void replace_variables(char *fn, const char *entry, char *cdir)
 	
 }
 
+/*
+ * Binary cache of the channel and region tables
+ * The file starts with a key describing everything the tables were built from:
+ * format version, structure sizes, load mask and the name, size and content hash of each table file.
+ * It is followed by the size and hash of the body and the body itself, a sequence of
+ * arrays each preceded by its number of elements.
+ */
+static const char CACHE_MAGIC[8] = { 'P', 'S', 'C', 'F', 'G', 'C', 'C', 'H' };
+static const uint32_t CACHE_VERSION = 1;
+
+static uint64_t hashBytes(const char *data, size_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ size;
+	size_t n = 0;
+	for(; n + 8 <= size; n += 8) {
+		uint64_t w;
+		memcpy(&w, data + n, 8);
+		h = (h ^ w) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	for(; n < size; n++) {
+		h = (h ^ (unsigned char)data[n]) * 0x100000001b3ULL;
+	}
+	return h ^ (h >> 32);
+}
+
+static bool hashFile(const char *fn, uint64_t &size, uint64_t &hash)
+{
+	int fd = open(fn, O_RDONLY);
+	if(fd == -1) return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	size = st.st_size;
+	hash = hashBytes(NULL, 0);
+	if(size > 0) {
+		char *data = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		hash = hashBytes(data, size);
+		munmap(data, size);
+	}
+	close(fd);
+	return true;
+}
+
+static void putBytes(std::vector<char> &buffer, const void *p, size_t n)
+{
+	buffer.insert(buffer.end(), (const char *)p, (const char *)p + n);
+}
+
+template <class T>
+static void putValue(std::vector<char> &buffer, T value)
+{
+	putBytes(buffer, &value, sizeof(T));
+}
+
+template <class T>
+static void putVector(std::vector<char> &buffer, const std::vector<T> &v)
+{
+	putValue<uint64_t>(buffer, v.size());
+	putBytes(buffer, v.data(), v.size() * sizeof(T));
+}
+
+static void putMap(std::vector<char> &buffer, const std::map<unsigned, unsigned> &m)
+{
+	putValue<uint64_t>(buffer, m.size());
+	for(std::map<unsigned, unsigned>::const_iterator it = m.begin(); it != m.end(); it++) {
+		putValue<uint32_t>(buffer, it->first);
+		putValue<uint32_t>(buffer, it->second);
+	}
+}
+
+// Sequential reads from a cache body whose hash has already been checked
+struct CacheReader {
+	const char *p;
+	const char *end;
+
+	void get(void *dst, size_t n) {
+		if(n > size_t(end - p)) {
+			fprintf(stderr, "ERROR: configuration cache body is truncated\n");
+			exit(1);
+		}
+		memcpy(dst, p, n);
+		p += n;
+	}
+	template <class T> T getValue() {
+		T value;
+		get(&value, sizeof(T));
+		return value;
+	}
+	template <class T> void getVector(std::vector<T> &v) {
+		v.resize(getValue<uint64_t>());
+		get(v.data(), v.size() * sizeof(T));
+	}
+	void getMap(std::map<unsigned, unsigned> &m) {
+		m.clear();
+		uint64_t n = getValue<uint64_t>();
+		for(uint64_t i = 0; i < n; i++) {
+			unsigned k = getValue<uint32_t>();
+			m[k] = getValue<uint32_t>();
+		}
+	}
+};
+
+bool SystemConfig::makeCacheKey(std::vector<char> &key, u_int64_t mask, TableFile **tableFiles, unsigned nTableFiles)
+{
+	key.clear();
+	putBytes(key, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	putValue<uint32_t>(key, CACHE_VERSION);
+	putValue<uint32_t>(key, sizeof(TacConfig));
+	putValue<uint32_t>(key, sizeof(QacConfig));
+	putValue<uint32_t>(key, sizeof(EnergyConfig));
+	putValue<uint32_t>(key, sizeof(FirmwareConfig));
+	putValue<uint32_t>(key, sizeof(ChannelPosition));
+	putValue<uint32_t>(key, MAX_TRIGGER_REGIONS);
+	putValue<uint64_t>(key, mask);
+
+	for(unsigned n = 0; n < nTableFiles; n++) {
+		if(tableFiles[n] == NULL) {
+			putValue<uint32_t>(key, 0);
+			continue;
+		}
+		const char *fn = tableFiles[n]->getFileName();
+		uint64_t size, hash;
+		if(!hashFile(fn, size, hash)) {
+			// Let the table parser report the error
+			key.clear();
+			return false;
+		}
+		putValue<uint32_t>(key, strlen(fn));
+		putBytes(key, fn, strlen(fn));
+		putValue<uint64_t>(key, size);
+		putValue<uint64_t>(key, hash);
+	}
+	return true;
+}
+
 SystemConfig *SystemConfig::fromFile(const char *configFileName, u_int64_t mask)
 {
+	return fromFile(configFileName, mask, NULL);
+}
+
+SystemConfig *SystemConfig::fromFile(const char *configFileName, u_int64_t mask, const bool *activeAsics)
+{
+	return load(configFileName, mask, activeAsics, false);
+}
+
+SystemConfig *SystemConfig::fromCache(const char *configFileName, u_int64_t mask)
+{
+	return load(configFileName, mask, NULL, true);
+}
+
+bool SystemConfig::hasCache(const char *configFileName)
+{
+	dictionary * configFile = iniparser_load(configFileName);
+	bool r = iniparser_getstring(configFile, "main:config_cache", NULL) != NULL;
+	iniparser_freedict(configFile);
+	return r;
+}
+
+SystemConfig *SystemConfig::load(const char *configFileName, u_int64_t mask, const bool *activeAsics, bool cacheOnly)
+{
+	struct timespec t0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
 	char *path = new char[PATH_MAX];
 	strcpy(path, configFileName);
 	char *cdir = dirname(path);
 	
 	char *fn = new char[PATH_MAX];
-	char *fn2 = new char[PATH_MAX];
 	
 	dictionary * configFile = iniparser_load(configFileName);
 	SystemConfig *config = new SystemConfig();
+	config->activeAsics = activeAsics;
 	
 
-	config->hasTDCCalibration = false;
+	// Load trigger configuration
+	config->sw_trigger_group_max_hits = iniparser_getint(configFile, "sw_trigger:group_max_hits", 64);
+	config->sw_trigger_group_min_hits = iniparser_getint(configFile, "sw_trigger:group_min_hits", 1);
+	config->sw_trigger_group_min_energy = iniparser_getdouble(configFile, "sw_trigger:group_min_energy", -1E6);
+	config->sw_trigger_group_max_energy = iniparser_getdouble(configFile, "sw_trigger:group_max_energy", +1E6);
+	config->sw_trigger_group_max_distance = iniparser_getdouble(configFile, "sw_trigger:group_max_distance", 100.0);
+	config->sw_trigger_group_time_window = iniparser_getdouble(configFile, "sw_trigger:group_time_window", 20.0);
+	config->sw_trigger_coincidence_time_window =  iniparser_getdouble(configFile, "sw_trigger:coincidence_time_window", 2.0);
+
+	const char *groupEngine = iniparser_getstring(configFile, "sw_trigger:group_engine", "region");
+	if(strcmp(groupEngine, "scan") == 0) {
+		config->sw_trigger_group_engine = GROUP_ENGINE_SCAN;
+	}
+	else if(strcmp(groupEngine, "region") == 0) {
+		config->sw_trigger_group_engine = GROUP_ENGINE_REGION;
+	}
+	else if(strcmp(groupEngine, "cluster") == 0) {
+		config->sw_trigger_group_engine = GROUP_ENGINE_CLUSTER;
+	}
+	else {
+		fprintf(stderr, "ERROR: unknown group_engine '%s' in section 'sw_trigger' of '%s'\n", groupEngine, configFileName);
+		exit(1);
+	}
+
+	const char *coincidenceEngine = iniparser_getstring(configFile, "sw_trigger:coincidence_engine", "scan");
+	if(strcmp(coincidenceEngine, "scan") == 0) {
+		config->sw_trigger_coincidence_engine = COINCIDENCE_ENGINE_SCAN;
+	}
+	else if(strcmp(coincidenceEngine, "region") == 0) {
+		config->sw_trigger_coincidence_engine = COINCIDENCE_ENGINE_REGION;
+	}
+	else {
+		fprintf(stderr, "ERROR: unknown coincidence_engine '%s' in section 'sw_trigger' of '%s'\n", coincidenceEngine, configFileName);
+		exit(1);
+	}
+
+	const char *delayedOffsets = iniparser_getstring(configFile, "sw_trigger:coincidence_delayed_offsets", "");
+	while(*delayedOffsets != '\0') {
+		if((*delayedOffsets == ' ') || (*delayedOffsets == ',')) {
+			delayedOffsets++;
+			continue;
+		}
+		char *end;
+		double offset = strtod(delayedOffsets, &end);
+		if((end == delayedOffsets) || (offset <= config->sw_trigger_coincidence_time_window)) {
+			fprintf(stderr, "ERROR: coincidence_delayed_offsets in section 'sw_trigger' of '%s' must be a list of offsets larger than coincidence_time_window\n", configFileName);
+			exit(1);
+		}
+		config->sw_trigger_coincidence_delayed_offsets.push_back(offset);
+		delayedOffsets = end;
+	}
+
+	config->sw_fw_trigger_group_min_energy = iniparser_getdouble(configFile, "hw_trigger:group_min_energy", 0);
+	config->sw_fw_trigger_group_max_energy = iniparser_getdouble(configFile, "hw_trigger:group_max_energy", 128);
+	config->sw_fw_trigger_group_min_nhits = iniparser_getint(configFile, "hw_trigger:group_min_multiplicity", 1);
+	config->sw_fw_trigger_group_max_nhits = iniparser_getint(configFile, "hw_trigger:group_max_multiplicity", 1024);
+	config->sw_fw_trigger_pre_window = iniparser_getdouble(configFile, "hw_trigger:pre_window", 2);
+	config->sw_fw_trigger_post_window = iniparser_getdouble(configFile, "hw_trigger:post_window", 3);
+	config->sw_fw_trigger_coinc_window = iniparser_getdouble(configFile, "hw_trigger:coincidence_window", 2);
+
+	config->lor_histogram_time_bin_width = iniparser_getdouble(configFile, "lor_histogram:time_bin_width", 0);
+	config->lor_histogram_time_bins = iniparser_getint(configFile, "lor_histogram:time_bins", 1);
+	config->lor_histogram_energy_bins = iniparser_getint(configFile, "lor_histogram:energy_bins", 1);
+	config->lor_histogram_energy_min = iniparser_getdouble(configFile, "lor_histogram:energy_min", -1E6);
+	config->lor_histogram_energy_max = iniparser_getdouble(configFile, "lor_histogram:energy_max", +1E6);
+	if((config->lor_histogram_time_bin_width < 0) || (config->lor_histogram_time_bins < 1) || (config->lor_histogram_time_bins > 65535)
+		|| (config->lor_histogram_energy_bins < 1) || (config->lor_histogram_energy_bins > 255)
+		|| (config->lor_histogram_energy_max <= config->lor_histogram_energy_min)) {
+		fprintf(stderr, "ERROR: section 'lor_histogram' of '%s' needs 1 to 65535 time bins of a width of 0 or more, and 1 to 255 energy bins over a non empty energy range\n", configFileName);
+		exit(1);
+	}
+
+	config->channel_spectra_energy_bins = iniparser_getint(configFile, "channel_spectra:energy_bins", 256);
+	config->channel_spectra_energy_min = iniparser_getdouble(configFile, "channel_spectra:energy_min", 0);
+	config->channel_spectra_energy_max = iniparser_getdouble(configFile, "channel_spectra:energy_max", 512);
+	config->channel_spectra_time_bins = iniparser_getint(configFile, "channel_spectra:time_bins", 256);
+	if((config->channel_spectra_energy_bins < 1) || (config->channel_spectra_time_bins < 1)
+		|| (config->channel_spectra_energy_max <= config->channel_spectra_energy_min)) {
+		fprintf(stderr, "ERROR: section 'channel_spectra' of '%s' needs at least 1 energy bin over a non empty energy range and at least 1 time bin\n", configFileName);
+		exit(1);
+	}
+
+	// Parse the tables in parallel threads, then apply them one at a time in this order,
+	// which sets the order in which channel indexes are assigned
+	TableFile *tdcFile = NULL;
+	TableFile *qdcFile = NULL;
+	TableFile *energyFile = NULL;
+	TableFile *channelMapFile = NULL;
+	TableFile *triggerMapFile = NULL;
+	TableFile *timeOffsetFile = NULL;
+	TableFile *firmwareFile = NULL;
+	TableFile *simpleFirmwareFile = NULL;
+
 	if((mask & LOAD_TDC_CALIBRATION) != 0) {
 		const char *entry = iniparser_getstring(configFile, "main:tdc_calibration_table", NULL);
 		if(entry == NULL) {
@@ -56,12 +321,9 @@ SystemConfig *SystemConfig::fromFile(const char *configFileName, u_int64_t mask)
 			exit(1);
 		}
 		replace_variables(fn, entry, cdir);
-		loadTDCCalibration(config, fn);
-		config->hasTDCCalibration = true;
+		tdcFile = new TableFile(fn, "uuuuucffff");
 	}
 	
-	config->hasQDCCalibration = false;
-	config->hasEnergyCalibration = false;
 	if ((mask & LOAD_QDC_CALIBRATION) != 0) {
 		const char *entry = iniparser_getstring(configFile, "main:qdc_calibration_table", NULL);
 		if(entry == NULL) {
@@ -69,18 +331,15 @@ SystemConfig *SystemConfig::fromFile(const char *configFileName, u_int64_t mask)
 			exit(1);
 		}
 		replace_variables(fn, entry, cdir);
-		loadQDCCalibration(config, fn);
-		config->hasQDCCalibration = true;
+		qdcFile = new TableFile(fn, "uuuuuffffffffff");
 
 		entry = iniparser_getstring(configFile, "main:energy_calibration_table", NULL);
 		if(entry != NULL) {
 			replace_variables(fn, entry, cdir);
-			loadEnergyCalibration(config, fn);
-			config->hasEnergyCalibration = true;
+			energyFile = new TableFile(fn, "uuuuuffff");
 		}	
 	}
 	
-	config->hasXYZ = false;
 	if((mask & LOAD_MAPPING) != 0) {
 		const char *entry = iniparser_getstring(configFile, "main:channel_map", NULL);
 		if(entry == NULL) {
@@ -88,8 +347,7 @@ SystemConfig *SystemConfig::fromFile(const char *configFileName, u_int64_t mask)
 			exit(1);
 		}
 		replace_variables(fn, entry, cdir);
-		loadChannelMap(config, fn);
-		config->hasXYZ = true;
+		channelMapFile = new TableFile(fn, "uuuudddfff");
 
 
 		entry = iniparser_getstring(configFile, "main:trigger_map", NULL);
@@ -98,38 +356,17 @@ SystemConfig *SystemConfig::fromFile(const char *configFileName, u_int64_t mask)
 			exit(1);
 		}
 		replace_variables(fn, entry, cdir);
-		loadTriggerMap(config, fn);
+		triggerMapFile = new TableFile(fn, "ddc");
 	}
 
-	config->hasTimeOffsetCalibration = false;
 	if ((mask & LOAD_TIMEALIGN_CALIBRATION) != 0) {
 		const char *entry = iniparser_getstring(configFile, "main:time_offset_calibration_table", NULL);
 		if(entry != NULL) {
 			replace_variables(fn, entry, cdir);
-			loadTimeOffsetCalibration(config, fn);
-			config->hasTimeOffsetCalibration = true;
+			timeOffsetFile = new TableFile(fn, "uuudf");
 		}        
 	}
 
-	// Load trigger configuration
-	config->sw_trigger_group_max_hits = iniparser_getint(configFile, "sw_trigger:group_max_hits", 64);
-	config->sw_trigger_group_min_hits = iniparser_getint(configFile, "sw_trigger:group_min_hits", 1);
-	config->sw_trigger_group_min_energy = iniparser_getdouble(configFile, "sw_trigger:group_min_energy", -1E6);
-	config->sw_trigger_group_max_energy = iniparser_getdouble(configFile, "sw_trigger:group_max_energy", +1E6);
-	config->sw_trigger_group_max_distance = iniparser_getdouble(configFile, "sw_trigger:group_max_distance", 100.0);
-	config->sw_trigger_group_time_window = iniparser_getdouble(configFile, "sw_trigger:group_time_window", 20.0);
-	config->sw_trigger_coincidence_time_window =  iniparser_getdouble(configFile, "sw_trigger:coincidence_time_window", 2.0);
-
-	config->sw_fw_trigger_group_min_energy = iniparser_getdouble(configFile, "hw_trigger:group_min_energy", 0);
-	config->sw_fw_trigger_group_max_energy = iniparser_getdouble(configFile, "hw_trigger:group_max_energy", 128);
-	config->sw_fw_trigger_group_min_nhits = iniparser_getint(configFile, "hw_trigger:group_min_multiplicity", 1);
-	config->sw_fw_trigger_group_max_nhits = iniparser_getint(configFile, "hw_trigger:group_max_multiplicity", 1024);
-	config->sw_fw_trigger_pre_window = iniparser_getdouble(configFile, "hw_trigger:pre_window", 2);
-	config->sw_fw_trigger_post_window = iniparser_getdouble(configFile, "hw_trigger:post_window", 3);
-	config->sw_fw_trigger_coinc_window = iniparser_getdouble(configFile, "hw_trigger:coincidence_window", 2);
-
-
-	config->hasFirmwareEmpiricalCalibrations = false;
 	if ((mask & LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS) != 0){
 		const char *entry = iniparser_getstring(configFile, "hw_trigger:hwtrigger_empirical_calibration_table", NULL);
 		if(entry == NULL){
@@ -139,107 +376,177 @@ SystemConfig *SystemConfig::fromFile(const char *configFileName, u_int64_t mask)
 
 		if(areHwTriggerThresholdsDefault(config)) {
 				const char *entry2 = iniparser_getstring(configFile, "main:tdc_calibration_table", NULL);
-				replace_variables(fn2, entry2, cdir);
-				makeSimpleFirmwareEmpiricalCalibration(config, fn2);
+				if(entry2 == NULL) {
+					fprintf(stderr, "ERROR: tdc_calibration_table not specified in section 'main' of '%s'\n", configFileName);
+					exit(1);
+				}
+				replace_variables(fn, entry2, cdir);
+				simpleFirmwareFile = new TableFile(fn, "uuuuucffff");
 		}
 		else{
 			replace_variables(fn, entry, cdir);
-			loadFirmwareEmpiricalCalibration(config, fn);
+			firmwareFile = new TableFile(fn, "uuuuuffff");
+		}
+	}
+
+	TableFile *tableFiles[] = { tdcFile, qdcFile, energyFile, channelMapFile, triggerMapFile, timeOffsetFile, firmwareFile, simpleFirmwareFile };
+	const unsigned nTableFiles = sizeof(tableFiles) / sizeof(TableFile *);
+
+	config->hasTDCCalibration = (tdcFile != NULL);
+	config->hasQDCCalibration = (qdcFile != NULL);
+	config->hasEnergyCalibration = (energyFile != NULL);
+	config->hasXYZ = (channelMapFile != NULL);
+	config->hasTimeOffsetCalibration = (timeOffsetFile != NULL);
+	config->hasFirmwareEmpiricalCalibrations = (firmwareFile != NULL) || (simpleFirmwareFile != NULL);
+
+	// The tables may come from a binary cache, valid for the same load mask and table contents
+	// Loads restricted to active ASICs do not use it
+	const char *cacheEntry = iniparser_getstring(configFile, "main:config_cache", NULL);
+	std::string cacheFileName;
+	std::vector<char> cacheKey;
+	bool fromCache = false;
+	if((cacheEntry != NULL) && (activeAsics == NULL)) {
+		replace_variables(fn, cacheEntry, cdir);
+		char suffix[32];
+		sprintf(suffix, ".%016llx", (unsigned long long)mask);
+		cacheFileName = std::string(fn) + suffix;
+
+		if(makeCacheKey(cacheKey, mask, tableFiles, nTableFiles)) {
+			fromCache = config->loadCache(cacheFileName.c_str(), cacheKey);
 		}
-		config-> hasFirmwareEmpiricalCalibrations = true;
+	}
+
+	if(cacheOnly && !fromCache) {
+		for(unsigned n = 0; n < nTableFiles; n++) {
+			delete tableFiles[n];
+		}
+		iniparser_freedict(configFile);
+		delete config;
+		delete [] fn;
+		delete [] path;
+		return NULL;
+	}
+
+	if(!fromCache) {
+		for(unsigned n = 0; n < nTableFiles; n++) {
+			if(tableFiles[n] != NULL) tableFiles[n]->start();
+		}
+		for(unsigned n = 0; n < nTableFiles; n++) {
+			if(tableFiles[n] != NULL) tableFiles[n]->wait();
+		}
+
+		if(tdcFile != NULL) loadTDCCalibration(config, tdcFile);
+		if(qdcFile != NULL) loadQDCCalibration(config, qdcFile);
+		if(energyFile != NULL) loadEnergyCalibration(config, energyFile);
+		if(channelMapFile != NULL) {
+			loadChannelMap(config, channelMapFile);
+			loadTriggerMap(config, triggerMapFile);
+		}
+		if(timeOffsetFile != NULL) loadTimeOffsetCalibration(config, timeOffsetFile);
+		if(firmwareFile != NULL) loadFirmwareEmpiricalCalibration(config, firmwareFile);
+		if(simpleFirmwareFile != NULL) makeSimpleFirmwareEmpiricalCalibration(config, simpleFirmwareFile);
+
+		if(!cacheKey.empty()) config->saveCache(cacheFileName.c_str(), cacheKey);
+	}
+
+	for(unsigned n = 0; n < nTableFiles; n++) {
+		delete tableFiles[n];
 	}
 	
 	iniparser_freedict(configFile);
+	config->activeAsics = NULL;
+
+	if(activeAsics != NULL) {
+		struct timespec t1;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		float dt = (t1.tv_sec - t0.tv_sec) + 1E-9 * (t1.tv_nsec - t0.tv_nsec);
+		fprintf(stderr, "INFO: loaded configuration for %u channels of active ASICs in %.3f s\n", config->getNumberOfChannels() - 1, dt);
+	}
 
 	delete [] fn;
 	delete [] path;
 	return config;
 }
 
-void SystemConfig::touchChannelConfig(unsigned channelID)
+unsigned SystemConfig::touchChannelIndex(unsigned channelID)
 {
 	unsigned indexH = channelID / 4096;
 	unsigned indexL= channelID % 4096;
-	ChannelConfig *ptr = channelConfig[indexH];
+	unsigned *ptr = channelIndex[indexH];
 	if(ptr == NULL) {
-		ptr  = new ChannelConfig[4096];
+		ptr  = new unsigned[4096];
 		for(unsigned n = 0; n < 4096; n++) {
-			ptr[n] = nullChannelConfig;
+			ptr[n] = 0;
 		}
-		channelConfig[indexH] = ptr;
+		channelIndex[indexH] = ptr;
 	}
+
+	if(ptr[indexL] == 0) {
+		// First time we see this channel: append a default entry to every table
+		ptr[indexL] = channelIDTable.size();
+		channelIDTable.push_back(channelID);
+		for(unsigned n = 0; n < 4; n++) {
+			tacTTable.push_back(tacTTable[n]);
+			tacETable.push_back(tacETable[n]);
+			qacTable.push_back(qacTable[n]);
+			energyTable.push_back(energyTable[n]);
+			firmwareTable.push_back(firmwareTable[n]);
+		}
+		timeOffsetTable.push_back(timeOffsetTable[0]);
+		positionTable.push_back(positionTable[0]);
+		triggerRegionTable.push_back(triggerRegionTable[0]);
+		denseTriggerRegionTable.push_back(denseTriggerRegionTable[0]);
+	}
+	return ptr[indexL];
 }
 
 SystemConfig::SystemConfig()
 {
+	activeAsics = NULL;
 	hasTDCCalibration = false;
 	hasQDCCalibration = false;
 	hasXYZ = false;
 	
-	channelConfig = new ChannelConfig *[PATH_MAX];
-	for(unsigned n = 0; n < PATH_MAX; n++) {
-		channelConfig[n] = NULL;
+	channelIndex = new unsigned *[CHANNEL_INDEX_PAGES];
+	for(unsigned n = 0; n < CHANNEL_INDEX_PAGES; n++) {
+		channelIndex[n] = NULL;
 	}
 	
 	/*
-	 * Initialize nullChannelConfig
+	 * Index 0 holds the configuration for channels absent from all tables
 	 */
+	channelIDTable.push_back(0);
 	for(unsigned n = 0; n < 4; n++) {
-		nullChannelConfig.tac_T[n] = { 0, 0, 0, 0};
-		nullChannelConfig.tac_E[n] = { 0, 0, 0, 0};
-		nullChannelConfig.qac_Q[n] = { 0, 0, 0, 0, 0 };
-		nullChannelConfig.eCal[n] = { 0, 0, 0, 0};
-		nullChannelConfig.x = 0.0;
-		nullChannelConfig.y = 0.0;
-		nullChannelConfig.z = 0.0;
-		nullChannelConfig.xi = 0;
-		nullChannelConfig.yi = 0;
-		nullChannelConfig.triggerRegion = -1;
-		
-		nullChannelConfig.t0 = 0.0;
+		tacTTable.push_back({ 0, 0, 0, 0 });
+		tacETable.push_back({ 0, 0, 0, 0 });
+		qacTable.push_back({ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 });
+		energyTable.push_back({ 0, 0, 0, 0 });
+		firmwareTable.push_back({ 0, 0, 0, 0, false });
 	}
+	timeOffsetTable.push_back(0.0);
+	positionTable.push_back({ 0.0, 0.0, 0.0, 0, 0 });
+	triggerRegionTable.push_back(-1);
+	denseTriggerRegionTable.push_back(-1);
 	
-	coincidenceTriggerMap = new bool[MAX_TRIGGER_REGIONS * MAX_TRIGGER_REGIONS];
-	for(int i = 0; i < MAX_TRIGGER_REGIONS * MAX_TRIGGER_REGIONS; i++)
-		coincidenceTriggerMap[i] = false;
-	
-	multihitTriggerMap = new bool[MAX_TRIGGER_REGIONS * MAX_TRIGGER_REGIONS];
-	for(int i = 0; i < MAX_TRIGGER_REGIONS * MAX_TRIGGER_REGIONS; i++)
-		multihitTriggerMap[i] = false;
+	regionToDense = new int[MAX_TRIGGER_REGIONS];
+	for(int i = 0; i < MAX_TRIGGER_REGIONS; i++)
+		regionToDense[i] = -1;
+	regionMatrixStride = 0;
 }
 
 SystemConfig::~SystemConfig()
 {
-	delete [] multihitTriggerMap;
-	delete [] coincidenceTriggerMap;
+	delete [] regionToDense;
 	
-	for(unsigned n = 0; n < PATH_MAX; n++) {
-		if(channelConfig[n] != NULL) {
-			delete [] channelConfig[n];
+	for(unsigned n = 0; n < CHANNEL_INDEX_PAGES; n++) {
+		if(channelIndex[n] != NULL) {
+			delete [] channelIndex[n];
 		}
 	}
-	delete channelConfig;
-}
-
-
-// Remove comments and extra whitespace
-// Leaving only fiels separated by a single \t character
-static void normalizeLine(char *line) {
-	std::string s = std::string(line);
-	// Remove carriage return, from Windows written files
-	s = boost::regex_replace(s, boost::regex("\r"), "");
-	// Remove comments
-	s = boost::regex_replace(s, boost::regex("\\s*#.*"), "");
-	// Remove leading white space
-	s = boost::regex_replace(s, boost::regex("^\\s+"), "");
-	// Remove trailing whitespace
-	s = boost::regex_replace(s, boost::regex("\\s+$"), "");
-	// Normalize white space to tab
-	s = boost::regex_replace(s, boost::regex("\\s+"), "\t");
-	strcpy(line, s.c_str());
-	
+	delete [] channelIndex;
 }
 
+
 static unsigned MAKE_GID(unsigned long portID, unsigned long slaveID, unsigned long chipID, unsigned long channelID)
 {
 	unsigned long gChannelID = 0;
@@ -250,81 +557,60 @@ static unsigned MAKE_GID(unsigned long portID, unsigned long slaveID, unsigned l
 	return gChannelID;
 }
 
+bool SystemConfig::isAsicActive(unsigned long gChannelID)
+{
+	if(activeAsics == NULL) return true;
+	return activeAsics[gChannelID >> 6];
+}
+
 
-void SystemConfig::loadTDCCalibration(SystemConfig *config, const char *fn)
+void SystemConfig::loadTDCCalibration(SystemConfig *config, TableFile *table)
 {
-	FILE *f = fopen(fn, "r");
-	if(f == NULL) {
-		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
-		exit(1);
-	}
-	char line[PATH_MAX];
-	while(fscanf(f, "%[^\n]\n", line) == 1) {
-		normalizeLine(line);
-		if(strlen(line) == 0) continue;
-		
-		unsigned portID, slaveID, chipID, channelID, tacID;
-		char bStr;
-		float t0, a0, a1, a2;
-		
-		if(sscanf(line, "%d\t%u\t%u\t%u\t%u\t%c\t%f\t%f\t%f\t%f\n", 
-			&portID, &slaveID, &chipID, &channelID, &tacID, &bStr,
-			&t0, &a0, &a1, &a2) != 10) continue;
+	for(unsigned n = 0; n < table->getNumberOfRows(); n++) {
+		const TableFile::Value *v = table->getRow(n);
+		unsigned portID = v[0].u, slaveID = v[1].u, chipID = v[2].u, channelID = v[3].u, tacID = v[4].u;
+		char bStr = v[5].c;
+		float t0 = v[6].f, a0 = v[7].f, a1 = v[8].f, a2 = v[9].f;
 		
 		unsigned long gChannelID = MAKE_GID(portID, slaveID, chipID, channelID);
+		if(!config->isAsicActive(gChannelID)) continue;
 		
-		config->touchChannelConfig(gChannelID);
-		ChannelConfig &channelConfig = config->getChannelConfig(gChannelID);
+		unsigned index = config->touchChannelIndex(gChannelID);
 		
-		TacConfig &tacConfig = (bStr == 'T') ? channelConfig.tac_T[tacID] : channelConfig.tac_E[tacID];
+		TacConfig &tacConfig = (bStr == 'T') ? config->getTacConfigT(index, tacID) : config->getTacConfigE(index, tacID);
 		
 		tacConfig.t0 = t0;
 		tacConfig.a0 = a0;
 		tacConfig.a1 = a1;
 		tacConfig.a2 = a2;
 	}
-	fclose(f);
 }
 
 
-void SystemConfig::loadQDCCalibration(SystemConfig *config, const char *fn)
+void SystemConfig::loadQDCCalibration(SystemConfig *config, TableFile *table)
 {
-	FILE *f = fopen(fn, "r");
-	if(f == NULL) {
-		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
-		exit(1);
-	}
-	char line[PATH_MAX];
-	while(fscanf(f, "%[^\n]\n", line) == 1) {
-		normalizeLine(line);
-		if(strlen(line) == 0) continue;
-		
-		unsigned portID, slaveID, chipID, channelID, tacID;
-		float p0, p1, p2, p3, p4, p5, p6, p7, p8, p9;
-		
-		if(sscanf(line, "%d\t%u\t%u\t%u\t%u\t\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\n",
-			&portID, &slaveID, &chipID, &channelID, &tacID,
-			  &p0, &p1, &p2, &p3, &p4, &p5, &p6, &p7, &p8, &p9) != 15) continue;
+	for(unsigned n = 0; n < table->getNumberOfRows(); n++) {
+		const TableFile::Value *v = table->getRow(n);
+		unsigned portID = v[0].u, slaveID = v[1].u, chipID = v[2].u, channelID = v[3].u, tacID = v[4].u;
 		
 		unsigned long gChannelID = MAKE_GID(portID, slaveID, chipID, channelID);
-		
-		config->touchChannelConfig(gChannelID);
-		ChannelConfig &channelConfig = config->getChannelConfig(gChannelID);
-		
-		QacConfig &qacConfig = channelConfig.qac_Q[tacID];
-		
-		qacConfig.p0 = p0;
-		qacConfig.p1 = p1;
-		qacConfig.p2 = p2;
-		qacConfig.p3 = p3;
-		qacConfig.p4 = p4;
-		qacConfig.p5 = p5;
-		qacConfig.p6 = p6;
-		qacConfig.p7 = p7;
-		qacConfig.p8 = p8;
-		qacConfig.p9 = p9;
+		if(!config->isAsicActive(gChannelID)) continue;
+		
+		unsigned index = config->touchChannelIndex(gChannelID);
+		
+		QacConfig &qacConfig = config->getQacConfig(index, tacID);
+		
+		qacConfig.p0 = v[5].f;
+		qacConfig.p1 = v[6].f;
+		qacConfig.p2 = v[7].f;
+		qacConfig.p3 = v[8].f;
+		qacConfig.p4 = v[9].f;
+		qacConfig.p5 = v[10].f;
+		qacConfig.p6 = v[11].f;
+		qacConfig.p7 = v[12].f;
+		qacConfig.p8 = v[13].f;
+		qacConfig.p9 = v[14].f;
 	}
-	fclose(f);
 }
 
 bool SystemConfig::areHwTriggerThresholdsDefault(SystemConfig *config){
@@ -335,31 +621,19 @@ bool SystemConfig::areHwTriggerThresholdsDefault(SystemConfig *config){
 }
 
 
-void SystemConfig::loadFirmwareEmpiricalCalibration(SystemConfig *config, const char *fn)
+void SystemConfig::loadFirmwareEmpiricalCalibration(SystemConfig *config, TableFile *table)
 {
-	FILE *f = fopen(fn, "r");
-	if(f == NULL) {
-		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
-		exit(1);
-	}
-	char line[PATH_MAX];
-	while(fscanf(f, "%[^\n]\n", line) == 1) {
-		normalizeLine(line);
-		if(strlen(line) == 0) continue;
-
-		unsigned portID, slaveID, chipID, channelID, tacID;
-		float p0, p1, p2, k0;
-
-		if(sscanf(line, "%d\t%u\t%u\t%u\t%u\t\t%f\t%f\t%f\t%f\n",
-			&portID, &slaveID, &chipID, &channelID, &tacID,
-			  &p0, &p1, &p2, &k0) != 9) continue;
+	for(unsigned n = 0; n < table->getNumberOfRows(); n++) {
+		const TableFile::Value *v = table->getRow(n);
+		unsigned portID = v[0].u, slaveID = v[1].u, chipID = v[2].u, channelID = v[3].u, tacID = v[4].u;
+		float p0 = v[5].f, p1 = v[6].f, p2 = v[7].f, k0 = v[8].f;
 
 		unsigned long gChannelID = MAKE_GID(portID, slaveID, chipID, channelID);
+		if(!config->isAsicActive(gChannelID)) continue;
 
-		config->touchChannelConfig(gChannelID);
-		ChannelConfig &channelConfig = config->getChannelConfig(gChannelID);
+		unsigned index = config->touchChannelIndex(gChannelID);
 
-		FirmwareConfig &empConfig = channelConfig.empConfig[tacID];
+		FirmwareConfig &empConfig = config->getFirmwareConfig(index, tacID);
 
 		empConfig.p0 = p0;
 		empConfig.p1 = p1;
@@ -367,134 +641,78 @@ void SystemConfig::loadFirmwareEmpiricalCalibration(SystemConfig *config, const
 		empConfig.k0 = k0;
 
 	}
-	fclose(f);
 }
 
 
-void SystemConfig::makeSimpleFirmwareEmpiricalCalibration(SystemConfig *config, const char *fn)
+void SystemConfig::makeSimpleFirmwareEmpiricalCalibration(SystemConfig *config, TableFile *table)
 {
-	FILE *f = fopen(fn, "r");
-	if(f == NULL) {
-		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
-		exit(1);
-	}
-	char line[PATH_MAX];
-	while(fscanf(f, "%[^\n]\n", line) == 1) {
-		normalizeLine(line);
-		if(strlen(line) == 0) continue;
-		
-		unsigned portID, slaveID, chipID, channelID, tacID;
-		char bStr;
-		float t0, a0, a1, a2;
-		
-		if(sscanf(line, "%d\t%u\t%u\t%u\t%u\t%c\t%f\t%f\t%f\t%f\n", 
-			&portID, &slaveID, &chipID, &channelID, &tacID, &bStr,
-			&t0, &a0, &a1, &a2) != 10) continue;
+	for(unsigned n = 0; n < table->getNumberOfRows(); n++) {
+		const TableFile::Value *v = table->getRow(n);
+		unsigned portID = v[0].u, slaveID = v[1].u, chipID = v[2].u, channelID = v[3].u, tacID = v[4].u;
 		
 		unsigned long gChannelID = MAKE_GID(portID, slaveID, chipID, channelID);
+		if(!config->isAsicActive(gChannelID)) continue;
 		
-		config->touchChannelConfig(gChannelID);
-		ChannelConfig &channelConfig = config->getChannelConfig(gChannelID);
+		unsigned index = config->touchChannelIndex(gChannelID);
 		
-		FirmwareConfig &empConfig = channelConfig.empConfig[tacID];
+		FirmwareConfig &empConfig = config->getFirmwareConfig(index, tacID);
 		
 		empConfig.p0 = 1;
 		empConfig.p1 = 0;
 		empConfig.p2 = 0;
 		empConfig.k0 = 0.5;
 	}
-	fclose(f);
 }
 
-void SystemConfig::loadEnergyCalibration(SystemConfig *config, const char *fn)
+void SystemConfig::loadEnergyCalibration(SystemConfig *config, TableFile *table)
 {
-	FILE *f = fopen(fn, "r");
-	if(f == NULL) {
-		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
-		exit(1);
-	}
-	char line[1024];
-	while(fscanf(f, "%[^\n]\n", line) == 1) {
-		normalizeLine(line);
-		if(strlen(line) == 0) continue;
-		
-		unsigned portID, slaveID, chipID, channelID, tacID;
-		float p0, p1, p2, p3;
-		
-		if(sscanf(line, "%d\t%u\t%u\t%u\t%u\t\t%f\t%f\t%f\t%f\n",
-			&portID, &slaveID, &chipID, &channelID, &tacID,
-			&p0, &p1, &p2, &p3) != 9) continue;
+	for(unsigned n = 0; n < table->getNumberOfRows(); n++) {
+		const TableFile::Value *v = table->getRow(n);
+		unsigned portID = v[0].u, slaveID = v[1].u, chipID = v[2].u, channelID = v[3].u, tacID = v[4].u;
+		float p0 = v[5].f, p1 = v[6].f, p2 = v[7].f, p3 = v[8].f;
 		
 		unsigned long gChannelID = MAKE_GID(portID, slaveID, chipID, channelID);
+		if(!config->isAsicActive(gChannelID)) continue;
 		
-		config->touchChannelConfig(gChannelID);
-		ChannelConfig &channelConfig = config->getChannelConfig(gChannelID);
+		unsigned index = config->touchChannelIndex(gChannelID);
 		
-		EnergyConfig &eCal = channelConfig.eCal[tacID];
+		EnergyConfig &eCal = config->getEnergyConfig(index, tacID);
 		
 		eCal.p0 = p0;
 		eCal.p1 = p1;
 		eCal.p2 = p2;
 		eCal.p3 = p3;
 	}
-	fclose(f);
 }
 
-void SystemConfig::loadTimeOffsetCalibration(SystemConfig *config, const char *fn)
+void SystemConfig::loadTimeOffsetCalibration(SystemConfig *config, TableFile *table)
 {
-	FILE *f = fopen(fn, "r");
-	if(f == NULL) {
-		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
-		exit(1);
-	}
-	char line[PATH_MAX];
-	while(fscanf(f, "%[^\n]\n", line) == 1) {
-		normalizeLine(line);
-		if(strlen(line) == 0) continue;
-		
-		unsigned portID, slaveID, chipID;
-                int channelID;
-		float t0;
-		
-		if(sscanf(line, "%u\t%u\t%u\t%d\t%f\n", 
-			&portID, &slaveID, &chipID, &channelID,
-			&t0) != 5) continue;
+	for(unsigned n = 0; n < table->getNumberOfRows(); n++) {
+		const TableFile::Value *v = table->getRow(n);
+		unsigned portID = v[0].u, slaveID = v[1].u, chipID = v[2].u;
+		int channelID = v[3].d;
+		float t0 = v[4].f;
                
 		unsigned long gChannelID = MAKE_GID(portID, slaveID, chipID, channelID);
+		if(!config->isAsicActive(gChannelID)) continue;
 		
-		config->touchChannelConfig(gChannelID);
-		ChannelConfig &channelConfig = config->getChannelConfig(gChannelID);
+		unsigned index = config->touchChannelIndex(gChannelID);
 
-		channelConfig.t0 = t0;
+		config->timeOffsetTable[index] = t0;
         }
-
-	fclose(f);
 }
 
 
-void SystemConfig::loadChannelMap(SystemConfig *config, const char *fn)
+void SystemConfig::loadChannelMap(SystemConfig *config, TableFile *table)
 {
-	FILE *f = fopen(fn, "r");
-	if(f == NULL) {
-		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
-		exit(1);
-	}
-
 	std::set<unsigned> triggerRegionsSet;
 
-	char line[PATH_MAX];
-	while(fscanf(f, "%[^\n]\n", line) == 1) {
-		normalizeLine(line);
-		if(strlen(line) == 0) continue;
-		
-		unsigned portID, slaveID, chipID, channelID;
-		int region, xi, yi;
-		float x, y, z;
-		
-		if(sscanf(line, "%u\t%u\t%u\t%u\t%d\t%d\t%d\t%f\t%f\t%f\n",
-			&portID, &slaveID, &chipID, &channelID,
-			&region, &xi, &yi,
-			&x, &y, &z) != 10) continue;
+	for(unsigned n = 0; n < table->getNumberOfRows(); n++) {
+		// Lines for inactive ASICs still count for the trigger region numbering
+		const TableFile::Value *v = table->getRow(n);
+		unsigned portID = v[0].u, slaveID = v[1].u, chipID = v[2].u, channelID = v[3].u;
+		int region = v[4].d, xi = v[5].d, yi = v[6].d;
+		float x = v[7].f, y = v[8].f, z = v[9].f;
 
 		if (triggerRegionsSet.find(region) != triggerRegionsSet.end()){
 			config->mapTriggerRegions[region] = triggerRegionsSet.size()-1;
@@ -503,56 +721,200 @@ void SystemConfig::loadChannelMap(SystemConfig *config, const char *fn)
 		triggerRegionsSet.insert(region);
 
 		unsigned long gChannelID = MAKE_GID(portID, slaveID, chipID, channelID);
+		if(!config->isAsicActive(gChannelID)) continue;
 		
-		config->touchChannelConfig(gChannelID);
-
-		ChannelConfig &channelConfig = config->getChannelConfig(gChannelID);
-		channelConfig.triggerRegion = region;
-		channelConfig.xi = xi;
-		channelConfig.yi = yi;
-		channelConfig.x = x;
-		channelConfig.y = y;
-		channelConfig.z = z;
+		unsigned index = config->touchChannelIndex(gChannelID);
+
+		config->triggerRegionTable[index] = region;
+		ChannelPosition &position = config->getChannelPosition(index);
+		position.xi = xi;
+		position.yi = yi;
+		position.x = x;
+		position.y = y;
+		position.z = z;
 		
 	}
-	fclose(f);
 }
 
-void SystemConfig::loadTriggerMap(SystemConfig *config, const char *fn)
+void SystemConfig::setRegionBit(std::vector<uint64_t> &matrix, int d1, int d2, bool value)
 {
-	FILE *f = fopen(fn, "r");
-	if(f == NULL) {
-		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
+	uint64_t mask = 1ULL << (d2 & 63);
+	uint64_t &word = matrix[d1 * regionMatrixStride + (d2 >> 6)];
+	word = value ? (word | mask) : (word & ~mask);
+}
+
+void SystemConfig::loadTriggerMap(SystemConfig *config, TableFile *table)
+{
+	const char *fn = table->getFileName();
+	if(table->getFirstBadLine() != 0) {
+		fprintf(stderr, "Error on '%s' line %d: line should have 3 entries\n", fn, table->getFirstBadLine());
 		exit(1);
 	}
-	char line[PATH_MAX];
-	int lineNumber = 0;
-	while(fscanf(f, "%[^\n]\n", line) == 1) {
-		lineNumber += 1;
-		normalizeLine(line);
-		if(strlen(line) == 0) continue;
-		
+
+	struct TriggerMapEntry {
 		int r1, r2;
 		char c;
-		if(sscanf(line, "%d\t%d\t%c\n", &r1, &r2, &c) != 3) {
-			fprintf(stderr, "Error on '%s' line %d: line should have 3 entries\n", fn, lineNumber);
-			exit(1);
-		}
+	};
+	std::vector<TriggerMapEntry> entries;
+	std::set<int> regionSet;
+
+	for(unsigned n = 0; n < table->getNumberOfRows(); n++) {
+		const TableFile::Value *v = table->getRow(n);
+		int r1 = v[0].d, r2 = v[1].d;
+		char c = v[2].c;
 		
 		if((r1 < 0) || (r1 >= MAX_TRIGGER_REGIONS) || (r2 < 0) || (r2 >= MAX_TRIGGER_REGIONS)) {
-			fprintf(stderr, "Error on '%s' line %d: trigger region number must be between 0 and %d", fn, lineNumber, MAX_TRIGGER_REGIONS);
+			fprintf(stderr, "Error on '%s' line %d: trigger region number must be between 0 and %d", fn, table->getLineNumber(n), MAX_TRIGGER_REGIONS);
 			exit(1);
 		}
 		c = toupper(c);
 		if((c != 'M') && (c != 'C')) {
-			fprintf(stderr, "Error on '%s' line %d: trigger type must be M or C", fn, lineNumber);
+			fprintf(stderr, "Error on '%s' line %d: trigger type must be M or C", fn, table->getLineNumber(n));
 			exit(1);
 		}
-		
-		config->coincidenceTriggerMap[r1 * MAX_TRIGGER_REGIONS + r2] = (c == 'C');
-		config->coincidenceTriggerMap[r2 * MAX_TRIGGER_REGIONS + r1] = (c == 'C');
-		config->multihitTriggerMap[r1 * MAX_TRIGGER_REGIONS + r2] = (c == 'M');
-		config->multihitTriggerMap[r2 * MAX_TRIGGER_REGIONS + r1] = (c == 'M');
+
+		entries.push_back({ r1, r2, c });
+		regionSet.insert(r1);
+		regionSet.insert(r2);
+	}
+
+	// Number the regions in increasing order of their ID
+	for(std::set<int>::iterator it = regionSet.begin(); it != regionSet.end(); it++) {
+		config->regionToDense[*it] = config->denseRegionIDs.size();
+		config->denseRegionIDs.push_back(*it);
+	}
+
+	unsigned R = config->denseRegionIDs.size();
+	config->regionMatrixStride = (R + 63) / 64;
+	config->coincidenceMatrix.assign(R * config->regionMatrixStride, 0);
+	config->multihitMatrix.assign(R * config->regionMatrixStride, 0);
+
+	// Apply the entries in file order, so that later lines override earlier ones
+	for(unsigned n = 0; n < entries.size(); n++) {
+		int d1 = config->regionToDense[entries[n].r1];
+		int d2 = config->regionToDense[entries[n].r2];
+		char c = entries[n].c;
+		config->setRegionBit(config->coincidenceMatrix, d1, d2, c == 'C');
+		config->setRegionBit(config->coincidenceMatrix, d2, d1, c == 'C');
+		config->setRegionBit(config->multihitMatrix, d1, d2, c == 'M');
+		config->setRegionBit(config->multihitMatrix, d2, d1, c == 'M');
+	}
+
+	for(unsigned index = 0; index < config->triggerRegionTable.size(); index++) {
+		config->denseTriggerRegionTable[index] = config->getDenseRegion(config->triggerRegionTable[index]);
+	}
+}
+
+bool SystemConfig::loadCache(const char *fn, std::vector<char> &key)
+{
+	int fd = open(fn, O_RDONLY);
+	if(fd == -1) return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	size_t headerSize = key.size() + 2 * sizeof(uint64_t);
+	if(size < headerSize) {
+		close(fd);
+		return false;
+	}
+	char *data = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) return false;
+
+	uint64_t bodySize, bodyHash;
+	memcpy(&bodySize, data + key.size(), sizeof(uint64_t));
+	memcpy(&bodyHash, data + key.size() + sizeof(uint64_t), sizeof(uint64_t));
+	bool valid = (memcmp(data, key.data(), key.size()) == 0) &&
+		(bodySize == size - headerSize) &&
+		(hashBytes(data + headerSize, bodySize) == bodyHash);
+	if(!valid) {
+		munmap(data, size);
+		return false;
+	}
+
+	// The tables are copied out of the mapping, one memcpy each, rather than used in place:
+	// they are growable std::vectors (touchChannelIndex() appends to them) and must outlive the mapping
+	CacheReader r = { data + headerSize, data + size };
+
+	uint64_t nPages = r.getValue<uint64_t>();
+	for(uint64_t n = 0; n < nPages; n++) {
+		unsigned page = r.getValue<uint32_t>();
+		channelIndex[page] = new unsigned[4096];
+		r.get(channelIndex[page], 4096 * sizeof(unsigned));
+	}
+	r.getVector(channelIDTable);
+	r.getVector(tacTTable);
+	r.getVector(tacETable);
+	r.getVector(qacTable);
+	r.getVector(energyTable);
+	r.getVector(firmwareTable);
+	r.getVector(timeOffsetTable);
+	r.getVector(positionTable);
+	r.getVector(triggerRegionTable);
+	r.getVector(denseTriggerRegionTable);
+	r.get(regionToDense, MAX_TRIGGER_REGIONS * sizeof(int));
+	r.getVector(denseRegionIDs);
+	regionMatrixStride = r.getValue<uint32_t>();
+	r.getVector(coincidenceMatrix);
+	r.getVector(multihitMatrix);
+	r.getMap(mapTriggerRegions);
+	r.getMap(mapTriggerRegionsInverted);
+
+	munmap(data, size);
+	return true;
+}
+
+void SystemConfig::saveCache(const char *fn, std::vector<char> &key)
+{
+	std::vector<char> body;
+
+	std::vector<uint32_t> pages;
+	for(unsigned n = 0; n < CHANNEL_INDEX_PAGES; n++) {
+		if(channelIndex[n] != NULL) pages.push_back(n);
+	}
+	putValue<uint64_t>(body, pages.size());
+	for(unsigned n = 0; n < pages.size(); n++) {
+		putValue<uint32_t>(body, pages[n]);
+		putBytes(body, channelIndex[pages[n]], 4096 * sizeof(unsigned));
+	}
+	putVector(body, channelIDTable);
+	putVector(body, tacTTable);
+	putVector(body, tacETable);
+	putVector(body, qacTable);
+	putVector(body, energyTable);
+	putVector(body, firmwareTable);
+	putVector(body, timeOffsetTable);
+	putVector(body, positionTable);
+	putVector(body, triggerRegionTable);
+	putVector(body, denseTriggerRegionTable);
+	putBytes(body, regionToDense, MAX_TRIGGER_REGIONS * sizeof(int));
+	putVector(body, denseRegionIDs);
+	putValue<uint32_t>(body, regionMatrixStride);
+	putVector(body, coincidenceMatrix);
+	putVector(body, multihitMatrix);
+	putMap(body, mapTriggerRegions);
+	putMap(body, mapTriggerRegionsInverted);
+
+	std::vector<char> header = key;
+	putValue<uint64_t>(header, body.size());
+	putValue<uint64_t>(header, hashBytes(body.data(), body.size()));
+
+	// Write a temporary file and rename it, so that concurrent readers never see a partial cache
+	char tmpName[PATH_MAX + 32];
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp%d", fn, getpid());
+	FILE *f = fopen(tmpName, "w");
+	if(f == NULL) {
+		fprintf(stderr, "WARNING: could not write configuration cache '%s': %s\n", tmpName, strerror(errno));
+		return;
+	}
+	bool ok = (fwrite(header.data(), 1, header.size(), f) == header.size()) &&
+		(fwrite(body.data(), 1, body.size(), f) == body.size());
+	ok = (fclose(f) == 0) && ok;
+	if(!ok || (rename(tmpName, fn) != 0)) {
+		fprintf(stderr, "WARNING: could not write configuration cache '%s': %s\n", fn, strerror(errno));
+		unlink(tmpName);
 	}
-	fclose(f);
 }
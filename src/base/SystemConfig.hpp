@@ -10,6 +10,7 @@
 
 namespace PETSYS
 {
+	class TableFile;
 
 	class SystemConfig
 	{
@@ -54,16 +55,9 @@ namespace PETSYS
 			float p2;
 			float p3;
 		};
-		struct ChannelConfig {
+		struct ChannelPosition {
 			float x, y, z;
 			int xi, yi;
-			int triggerRegion;
-			float t0;
-			TacConfig tac_T[4];
-			TacConfig tac_E[4];
-			QacConfig qac_Q[4];
-			FirmwareConfig empConfig[4];
-			EnergyConfig eCal[4];
 		};
 
 		// Software trigger configuration
@@ -82,10 +76,39 @@ namespace PETSYS
 
 		float sw_trigger_group_max_distance;
 		double sw_trigger_group_time_window;
+		// SCAN and REGION group hits around a seed hit and give the same photons
+		// CLUSTER groups connected sets of neighbour channel hits
+		enum GroupEngine { GROUP_ENGINE_SCAN, GROUP_ENGINE_REGION, GROUP_ENGINE_CLUSTER };
+		GroupEngine sw_trigger_group_engine;
 		double sw_trigger_coincidence_time_window;
+		enum CoincidenceEngine { COINCIDENCE_ENGINE_SCAN, COINCIDENCE_ENGINE_REGION };
+		CoincidenceEngine sw_trigger_coincidence_engine;
+		// Offsets of the delayed coincidence windows, in clock periods
+		std::vector<double> sw_trigger_coincidence_delayed_offsets;
+
+		// Binning of the LOR histogram output
+		double lor_histogram_time_bin_width;	// Picoseconds, 0 for a single bin of any time difference
+		int lor_histogram_time_bins;
+		int lor_histogram_energy_bins;
+		double lor_histogram_energy_min;
+		double lor_histogram_energy_max;
+
+		// Binning of the channel spectra output
+		int channel_spectra_energy_bins;
+		double channel_spectra_energy_min;
+		double channel_spectra_energy_max;
+		int channel_spectra_time_bins;		// Over one frame
 
 		static SystemConfig *fromFile(const char *configFileName);
 		static SystemConfig *fromFile(const char *configFileName, u_int64_t mask);
+		// Load only the channel tables for ASICs flagged in activeAsics, indexed by (channelID >> 6)
+		// activeAsics may be NULL, in which case all channels are loaded
+		static SystemConfig *fromFile(const char *configFileName, u_int64_t mask, const bool *activeAsics);
+		// Same as fromFile(), but only when the tables can come from a valid binary cache; NULL otherwise
+		// The text tables are never parsed
+		static SystemConfig *fromCache(const char *configFileName, u_int64_t mask);
+		// Whether the configuration asks for a binary cache of the tables (main:config_cache)
+		static bool hasCache(const char *configFileName);
 
 		inline bool useTDCCalibration() { return hasTDCCalibration; };
 		inline bool useQDCCalibration() { return hasQDCCalibration; };
@@ -94,25 +117,58 @@ namespace PETSYS
 		inline bool useTimeOffsetCalibration() { return hasTimeOffsetCalibration; };
 		inline bool useXYZ() { return hasXYZ; };
 
-		inline SystemConfig::ChannelConfig &getChannelConfig(unsigned channelID){
+		// Channels present in any of the loaded tables get a dense index
+		// Index 0 is reserved for channels without any configuration
+		inline unsigned getChannelIndex(unsigned channelID) {
 			unsigned indexH = channelID / 4096;
 			unsigned indexL = channelID % 4096;
 
-			ChannelConfig *ptr = channelConfig[indexH];
+			unsigned *ptr = channelIndex[indexH];
 			if (ptr == NULL)
-				return nullChannelConfig;
+				return 0;
 			else
 				return ptr[indexL];
 		};
 
+		inline unsigned getNumberOfChannels() { return channelIDTable.size(); };
+		inline unsigned getChannelID(unsigned index) { return channelIDTable[index]; };
+
+		// Per-purpose tables, indexed by dense channel index (and TAC)
+		inline TacConfig &getTacConfigT(unsigned index, unsigned tacID) { return tacTTable[index * 4 + tacID]; };
+		inline TacConfig &getTacConfigE(unsigned index, unsigned tacID) { return tacETable[index * 4 + tacID]; };
+		inline QacConfig &getQacConfig(unsigned index, unsigned tacID) { return qacTable[index * 4 + tacID]; };
+		inline EnergyConfig &getEnergyConfig(unsigned index, unsigned tacID) { return energyTable[index * 4 + tacID]; };
+		inline FirmwareConfig &getFirmwareConfig(unsigned index, unsigned tacID) { return firmwareTable[index * 4 + tacID]; };
+		inline float getTimeOffset(unsigned index) { return timeOffsetTable[index]; };
+		inline ChannelPosition &getChannelPosition(unsigned index) { return positionTable[index]; };
+		inline int getTriggerRegion(unsigned index) { return triggerRegionTable[index]; };
+
+		// Trigger regions which appear in the trigger map are numbered 0..R-1 (dense region ID)
+		// Regions absent from the trigger map have dense ID -1
+		inline unsigned getNumberOfDenseRegions() { return denseRegionIDs.size(); };
+		inline int getDenseRegion(int region) {
+			if((region < 0) || (region >= (int)MAX_TRIGGER_REGIONS)) return -1;
+			return regionToDense[region];
+		};
+		inline int getRegionFromDense(int denseRegion) { return denseRegionIDs[denseRegion]; };
+		inline int getDenseTriggerRegion(unsigned index) { return denseTriggerRegionTable[index]; };
+
 		inline bool isCoincidenceAllowed(int r1, int r2) {
-			if ((r1 < 0) || (r2 < 0)) return false;
-			return coincidenceTriggerMap[r1 * MAX_TRIGGER_REGIONS + r2];
+			return isCoincidenceAllowedDense(getDenseRegion(r1), getDenseRegion(r2));
 		};
 
 		inline bool isMultiHitAllowed(int r1, int r2) {
-			if ((r1 < 0) || (r2 < 0)) return false;
-			return multihitTriggerMap[r1 * MAX_TRIGGER_REGIONS + r2];
+			return isMultiHitAllowedDense(getDenseRegion(r1), getDenseRegion(r2));
+		};
+
+		inline bool isCoincidenceAllowedDense(int d1, int d2) {
+			if ((d1 < 0) || (d2 < 0)) return false;
+			return testRegionBit(coincidenceMatrix, d1, d2);
+		};
+
+		inline bool isMultiHitAllowedDense(int d1, int d2) {
+			if ((d1 < 0) || (d2 < 0)) return false;
+			return testRegionBit(multihitMatrix, d1, d2);
 		};
 
 		std::map<unsigned, unsigned> mapTriggerRegions;
@@ -122,16 +178,25 @@ namespace PETSYS
 		~SystemConfig();
 
 	private:
-		void touchChannelConfig(unsigned channelID);
+		unsigned touchChannelIndex(unsigned channelID);
+		void setRegionBit(std::vector<uint64_t> &matrix, int d1, int d2, bool value);
+		inline bool testRegionBit(std::vector<uint64_t> &matrix, int d1, int d2) {
+			return (matrix[d1 * regionMatrixStride + (d2 >> 6)] >> (d2 & 63)) & 1;
+		};
+		bool isAsicActive(unsigned long gChannelID);
 		static bool areHwTriggerThresholdsDefault(SystemConfig *config);
-		static void loadTDCCalibration(SystemConfig *config, const char *fn);
-		static void loadQDCCalibration(SystemConfig *config, const char *fn);
-		static void loadFirmwareEmpiricalCalibration(SystemConfig *config, const char *fn);
-		static void makeSimpleFirmwareEmpiricalCalibration(SystemConfig *config, const char *fn);
-		static void loadEnergyCalibration(SystemConfig *config, const char *fn);
-		static void loadTimeOffsetCalibration(SystemConfig *config, const char *fn);
-		static void loadChannelMap(SystemConfig *config, const char *fn);
-		static void loadTriggerMap(SystemConfig *config, const char *fn);
+		static void loadTDCCalibration(SystemConfig *config, TableFile *table);
+		static void loadQDCCalibration(SystemConfig *config, TableFile *table);
+		static void loadFirmwareEmpiricalCalibration(SystemConfig *config, TableFile *table);
+		static void makeSimpleFirmwareEmpiricalCalibration(SystemConfig *config, TableFile *table);
+		static void loadEnergyCalibration(SystemConfig *config, TableFile *table);
+		static void loadTimeOffsetCalibration(SystemConfig *config, TableFile *table);
+		static void loadChannelMap(SystemConfig *config, TableFile *table);
+		static void loadTriggerMap(SystemConfig *config, TableFile *table);
+		static SystemConfig *load(const char *configFileName, u_int64_t mask, const bool *activeAsics, bool cacheOnly);
+		static bool makeCacheKey(std::vector<char> &key, u_int64_t mask, TableFile **tableFiles, unsigned nTableFiles);
+		bool loadCache(const char *fn, std::vector<char> &key);
+		void saveCache(const char *fn, std::vector<char> &key);
 
 		bool hasTDCCalibration;
 		bool hasQDCCalibration;
@@ -140,13 +205,31 @@ namespace PETSYS
 		bool hasTimeOffsetCalibration;
 		bool hasXYZ;
 
-		ChannelConfig **channelConfig;
-		ChannelConfig nullChannelConfig;
+		static const unsigned CHANNEL_INDEX_PAGES = 1024; // 22 bit channel ID in 4096 entry pages
+
+		const bool *activeAsics;	// Only valid while loading
+
+		unsigned **channelIndex;
+		std::vector<unsigned> channelIDTable;
+		std::vector<TacConfig> tacTTable;
+		std::vector<TacConfig> tacETable;
+		std::vector<QacConfig> qacTable;
+		std::vector<EnergyConfig> energyTable;
+		std::vector<FirmwareConfig> firmwareTable;
+		std::vector<float> timeOffsetTable;
+		std::vector<ChannelPosition> positionTable;
+		std::vector<int> triggerRegionTable;
+		std::vector<int> denseTriggerRegionTable;
 
 		static const unsigned MAX_TRIGGER_REGIONS = 4096; // 1024 FEB/D x 4 regions;
 
-		bool *coincidenceTriggerMap;
-		bool *multihitTriggerMap;
+		int *regionToDense;
+		std::vector<int> denseRegionIDs;
+
+		// R x R bit matrices over dense region IDs, rows of regionMatrixStride words
+		unsigned regionMatrixStride;
+		std::vector<uint64_t> coincidenceMatrix;
+		std::vector<uint64_t> multihitMatrix;
 	};
 
 }
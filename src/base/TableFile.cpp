@@ -0,0 +1,156 @@
+#include "TableFile.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+
+using namespace PETSYS;
+
+TableFile::TableFile(const char *fileName, const char *format) :
+	fileName(fileName), format(format)
+{
+	nColumns = this->format.size();
+	firstBadLine = 0;
+	readErrno = 0;
+	started = false;
+}
+
+TableFile::~TableFile()
+{
+	if(started) wait();
+}
+
+void TableFile::start()
+{
+	started = true;
+	pthread_create(&thread, NULL, parseThread, (void *)this);
+}
+
+void TableFile::wait()
+{
+	if(started) {
+		pthread_join(thread, NULL);
+		started = false;
+	}
+	if(readErrno != 0) {
+		fprintf(stderr, "Could not open '%s' for reading: %s\n", fileName.c_str(), strerror(readErrno));
+		exit(1);
+	}
+}
+
+void *TableFile::parseThread(void *arg)
+{
+	TableFile *t = (TableFile *)arg;
+	t->parse();
+	return NULL;
+}
+
+static inline bool isBlank(char c)
+{
+	return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\v') || (c == '\f');
+}
+
+// Parse a whole field [b, e) as a value of the given format character
+static bool parseValue(char format, const char *b, const char *e, TableFile::Value &v)
+{
+	if(format == 'c') {
+		v.c = *b;
+		return true;
+	}
+	// sscanf accepts an explicit plus sign, from_chars does not
+	if((*b == '+') && (e - b > 1)) b++;
+#ifdef __cpp_lib_to_chars
+	std::from_chars_result r;
+	if(format == 'd') r = std::from_chars(b, e, v.d);
+	else if(format == 'u') r = std::from_chars(b, e, v.u);
+	else r = std::from_chars(b, e, v.f);
+	return (r.ec == std::errc()) && (r.ptr == e);
+#else
+	// The mapped file is not null terminated
+	char field[64];
+	if(e - b >= (long)sizeof(field)) return false;
+	memcpy(field, b, e - b);
+	field[e - b] = '\0';
+
+	char *end;
+	errno = 0;
+	if(format == 'd') v.d = strtol(field, &end, 10);
+	else if(format == 'u') v.u = strtoul(field, &end, 10);
+	else v.f = strtof(field, &end);
+	return (errno == 0) && (end == field + (e - b));
+#endif
+}
+
+void TableFile::parse()
+{
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if(fd == -1) {
+		readErrno = errno;
+		return;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		readErrno = errno;
+		close(fd);
+		return;
+	}
+	size_t size = st.st_size;
+	if(size == 0) {
+		close(fd);
+		return;
+	}
+	char *data = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED) {
+		readErrno = errno;
+		close(fd);
+		return;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	// Rough guess of one row per 32 bytes, to avoid most reallocations
+	values.reserve(size / 32 * nColumns);
+	std::vector<Value> row(nColumns);
+
+	const char *p = data;
+	const char *end = data + size;
+	int lineNumber = 0;
+	while(p < end) {
+		lineNumber += 1;
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		if(eol == NULL) eol = end;
+
+		unsigned nFields = 0;
+		bool valid = true;
+		const char *q = p;
+		while(true) {
+			while((q < eol) && isBlank(*q)) q++;
+			if((q == eol) || (*q == '#')) break;
+
+			const char *fieldBegin = q;
+			while((q < eol) && !isBlank(*q) && (*q != '#')) q++;
+			if(nFields < nColumns) {
+				valid = valid && parseValue(format[nFields], fieldBegin, q, row[nFields]);
+			}
+			nFields++;
+		}
+		p = eol + 1;
+
+		if(nFields == 0) continue;
+		if(!valid || (nFields < nColumns)) {
+			if(firstBadLine == 0) firstBadLine = lineNumber;
+			continue;
+		}
+		values.insert(values.end(), row.begin(), row.end());
+		lineNumbers.push_back(lineNumber);
+	}
+
+	munmap(data, size);
+	close(fd);
+}
@@ -0,0 +1,58 @@
+#ifndef __PETSYS_TABLEFILE_HPP__DEFINED__
+#define __PETSYS_TABLEFILE_HPP__DEFINED__
+
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+namespace PETSYS {
+
+/*
+ * Whitespace separated text table, such as the calibration and map tables.
+ * The file is mapped in memory and tokenized in a single pass: '#' starts a comment,
+ * blank lines are ignored and each line is matched against a column format, with one
+ * character per column as in a sscanf format ('d' int, 'u' unsigned, 'f' float, 'c' char).
+ * Extra columns are ignored; lines with missing or malformed columns are skipped.
+ */
+class TableFile {
+public:
+	union Value {
+		int d;
+		unsigned u;
+		float f;
+		char c;
+	};
+
+	TableFile(const char *fileName, const char *format);
+	~TableFile();
+
+	// Parse the file in a new thread
+	void start();
+	// Wait for the parsing thread; exits if the file could not be read
+	void wait();
+
+	unsigned getNumberOfRows() { return values.size() / nColumns; };
+	const Value *getRow(unsigned n) { return &values[n * nColumns]; };
+	int getLineNumber(unsigned n) { return lineNumbers[n]; };
+	const char *getFileName() { return fileName.c_str(); };
+	// Number of the first line which was skipped as malformed, 0 if none
+	int getFirstBadLine() { return firstBadLine; };
+
+private:
+	std::string fileName;
+	std::string format;
+	unsigned nColumns;
+	std::vector<Value> values;
+	std::vector<int> lineNumbers;
+	int firstBadLine;
+	int readErrno;
+	pthread_t thread;
+	bool started;
+
+	void parse();
+	static void *parseThread(void *arg);
+};
+
+}
+
+#endif // __PETSYS_TABLEFILE_HPP__DEFINED__
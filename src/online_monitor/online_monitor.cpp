@@ -59,7 +59,7 @@ struct UndecodedHit {
 
 class Decoder : public UnorderedEventHandler<UndecodedHit, RawHit> {
 	public:
-		Decoder(bool mod, EventSink<RawHit> *sink) : UnorderedEventHandler<UndecodedHit, RawHit>(sink), totMode(mod)
+		Decoder(bool mod, SystemConfig *config, EventSink<RawHit> *sink) : UnorderedEventHandler<UndecodedHit, RawHit>(sink), totMode(mod), config(config)
 		{
 		};
 		
@@ -80,6 +80,7 @@ class Decoder : public UnorderedEventHandler<UndecodedHit, RawHit> {
 		for(; pi < pe; pi++, po++) {
 			RawEventWord e = RawEventWord(pi->eventWord);
 			po->channelID = e.getChannelID();
+			po->channelIndex = config->getChannelIndex(po->channelID);
 			po->qdcMode = !totMode;
 			po->tacID = e.getTacID();
 			po->frameID = pi->frameID;
@@ -94,10 +95,12 @@ class Decoder : public UnorderedEventHandler<UndecodedHit, RawHit> {
 			po->valid = true;
 	}
 	outBuffer->setUsed(N);
+	outBuffer->releaseParent();
 	return outBuffer;			
 		}
 	private:
 		bool totMode;
+		SystemConfig *config;
 	};
 
 class Filler  : public OrderedEventHandler<Coincidence, Coincidence> {
@@ -161,8 +164,11 @@ public:
 		
 		monitor->lock();
 		int N = buffer->getSize();
+		int nPrompts = 0;
 		for (int i = 0; i < N; i++) {
 			Coincidence &e = buffer->get(i);
+			if(e.delayed != 0) continue;
+			nPrompts += 1;
 			
 			for(int j = 0; j < e.nPhotons; j++) {
 				GammaPhoton *group = e.photons[j];
@@ -170,7 +176,7 @@ public:
 				for(int k = 0; k < group->nHits; k++) {
 					Hit *hit = group->hits[k];
 					
-					int channel = hit->raw->channelID;
+					int channel = hit->channelID;
 					
 					auto hcounter = channel_counter.find(channel);
 					if(hcounter != channel_counter.end()) hcounter->second->addToValue(1);
@@ -184,7 +190,7 @@ public:
 			
 		}
  		if(acquisition_elapsed != NULL) acquisition_elapsed->setValue(buffer->getTMax());
- 		if(coincidence_counter != NULL) coincidence_counter->addToValue(N);
+ 		if(coincidence_counter != NULL) coincidence_counter->addToValue(nPrompts);
 		monitor->unlock();
 		
 		return buffer;
@@ -245,11 +251,11 @@ int main(int argc, char *argv[])
 	auto eventStream = new MyEventStream(systemFrequency, triggerID);
 	auto monitor = new Monitor(false);
 	
-	auto pipeline = new Decoder(totMode, 
+	auto pipeline = new Decoder(totMode, config,
 			new CoarseSorter(
 			new ProcessHit(config, eventStream,
-			new SimpleGrouper(config,
-			new CoincidenceGrouper(config,
+			new SimpleGrouper(config, eventStream,
+			new CoincidenceGrouper(config, eventStream,
 			new Filler(tocFileName, monitor, 
 			new NullSink<Coincidence>()
 		))))));
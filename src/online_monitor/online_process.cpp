@@ -29,6 +29,7 @@
 #include <CoincidenceGrouper.hpp>
 #include <DataFileWriter.hpp>
 #include <ThreadPool.hpp>
+#include <ConfigReloader.hpp>
 #include <boost/regex.hpp>
 #include <string>
 #include <iostream>
@@ -86,7 +87,7 @@ struct UndecodedHit {
 class Decoder : public UnorderedEventHandler<UndecodedHit, RawHit> {
 
 public:
-	Decoder(OnlineEventStream *stream, EventSink<RawHit> *sink) : UnorderedEventHandler<UndecodedHit, RawHit>(sink), stream(stream)
+	Decoder(OnlineEventStream *stream, SystemConfig *config, EventSink<RawHit> *sink) : UnorderedEventHandler<UndecodedHit, RawHit>(sink), stream(stream), config(config)
 	{
 	};
 	~Decoder()  
@@ -112,6 +113,7 @@ protected:
 		for(; pi < pe; pi++, po++) {
 			RawEventWord e = RawEventWord(pi->eventWord);
 			po->channelID = e.getChannelID();
+			po->channelIndex = config->getChannelIndex(po->channelID);
 			po->qdcMode = stream->isQDC(po->channelID);
 			po->tacID = e.getTacID();
 			po->frameID = pi->frameID;
@@ -125,22 +127,24 @@ protected:
 			po->valid = true;
 		}
 		outBuffer->setUsed(N);
+		outBuffer->releaseParent();
 		return outBuffer;			
 	}
 	OnlineEventStream *stream;
+	SystemConfig *config;
 };
 
 
 Decoder *createProcessingPipeline(EVENT_TYPE eventType, OnlineEventStream *eventStream, SystemConfig *config, DataFileWriter *dataFileWriter){
 	Decoder *pipeline;
 	if(eventType == RAW){
-		pipeline = new Decoder(eventStream, 
+		pipeline = new Decoder(eventStream, config,
 			new WriteRawHelper(dataFileWriter,
 			new NullSink<RawHit>()
 			));
 	}
 	else if(eventType == SINGLE){
-		pipeline = new Decoder(eventStream, 
+		pipeline = new Decoder(eventStream, config,
 			new CoarseSorter(
 			new ProcessHit(config, eventStream,
 			new WriteSinglesHelper(dataFileWriter, 
@@ -148,20 +152,20 @@ Decoder *createProcessingPipeline(EVENT_TYPE eventType, OnlineEventStream *event
 			))));
 	}
 	else if(eventType == GROUP){
-		pipeline = new Decoder(eventStream, 
+		pipeline = new Decoder(eventStream, config,
 			new CoarseSorter(
 			new ProcessHit(config, eventStream,
-			new SimpleGrouper(config,		
+			new SimpleGrouper(config, eventStream,		
 			new WriteGroupsHelper(dataFileWriter, 
 			new NullSink<GammaPhoton>()
 			)))));
 	}
 	else if(eventType == COINCIDENCE){
-		pipeline = new Decoder(eventStream, 
+		pipeline = new Decoder(eventStream, config,
 			new CoarseSorter(
 			new ProcessHit(config, eventStream,
-			new SimpleGrouper(config,
-			new CoincidenceGrouper(config,
+			new SimpleGrouper(config, eventStream,
+			new CoincidenceGrouper(config, eventStream,
 			new WriteCoincidencesHelper(dataFileWriter, 
 			new NullSink<Coincidence>()
 			))))));
@@ -199,6 +203,7 @@ int main(int argc, char *argv[])
 	bool verbose = (argv[15][0] == 'T');
 	
 	bool useAsyncWriting = false;
+	int compressionLevel = 0;
 	
 	EVENT_TYPE eventType; 
 	if(strcmp(eType, "raw") == 0){
@@ -231,6 +236,29 @@ int main(int argc, char *argv[])
 	else if(strcmp(fType, "root") == 0){
 		fileType = FILE_ROOT;
 	}
+	else if(strcmp(fType, "columnar") == 0){
+		fileType = FILE_COLUMNAR;
+		useAsyncWriting = true;
+	}
+	else if(strcmp(fType, "binaryCompressed") == 0){
+		fileType = FILE_BINARY;
+		compressionLevel = 1;
+		useAsyncWriting = true;
+	}
+	else if(strcmp(fType, "binaryCompactCompressed") == 0){
+		fileType = FILE_BINARY_COMPACT;
+		compressionLevel = 1;
+		useAsyncWriting = true;
+	}
+	else if(strcmp(fType, "lorHistogram") == 0){
+		fileType = FILE_LOR_HISTOGRAM;
+	}
+	else if(strcmp(fType, "spectra") == 0){
+		fileType = FILE_CHANNEL_SPECTRA;
+	}
+	else if(strcmp(fType, "spectraRoot") == 0){
+		fileType = FILE_CHANNEL_SPECTRA_ROOT;
+	}
 
 		
 	timeref_t tb; 
@@ -248,6 +276,11 @@ int main(int argc, char *argv[])
 		tb = MANUAL;
 	}
 
+	if(eventType == RAW && compressionLevel > 0){
+		fprintf(stderr, "ERROR: Raw output type cannot be written to the compressed output formats\n");
+		exit(1);
+	}
+
 	if(eventType == RAW && fileType != FILE_TEXT && fileType != FILE_ROOT){
 		fprintf(stderr, "ERROR: Raw output type can only be written to text or ROOT output format\n");
 		exit(1);
@@ -257,6 +290,15 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "ERROR: Singles output type can only be written to text, binary or ROOT output formats.\n");
 		exit(1);
 	}
+	if(eventType != COINCIDENCE && fileType == FILE_LOR_HISTOGRAM){
+		fprintf(stderr, "ERROR: Only coincidences can be written to the lorHistogram output format.\n");
+		exit(1);
+	}
+
+	if(eventType != SINGLE && (fileType == FILE_CHANNEL_SPECTRA || fileType == FILE_CHANNEL_SPECTRA_ROOT)){
+		fprintf(stderr, "ERROR: Only singles can be written to the spectra and spectraRoot output formats.\n");
+		exit(1);
+	}
 	bool totMode = (strcmp(mode, "tot") == 0);
        	
 	// If data was taken in full ToT mode, do not attempt to load these files
@@ -265,6 +307,8 @@ int main(int argc, char *argv[])
 		mask ^= (SystemConfig::LOAD_QDC_CALIBRATION | SystemConfig::LOAD_ENERGY_CALIBRATION);
 	}
 	SystemConfig *config = SystemConfig::fromFile(configFileName, mask);	
+	// SIGHUP reloads the configuration, for example after updating the energy or time offset calibration
+	ConfigReloader *configReloader = new ConfigReloader(configFileName, mask);
 	
 	PETSYS::SHM_RAW *shm = new PETSYS::SHM_RAW(shmObjectPath);
 	bool firstBlock = true;
@@ -318,7 +362,7 @@ int main(int argc, char *argv[])
 
 	char outputFileName[1024];
 	
-	DataFileWriter *dataFileWriter = new DataFileWriter(fileNamePrefix, useAsyncWriting, eventStream->getFrequency(), eventType, fileType, userTimeRef, hitLimitToWrite, eventFractionToWrite, 0);
+	DataFileWriter *dataFileWriter = new DataFileWriter(fileNamePrefix, useAsyncWriting, eventStream->getFrequency(), eventType, fileType, userTimeRef, hitLimitToWrite, eventFractionToWrite, 0, compressionLevel, config);
 
 	Decoder *pipeline = createProcessingPipeline(eventType, eventStream, config, dataFileWriter);
 
@@ -333,6 +377,7 @@ int main(int argc, char *argv[])
 	EventBuffer<UndecodedHit> *outBuffer = NULL; 
 	size_t seqN = 0;
 	long long currentBufferFirstFrame = 0;	
+	double t0 = 0;
 
 	while(fread(&blockHeader, sizeof(blockHeader), 1, stdin) == 1){
 		dataFileWriter->setStepValues(blockHeader.step1, blockHeader.step2);
@@ -355,7 +400,6 @@ int main(int argc, char *argv[])
 			stepFirstFrameID = shm->getFrameID(index);
 			lastFrameID = stepFirstFrameID - 1;
 			lastFrameType = FRAME_TYPE_UNKNOWN;
-			double t0 = 0;
 			switch(tb) {
 				case SYNC:	t0 = 0;
 						break;
@@ -498,6 +542,20 @@ int main(int argc, char *argv[])
 			
 			
 		}
+
+		// No buffers are in flight here, so a reloaded configuration can replace the current one,
+		// together with the pipeline stages built over it
+		SystemConfig *newConfig = configReloader->takeConfig();
+		if(newConfig != NULL) {
+			if(verbose) pipeline->report();
+			delete pipeline;
+			delete config;
+			config = newConfig;
+			pipeline = createProcessingPipeline(eventType, eventStream, config, dataFileWriter);
+			pipeline->pushT0(t0);
+			seqN = 0;
+			fprintf(stderr, "INFO: reloaded configuration from '%s'\n", configFileName);
+		}
 		
 		fwrite(&rdPointer, sizeof(uint32_t), 1, stdout);
 		//long long dummy = 0;
@@ -509,6 +567,7 @@ int main(int argc, char *argv[])
 
 	}
 
+	delete configReloader;
 	delete dataFileWriter;
 	delete pool;		
 	
@@ -0,0 +1,50 @@
+# kate: indent-mode: python; indent-pasted-text false; indent-width 8; replace-tabs: off;
+# vim: tabstop=8 shiftwidth=8
+
+# Reader for the channel spectra files (.lspc) written with --writeSpectra
+# The layout is described in src/base/ChannelSpectra.hpp
+
+import numpy
+
+MAGIC = b"PSSPECTR"
+
+_header_dtype = numpy.dtype([ ("magic", "S8"), ("energyMin", "<f4"), ("energyMax", "<f4"), ("energyBins", "<u4"), ("timeBins", "<u4"), ("frameLength", "<f4"), ("reserved", "<u4") ])
+_step_dtype = numpy.dtype([ ("step1", "<f4"), ("step2", "<f4"), ("nChannels", "<u8") ])
+
+class ChannelSpectraFile:
+	def __init__(self, fileName):
+		data = numpy.fromfile(fileName, dtype=numpy.uint8)
+		if len(data) < _header_dtype.itemsize:
+			raise ValueError("%s is not a channel spectra file" % fileName)
+		header = numpy.frombuffer(data, _header_dtype, 1, 0)[0]
+		if header["magic"] != MAGIC:
+			raise ValueError("%s is not a channel spectra file" % fileName)
+
+		self.energyMin = float(header["energyMin"])
+		self.energyMax = float(header["energyMax"])
+		self.energyBins = int(header["energyBins"])
+		self.timeBins = int(header["timeBins"])
+		self.frameLength = float(header["frameLength"])
+		self.channel_dtype = numpy.dtype([ ("channelID", "<u4"), ("energyUnderflow", "<u4"), ("energyOverflow", "<u4"), ("reserved", "<u4"),
+			("energy", "<u4", (self.energyBins,)), ("time", "<u4", (self.timeBins,)) ])
+
+		# Channel records of each step, as (step1, step2, channels)
+		self.steps = []
+		offset = _header_dtype.itemsize
+		while offset + _step_dtype.itemsize <= len(data):
+			step = numpy.frombuffer(data, _step_dtype, 1, offset)[0]
+			offset += _step_dtype.itemsize
+			nChannels = int(step["nChannels"])
+			if offset + nChannels * self.channel_dtype.itemsize > len(data):
+				raise ValueError("%s has a truncated step" % fileName)
+			channels = numpy.frombuffer(data, self.channel_dtype, nChannels, offset)
+			offset += nChannels * self.channel_dtype.itemsize
+			self.steps.append((float(step["step1"]), float(step["step2"]), channels))
+
+	# Lower edges of the energy bins, followed by the upper edge of the last one
+	def getEnergyBinEdges(self):
+		return numpy.linspace(self.energyMin, self.energyMax, self.energyBins + 1)
+
+	# Lower edges of the time of frame bins, in picoseconds, followed by the frame length
+	def getTimeBinEdges(self):
+		return numpy.linspace(0, self.frameLength, self.timeBins + 1)
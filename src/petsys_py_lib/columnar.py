@@ -0,0 +1,78 @@
+# kate: indent-mode: python; indent-pasted-text false; indent-width 8; replace-tabs: off;
+# vim: tabstop=8 shiftwidth=8
+
+# Reader for the columnar event files (.lcol) written with --writeColumnar
+# The layout is described in src/base/ColumnarFile.hpp
+# Columns are returned as NumPy arrays over a memory mapping of the file,
+# so only the pages of the columns which are used get read
+
+import numpy
+
+MAGIC = b"PSCOLUMN"
+VERSION = 1
+ALIGNMENT = 8
+
+EVENT_TYPES = [ "raw", "singles", "groups", "coincidences" ]
+
+_header_dtype = numpy.dtype([ ("magic", "S8"), ("version", "<u4"), ("eventType", "<u4"), ("nColumns", "<u4"), ("reserved", "<u4") ])
+_column_dtype = numpy.dtype([ ("name", "S24"), ("type", "S8") ])
+_block_dtype = numpy.dtype([ ("offset", "<u8"), ("nRows", "<u8") ])
+_step_dtype = numpy.dtype([ ("step1", "<f4"), ("step2", "<f4"), ("firstBlock", "<u8"), ("endBlock", "<u8") ])
+_trailer_dtype = numpy.dtype([ ("directoryOffset", "<u8"), ("nBlocks", "<u8"), ("nSteps", "<u8"), ("magic", "S8") ])
+_block_header_size = 16
+
+class ColumnarFile:
+	def __init__(self, fileName):
+		self.__data = numpy.memmap(fileName, dtype=numpy.uint8, mode="r")
+		size = len(self.__data)
+		if size < _header_dtype.itemsize + _trailer_dtype.itemsize:
+			raise ValueError("%s is not a complete columnar event file" % fileName)
+
+		header = numpy.frombuffer(self.__data, _header_dtype, 1, 0)[0]
+		trailer = numpy.frombuffer(self.__data, _trailer_dtype, 1, size - _trailer_dtype.itemsize)[0]
+		if header["magic"] != MAGIC or trailer["magic"] != MAGIC or header["version"] != VERSION:
+			raise ValueError("%s is not a complete columnar event file" % fileName)
+
+		self.eventType = EVENT_TYPES[header["eventType"]]
+		columns = numpy.frombuffer(self.__data, _column_dtype, int(header["nColumns"]), _header_dtype.itemsize)
+		self.columns = [ c["name"].decode() for c in columns ]
+		self.__types = [ numpy.dtype(c["type"].decode()) for c in columns ]
+
+		directoryOffset = int(trailer["directoryOffset"])
+		nBlocks = int(trailer["nBlocks"])
+		self.__blocks = numpy.frombuffer(self.__data, _block_dtype, nBlocks, directoryOffset)
+		self.steps = numpy.frombuffer(self.__data, _step_dtype, int(trailer["nSteps"]), directoryOffset + nBlocks * _block_dtype.itemsize)
+
+	def getNumberOfBlocks(self):
+		return len(self.__blocks)
+
+	def getNumberOfRows(self):
+		return int(self.__blocks["nRows"].sum())
+
+	# Column of one block, without copying
+	def getBlockColumn(self, block, name):
+		n = self.columns.index(name)
+		nRows = int(self.__blocks[block]["nRows"])
+		offset = int(self.__blocks[block]["offset"]) + _block_header_size
+		for t in self.__types[:n]:
+			size = nRows * t.itemsize
+			offset += (size + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+		return numpy.frombuffer(self.__data, self.__types[n], nRows, offset)
+
+	# Columns of a range of blocks (all by default), as a dictionary of arrays
+	def read(self, names=None, firstBlock=0, endBlock=None):
+		if names is None: names = self.columns
+		if endBlock is None: endBlock = len(self.__blocks)
+		result = {}
+		for name in names:
+			parts = [ self.getBlockColumn(b, name) for b in range(firstBlock, endBlock) ]
+			if len(parts) == 0:
+				result[name] = numpy.zeros(0, self.__types[self.columns.index(name)])
+			else:
+				result[name] = numpy.concatenate(parts)
+		return result
+
+	# Columns of the events of each step, as (step1, step2, columns)
+	def readSteps(self, names=None):
+		for s in self.steps:
+			yield (float(s["step1"]), float(s["step2"]), self.read(names, int(s["firstBlock"]), int(s["endBlock"])))
@@ -0,0 +1,125 @@
+# kate: indent-mode: python; indent-pasted-text false; indent-width 8; replace-tabs: off;
+# vim: tabstop=8 shiftwidth=8
+
+# Reader for the compressed binary event files (.ldatz) written with --compress
+# The layout is described in src/base/CompressedFile.hpp
+# The records are returned as the bytes of the .ldat file of the same events,
+# or as NumPy arrays of the records of the fixed size layouts
+
+import numpy
+try:
+	from compression import zstd
+except ImportError:
+	try:
+		from backports import zstd
+	except ImportError:
+		import zstandard as zstd
+
+MAGIC = b"PSLDATZ1"
+
+LAYOUTS = [ "singles", "groups", "coincidences", "groups compact", "coincidences compact" ]
+
+# Records of the .ldat file, as in src/base/DataFileWriter.hpp
+event_dtype = numpy.dtype([ ("time", "<i8"), ("energy", "<f4"), ("channelID", "<i4") ])
+group_event_dtype = numpy.dtype([ ("mh_n", "u1"), ("mh_j", "u1"), ("time", "<i8"), ("energy", "<f4"), ("channelID", "<i4") ])
+coincidence_event_dtype = numpy.dtype([
+	("mh_n1", "u1"), ("mh_j1", "u1"), ("time1", "<i8"), ("energy1", "<f4"), ("channelID1", "<i4"),
+	("mh_n2", "u1"), ("mh_j2", "u1"), ("time2", "<i8"), ("energy2", "<f4"), ("channelID2", "<i4") ])
+_record_dtypes = [ event_dtype, group_event_dtype, coincidence_event_dtype, None, None ]
+# Offsets of the time fields in each record of the fixed size layouts
+_time_offsets = [ [ 0 ], [ 2 ], [ 2, 20 ], None, None ]
+
+_header_dtype = numpy.dtype([ ("magic", "S8"), ("layout", "<u4"), ("reserved", "<u4") ])
+_block_header_dtype = numpy.dtype([ ("rawSize", "<u8"), ("compressedSize", "<u8") ])
+
+class CompressedFile:
+	# Opens <prefix>.ldatz and <prefix>.lidx
+	def __init__(self, prefix):
+		self.__data = numpy.memmap(prefix + ".ldatz", dtype=numpy.uint8, mode="r")
+		if len(self.__data) < _header_dtype.itemsize:
+			raise ValueError("%s.ldatz is not a compressed binary event file" % prefix)
+		header = numpy.frombuffer(self.__data, _header_dtype, 1, 0)[0]
+		if header["magic"] != MAGIC or header["layout"] >= len(LAYOUTS):
+			raise ValueError("%s.ldatz is not a compressed binary event file" % prefix)
+		self.__layout = int(header["layout"])
+		self.layout = LAYOUTS[self.__layout]
+
+		# Steps as (rawBegin, rawEnd, step1, step2, fileBegin, fileEnd), the begin and end
+		# of each step in the decompressed stream and in the .ldatz file
+		self.steps = []
+		with open(prefix + ".lidx") as f:
+			for line in f:
+				fields = line.split()
+				if len(fields) < 6: continue
+				self.steps.append((int(fields[0]), int(fields[1]), float(fields[2]), float(fields[3]), int(fields[4]), int(fields[5])))
+
+	# Offsets of the time fields of a decompressed block, in stream order
+	def __getTimeOffsets(self, data):
+		dtype = _record_dtypes[self.__layout]
+		if dtype is not None:
+			n = len(data) // dtype.itemsize
+			return (numpy.arange(n)[:, None] * dtype.itemsize + _time_offsets[self.__layout]).ravel()
+
+		offsets = []
+		offset = 0
+		while offset < len(data):
+			nHits = int(data[offset])
+			offset += 1
+			if LAYOUTS[self.__layout] == "coincidences compact" and offset < len(data):
+				nHits += int(data[offset])
+				offset += 1
+			for n in range(nHits):
+				if offset + event_dtype.itemsize > len(data): break
+				offsets.append(offset)
+				offset += event_dtype.itemsize
+		return numpy.array(offsets, dtype=numpy.int64)
+
+	# Decompress the block at offset and undo the differences of its time fields
+	def __readBlock(self, offset):
+		header = numpy.frombuffer(self.__data, _block_header_dtype, 1, offset)[0]
+		begin = offset + _block_header_dtype.itemsize
+		end = begin + int(header["compressedSize"])
+		if end > len(self.__data):
+			raise ValueError("compressed binary event file has a truncated block")
+		data = numpy.frombuffer(zstd.decompress(self.__data[begin:end].tobytes()), dtype=numpy.uint8).copy()
+		if len(data) != int(header["rawSize"]):
+			raise ValueError("compressed binary event file has a corrupted block")
+
+		offsets = self.__getTimeOffsets(data)
+		if len(offsets) > 0:
+			fields = offsets[:, None] + numpy.arange(8)
+			times = numpy.cumsum(data[fields].view("<u8").ravel(), dtype=numpy.uint64)
+			data[fields] = times.astype("<u8").view(numpy.uint8).reshape(-1, 8)
+		return data, end
+
+	# Records of one step, or of the whole file, as the bytes of the .ldat file
+	def readBytes(self, step=None):
+		if step is None:
+			offset = _header_dtype.itemsize
+			end = len(self.__data)
+			size = None
+		else:
+			rawBegin, rawEnd, step1, step2, offset, end = self.steps[step]
+			size = rawEnd - rawBegin
+
+		blocks = []
+		total = 0
+		while offset < end and (size is None or total < size):
+			data, offset = self.__readBlock(offset)
+			blocks.append(data)
+			total += len(data)
+		if len(blocks) == 0:
+			return b""
+		return numpy.concatenate(blocks).tobytes()
+
+	# Records of one step, or of the whole file, as an array of the fixed size layouts
+	def read(self, step=None):
+		dtype = _record_dtypes[self.__layout]
+		if dtype is None:
+			raise ValueError("records of the %s layout have no fixed size, use readBytes()" % self.layout)
+		return numpy.frombuffer(self.readBytes(step), dtype)
+
+	# Records of each step, as (step1, step2, records)
+	def readSteps(self):
+		for n, s in enumerate(self.steps):
+			yield (s[2], s[3], self.read(n))
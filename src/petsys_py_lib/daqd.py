@@ -1120,7 +1120,7 @@ class Connection:
 
 		if output_format in ["text","textCompact"]:
 			processedFileNamePrefix += ".dat"
-		elif output_format == "root":
+		elif output_format in ["root", "spectraRoot"]:
 			processedFileNamePrefix += ".root"
 
 		return self.__openRawAcquisition(None, processedFileNamePrefix, False, config, None, False, event_type, output_format, fractionToWrite, hitLimit, tref, userTimeRef, secondary_exec=online_process_exec, verbose=verbose)
@@ -1138,7 +1138,7 @@ class Connection:
 
 		if output_format in ["text","textCompact"]:
 			processedFileNamePrefix += ".dat"
-		elif output_format == "root":
+		elif output_format in ["root", "spectraRoot"]:
 			processedFileNamePrefix += ".root"
 		return self.__openRawAcquisition(fileNamePrefix, processedFileNamePrefix, False, config, None, True, event_type, output_format, fractionToWrite, hitLimit, tref, userTimeRef, secondary_exec=online_process_exec, verbose=verbose)
 
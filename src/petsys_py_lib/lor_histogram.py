@@ -0,0 +1,49 @@
+# kate: indent-mode: python; indent-pasted-text false; indent-width 8; replace-tabs: off;
+# vim: tabstop=8 shiftwidth=8
+
+# Reader for the LOR histogram files (.llor) written with --writeLORHistogram
+# The layout is described in src/base/LORHistogram.hpp
+
+import numpy
+
+MAGIC = b"PSLORHST"
+
+_header_dtype = numpy.dtype([ ("magic", "S8"), ("timeBinWidth", "<f4"), ("timeBins", "<u4"), ("energyMin", "<f4"), ("energyMax", "<f4"), ("energyBins", "<u4"), ("reserved", "<u4") ])
+_step_dtype = numpy.dtype([ ("step1", "<f4"), ("step2", "<f4"), ("nEntries", "<u8") ])
+entry_dtype = numpy.dtype([ ("channelID1", "<u4"), ("channelID2", "<u4"), ("timeBin", "<u2"), ("energyBin1", "u1"), ("energyBin2", "u1"), ("counts", "<u4") ])
+
+class LORHistogramFile:
+	def __init__(self, fileName):
+		data = numpy.fromfile(fileName, dtype=numpy.uint8)
+		if len(data) < _header_dtype.itemsize:
+			raise ValueError("%s is not a LOR histogram file" % fileName)
+		header = numpy.frombuffer(data, _header_dtype, 1, 0)[0]
+		if header["magic"] != MAGIC:
+			raise ValueError("%s is not a LOR histogram file" % fileName)
+
+		self.timeBinWidth = float(header["timeBinWidth"])
+		self.timeBins = int(header["timeBins"])
+		self.energyMin = float(header["energyMin"])
+		self.energyMax = float(header["energyMax"])
+		self.energyBins = int(header["energyBins"])
+
+		# Entries of each step, as (step1, step2, entries)
+		self.steps = []
+		offset = _header_dtype.itemsize
+		while offset + _step_dtype.itemsize <= len(data):
+			step = numpy.frombuffer(data, _step_dtype, 1, offset)[0]
+			offset += _step_dtype.itemsize
+			nEntries = int(step["nEntries"])
+			if offset + nEntries * entry_dtype.itemsize > len(data):
+				raise ValueError("%s has a truncated step" % fileName)
+			entries = numpy.frombuffer(data, entry_dtype, nEntries, offset)
+			offset += nEntries * entry_dtype.itemsize
+			self.steps.append((float(step["step1"]), float(step["step2"]), entries))
+
+	# Lower edge of a time difference bin, in picoseconds
+	def getTimeBinEdge(self, timeBin):
+		return (timeBin - self.timeBins // 2) * self.timeBinWidth
+
+	# Lower edge of an energy bin
+	def getEnergyBinEdge(self, energyBin):
+		return self.energyMin + energyBin * (self.energyMax - self.energyMin) / self.energyBins
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <SystemConfig.hpp>
+
+using namespace PETSYS;
+
+/*
+ * Loads a configuration and exits with status 0 if it loaded.
+ * SystemConfig::fromFile() exits on any error in the configuration, so ConfigReloader
+ * runs this as a separate process to check a configuration before loading it.
+ * Loading also refreshes the binary cache of the tables, if main:config_cache is set.
+ * Usage: check_config <config file> <load mask, in hexadecimal>
+ */
+int main(int argc, char *argv[])
+{
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s <config file> <load mask, in hexadecimal>\n", argv[0]);
+		return 1;
+	}
+
+	char *end;
+	u_int64_t mask = strtoull(argv[2], &end, 16);
+	if((end == argv[2]) || (*end != '\0')) {
+		fprintf(stderr, "ERROR: invalid load mask '%s'\n", argv[2]);
+		return 1;
+	}
+
+	SystemConfig *config = SystemConfig::fromFile(argv[1], mask);
+	delete config;
+	return 0;
+}
@@ -30,15 +30,38 @@ void displayHelp(char * program)
 	fprintf(stderr,  "  --writeBinaryCompact \t Set the output data format to compact binary\n");
 	fprintf(stderr,  "  --writeTextCompact \t Set the output data format to compact text \n");
 	fprintf(stderr,  "  --writeRoot \t\t Set the output data format to ROOT (TTree)\n");
+	fprintf(stderr,  "  --rootBatches \t Write the ROOT output in batches compressed by several threads\n");
+	fprintf(stderr,  "  --writeColumnar \t Set the output data format to columnar binary\n");
+	fprintf(stderr,  "  --writeLORHistogram \t Write the coincidence counts per channel pair, binned as set in the configuration\n");
+	fprintf(stderr,  "  --compress N \t\t Compress the binary output with zstd at level N\n");
+	fprintf(stderr,  "  --timeSliceFraction N \t Process only N percent of the data, as whole time slices\n");
+	fprintf(stderr,  "  --timeSliceLength K \t Time slices are selected from every K frames (default 1024)\n");
 	fprintf(stderr,  "  --writeMultipleHits N  Writes multiple hits, up to the Nth hit\n");
 	fprintf(stderr,  "  --writeFraction N \t Fraction of events to write, in percentage\n");
 	fprintf(stderr,  "  --splitTime t \t Split output into different files every t seconds\n");
 	fprintf(stderr,  "  --simulateHwTrigger \t\t Set the program to filter raw events as in hw trigger, before processing them\n");
 	fprintf(stderr,  "  --timeref [sync|wall|step|manual] \t\t Select timeref for written data\n");
 	fprintf(stderr,  "  --userTimeref \t\tEpoch for --timeref wall setting. 0 is UNIX epoch time.\n");
+	fprintf(stderr,  "  --lazyConfig \t\t Load calibrations only for the ASICs present in the data\n");
 	fprintf(stderr,  "  --help \t\t Show this help message and exit \n");
+	fprintf(stderr, "Coincidences of the delayed windows set with coincidence_delayed_offsets in the configuration\n");
+	fprintf(stderr, "are written to separate files, with _delayedN added to the output file name.\n");
 };
 
+// Name of the output file for delayed window N: the binary, columnar and LOR histogram output names are prefixes, 
+// otherwise the suffix goes before the extension
+static std::string delayedFileName(const char *outputFileName, FILE_TYPE fileType, int delayed)
+{
+	char suffix[32];
+	sprintf(suffix, "_delayed%d", delayed);
+	std::string fName = outputFileName;
+	size_t p = fName.rfind('.');
+	if(fileType == FILE_BINARY || fileType == FILE_BINARY_COMPACT || fileType == FILE_COLUMNAR || fileType == FILE_LOR_HISTOGRAM || p == std::string::npos || fName.find('/', p) != std::string::npos)
+		return fName + suffix;
+	else
+		return fName.substr(0, p) + suffix + fName.substr(p);
+}
+
 void displayUsage(char *argv0)
 {
 	printf("Usage: %s --config <config_file> -i <input_file_prefix> -o <output_file_prefix> [optional arguments]\n", argv0);
@@ -57,6 +80,11 @@ int main(int argc, char *argv[])
 	double fileSplitTime = 0;
 	RawReader::timeref_t tb = RawReader::SYNC;
 	double userTimeref = 0;
+	bool lazyConfig = false;
+	bool rootBatches = false;
+	int compressionLevel = 0;
+	double timeSliceFraction = 100;
+	unsigned timeSliceLength = 1024;
 
 	static struct option longOptions[] = {
 		{ "help", no_argument, 0, 0 },
@@ -70,7 +98,14 @@ int main(int argc, char *argv[])
 		{ "simulateHwTrigger", no_argument, 0, 0},
 		{ "splitTime", required_argument, 0, 0},
 		{ "timeref", required_argument, 0, 0},
-		{ "userTimeref", required_argument, 0, 0}
+		{ "userTimeref", required_argument, 0, 0},
+		{ "lazyConfig", no_argument, 0, 0},
+		{ "writeColumnar", no_argument, 0, 0},
+		{ "compress", required_argument, 0, 0},
+		{ "timeSliceFraction", required_argument, 0, 0},
+		{ "timeSliceLength", required_argument, 0, 0},
+		{ "writeLORHistogram", no_argument, 0, 0},
+		{ "rootBatches", no_argument, 0, 0}
     };
 
 	while(true) {
@@ -105,6 +140,13 @@ int main(int argc, char *argv[])
 							else { fprintf(stderr, "ERROR: unkown timeref '%s'\n", optarg); exit(1); }
 							break;
 			        case 11:	userTimeref = boost::lexical_cast<double>(optarg); break;			
+			        case 12:	lazyConfig = true; break;
+			        case 13:	fileType = FILE_COLUMNAR; break;
+			        case 14:	compressionLevel = boost::lexical_cast<int>(optarg); break;
+			        case 15:	timeSliceFraction = boost::lexical_cast<double>(optarg); break;
+			        case 16:	timeSliceLength = boost::lexical_cast<unsigned>(optarg); break;
+			        case 17:	fileType = FILE_LOR_HISTOGRAM; break;
+			        case 18:	rootBatches = true; break;
 				default:	displayUsage(argv[0]); exit(1);
 
 			}
@@ -129,7 +171,30 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if(compressionLevel > 0 && fileType != FILE_BINARY && fileType != FILE_BINARY_COMPACT) {
+		fprintf(stderr, "--compress requires a binary output format\n");
+		exit(1);
+	}
+
+	if(fileSplitTime > 0 && fileType == FILE_LOR_HISTOGRAM) {
+		fprintf(stderr, "--splitTime can not be used with --writeLORHistogram\n");
+		exit(1);
+	}
+
+	if((hitLimitToWrite != 1 || eventFractionToWrite < 1024) && fileType == FILE_LOR_HISTOGRAM) {
+		fprintf(stderr, "--writeMultipleHits and --writeFraction can not be used with --writeLORHistogram\n");
+		exit(1);
+	}
+
+	if(timeSliceLength == 0) {
+		fprintf(stderr, "--timeSliceLength must be at least 1\n");
+		exit(1);
+	}
+
 	RawReader *reader = RawReader::openFile(inputFilePrefix, tb);
+	if(timeSliceFraction < 100) {
+		reader->setTimeSlicePrescale(round(timeSliceLength * timeSliceFraction / 100.0), timeSliceLength);
+	}
 	
 	unsigned long long mask = SystemConfig::LOAD_ALL;
 	// If data was taken in full ToT mode, do not attempt to load these files
@@ -141,9 +206,21 @@ int main(int argc, char *argv[])
 		mask ^= (SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
 	}
 	
-	SystemConfig *config = SystemConfig::fromFile(configFileName, mask);
+	const bool *activeAsics = lazyConfig ? reader->getActiveAsics() : NULL;
+	if(lazyConfig && activeAsics == NULL) {
+		fprintf(stderr, "WARNING: could not determine the ASICs present in the data, loading all channels\n");
+	}
+	SystemConfig *config = SystemConfig::fromFile(configFileName, mask, activeAsics);
+	reader->setSystemConfig(config);
 	
-	DataFileWriter *dataFileWriter = new DataFileWriter(outputFileName, false, reader->getFrequency(), COINCIDENCE, fileType, userTimeref, hitLimitToWrite, eventFractionToWrite, fileSplitTime);
+	DataFileWriter *dataFileWriter = new DataFileWriter(outputFileName, false, reader->getFrequency(), COINCIDENCE, fileType, userTimeref, hitLimitToWrite, eventFractionToWrite, fileSplitTime, compressionLevel, config);
+	if(rootBatches) dataFileWriter->enableRootBatches();
+	std::vector<DataFileWriter *> delayedFileWriters;
+	for(unsigned k = 0; k < config->sw_trigger_coincidence_delayed_offsets.size(); k++) {
+		std::string fName = delayedFileName(outputFileName, fileType, k + 1);
+		delayedFileWriters.push_back(new DataFileWriter((char *)fName.c_str(), false, reader->getFrequency(), COINCIDENCE, fileType, userTimeref, hitLimitToWrite, eventFractionToWrite, fileSplitTime, compressionLevel, config));
+		if(rootBatches) delayedFileWriters.back()->enableRootBatches();
+	}
 	
 	int stepIndex = 0;
 	while(reader->getNextStep()) {
@@ -152,14 +229,16 @@ int main(int argc, char *argv[])
 		printf("Processing step %d: (%f, %f)\n", stepIndex+1, step1, step2);
 		fflush(stdout);
 		dataFileWriter->setStepValues(step1, step2);
+		for(unsigned k = 0; k < delayedFileWriters.size(); k++)
+			delayedFileWriters[k]->setStepValues(step1, step2);
 
 		if(!simulateHwTrigger){
 			reader->processStep(true,
 					new CoarseSorter(
 					new ProcessHit(config, reader,
-					new SimpleGrouper(config,
-					new CoincidenceGrouper(config,
-					new WriteCoincidencesHelper(dataFileWriter,
+					new SimpleGrouper(config, reader,
+					new CoincidenceGrouper(config, reader,
+					new WriteCoincidencesHelper(dataFileWriter, delayedFileWriters,
 					new NullSink<Coincidence>()
 					))))));
 		}
@@ -167,18 +246,22 @@ int main(int argc, char *argv[])
 			reader->processStep(true,
 					new HwTriggerSimulator(config,
 					new ProcessHit(config, reader,
-					new SimpleGrouper(config,
-					new CoincidenceGrouper(config,
-					new WriteCoincidencesHelper(dataFileWriter,
+					new SimpleGrouper(config, reader,
+					new CoincidenceGrouper(config, reader,
+					new WriteCoincidencesHelper(dataFileWriter, delayedFileWriters,
 					new NullSink<Coincidence>()
 					))))));
 		}
 
 		dataFileWriter->closeStep();
+		for(unsigned k = 0; k < delayedFileWriters.size(); k++)
+			delayedFileWriters[k]->closeStep();
 		stepIndex += 1;
 	}
 
 	delete dataFileWriter;
+	for(unsigned k = 0; k < delayedFileWriters.size(); k++)
+		delete delayedFileWriters[k];
 	delete reader;
 
 	return 0;
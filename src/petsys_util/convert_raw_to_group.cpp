@@ -28,14 +28,20 @@ void displayHelp(char * program)
 	fprintf(stderr, "Optional flags:\n");
 	fprintf(stderr,  "  --writeBinary \t Set the output data format to binary\n");
 	fprintf(stderr,  "  --writeRoot \t\t Set the output data format to ROOT (TTree)\n");
+	fprintf(stderr,  "  --rootBatches \t Write the ROOT output in batches compressed by several threads\n");
 	fprintf(stderr,  "  --writeBinaryCompact \t Set the output data format to compact binary\n");
 	fprintf(stderr,  "  --writeTextCompact \t Set the output data format to compact text \n");
+	fprintf(stderr,  "  --writeColumnar \t Set the output data format to columnar binary\n");
+	fprintf(stderr,  "  --compress N \t\t Compress the binary output with zstd at level N\n");
+	fprintf(stderr,  "  --timeSliceFraction N \t Process only N percent of the data, as whole time slices\n");
+	fprintf(stderr,  "  --timeSliceLength K \t Time slices are selected from every K frames (default 1024)\n");
 	fprintf(stderr,  "  --writeMultipleHits N  Writes multiple hits, up to the Nth hit\n");
 	fprintf(stderr,  "  --writeFraction N \t Fraction of events to write, in percentage\n");
 	fprintf(stderr,  "  --splitTime t \t Split output into different files every t seconds\n");
 	fprintf(stderr,  "  --simulateHwTrigger \t\t Set the program to filter raw events as in hw trigger, before processing them\n");
 	fprintf(stderr,  "  --timeref [sync|wall|step|manual] \t\t Select timeref for written data\n");
 	fprintf(stderr,  "  --userTimeref \t\tEpoch for --timeref wall setting. 0 is UNIX epoch time.\n");
+	fprintf(stderr,  "  --lazyConfig \t\t Load calibrations only for the ASICs present in the data\n");
 	fprintf(stderr,  "  --help \t\t Show this help message and exit \n");
 	
 };
@@ -58,6 +64,11 @@ int main(int argc, char *argv[])
 	double fileSplitTime = 0.0;
 	RawReader::timeref_t tb = RawReader::SYNC;
 	double userTimeref = 0;
+	bool lazyConfig = false;
+	bool rootBatches = false;
+	int compressionLevel = 0;
+	double timeSliceFraction = 100;
+	unsigned timeSliceLength = 1024;
 
 	static struct option longOptions[] = {
 		{ "help", no_argument, 0, 0 },
@@ -71,7 +82,13 @@ int main(int argc, char *argv[])
 		{ "simulateHwTrigger", no_argument, 0, 0},
 		{ "splitTime", required_argument, 0, 0},
 		{ "timeref", required_argument, 0, 0},
-		{ "userTimeref", required_argument, 0, 0}
+		{ "userTimeref", required_argument, 0, 0},
+		{ "lazyConfig", no_argument, 0, 0},
+		{ "writeColumnar", no_argument, 0, 0},
+		{ "compress", required_argument, 0, 0},
+		{ "timeSliceFraction", required_argument, 0, 0},
+		{ "timeSliceLength", required_argument, 0, 0},
+		{ "rootBatches", no_argument, 0, 0}
 	};
 
 	while(true) {
@@ -106,6 +123,12 @@ int main(int argc, char *argv[])
 						else { fprintf(stderr, "ERROR: unkown timeref '%s'\n", optarg); exit(1); }
 						break;
 			case 11:	userTimeref = boost::lexical_cast<double>(optarg); break;
+			case 12:	lazyConfig = true; break;
+			case 13:	fileType = FILE_COLUMNAR; break;
+			case 14:	compressionLevel = boost::lexical_cast<int>(optarg); break;
+			case 15:	timeSliceFraction = boost::lexical_cast<double>(optarg); break;
+			case 16:	timeSliceLength = boost::lexical_cast<unsigned>(optarg); break;
+			case 17:	rootBatches = true; break;
 			default:	displayUsage(argv[0]); exit(1);
 			}
 		}
@@ -129,7 +152,20 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if(compressionLevel > 0 && fileType != FILE_BINARY && fileType != FILE_BINARY_COMPACT) {
+		fprintf(stderr, "--compress requires a binary output format\n");
+		exit(1);
+	}
+
+	if(timeSliceLength == 0) {
+		fprintf(stderr, "--timeSliceLength must be at least 1\n");
+		exit(1);
+	}
+
 	RawReader *reader = RawReader::openFile(inputFilePrefix, tb);
+	if(timeSliceFraction < 100) {
+		reader->setTimeSlicePrescale(round(timeSliceLength * timeSliceFraction / 100.0), timeSliceLength);
+	}
 	
 	// If data was taken in ToT mode, do not attempt to load these files
 	unsigned long long mask = SystemConfig::LOAD_ALL;
@@ -141,9 +177,15 @@ int main(int argc, char *argv[])
 		mask ^= (SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
 	}
 
-	SystemConfig *config = SystemConfig::fromFile(configFileName, mask);
+	const bool *activeAsics = lazyConfig ? reader->getActiveAsics() : NULL;
+	if(lazyConfig && activeAsics == NULL) {
+		fprintf(stderr, "WARNING: could not determine the ASICs present in the data, loading all channels\n");
+	}
+	SystemConfig *config = SystemConfig::fromFile(configFileName, mask, activeAsics);
+	reader->setSystemConfig(config);
 	
-	DataFileWriter *dataFileWriter = new DataFileWriter(outputFileName, false, reader->getFrequency(), GROUP, fileType, userTimeref, hitLimitToWrite, eventFractionToWrite, fileSplitTime);
+	DataFileWriter *dataFileWriter = new DataFileWriter(outputFileName, false, reader->getFrequency(), GROUP, fileType, userTimeref, hitLimitToWrite, eventFractionToWrite, fileSplitTime, compressionLevel);
+	if(rootBatches) dataFileWriter->enableRootBatches();
 	
 	int stepIndex = 0;
 	while(reader->getNextStep()) {
@@ -157,7 +199,7 @@ int main(int argc, char *argv[])
 			reader->processStep(true,
 					new CoarseSorter(
 					new ProcessHit(config, reader,
-					new SimpleGrouper(config,
+					new SimpleGrouper(config, reader,
 					new WriteGroupsHelper(dataFileWriter,
 					new NullSink<GammaPhoton>()
 					)))));
@@ -166,7 +208,7 @@ int main(int argc, char *argv[])
 			reader->processStep(true,
 					new HwTriggerSimulator(config,
 					new ProcessHit(config, reader,
-					new SimpleGrouper(config,
+					new SimpleGrouper(config, reader,
 					new WriteGroupsHelper(dataFileWriter,
 					new NullSink<GammaPhoton>()
 					)))));
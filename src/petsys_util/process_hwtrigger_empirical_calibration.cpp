@@ -242,8 +242,8 @@ public:
 			
 			Hit &h0 = *p.hits[0];
 	        	
-			unsigned gChannelID = h0.raw->channelID;
-			int gAsicID = int(h0.raw->channelID / 64);
+			unsigned gChannelID = h0.channelID;
+			int gAsicID = int(h0.channelID / 64);
 
 			maxgAsicID = (maxgAsicID > gAsicID) ? maxgAsicID : gAsicID;
 			
@@ -270,11 +270,12 @@ public:
 				Hit &h0 = *p.hits[0];
 				Hit &h = *p.hits[m];
 				EnergyEmpiricalCalibrationEvent e;
-				e.gTacID = int(h.raw->channelID)*4 + int(h.raw->tacID);
+				e.gTacID = int(h.channelID)*4 + int(h.tacID);
 				e.energy = h.energy;
-				e.eFine = h.raw->efine;
+				e.eFine = h.efine;
 				if(m>0) {
-					e.time = h.time - h0.time;
+					// Keep the time difference in clock units
+					e.time = (h.time - h0.time) / Tps;
 				}
 				else{
 					e.time = -1E10;
@@ -322,6 +323,7 @@ void sortData(SystemConfig *config, char *inputFilePrefix, char *outputFilePrefi
 	RawReader::timeref_t tb = RawReader::SYNC;
 	RawReader *reader = RawReader::openFile(inputFilePrefix, tb);
 	assert(!reader->isTOT());
+	reader->setSystemConfig(config);
 	EventWriter *eventWriter;
 	
 	eventWriter = new EventWriter(outputFilePrefix, reader->getFrequency(), config);
@@ -332,7 +334,7 @@ void sortData(SystemConfig *config, char *inputFilePrefix, char *outputFilePrefi
 		reader->processStep(true,
 			   new CoarseSorter(    
 			   new ProcessHit(config, reader,
-			   new SimpleGrouper(config,	       
+			   new SimpleGrouper(config, reader,	       
 			   new WriteHelper(eventWriter,
 			   new NullSink<GammaPhoton>()
 			   )))));
@@ -59,8 +59,7 @@ struct CalibrationData{
 		float time, q_T;
 		unsigned channelID = (gid >> 2);
 		unsigned tacID = (gid >> 0) % 4;
-		SystemConfig::ChannelConfig &cc = config->getChannelConfig(channelID);
-		SystemConfig::TacConfig &ct = cc.tac_T[tacID];
+		SystemConfig::TacConfig &ct = config->getTacConfigT(config->getChannelIndex(channelID), tacID);
 		float delta = (ct.a1 * ct.a1) - (4.0f * (ct.a0 - tfine) * ct.a2);
 		if(delta<0){
 			time = tcoarse;
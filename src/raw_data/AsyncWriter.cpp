@@ -70,6 +70,10 @@ DataWriter::~DataWriter() {
 
 	io_destroy(ctx);
 	close(fd);
+
+	for (int i = 0; i < N_BUFFERS; i++) {
+		free(buffers[i].data);
+	}
 }
 
 void DataWriter::appendData(void *buf, size_t count)
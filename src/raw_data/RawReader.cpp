@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <assert.h>
 #include <boost/regex.hpp>
 #include <libgen.h>
@@ -38,7 +39,8 @@ static void normalizeLine(char *line) {
 
 
 RawReader::RawReader() :
-	dataFile(-1), indexFile(NULL)
+	indexFile(NULL), dataFile(-1), activeAsics(NULL), fileNamePrefix(NULL), systemConfig(NULL),
+	sliceFrames(1), windowFrames(1)
 {
 	assert(dataFileBufferSize >= MaxRawDataFrameSize * sizeof(uint64_t));
 	dataFileBuffer = new char[dataFileBufferSize];
@@ -49,6 +51,8 @@ RawReader::RawReader() :
 RawReader::~RawReader()
 {
 	delete [] dataFileBuffer;
+	delete [] activeAsics;
+	delete [] fileNamePrefix;
 	close(dataFile);
 
 	if(indexFile != NULL) fclose(indexFile);
@@ -57,6 +61,8 @@ RawReader::~RawReader()
 RawReader *RawReader::openFile(const char *fnPrefix, timeref_t tb)
 {
 	RawReader *reader = new RawReader();
+	reader->fileNamePrefix = new char[strlen(fnPrefix) + 1];
+	strcpy(reader->fileNamePrefix, fnPrefix);
 
 	char fName[1024];
 
@@ -167,6 +173,98 @@ int RawReader::getTriggerID()
 	return triggerID;
 }
 
+void RawReader::setSystemConfig(SystemConfig *config)
+{
+	systemConfig = config;
+}
+
+void RawReader::setTimeSlicePrescale(unsigned sliceFrames, unsigned windowFrames)
+{
+	assert(windowFrames > 0);
+	this->sliceFrames = sliceFrames;
+	this->windowFrames = windowFrames;
+}
+
+const bool *RawReader::getActiveAsics()
+{
+	if(activeAsics != NULL)
+		return activeAsics;
+
+	activeAsics = new bool[MAX_NUMBER_ASICS];
+	for(unsigned n = 0; n < MAX_NUMBER_ASICS; n++)
+		activeAsics[n] = false;
+
+	if(readModeFileAsics() || prescanActiveAsics())
+		return activeAsics;
+
+	delete [] activeAsics;
+	activeAsics = NULL;
+	return NULL;
+}
+
+// The mode file lists every channel configured for the acquisition
+bool RawReader::readModeFileAsics()
+{
+	char fName[1024];
+	sprintf(fName, "%s.modf", fileNamePrefix);
+	FILE *modeFile = fopen(fName, "r");
+	if(modeFile == NULL) return false;
+
+	bool found = false;
+	char line[PATH_MAX];
+	while(fscanf(modeFile, "%[^\n]\n", line) == 1) {
+		unsigned portID, slaveID, chipID;
+		if(sscanf(line, "%u %u %u", &portID, &slaveID, &chipID) != 3) continue;
+		unsigned long gChannelID = 0;
+		gChannelID |= (chipID << 6);
+		gChannelID |= (slaveID << 12);
+		gChannelID |= (portID << 17);
+		activeAsics[gChannelID >> 6] = true;
+		found = true;
+	}
+	fclose(modeFile);
+	return found;
+}
+
+// Walk the frames of every step and flag the ASICs which have events
+// Only the channel ID of each event word is looked at, so this is limited by I/O
+bool RawReader::prescanActiveAsics()
+{
+	// The file is still being written
+	if(indexIsTemp) return false;
+
+	struct stat st;
+	if(fstat(dataFile, &st) != 0) return false;
+	if(st.st_size == 0) return false;
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, dataFile, 0);
+	if(map == MAP_FAILED) return false;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	char *mapBegin = (char *)map;
+	char *mapEnd = mapBegin + st.st_size;
+
+	long indexPosition = ftell(indexFile);
+	rewind(indexFile);
+	unsigned long long begin, end;
+	while(fscanf(indexFile, "%llu\t%llu\t%*u\t%*u\t%*f\t%*f\n", &begin, &end) == 2) {
+		uint64_t *p = (uint64_t *)(mapBegin + begin);
+		uint64_t *pEnd = (uint64_t *)(mapBegin + end);
+		if((char *)pEnd > mapEnd) pEnd = (uint64_t *)mapEnd;
+
+		while(p + 2 <= pEnd) {
+			int N = p[1] & 0x7FFF;
+			p += 2;
+			for(int i = 0; (i < N) && (p < pEnd); i++, p++) {
+				activeAsics[(*p >> 42) >> 6] = true;
+			}
+		}
+	}
+	fseek(indexFile, indexPosition, SEEK_SET);
+
+	munmap(map, st.st_size);
+	return true;
+}
+
 int RawReader::readFromDataFile(char *buf, int count)
 {
 	int rval = 0;
@@ -304,6 +402,7 @@ void RawReader::processStep(bool verbose, EventSink<RawHit> *sink)
 	long long nFramesLostN = 0;
 	long long nEventsNoLost = 0;
 	long long nEventsSomeLost = 0;
+	long long nFramesPrescaled = 0;
 	
 	// Set file handle to start of step
 	lseek(dataFile, getStepBegin(), SEEK_SET);
@@ -360,6 +459,12 @@ void RawReader::processStep(bool verbose, EventSink<RawHit> *sink)
 		assert(r == N*sizeof(uint64_t));
 		currentPosition += r;
 
+		// Frames outside of the selected time slices are dropped before any processing
+		if((frameID % windowFrames) >= sliceFrames) {
+			nFramesPrescaled += 1;
+			continue;
+		}
+
 		// Blocksize
 		// Best block size from profiling: 2048
 		// but handle larger frames correctly
@@ -402,6 +507,8 @@ void RawReader::processStep(bool verbose, EventSink<RawHit> *sink)
 		fprintf(stderr, " %10lld total\n", nFrames);
 		fprintf(stderr, " %10lld (%4.1f%%) were missing all data\n", nFramesLost0, 100.0 * nFramesLost0 / (nFrames));
 		fprintf(stderr, " %10lld (%4.1f%%) were missing some data\n", nFramesLostN, 100.0 * nFramesLostN / (nFrames));
+		if(sliceFrames < windowFrames)
+			fprintf(stderr, " %10lld frames with data were outside of the selected time slices\n", nFramesPrescaled);
 		fprintf(stderr, " events\n");
 		fprintf(stderr, " %10lld total\n", nEventsNoLost + nEventsSomeLost);
 		long long goodFrames = nFrames - nFramesLost0 - nFramesLostN;
@@ -428,9 +535,11 @@ EventBuffer<RawHit> * RawReader::Decoder::handleEvents(EventBuffer<RawReader::Un
 	UndecodedHit *pi = inBuffer->getPtr();
 	UndecodedHit *pe = pi + N;
 	RawHit *po = outBuffer->getPtr();
+	SystemConfig *config = reader->systemConfig;
 	for(; pi < pe; pi++, po++) {
 		RawEventWord e = RawEventWord(pi->eventWord);
 		po->channelID = e.getChannelID();
+		po->channelIndex = (config != NULL) ? config->getChannelIndex(po->channelID) : 0;
 		po->qdcMode = reader->isQDC(po->channelID);
 		po->tacID = e.getTacID();
 		po->frameID = pi->frameID;
@@ -445,6 +554,7 @@ EventBuffer<RawHit> * RawReader::Decoder::handleEvents(EventBuffer<RawReader::Un
 		po->valid = true;
 	}
 	outBuffer->setUsed(N);
+	outBuffer->releaseParent();
 	return outBuffer;
 
 }
@@ -5,10 +5,12 @@
 #include <Event.hpp>
 #include <UnorderedEventHandler.hpp>
 #include <event_decode.hpp>
+#include <SystemConfig.hpp>
 
 #include <vector>
 
 static const unsigned MAX_NUMBER_CHANNELS = 4194304;
+static const unsigned MAX_NUMBER_ASICS = MAX_NUMBER_CHANNELS / 64;
 
 namespace PETSYS {
 
@@ -45,11 +47,19 @@ namespace PETSYS {
 		bool isTOT();
 		double getFrequency();
 		int getTriggerID();
+		void setSystemConfig(SystemConfig *config);
+		// ASICs present in this acquisition, indexed by (channelID >> 6)
+		// Taken from the .modf file or from a prescan of the data; NULL if it can't be determined
+		const bool *getActiveAsics();
 
 		bool getNextStep();
 		void getStepValue(float &step1, float &step2);
 		void processStep(bool verbose, EventSink<RawHit> *pipeline);
 
+		// Process only the first sliceFrames frames of every windowFrames frames, by frame ID
+		// The other frames are read past without being decoded
+		void setTimeSlicePrescale(unsigned sliceFrames, unsigned windowFrames);
+
 	private:
 		RawReader();
 
@@ -72,9 +82,16 @@ namespace PETSYS {
 
 		unsigned frequency;
 		bool qdcMode[MAX_NUMBER_CHANNELS];		
+		bool *activeAsics;
+		char *fileNamePrefix;
+		bool readModeFileAsics();
+		bool prescanActiveAsics();
 		int triggerID;
+		SystemConfig *systemConfig;
 
 		timeref_t tb;
+		unsigned sliceFrames;
+		unsigned windowFrames;
 		double daqSynchronizationEpoch;
 		unsigned long long fileCreationDAQTime;
 
@@ -0,0 +1,215 @@
+#ifndef __PETSYS_OUTPUTREFERENCE_HPP__DEFINED__
+#define __PETSYS_OUTPUTREFERENCE_HPP__DEFINED__
+
+#include "TestUtil.hpp"
+#include <DataFileWriter.hpp>
+#include <math.h>
+#include <limits.h>
+
+namespace PETSYS { namespace Test {
+
+/*
+ * Singles, groups and coincidences of the same raw hits, in consecutive buffers,
+ * for the output writers. Each buffer owns the buffers it was made from.
+ */
+struct TestEvents {
+	std::vector<EventBuffer<Hit> *> singles;
+	std::vector<EventBuffer<GammaPhoton> *> groups;
+	std::vector<EventBuffer<Coincidence> *> coincidences;
+
+	~TestEvents() {
+		for(unsigned n = 0; n < singles.size(); n++) delete singles[n];
+		for(unsigned n = 0; n < groups.size(); n++) delete groups[n];
+		for(unsigned n = 0; n < coincidences.size(); n++) delete coincidences[n];
+	};
+
+	unsigned size() { return singles.size(); };
+};
+
+// nBuffers buffers of N raw hits, starting every bufferLength clocks
+static inline void makeTestEvents(TestEvents &events, SystemConfig *config, EventStream *stream, TestSystem &system,
+	unsigned nBuffers, unsigned N, long long bufferLength, std::mt19937 &rng)
+{
+	for(unsigned b = 0; b < nBuffers; b++) {
+		EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(N, b, b * bufferLength);
+		generateRawHits(raw, config, system, N, 0.5, 5, rng);
+		raw->setTMax((b + 1) * bufferLength);
+
+		events.singles.push_back(processHits(config, stream, copyBuffer(raw)));
+		events.groups.push_back(groupHits(config, stream, processHits(config, stream, copyBuffer(raw))));
+		events.coincidences.push_back(findCoincidences(config, stream, groupHits(config, stream, processHits(config, stream, raw))));
+	}
+}
+
+/*
+ * Writes events through a DataFileWriter in two steps, (1, 2) and (3, 4), either with
+ * write*Events() or, as WriteHelpers do with a thread pool, by formatting all buffers
+ * out of order before writing the blocks in order.
+ */
+static inline void writeTestEvents(DataFileWriter *writer, TestEvents &events, EVENT_TYPE eventType, double t0,
+	short delayed, bool formatAhead)
+{
+	unsigned nBuffers = events.size();
+	std::vector<OutputBlock *> blocks(nBuffers, (OutputBlock *)NULL);
+	if(formatAhead) {
+		for(unsigned b = nBuffers; b > 0; b--) {
+			unsigned n = b - 1;
+			if(eventType == SINGLE) blocks[n] = writer->formatSingleEvents(events.singles[n], t0);
+			else if(eventType == GROUP) blocks[n] = writer->formatGroupEvents(events.groups[n], t0);
+			else blocks[n] = writer->formatCoincidenceEvents(events.coincidences[n], t0, delayed);
+		}
+	}
+
+	writer->setStepValues(1, 2);
+	for(unsigned n = 0; n < nBuffers; n++) {
+		if(n == nBuffers / 2) {
+			writer->closeStep();
+			writer->setStepValues(3, 4);
+		}
+		if(blocks[n] != NULL) writer->writeBlock(blocks[n]);
+		else if(eventType == SINGLE) writer->writeSingleEvents(events.singles[n], t0);
+		else if(eventType == GROUP) writer->writeGroupEvents(events.groups[n], t0);
+		else writer->writeCoincidenceEvents(events.coincidences[n], t0, delayed);
+	}
+	writer->closeStep();
+}
+
+/*
+ * The binary formats as DataFileWriter wrote them one event at a time, with fwrite(),
+ * before it serialised whole buffers: the .ldat records and the .lidx step index.
+ */
+class ReferenceBinaryWriter {
+public:
+	ReferenceBinaryWriter(double frequency, FILE_TYPE fileType, int hitLimitToWrite, int eventFractionToWrite)
+	: fileType(fileType), hitLimitToWrite(hitLimitToWrite), eventFractionToWrite(eventFractionToWrite)
+	{
+		Tps = 1E12 / frequency;
+		Tns = Tps / 1000.;
+		eventCounter = 0;
+		stepBegin = 0;
+	};
+
+	std::string data;
+	std::string index;
+
+	void writeSingleEvents(EventBuffer<Hit> *buffer, double t0) {
+		long long tMin = (long long)(buffer->getTMin() + t0) * (long long)Tps;
+		for(unsigned i = 0; i < buffer->getSize(); i++) {
+			if(!selectEvent()) continue;
+			Hit &hit = buffer->get(i);
+			// Singles have no compact format
+			if(!hit.valid || fileType != FILE_BINARY) continue;
+			float Eunit = hit.qdcMode ? 1.0 : Tns;
+			Event eo = { hit.time + tMin, hit.energy * Eunit, (int)hit.channelID };
+			put(eo);
+		}
+	};
+
+	void writeGroupEvents(EventBuffer<GammaPhoton> *buffer, double t0) {
+		long long tMin = (long long)(buffer->getTMin() + t0) * (long long)Tps;
+		for(unsigned i = 0; i < buffer->getSize(); i++) {
+			if(!selectEvent()) continue;
+			GammaPhoton &p = buffer->get(i);
+			if(!p.valid) continue;
+			int limit = (hitLimitToWrite < p.nHits) ? hitLimitToWrite : p.nHits;
+			if(fileType == FILE_BINARY_COMPACT) {
+				GroupHeader header = {(uint8_t)limit};
+				put(header);
+			}
+			for(int m = 0; m < limit; m++) {
+				Hit &h = *p.hits[m];
+				float Eunit = h.qdcMode ? 1.0 : Tns;
+				if(fileType == FILE_BINARY) {
+					GroupEvent eo = { (uint8_t)p.nHits, (uint8_t)m, h.time + tMin, h.energy * Eunit, (int)h.channelID };
+					put(eo);
+				}
+				else {
+					Event eo = { h.time + tMin, h.energy * Eunit, (int)h.channelID };
+					put(eo);
+				}
+			}
+		}
+	};
+
+	void writeCoincidenceEvents(EventBuffer<Coincidence> *buffer, double t0, short delayed) {
+		long long tMin = (long long)(buffer->getTMin() + t0) * (long long)Tps;
+		for(unsigned i = 0; i < buffer->getSize(); i++) {
+			Coincidence &e = buffer->get(i);
+			if(e.delayed != delayed) continue;
+			if(!selectEvent()) continue;
+			if(!e.valid || e.nPhotons != 2) continue;
+
+			GammaPhoton &p1 = *e.photons[0];
+			GammaPhoton &p2 = *e.photons[1];
+			int limit1 = (hitLimitToWrite < p1.nHits) ? hitLimitToWrite : p1.nHits;
+			int limit2 = (hitLimitToWrite < p2.nHits) ? hitLimitToWrite : p2.nHits;
+
+			if(fileType == FILE_BINARY_COMPACT) {
+				CoincidenceGroupHeader header = {(uint8_t)limit1, (uint8_t)limit2};
+				put(header);
+				for(int k = 0; k < limit1 + limit2; k++) {
+					Hit &h = k < limit1 ? *p1.hits[k] : *p2.hits[k - limit1];
+					float Eunit = h.qdcMode ? 1.0 : Tns;
+					Event eo = { h.time + tMin, h.energy * Eunit, (int)h.channelID };
+					put(eo);
+				}
+				continue;
+			}
+			for(int m = 0; m < limit1; m++) for(int n = 0; n < limit2; n++) {
+				if(m != 0 && n != 0) continue;
+				Hit &h1 = *p1.hits[m];
+				Hit &h2 = *p2.hits[n];
+				float Eunit1 = h1.qdcMode ? 1.0 : Tns;
+				float Eunit2 = h2.qdcMode ? 1.0 : Tns;
+				CoincidenceEvent eo = {
+					(uint8_t)p1.nHits, (uint8_t)m, h1.time + tMin, h1.energy * Eunit1, (int)h1.channelID,
+					(uint8_t)p2.nHits, (uint8_t)n, h2.time + tMin, h2.energy * Eunit2, (int)h2.channelID
+				};
+				put(eo);
+			}
+		}
+	};
+
+	void closeStep(float step1, float step2) {
+		char line[256];
+		sprintf(line, "%ld\t%ld\t%e\t%e\n", (long)stepBegin, (long)data.size(), step1, step2);
+		index += line;
+		stepBegin = data.size();
+	};
+
+	// Same steps as writeTestEvents()
+	void writeTestEvents(TestEvents &events, EVENT_TYPE eventType, double t0, short delayed) {
+		unsigned nBuffers = events.size();
+		for(unsigned n = 0; n < nBuffers; n++) {
+			if(n == nBuffers / 2) closeStep(1, 2);
+			if(eventType == SINGLE) writeSingleEvents(events.singles[n], t0);
+			else if(eventType == GROUP) writeGroupEvents(events.groups[n], t0);
+			else writeCoincidenceEvents(events.coincidences[n], t0, delayed);
+		}
+		closeStep(3, 4);
+	};
+
+private:
+	FILE_TYPE fileType;
+	int hitLimitToWrite;
+	int eventFractionToWrite;
+	double Tps;
+	float Tns;
+	long long eventCounter;
+	size_t stepBegin;
+
+	bool selectEvent() {
+		long long tmpCounter = eventCounter;
+		eventCounter += 1;
+		return (tmpCounter % 1024) < eventFractionToWrite;
+	};
+
+	template <class T>
+	void put(const T &record) {
+		data.append((const char *)&record, sizeof(T));
+	};
+};
+
+}}
+
+#endif // __PETSYS_OUTPUTREFERENCE_HPP__DEFINED__
@@ -0,0 +1,171 @@
+#ifndef __PETSYS_PROCESSHITREFERENCE_HPP__DEFINED__
+#define __PETSYS_PROCESSHITREFERENCE_HPP__DEFINED__
+
+#include <math.h>
+#include <vector>
+#include <Event.hpp>
+#include <EventBuffer.hpp>
+#include <SystemConfig.hpp>
+
+namespace PETSYS {
+namespace Test {
+
+/*
+ * The generic hit processing loop, testing the configuration flags for every hit,
+ * as ProcessHit did before its kernel was specialised over them.
+ * Times are converted to integer picoseconds as ProcessHit does.
+ * If clockTimes is given, the calibrated time of each output hit in clock periods,
+ * as hits carried it before the conversion to picoseconds, is appended to it.
+ */
+static inline EventBuffer<Hit> *processHitsReference(SystemConfig *systemConfig, EventStream *eventStream, EventBuffer<RawHit> *inBuffer,
+	std::vector<double> *clockTimes = NULL)
+{
+	unsigned N =  inBuffer->getSize();
+
+	EventBuffer<Hit> * outBuffer = new EventBuffer<Hit>(N, inBuffer->getSeqN(), inBuffer->getTMin());
+
+	int triggerID = eventStream->getTriggerID();
+	float clockPeriod = 1./eventStream->getFrequency()*1e12;
+	double Tps = 1E12/eventStream->getFrequency();
+
+	bool useTDC = systemConfig->useTDCCalibration();
+	bool useQDC = systemConfig->useQDCCalibration();
+	bool useEnergyCal = systemConfig->useEnergyCalibration();
+	bool useTimeOffsetCal = systemConfig->useTimeOffsetCalibration();
+	bool useXYZ = systemConfig->useXYZ();
+
+	for(int i = 0; i < N; i++) {
+		RawHit &in = inBuffer->get(i);
+		Hit &out = outBuffer->getWriteSlot();
+		out.qdcMode = in.qdcMode;
+		out.tacID = in.tacID;
+		out.efine = in.efine;
+		out.channelID = in.channelID;
+		out.channelIndex = in.channelIndex;
+		out.rawTime = in.time;
+		out.rawTimeEnd = in.timeEnd;
+
+		double time, timeEnd;
+		uint8_t eventFlags = in.valid ? 0x0 : 0x1;
+
+		if((in.channelID >> 12) == triggerID) {
+			// This event comes from the trigger
+			time = in.time;
+			time -= (in.tfine - 27) * 0.25;
+			timeEnd = time;
+			out.energy = (in.efine == 28) ? 1 : -1;
+			out.region = -1;
+			out.denseRegion = -1;
+			out.x = out.y = out.z = 0.0;
+			out.xi = out.yi = 0;
+		}
+		else {
+			unsigned index = in.channelIndex;
+
+			time = in.time;
+			if(useTDC) {
+				SystemConfig::TacConfig &ct = systemConfig->getTacConfigT(index, in.tacID);
+				float q_T = ( -ct.a1 + sqrtf((ct.a1 * ct.a1) - (4.0f * (ct.a0 - in.tfine) * ct.a2))) / (2.0f * ct.a2) ;
+				time = double(in.time) - q_T - ct.t0;
+				if(useTimeOffsetCal)
+					time -= double(systemConfig->getTimeOffset(index))/clockPeriod;
+
+				if(ct.a1 == 0) eventFlags |= 0x2;
+			}
+			if(!in.qdcMode) {
+				timeEnd = in.timeEnd;
+				if(useTDC) {
+					SystemConfig::TacConfig &ce = systemConfig->getTacConfigE(index, in.tacID);
+					float q_E = ( -ce.a1 + sqrtf((ce.a1 * ce.a1) - (4.0f * (ce.a0 - in.efine) * ce.a2))) / (2.0f * ce.a2) ;
+					timeEnd = double(in.timeEnd) - q_E - ce.t0;
+					if(ce.a1 == 0) eventFlags |= 0x2;
+				}
+				out.energy = timeEnd - time;
+			}
+			else {
+				timeEnd = in.timeEnd;
+				out.energy = in.efine;
+
+				if(useQDC) {
+					SystemConfig::QacConfig &cq = systemConfig->getQacConfig(index, in.tacID);
+
+					float ti = (timeEnd - time);
+
+					float t_eq = ti;
+					float delta = 0;
+					int iter = 0;
+					do {
+						float f = (cq.p0 - in.efine) +
+							cq.p1 * t_eq +
+							cq.p2 * t_eq * t_eq +
+							cq.p3 * t_eq * t_eq * t_eq +
+							cq.p4 * t_eq * t_eq * t_eq * t_eq +
+							cq.p5 * t_eq * t_eq * t_eq * t_eq * t_eq +
+							cq.p6 * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq +
+							cq.p7 * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq +
+							cq.p8 * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq +
+							cq.p9 * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq;
+
+						float f_ = cq.p1 +
+							cq.p2 * t_eq * 2 +
+							cq.p3 * t_eq * t_eq * 3 +
+							cq.p4 * t_eq * t_eq * t_eq * 4 +
+							cq.p5 * t_eq * t_eq * t_eq * t_eq * 5 +
+							cq.p6 * t_eq * t_eq * t_eq * t_eq * t_eq * 6 +
+							cq.p7 * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * 7 +
+							cq.p8 * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * 8 +
+							cq.p9 * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * t_eq * 9;
+
+						delta = - f / f_;
+
+						if(delta < -10.0) delta = -10.0;
+						if(delta > +10.0) delta = +10.0;
+
+						t_eq = t_eq + delta;
+						iter += 1;
+					} while ((fabs(delta) > 0.05) && (iter < 100));
+
+					out.energy = t_eq - ti ;
+					if(cq.p1 == 0) eventFlags |= 0x4;
+
+					if(useEnergyCal){
+						SystemConfig::EnergyConfig &cen = systemConfig->getEnergyConfig(index, in.tacID);
+						float Energy =  cen.p0 * pow(cen.p1,pow(out.energy,cen.p2)) + cen.p3 * out.energy - cen.p0;
+						out.energy = Energy;
+						if(cen.p0 == 0) eventFlags |= 0x10;
+					}
+				}
+			}
+
+			out.region = -1;
+			out.denseRegion = -1;
+			out.x = out.y = out.z = 0.0;
+			out.xi = out.yi = 0;
+			if(useXYZ) {
+				SystemConfig::ChannelPosition &cp = systemConfig->getChannelPosition(index);
+				out.region = systemConfig->getTriggerRegion(index);
+				out.denseRegion = systemConfig->getDenseTriggerRegion(index);
+				out.x = cp.x;
+				out.y = cp.y;
+				out.z = cp.z;
+				out.xi = cp.xi;
+				out.yi = cp.yi;
+				if(out.region == -1) eventFlags |= 0x8;
+			}
+		}
+		out.time = (long long)(time * Tps);
+		out.timeEnd = (long long)(timeEnd * Tps);
+
+		if(eventFlags == 0) {
+			out.valid = true;
+			outBuffer->pushWriteSlot();
+			if(clockTimes != NULL) clockTimes->push_back(time);
+		}
+	}
+	return outBuffer;
+}
+
+}
+}
+
+#endif // __PETSYS_PROCESSHITREFERENCE_HPP__DEFINED__
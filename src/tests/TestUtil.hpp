@@ -0,0 +1,408 @@
+#ifndef __PETSYS_TESTUTIL_HPP__DEFINED__
+#define __PETSYS_TESTUTIL_HPP__DEFINED__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <Event.hpp>
+#include <EventBuffer.hpp>
+#include <EventSourceSink.hpp>
+#include <SystemConfig.hpp>
+#include <ProcessHit.hpp>
+#include <SimpleGrouper.hpp>
+#include <CoincidenceGrouper.hpp>
+
+/*
+ * Helpers shared by the test programs in this directory.
+ * Each test is a program which returns 0 when all its checks pass.
+ */
+
+namespace PETSYS {
+namespace Test {
+
+static int nFailures = 0;
+
+// Report the failures of a test program and make its exit status
+static inline int result(const char *testName)
+{
+	if(nFailures == 0)
+		fprintf(stderr, "%s: all checks passed\n", testName);
+	else
+		fprintf(stderr, "%s: %d checks FAILED\n", testName, nFailures);
+	return (nFailures == 0) ? 0 : 1;
+}
+
+// Bit by bit comparison, so that NaN results compare equal to themselves
+template <class T>
+static inline bool sameBits(const T &a, const T &b)
+{
+	return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+// Seconds on the monotonic clock
+static inline double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1E-9 * t.tv_nsec;
+}
+
+/*
+ * Temporary directory, removed with its contents on destruction
+ */
+class TestDir {
+public:
+	TestDir() {
+		char name[] = "/tmp/petsys_test_XXXXXX";
+		if(mkdtemp(name) == NULL) {
+			perror("ERROR: could not create test directory");
+			exit(1);
+		}
+		path = name;
+	};
+
+	~TestDir() {
+		nftw(path.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+	};
+
+	std::string file(const char *name) {
+		return path + "/" + name;
+	};
+
+	void writeFile(const char *name, const std::string &content) {
+		FILE *f = fopen(file(name).c_str(), "w");
+		if(f == NULL) {
+			perror("ERROR: could not write test file");
+			exit(1);
+		}
+		fwrite(content.data(), 1, content.size(), f);
+		fclose(f);
+	};
+
+	std::string readFile(const char *name) {
+		std::string content;
+		FILE *f = fopen(file(name).c_str(), "r");
+		if(f == NULL) return content;
+		char buf[65536];
+		size_t n;
+		while((n = fread(buf, 1, sizeof(buf), f)) > 0) content.append(buf, n);
+		fclose(f);
+		return content;
+	};
+
+	std::string path;
+
+private:
+	static int removeEntry(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+		remove(fpath);
+		return 0;
+	};
+};
+
+/*
+ * Synthetic system: nPorts FEB/Ds of nSlaves (4) slaves with nChips (2) ASICs each.
+ * Each ASIC is a trigger region, in coincidence with the two regions across the system
+ * from it; each pair of ASICs of a slave allows multiple hit photons between them.
+ * Channels 0..3 of chip 1 have no TDC, QDC or energy calibration and channel 63 of
+ * chip 0 is not in the channel map, so that hits missing them are seen.
+ */
+class TestSystem {
+public:
+	TestSystem(TestDir &dir, unsigned nPorts, bool selfCoincidence = false, unsigned seed = 1, unsigned nSlaves = 4, unsigned nChips = 2)
+	: dir(dir), nPorts(nPorts), nSlaves(nSlaves), nChips(nChips)
+	{
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<double> u(0, 1);
+
+		std::string tdc, qdc, energy, timeOffset, map, trigger;
+		char line[512];
+		for(unsigned n = 0; n < getNumberOfChannels(); n++) {
+			unsigned channelID = getChannelID(n);
+			unsigned portID = channelID >> 17;
+			unsigned slaveID = (channelID >> 12) % 32;
+			unsigned chipID = (channelID >> 6) % 64;
+			unsigned channel = channelID % 64;
+			unsigned region = getRegion(channelID);
+			bool calibrated = !(chipID == 1 && channel < 4);
+
+			for(unsigned tac = 0; tac < 4 && calibrated; tac++) {
+				for(const char *branch = "TE"; *branch != '\0'; branch++) {
+					sprintf(line, "%u\t%u\t%u\t%u\t%u\t%c\t%.6f\t%.6f\t%.6f\t%.6f\n",
+						portID, slaveID, chipID, channel, tac, *branch,
+						u(rng) - 0.5, 90 + 20 * u(rng), 280 + 40 * u(rng), 5 + 10 * u(rng));
+					tdc += line;
+				}
+				sprintf(line, "%u\t%u\t%u\t%u\t%u\t%.6f\t%.6f\t%.6f\t%.8f\t0\t0\t0\t0\t0\t0\n",
+					portID, slaveID, chipID, channel, tac,
+					5 + 10 * u(rng), 2 + 2 * u(rng), 0.01 * u(rng), 1E-6 * u(rng));
+				qdc += line;
+				sprintf(line, "%u\t%u\t%u\t%u\t%u\t%.6f\t%.6f\t%.6f\t%.6f\n",
+					portID, slaveID, chipID, channel, tac,
+					5 + 5 * u(rng), 1.02 + 0.05 * u(rng), 0.8 + 0.2 * u(rng), 0.5 * u(rng));
+				energy += line;
+			}
+
+			sprintf(line, "%u\t%u\t%u\t%u\t%.3f\n", portID, slaveID, chipID, channel, 1000 * u(rng) - 500);
+			timeOffset += line;
+
+			if(chipID == 0 && channel == 63) continue;
+			unsigned xi = channel % 8;
+			unsigned yi = channel / 8;
+			sprintf(line, "%u\t%u\t%u\t%u\t%u\t%u\t%u\t%.3f\t%.3f\t%.3f\n",
+				portID, slaveID, chipID, channel, region, xi, yi,
+				xi * 3.2 + 30.0 * (region % 4), yi * 3.2, 100.0 * (region / 4));
+			map += line;
+		}
+
+		unsigned R = getNumberOfRegions();
+		for(unsigned r = 0; r < R; r++) {
+			sprintf(line, "%u\t%u\t%c\n", r, r, selfCoincidence ? 'C' : 'M');
+			trigger += line;
+			if(r % 2 == 0) {
+				sprintf(line, "%u\t%u\tM\n", r, r + 1);
+				trigger += line;
+			}
+			sprintf(line, "%u\t%u\tC\n", r, (r + R / 2) % R);
+			trigger += line;
+			sprintf(line, "%u\t%u\tC\n", r, (r + R / 2 + 1) % R);
+			trigger += line;
+		}
+
+		dir.writeFile("tdc.tsv", tdc);
+		dir.writeFile("qdc.tsv", qdc);
+		dir.writeFile("energy.tsv", energy);
+		dir.writeFile("time_offset.tsv", timeOffset);
+		dir.writeFile("map.tsv", map);
+		dir.writeFile("trigger.tsv", trigger);
+	};
+
+	// Write a configuration over the tables, followed by extra sections or keys
+	// Returns its file name
+	std::string writeConfig(const char *name, const char *extra = "") {
+		std::string content =
+			"[main]\n"
+			"tdc_calibration_table = %CDIR%/tdc.tsv\n"
+			"qdc_calibration_table = %CDIR%/qdc.tsv\n"
+			"energy_calibration_table = %CDIR%/energy.tsv\n"
+			"time_offset_calibration_table = %CDIR%/time_offset.tsv\n"
+			"channel_map = %CDIR%/map.tsv\n"
+			"trigger_map = %CDIR%/trigger.tsv\n";
+		content += extra;
+		dir.writeFile(name, content);
+		return dir.file(name);
+	};
+
+	unsigned getNumberOfChannels() { return nPorts * nSlaves * nChips * 64; };
+	unsigned getChannelID(unsigned n) {
+		unsigned portID = n / (nSlaves * nChips * 64);
+		unsigned slaveID = (n / (nChips * 64)) % nSlaves;
+		unsigned chipID = (n / 64) % nChips;
+		return (portID << 17) | (slaveID << 12) | (chipID << 6) | (n % 64);
+	};
+	unsigned getNumberOfRegions() { return nPorts * nSlaves * nChips; };
+	unsigned getRegion(unsigned channelID) {
+		return (((channelID >> 17) * nSlaves + (channelID >> 12) % 32) * nChips) + (channelID >> 6) % 64;
+	};
+	// n-th channel of a region
+	unsigned getRegionChannelID(unsigned region, unsigned n) {
+		return getChannelID(region * 64 + n);
+	};
+
+private:
+	TestDir &dir;
+	unsigned nPorts;
+	unsigned nSlaves;
+	unsigned nChips;
+};
+
+/*
+ * Random raw hits of a test system, in time order
+ * A fraction qdcFraction of the hits is in QDC mode; with triggerID != -1, some hits come from the trigger.
+ * Events of clusterSize hits in neighbour channels of a region and of the region in coincidence with it
+ * are mixed with single hits.
+ */
+static inline void generateRawHits(EventBuffer<RawHit> *buffer, SystemConfig *config, TestSystem &system,
+	unsigned N, double qdcFraction, double meanInterval, std::mt19937 &rng, int triggerID = -1, unsigned clusterSize = 3)
+{
+	std::uniform_real_distribution<double> u(0, 1);
+	std::exponential_distribution<double> interval(1.0 / meanInterval);
+	double t = 1;
+	unsigned R = system.getNumberOfRegions();
+	std::vector<unsigned> channels;
+	while(buffer->getSize() < N) {
+		t += interval(rng);
+		channels.clear();
+		if(u(rng) < 0.5) {
+			channels.push_back(system.getChannelID(rng() % system.getNumberOfChannels()));
+		}
+		else {
+			unsigned r1 = rng() % R;
+			unsigned r2 = (r1 + R / 2) % R;
+			unsigned c1 = rng() % 64;
+			unsigned c2 = rng() % 64;
+			for(unsigned k = 0; k < clusterSize; k++) {
+				channels.push_back(system.getRegionChannelID(r1, (c1 + k) % 64));
+				channels.push_back(system.getRegionChannelID(r2, (c2 + k) % 64));
+			}
+		}
+
+		for(unsigned k = 0; k < channels.size() && buffer->getSize() < N; k++) {
+			RawHit &hit = buffer->getWriteSlot();
+			hit.valid = u(rng) > 0.01;
+			hit.qdcMode = u(rng) < qdcFraction;
+			hit.channelID = channels[k];
+			if(triggerID != -1 && u(rng) < 0.02) hit.channelID = (triggerID << 12) | (rng() % 64);
+			hit.channelIndex = config->getChannelIndex(hit.channelID);
+			hit.time = (long long)(t + 3 * u(rng));
+			hit.timeEnd = hit.time + 1 + (rng() % 300);
+			hit.frameID = hit.time / 1024;
+			hit.tcoarse = hit.time % 1024;
+			hit.ecoarse = hit.timeEnd % 1024;
+			hit.tfine = 90 + rng() % 330;
+			hit.efine = hit.qdcMode ? 20 + rng() % 800 : 90 + rng() % 330;
+			hit.tacID = rng() % 4;
+			buffer->pushWriteSlot();
+		}
+	}
+}
+
+/*
+ * Raw data file (.rawf) and index (.idxf) named prefix, of one step with the hits in frames
+ * from firstFrame to endFrame, in ToT mode at 200 MHz. The hits must be in frame order.
+ */
+static inline void writeRawFile(TestDir &dir, const char *prefix, EventBuffer<RawHit> *hits, long long firstFrame, long long endFrame)
+{
+	std::string data;
+	uint64_t header[8] = { 200000000, 0, 0, 0, 0, 0, 0, 0 };
+	data.append((const char *)header, sizeof(header));
+
+	unsigned n = 0;
+	for(long long frameID = firstFrame; frameID < endFrame; frameID++) {
+		std::vector<uint64_t> words;
+		for(; n < hits->getSize() && hits->get(n).frameID == frameID; n++) {
+			RawHit &hit = hits->get(n);
+			// RawEventWord adds 27 to the fine times
+			uint64_t efine = (hit.efine + 1024 - 27) % 1024;
+			uint64_t tfine = (hit.tfine + 1024 - 27) % 1024;
+			words.push_back(efine | (tfine << 10) | ((uint64_t)hit.ecoarse << 20) | ((uint64_t)hit.tcoarse << 30)
+				| ((uint64_t)hit.tacID << 40) | ((uint64_t)hit.channelID << 42));
+		}
+		uint64_t frameHeader[2] = { (uint64_t)frameID, words.size() };
+		data.append((const char *)frameHeader, sizeof(frameHeader));
+		data.append((const char *)words.data(), words.size() * sizeof(uint64_t));
+	}
+	dir.writeFile((std::string(prefix) + ".rawf").c_str(), data);
+
+	char index[256];
+	sprintf(index, "%lu\t%lu\t%lld\t0\t%f\t%f\n", sizeof(header), data.size(), firstFrame, 0.0, 0.0);
+	dir.writeFile((std::string(prefix) + ".idxf").c_str(), index);
+}
+
+/*
+ * Event stream with a fixed frequency and trigger
+ */
+class TestEventStream : public EventStream {
+public:
+	TestEventStream(double frequency = 200E6, int triggerID = -1) : frequency(frequency), triggerID(triggerID) {};
+	virtual double getFrequency() { return frequency; };
+	virtual int getTriggerID() { return triggerID; };
+private:
+	double frequency;
+	int triggerID;
+};
+
+/*
+ * Sink which keeps the buffers it is given, for the test to inspect
+ */
+template <class TEvent>
+class CaptureSink : public EventSink<TEvent> {
+public:
+	CaptureSink() { pthread_mutex_init(&lock, NULL); };
+	~CaptureSink() {
+		clear();
+		pthread_mutex_destroy(&lock);
+	};
+
+	virtual void pushT0(double t0) {};
+	virtual void pushEvents(EventBuffer<TEvent> *buffer) {
+		pthread_mutex_lock(&lock);
+		buffers.push_back(buffer);
+		pthread_mutex_unlock(&lock);
+	};
+	virtual void finish() {};
+	virtual void report() {};
+	virtual void resetCounters() {};
+
+	void clear() {
+		for(unsigned n = 0; n < buffers.size(); n++) delete buffers[n];
+		buffers.clear();
+	};
+
+	std::vector<EventBuffer<TEvent> *> buffers;
+
+private:
+	pthread_mutex_t lock;
+};
+
+// Copy of a hit buffer, for feeding the same hits to several pipelines
+template <class TEvent>
+static inline EventBuffer<TEvent> *copyBuffer(EventBuffer<TEvent> *in)
+{
+	EventBuffer<TEvent> *out = new EventBuffer<TEvent>(in->getSize(), in->getSeqN(), in->getTMin());
+	out->setTMax(in->getTMax());
+	for(unsigned n = 0; n < in->getSize(); n++) out->push(in->get(n));
+	return out;
+}
+
+/*
+ * Run one stage of the processing chain over a buffer and return its output buffer.
+ * The input buffer becomes owned by the output, as in the chain.
+ */
+template <class THandler, class TIn, class TOut>
+static inline EventBuffer<TOut> *runStage(THandler *handler, CaptureSink<TOut> *sink, EventBuffer<TIn> *in)
+{
+	handler->pushEvents(in);
+	EventBuffer<TOut> *out = sink->buffers[0];
+	sink->buffers.clear();
+	// The handler deletes its sink
+	delete handler;
+	return out;
+}
+
+static inline EventBuffer<Hit> *processHits(SystemConfig *config, EventStream *stream, EventBuffer<RawHit> *in)
+{
+	CaptureSink<Hit> *sink = new CaptureSink<Hit>();
+	return runStage(new ProcessHit(config, stream, sink), sink, in);
+}
+
+static inline EventBuffer<GammaPhoton> *groupHits(SystemConfig *config, EventStream *stream, EventBuffer<Hit> *in)
+{
+	CaptureSink<GammaPhoton> *sink = new CaptureSink<GammaPhoton>();
+	return runStage(new SimpleGrouper(config, stream, sink), sink, in);
+}
+
+static inline EventBuffer<Coincidence> *findCoincidences(SystemConfig *config, EventStream *stream, EventBuffer<GammaPhoton> *in)
+{
+	CaptureSink<Coincidence> *sink = new CaptureSink<Coincidence>();
+	return runStage(new CoincidenceGrouper(config, stream, sink), sink, in);
+}
+
+}
+}
+
+#define CHECK(condition) do { \
+	if(!(condition)) { \
+		if(PETSYS::Test::nFailures < 20) fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+		PETSYS::Test::nFailures += 1; \
+	} \
+} while(0)
+
+#endif // __PETSYS_TESTUTIL_HPP__DEFINED__
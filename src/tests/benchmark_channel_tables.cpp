@@ -0,0 +1,282 @@
+/*
+ * Cache misses of the channel configuration lookups of hit processing: the generic hit loop
+ * over the per-purpose tables of SystemConfig, indexed by the dense channel index, against
+ * the same loop over the interleaved ChannelConfig pages indexed by channel ID, as
+ * SystemConfig kept them before, and ProcessHit itself.
+ * The counters are the ones perf stat reports, read with perf_event_open(); where the
+ * hardware does not expose them, run one layout at a time under perf stat instead:
+ *   perf stat -e cache-references,cache-misses,L1-dcache-load-misses benchmark_channel_tables 200 tables
+ * Usage: benchmark_channel_tables [number of buffers] [all | interleaved | tables | ProcessHit]
+ */
+
+#include "TestUtil.hpp"
+#include "ProcessHitReference.hpp"
+#include <ProcessHit.hpp>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+/*
+ * Counters of the calling thread, in user space
+ */
+class HardwareCounters {
+public:
+	static const int nCounters = 4;
+
+	HardwareCounters() {
+		const struct { uint32_t type; uint64_t config; } events[nCounters] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+		};
+		for(int n = 0; n < nCounters; n++) {
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = events[n].type;
+			attr.config = events[n].config;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fd[n] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+	};
+
+	~HardwareCounters() {
+		for(int n = 0; n < nCounters; n++) if(fd[n] >= 0) close(fd[n]);
+	};
+
+	void start() {
+		for(int n = 0; n < nCounters; n++) if(fd[n] >= 0) ioctl(fd[n], PERF_EVENT_IOC_ENABLE, 0);
+	};
+
+	void stop() {
+		for(int n = 0; n < nCounters; n++) if(fd[n] >= 0) ioctl(fd[n], PERF_EVENT_IOC_DISABLE, 0);
+	};
+
+	// Counts per hit, or a dash where the counter is not available
+	void print(double nHits) {
+		for(int n = 0; n < nCounters; n++) {
+			long long value;
+			if(fd[n] >= 0 && read(fd[n], &value, sizeof(value)) == sizeof(value))
+				printf(" %12.3f", value / nHits);
+			else
+				printf(" %12s", "-");
+		}
+	};
+
+	static void printHeader() {
+		printf(" %12s %12s %12s %12s", "cache-refs", "cache-misses", "L1d-misses", "LLC-misses");
+	};
+
+private:
+	int fd[nCounters];
+};
+
+/*
+ * The channel configuration as SystemConfig kept it before the per-purpose tables:
+ * one ChannelConfig per channel, in pages of 4096 channel IDs, copied from the tables
+ */
+class InterleavedConfig {
+public:
+	struct ChannelConfig {
+		float x, y, z;
+		int xi, yi;
+		int triggerRegion;
+		float t0;
+		SystemConfig::TacConfig tac_T[4];
+		SystemConfig::TacConfig tac_E[4];
+		SystemConfig::QacConfig qac_Q[4];
+		SystemConfig::FirmwareConfig empConfig[4];
+		SystemConfig::EnergyConfig eCal[4];
+	};
+
+	InterleavedConfig(SystemConfig *config) {
+		memset(&nullChannelConfig, 0, sizeof(nullChannelConfig));
+		nullChannelConfig.triggerRegion = -1;
+		for(unsigned n = 0; n < 1024; n++) pages[n] = NULL;
+		for(unsigned index = 1; index < config->getNumberOfChannels(); index++) {
+			unsigned channelID = config->getChannelID(index);
+			ChannelConfig *&page = pages[channelID / 4096];
+			if(page == NULL) {
+				page = new ChannelConfig[4096];
+				for(unsigned k = 0; k < 4096; k++) page[k] = nullChannelConfig;
+			}
+			ChannelConfig &cc = page[channelID % 4096];
+			SystemConfig::ChannelPosition &cp = config->getChannelPosition(index);
+			cc.x = cp.x; cc.y = cp.y; cc.z = cp.z;
+			cc.xi = cp.xi; cc.yi = cp.yi;
+			cc.triggerRegion = config->getTriggerRegion(index);
+			cc.t0 = config->getTimeOffset(index);
+			for(unsigned tac = 0; tac < 4; tac++) {
+				cc.tac_T[tac] = config->getTacConfigT(index, tac);
+				cc.tac_E[tac] = config->getTacConfigE(index, tac);
+				cc.qac_Q[tac] = config->getQacConfig(index, tac);
+				cc.empConfig[tac] = config->getFirmwareConfig(index, tac);
+				cc.eCal[tac] = config->getEnergyConfig(index, tac);
+			}
+		}
+	};
+
+	~InterleavedConfig() {
+		for(unsigned n = 0; n < 1024; n++) delete [] pages[n];
+	};
+
+	inline ChannelConfig &getChannelConfig(unsigned channelID) {
+		ChannelConfig *page = pages[channelID / 4096];
+		return (page == NULL) ? nullChannelConfig : page[channelID % 4096];
+	};
+
+private:
+	ChannelConfig *pages[1024];
+	ChannelConfig nullChannelConfig;
+};
+
+/*
+ * processHitsReference() over the interleaved pages
+ * The QDC path is left out: its Newton iterations, not the lookups, dominate its time
+ */
+static EventBuffer<Hit> *processHitsInterleaved(SystemConfig *systemConfig, InterleavedConfig *interleaved,
+	EventStream *eventStream, EventBuffer<RawHit> *inBuffer)
+{
+	unsigned N = inBuffer->getSize();
+	EventBuffer<Hit> *outBuffer = new EventBuffer<Hit>(N, inBuffer->getSeqN(), inBuffer->getTMin());
+
+	int triggerID = eventStream->getTriggerID();
+	float clockPeriod = 1./eventStream->getFrequency()*1e12;
+	double Tps = 1E12/eventStream->getFrequency();
+	bool useTDC = systemConfig->useTDCCalibration();
+	bool useTimeOffsetCal = systemConfig->useTimeOffsetCalibration();
+	bool useXYZ = systemConfig->useXYZ();
+
+	for(unsigned i = 0; i < N; i++) {
+		RawHit &in = inBuffer->get(i);
+		Hit &out = outBuffer->getWriteSlot();
+		out.qdcMode = in.qdcMode;
+		out.tacID = in.tacID;
+		out.efine = in.efine;
+		out.channelID = in.channelID;
+		out.channelIndex = in.channelIndex;
+		out.rawTime = in.time;
+		out.rawTimeEnd = in.timeEnd;
+
+		double time, timeEnd;
+		uint8_t eventFlags = in.valid ? 0x0 : 0x1;
+		if((in.channelID >> 12) == triggerID) continue;
+
+		InterleavedConfig::ChannelConfig &cc = interleaved->getChannelConfig(in.channelID);
+		time = in.time;
+		if(useTDC) {
+			SystemConfig::TacConfig &ct = cc.tac_T[in.tacID];
+			float q_T = ( -ct.a1 + sqrtf((ct.a1 * ct.a1) - (4.0f * (ct.a0 - in.tfine) * ct.a2))) / (2.0f * ct.a2) ;
+			time = double(in.time) - q_T - ct.t0;
+			if(useTimeOffsetCal)
+				time -= double(cc.t0)/clockPeriod;
+			if(ct.a1 == 0) eventFlags |= 0x2;
+		}
+		timeEnd = in.timeEnd;
+		if(useTDC) {
+			SystemConfig::TacConfig &ce = cc.tac_E[in.tacID];
+			float q_E = ( -ce.a1 + sqrtf((ce.a1 * ce.a1) - (4.0f * (ce.a0 - in.efine) * ce.a2))) / (2.0f * ce.a2) ;
+			timeEnd = double(in.timeEnd) - q_E - ce.t0;
+			if(ce.a1 == 0) eventFlags |= 0x2;
+		}
+		out.energy = timeEnd - time;
+
+		out.region = -1;
+		out.denseRegion = -1;
+		out.x = out.y = out.z = 0.0;
+		out.xi = out.yi = 0;
+		if(useXYZ) {
+			out.region = cc.triggerRegion;
+			out.denseRegion = systemConfig->getDenseRegion(cc.triggerRegion);
+			out.x = cc.x;
+			out.y = cc.y;
+			out.z = cc.z;
+			out.xi = cc.xi;
+			out.yi = cc.yi;
+			if(cc.triggerRegion == -1) eventFlags |= 0x8;
+		}
+		out.time = (long long)(time * Tps);
+		out.timeEnd = (long long)(timeEnd * Tps);
+
+		if(eventFlags == 0) {
+			out.valid = true;
+			outBuffer->pushWriteSlot();
+		}
+	}
+	return outBuffer;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nBuffers = (argc > 1) ? atoi(argv[1]) : 200;
+	const char *layout = (argc > 2) ? argv[2] : "all";
+	const unsigned N = 16384;
+
+	// 16384 channels in 128 slaves: the interleaved pages of the channels take 7.5 MB, spread
+	// over 240 MB of pages, and the tables 2.6 MB
+	TestDir dir;
+	TestSystem system(dir, 32);
+	std::string configName = system.writeConfig("config.ini");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	InterleavedConfig *interleaved = new InterleavedConfig(config);
+	TestEventStream stream;
+
+	// ToT hits, in random channels over the whole system
+	std::mt19937 rng(26);
+	std::vector<EventBuffer<RawHit> *> raw;
+	for(unsigned n = 0; n < 16; n++) {
+		EventBuffer<RawHit> *buffer = new EventBuffer<RawHit>(N, n, 0);
+		generateRawHits(buffer, config, system, N, 0.0, 20, rng);
+		raw.push_back(buffer);
+	}
+
+	printf("# %u buffers of %u ToT hits over %u channels; counts per hit\n", nBuffers, N, system.getNumberOfChannels());
+	printf("%-12s %10s", "layout", "Mhits/s");
+	HardwareCounters::printHeader();
+	printf("\n");
+	const char *layouts[] = { "interleaved", "tables", "ProcessHit" };
+	for(int l = 0; l < 3; l++) {
+		if(strcmp(layout, "all") != 0 && strcmp(layout, layouts[l]) != 0) continue;
+
+		CaptureSink<Hit> *sink = new CaptureSink<Hit>();
+		ProcessHit *processHit = new ProcessHit(config, &stream, sink);
+		HardwareCounters counters;
+		double t = 0;
+		for(unsigned n = 0; n < nBuffers; n++) {
+			EventBuffer<RawHit> *in = copyBuffer(raw[n % raw.size()]);
+			double t0 = now();
+			counters.start();
+			if(l == 2) {
+				processHit->pushEvents(in);
+				counters.stop();
+				t += now() - t0;
+				sink->clear();
+				continue;
+			}
+			EventBuffer<Hit> *out = (l == 0) ?
+				processHitsInterleaved(config, interleaved, &stream, in) :
+				processHitsReference(config, &stream, in);
+			delete in;
+			counters.stop();
+			t += now() - t0;
+			delete out;
+		}
+		delete processHit;
+
+		double hits = (double)nBuffers * N;
+		printf("%-12s %10.1f", layouts[l], 1E-6 * hits / t);
+		counters.print(hits);
+		printf("\n");
+	}
+
+	for(unsigned n = 0; n < raw.size(); n++) delete raw[n];
+	delete interleaved;
+	delete config;
+	return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Throughput of the cluster grouping engine against the scan and region engines, on two
+ * 16x16 pixel modules in coincidence, at several singles rates. Each single lights up to
+ * 5 pixels around a random pixel of a module.
+ * Usage: benchmark_cluster_grouping [number of buffers]
+ */
+
+#include "TestUtil.hpp"
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	unsigned nBuffers = (argc > 1) ? atoi(argv[1]) : 50;
+	const unsigned N = 16384;
+
+	// The calibration tables of the 8 ASICs of one FEB/D, with a channel map of two
+	// modules of 4 ASICs, 3.2 mm pixels, each one trigger region
+	TestDir dir;
+	TestSystem system(dir, 1);
+	std::string map;
+	char line[512];
+	for(unsigned n = 0; n < 512; n++) {
+		unsigned channelID = system.getChannelID(n);
+		unsigned module = n / 256;
+		unsigned xi = n % 16;
+		unsigned yi = (n % 256) / 16;
+		sprintf(line, "%u\t%u\t%u\t%u\t%u\t%u\t%u\t%.3f\t%.3f\t%.3f\n",
+			channelID >> 17, (channelID >> 12) % 32, (channelID >> 6) % 64, channelID % 64,
+			module, xi, yi, xi * 3.2, yi * 3.2, 100.0 * module);
+		map += line;
+	}
+	dir.writeFile("map.tsv", map);
+	dir.writeFile("trigger.tsv", "0\t0\tM\n1\t1\tM\n0\t1\tC\n");
+	TestEventStream stream;
+
+	// Mean clocks between singles over both modules
+	const double intervals[] = { 200, 20, 5, 2 };
+	const char *engines[] = { "scan", "region", "cluster" };
+
+	printf("# %u buffers of %u hits on two 16x16 pixel modules; Mhits/s and hits per photon\n", nBuffers, N);
+	printf("%10s %10s", "Msingles/s", "interval");
+	for(int e = 0; e < 3; e++) printf(" %10s %6s", engines[e], "hits");
+	printf("\n");
+	for(unsigned i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+		printf("%10.1f %10.0f", 1E-6 * stream.getFrequency() / intervals[i], intervals[i]);
+		for(int e = 0; e < 3; e++) {
+			char settings[256];
+			sprintf(settings, "[sw_trigger]\ngroup_engine = %s\ngroup_max_distance = 10\n", engines[e]);
+			std::string configName = system.writeConfig("config.ini", settings);
+			SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+
+			std::mt19937 rng(33);
+			std::uniform_real_distribution<double> u(0, 1);
+			std::exponential_distribution<double> interval(1.0 / intervals[i]);
+			EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(N, 0, 0);
+			double t = 1;
+			while(raw->getSize() < N) {
+				t += interval(rng);
+				unsigned module = rng() % 2;
+				int x0 = rng() % 16;
+				int y0 = rng() % 16;
+				unsigned nPixels = 1 + rng() % 5;
+				for(unsigned k = 0; k < nPixels && raw->getSize() < N; k++) {
+					int x = std::min(15, std::max(0, x0 + (int)(rng() % 3) - 1));
+					int y = std::min(15, std::max(0, y0 + (int)(rng() % 3) - 1));
+					RawHit &hit = raw->getWriteSlot();
+					hit.valid = true;
+					hit.qdcMode = false;
+					hit.channelID = system.getChannelID(module * 256 + y * 16 + x);
+					hit.channelIndex = config->getChannelIndex(hit.channelID);
+					hit.time = (long long)(t + 3 * u(rng));
+					hit.timeEnd = hit.time + 1 + (rng() % 300);
+					hit.frameID = hit.time / 1024;
+					hit.tcoarse = hit.time % 1024;
+					hit.ecoarse = hit.timeEnd % 1024;
+					hit.tfine = 90 + rng() % 330;
+					hit.efine = 90 + rng() % 330;
+					hit.tacID = rng() % 4;
+					raw->pushWriteSlot();
+				}
+			}
+			EventBuffer<Hit> *hits = processHits(config, &stream, raw);
+
+			CaptureSink<GammaPhoton> *sink = new CaptureSink<GammaPhoton>();
+			SimpleGrouper *grouper = new SimpleGrouper(config, &stream, sink);
+			double tGroup = 0;
+			double nPhotons = 0, nPhotonHits = 0;
+			for(unsigned n = 0; n < nBuffers; n++) {
+				EventBuffer<Hit> *in = copyBuffer(hits);
+				double t0 = now();
+				grouper->pushEvents(in);
+				tGroup += now() - t0;
+				EventBuffer<GammaPhoton> *photons = sink->buffers[0];
+				nPhotons += photons->getSize();
+				for(unsigned k = 0; k < photons->getSize(); k++) nPhotonHits += photons->get(k).nHits;
+				sink->clear();
+			}
+			delete grouper;
+			delete hits;
+			delete config;
+
+			printf(" %10.1f %6.2f", 1E-6 * nBuffers * N / tGroup, nPhotonHits / nPhotons);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+	return 0;
+}
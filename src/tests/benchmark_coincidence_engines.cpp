@@ -0,0 +1,62 @@
+/*
+ * Throughput of the region queue coincidence engine against the scan engine, over photon
+ * rates and coincidence time windows, among them the shipped window of 2 clocks.
+ * Usage: benchmark_coincidence_engines [number of buffers]
+ */
+
+#include "TestUtil.hpp"
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	unsigned nBuffers = (argc > 1) ? atoi(argv[1]) : 100;
+	const unsigned N = 16384;
+
+	TestDir dir;
+	TestSystem system(dir, 8);
+	TestEventStream stream;
+
+	// Mean clocks between events over the 64 regions, and windows in clocks
+	const double intervals[] = { 50, 10, 2, 0.5 };
+	const double windows[] = { 0.2, 2, 20, 200 };
+
+	printf("# %u buffers of photons from %u hits over %u regions; Mphotons/s\n", nBuffers, N, system.getNumberOfRegions());
+	printf("%10s %8s %10s %10s %10s %8s\n", "interval", "window", "photons", "scan", "region", "speedup");
+	for(unsigned i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+		for(unsigned w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+			char settings[256];
+			sprintf(settings, "[sw_trigger]\ncoincidence_time_window = %g\n", windows[w]);
+			std::string configName = system.writeConfig("config.ini", settings);
+			SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+
+			std::mt19937 rng(34);
+			EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(N, 0, 0);
+			generateRawHits(raw, config, system, N, 0.0, intervals[i], rng);
+			EventBuffer<GammaPhoton> *photons = groupHits(config, &stream, processHits(config, &stream, raw));
+
+			double t[2] = { 0, 0 };
+			for(int e = 0; e < 2; e++) {
+				config->sw_trigger_coincidence_engine = (e == 0) ? SystemConfig::COINCIDENCE_ENGINE_SCAN : SystemConfig::COINCIDENCE_ENGINE_REGION;
+				CaptureSink<Coincidence> *sink = new CaptureSink<Coincidence>();
+				CoincidenceGrouper *grouper = new CoincidenceGrouper(config, &stream, sink);
+				for(unsigned n = 0; n < nBuffers; n++) {
+					EventBuffer<GammaPhoton> *in = copyBuffer(photons);
+					double t0 = now();
+					grouper->pushEvents(in);
+					t[e] += now() - t0;
+					sink->clear();
+				}
+				delete grouper;
+			}
+
+			double mphotons = 1E-6 * nBuffers * photons->getSize();
+			printf("%10.1f %8.1f %10lu %10.1f %10.1f %8.2f\n", intervals[i], windows[w], photons->getSize(),
+				mphotons / t[0], mphotons / t[1], t[0] / t[1]);
+			delete photons;
+			delete config;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Reads time1 and energy1 of every coincidence from a cold cache, from a columnar file
+ * with ColumnarFileReader and from the .ldat records of the same events, and reports
+ * the time and the bytes read from disk for each. The files are written first, in the
+ * given directory, and removed afterwards.
+ * Usage: benchmark_columnar_projection [size of the .ldat file in GB] [directory]
+ */
+
+#include "OutputReference.hpp"
+#include <ColumnarFile.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+// Bytes which this process caused to be read from storage
+static long long readBytes()
+{
+	long long n = -1;
+	FILE *f = fopen("/proc/self/io", "r");
+	if(f == NULL) return n;
+	char line[256];
+	while(fgets(line, sizeof(line), f) != NULL) {
+		if(sscanf(line, "read_bytes: %lld", &n) == 1) break;
+	}
+	fclose(f);
+	return n;
+}
+
+// Drop a file from the page cache, so that it is read again from storage
+static void dropCache(const char *fileName)
+{
+	int fd = open(fileName, O_RDONLY);
+	if(fd < 0) return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static long long fileSize(const char *fileName)
+{
+	struct stat st;
+	return (stat(fileName, &st) == 0) ? st.st_size : 0;
+}
+
+struct Projection {
+	double seconds;
+	long long bytesRead;
+	long long nRows;
+	// Of the values, and of the bits of the energies, some of which are not numbers
+	long long timeSum;
+	unsigned long long energyBits;
+};
+
+static void report(const char *what, Projection &p, long long fileBytes)
+{
+	printf("%-10s %10.2f %10.2f %10.2f %10.3f %10.2f\n", what, 1E-9 * fileBytes,
+		(p.bytesRead >= 0) ? 1E-9 * p.bytesRead : NAN, p.seconds, 1E-6 * p.nRows / p.seconds,
+		1E-9 * fileBytes / p.seconds);
+}
+
+int main(int argc, char *argv[])
+{
+	double sizeGB = (argc > 1) ? atof(argv[1]) : 3;
+	TestDir dir;
+	std::string prefix = (argc > 2) ? std::string(argv[2]) + "/benchmark_projection" : dir.file("out");
+
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+
+	std::mt19937 rng(44);
+	TestEvents events;
+	const long long bufferLength = 1LL << 20;
+	const unsigned nBuffers = 16;
+	makeTestEvents(events, config, &stream, system, nBuffers, 200000, bufferLength, rng);
+
+	// The same coincidences repeated, later each time, until the .ldat file has the requested size
+	std::string binaryName = prefix + "_binary";
+	std::string columnarName = prefix + "_columnar";
+	DataFileWriter *binary = new DataFileWriter((char *)binaryName.c_str(), true, frequency, COINCIDENCE, FILE_BINARY, 0, 1, 1024, 0, 0);
+	DataFileWriter *columnar = new DataFileWriter((char *)columnarName.c_str(), true, frequency, COINCIDENCE, FILE_COLUMNAR, 0, 1, 1024, 0, 0);
+	binary->setStepValues(0, 0);
+	columnar->setStepValues(0, 0);
+	size_t blockBytes = 0;
+	for(unsigned n = 0; n < nBuffers; n++) {
+		OutputBlock *block = binary->formatCoincidenceEvents(events.coincidences[n], 0, 0);
+		blockBytes += block->getSize();
+		binary->writeBlock(block);
+		columnar->writeBlock(columnar->formatCoincidenceEvents(events.coincidences[n], 0, 0));
+	}
+	long long nRepeat = (long long)(sizeGB * 1E9 / blockBytes);
+	for(long long k = 1; k < nRepeat; k++) {
+		double t0 = k * nBuffers * bufferLength;
+		for(unsigned n = 0; n < nBuffers; n++) {
+			binary->writeBlock(binary->formatCoincidenceEvents(events.coincidences[n], t0, 0));
+			columnar->writeBlock(columnar->formatCoincidenceEvents(events.coincidences[n], t0, 0));
+		}
+	}
+	binary->closeStep();
+	columnar->closeStep();
+	delete binary;
+	delete columnar;
+
+	binaryName += ".ldat";
+	columnarName += ".lcol";
+	dropCache(binaryName.c_str());
+	dropCache(columnarName.c_str());
+
+	// Only the pages of the two columns are read, the next block's while this one is summed
+	Projection c = { 0, 0, 0, 0, 0 };
+	long long r0 = readBytes();
+	double s0 = now();
+	{
+		ColumnarFileReader reader(columnarName.c_str());
+		int time1 = reader.getColumnIndex("time1");
+		int energy1 = reader.getColumnIndex("energy1");
+		uint64_t nBlocks = reader.getNumberOfBlocks();
+		if(nBlocks > 0) {
+			reader.prefetchColumn(0, time1);
+			reader.prefetchColumn(0, energy1);
+		}
+		for(uint64_t b = 0; b < nBlocks; b++) {
+			if(b + 1 < nBlocks) {
+				reader.prefetchColumn(b + 1, time1);
+				reader.prefetchColumn(b + 1, energy1);
+			}
+			uint64_t N = reader.getNumberOfRows(b);
+			const long long *t = (const long long *)reader.getColumn(b, time1);
+			const uint32_t *e = (const uint32_t *)reader.getColumn(b, energy1);
+			for(uint64_t r = 0; r < N; r++) {
+				c.timeSum += t[r];
+				c.energyBits += e[r];
+			}
+			c.nRows += N;
+		}
+	}
+	c.seconds = now() - s0;
+	c.bytesRead = (r0 >= 0) ? readBytes() - r0 : -1;
+
+	// The records are read whole, as the analysis jobs read them
+	Projection b = { 0, 0, 0, 0, 0 };
+	r0 = readBytes();
+	s0 = now();
+	{
+		FILE *f = fopen(binaryName.c_str(), "r");
+		const size_t chunk = 1 << 16;
+		std::vector<CoincidenceEvent> records(chunk);
+		size_t N;
+		while((N = fread(records.data(), sizeof(CoincidenceEvent), chunk, f)) > 0) {
+			for(size_t r = 0; r < N; r++) {
+				b.timeSum += records[r].time1;
+				uint32_t e;
+				memcpy(&e, &records[r].e1, sizeof(e));
+				b.energyBits += e;
+			}
+			b.nRows += N;
+		}
+		fclose(f);
+	}
+	b.seconds = now() - s0;
+	b.bytesRead = (r0 >= 0) ? readBytes() - r0 : -1;
+
+	printf("# time1 and energy1 of %lld coincidences, from a cold cache\n", c.nRows);
+	printf("%-10s %10s %10s %10s %10s %10s\n", "format", "file GB", "read GB", "seconds", "Mrows/s", "file GB/s");
+	report("columnar", c, fileSize(columnarName.c_str()));
+	report("ldat", b, fileSize(binaryName.c_str()));
+	bool same = (c.nRows == b.nRows) && (c.timeSum == b.timeSum) && (c.energyBits == b.energyBits);
+	if(!same) {
+		fprintf(stderr, "ERROR: the columnar file has different events than the .ldat file\n");
+	}
+
+	unlink(binaryName.c_str());
+	unlink((prefix + "_binary.lidx").c_str());
+	unlink(columnarName.c_str());
+	delete config;
+	return same ? 0 : 1;
+}
@@ -0,0 +1,61 @@
+/*
+ * Throughput of the region bucket grouping engine against the scan engine, over hit rates
+ * and group time windows.
+ * Usage: benchmark_group_engines [number of buffers]
+ */
+
+#include "TestUtil.hpp"
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	unsigned nBuffers = (argc > 1) ? atoi(argv[1]) : 100;
+	const unsigned N = 16384;
+
+	TestDir dir;
+	TestSystem system(dir, 8);
+	TestEventStream stream;
+
+	// Mean clocks between events over the 64 regions, and windows in ns
+	const double intervals[] = { 20, 5, 1 };
+	const double windows[] = { 5, 20, 100 };
+	const char *engines[] = { "scan", "region" };
+
+	printf("# %u buffers of %u hits over %u regions; Mhits/s\n", nBuffers, N, system.getNumberOfRegions());
+	printf("%10s %8s %10s %10s %8s\n", "interval", "window", "scan", "region", "speedup");
+	for(unsigned i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+		for(unsigned w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+			double t[2] = { 0, 0 };
+			for(int e = 0; e < 2; e++) {
+				char settings[256];
+				sprintf(settings, "[sw_trigger]\ngroup_engine = %s\ngroup_time_window = %f\n", engines[e], windows[w]);
+				std::string configName = system.writeConfig("config.ini", settings);
+				SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+
+				std::mt19937 rng(31);
+				EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(N, 0, 0);
+				generateRawHits(raw, config, system, N, 0.0, intervals[i], rng);
+				EventBuffer<Hit> *hits = processHits(config, &stream, raw);
+
+				CaptureSink<GammaPhoton> *sink = new CaptureSink<GammaPhoton>();
+				SimpleGrouper *grouper = new SimpleGrouper(config, &stream, sink);
+				for(unsigned n = 0; n < nBuffers; n++) {
+					EventBuffer<Hit> *in = copyBuffer(hits);
+					double t0 = now();
+					grouper->pushEvents(in);
+					t[e] += now() - t0;
+					sink->clear();
+				}
+				delete grouper;
+				delete hits;
+				delete config;
+			}
+
+			double mhits = 1E-6 * nBuffers * N;
+			printf("%10.0f %8.0f %10.1f %10.1f %8.2f\n", intervals[i], windows[w], mhits / t[0], mhits / t[1], t[0] / t[1]);
+		}
+	}
+	return 0;
+}
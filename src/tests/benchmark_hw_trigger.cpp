@@ -0,0 +1,61 @@
+/*
+ * Throughput of HwTriggerSimulator, request finding, coincidence matching and hit
+ * selection together, over event rates of 1x to 10x of 0.05 events per clock and
+ * buffer sizes.
+ * Usage: benchmark_hw_trigger [number of hits]
+ */
+
+#include "TestUtil.hpp"
+#include <HwTriggerSimulator.hpp>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	unsigned nHits = (argc > 1) ? atoi(argv[1]) : 200000;
+
+	TestDir dir;
+	TestSystem system(dir, 8);
+	std::string configName = system.writeConfig("config.ini",
+		"[hw_trigger]\n"
+		"hwtrigger_empirical_calibration_table = %CDIR%/firmware.tsv\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL);
+
+	const double rates[] = { 0.05, 0.1, 0.2, 0.5 };
+	const unsigned bufferSizes[] = { 2048, 32768 };
+
+	printf("# %u hits over %u regions, default trigger settings; Mhits/s and fraction passed\n", nHits, system.getNumberOfRegions());
+	printf("%10s %10s %10s %8s\n", "events/clk", "buffer", "Mhits/s", "passed");
+	for(unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+		for(unsigned b = 0; b < sizeof(bufferSizes) / sizeof(bufferSizes[0]); b++) {
+			unsigned N = bufferSizes[b];
+			std::mt19937 rng(37);
+			std::vector<EventBuffer<RawHit> *> raw;
+			for(unsigned n = 0; n < nHits; n += N) {
+				EventBuffer<RawHit> *buffer = new EventBuffer<RawHit>(N, raw.size(), 0);
+				generateRawHits(buffer, config, system, N, 0, 1 / rates[r], rng);
+				raw.push_back(buffer);
+			}
+
+			CaptureSink<RawHit> *sink = new CaptureSink<RawHit>();
+			HwTriggerSimulator *trigger = new HwTriggerSimulator(config, sink);
+			double t = 0;
+			double nPassed = 0;
+			for(unsigned n = 0; n < raw.size(); n++) {
+				double t0 = now();
+				trigger->pushEvents(raw[n]);
+				t += now() - t0;
+				nPassed += sink->buffers[0]->getSize();
+				sink->clear();
+			}
+			delete trigger;
+
+			double hits = (double)raw.size() * N;
+			printf("%10.2f %10u %10.2f %8.3f\n", rates[r], N, 1E-6 * hits / t, nPassed / hits);
+		}
+	}
+
+	delete config;
+	return 0;
+}
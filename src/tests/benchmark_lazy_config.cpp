@@ -0,0 +1,79 @@
+/*
+ * Startup time of a run against a large calibration set: the full load of the tables of a
+ * 1024 ASIC system against the lazy load of the ASICs of a run which has hits in 16 of them,
+ * with the active ASICs taken from the .modf file or from a prescan of the raw data.
+ * Usage: benchmark_lazy_config [repetitions]
+ */
+
+#include "TestUtil.hpp"
+#include <RawReader.hpp>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	unsigned nRepetitions = (argc > 1) ? atoi(argv[1]) : 5;
+
+	// 16 FEB/Ds of 8 slaves with 8 ASICs each
+	TestDir dir;
+	TestSystem system(dir, 16, false, 1, 8, 8);
+	std::string configName = system.writeConfig("config.ini");
+	u_int64_t mask = SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS;
+	SystemConfig *full = SystemConfig::fromFile(configName.c_str(), mask);
+
+	// A run with hits in the 16 ASICs of two slaves
+	bool *runAsics = new bool[MAX_NUMBER_ASICS]();
+	std::string modeFile = "#portID\tslaveID\tchipID\tchannelID\tmode\n";
+	for(unsigned n = 0; n < 16 * 64; n++) {
+		unsigned channelID = system.getChannelID(5 * 8 * 64 + n);
+		runAsics[channelID >> 6] = true;
+		char line[128];
+		sprintf(line, "%u\t%u\t%u\t%u\ttot\n", channelID >> 17, (channelID >> 12) % 32, (channelID >> 6) % 64, channelID % 64);
+		modeFile += line;
+	}
+	std::mt19937 rng(30);
+	EventBuffer<RawHit> *generated = new EventBuffer<RawHit>(1000000, 0, 0);
+	generateRawHits(generated, full, system, 1000000, 0, 1, rng);
+	std::vector<RawHit> kept;
+	for(unsigned n = 0; n < generated->getSize(); n++) {
+		RawHit &hit = generated->get(n);
+		if(runAsics[hit.channelID >> 6]) kept.push_back(hit);
+	}
+	delete generated;
+	std::stable_sort(kept.begin(), kept.end(), [](const RawHit &a, const RawHit &b) { return a.frameID < b.frameID; });
+	EventBuffer<RawHit> *hits = new EventBuffer<RawHit>(kept.size(), 0, 0);
+	for(unsigned n = 0; n < kept.size(); n++) hits->push(kept[n]);
+	writeRawFile(dir, "run", hits, 0, kept.back().frameID + 1);
+	delete hits;
+	delete full;
+
+	printf("# %u ASICs in the tables, %lu hits in 16 ASICs in the run; best of %u\n",
+		system.getNumberOfRegions(), kept.size(), nRepetitions);
+	printf("%-10s %10s %10s %10s\n", "load", "scan (s)", "load (s)", "channels");
+	const char *loads[] = { "full", "prescan", "modf" };
+	for(int l = 0; l < 3; l++) {
+		if(l == 2) dir.writeFile("run.modf", modeFile);
+		double bestScan = 1E9;
+		double bestLoad = 1E9;
+		unsigned nChannels = 0;
+		for(unsigned r = 0; r < nRepetitions; r++) {
+			double t0 = now();
+			RawReader *reader = RawReader::openFile(dir.file("run").c_str(), RawReader::SYNC);
+			const bool *activeAsics = (l == 0) ? NULL : reader->getActiveAsics();
+			double t1 = now();
+			SystemConfig *config = SystemConfig::fromFile(configName.c_str(), mask, activeAsics);
+			double t2 = now();
+			nChannels = config->getNumberOfChannels() - 1;
+			delete config;
+			delete reader;
+			bestScan = std::min(bestScan, t1 - t0);
+			bestLoad = std::min(bestLoad, t2 - t1);
+		}
+		printf("%-10s %10.4f %10.4f %10u\n", loads[l], bestScan, bestLoad, nChannels);
+	}
+
+	delete [] runAsics;
+	return 0;
+}
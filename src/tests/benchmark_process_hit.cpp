@@ -0,0 +1,74 @@
+/*
+ * Throughput of ProcessHit over the combinations of configuration flags and buffer
+ * energy modes, against the generic loop which tests the flags for every hit.
+ * Usage: benchmark_process_hit [number of buffers]
+ */
+
+#include "TestUtil.hpp"
+#include "ProcessHitReference.hpp"
+#include <ProcessHit.hpp>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	unsigned nBuffers = (argc > 1) ? atoi(argv[1]) : 200;
+	const unsigned N = 16384;
+
+	TestDir dir;
+	TestSystem system(dir, 8);
+	std::string configName = system.writeConfig("config.ini");
+	const char *modeNames[] = { "ToT", "QDC", "mixed" };
+	const double qdcFractions[] = { 0.0, 1.0, 0.5 };
+
+	struct { const char *name; u_int64_t mask; } flagSets[] = {
+		{ "none", 0 },
+		{ "TDC", SystemConfig::LOAD_TDC_CALIBRATION },
+		{ "TDC+map", SystemConfig::LOAD_TDC_CALIBRATION | SystemConfig::LOAD_MAPPING },
+		{ "TDC+QDC+map", SystemConfig::LOAD_TDC_CALIBRATION | SystemConfig::LOAD_QDC_CALIBRATION | SystemConfig::LOAD_MAPPING },
+		{ "all", SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS }
+	};
+
+	printf("# %u buffers of %u hits; Mhits/s\n", nBuffers, N);
+	printf("%-14s %-6s %10s %10s %8s\n", "flags", "buffer", "generic", "ProcessHit", "speedup");
+	for(unsigned f = 0; f < sizeof(flagSets) / sizeof(flagSets[0]); f++) {
+		SystemConfig *config = SystemConfig::fromFile(configName.c_str(), flagSets[f].mask);
+		TestEventStream stream;
+		for(int mode = 0; mode < 3; mode++) {
+			std::mt19937 rng(mode);
+			EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(N, 0, 0);
+			generateRawHits(raw, config, system, N, qdcFractions[mode], 20, rng);
+
+			// Both loops are timed over processing, handing over and freeing the input
+			double tReference = 0;
+			for(unsigned n = 0; n < nBuffers; n++) {
+				EventBuffer<RawHit> *in = copyBuffer(raw);
+				double t0 = now();
+				EventBuffer<Hit> *out = processHitsReference(config, &stream, in);
+				delete in;
+				tReference += now() - t0;
+				delete out;
+			}
+
+			CaptureSink<Hit> *sink = new CaptureSink<Hit>();
+			ProcessHit *processHit = new ProcessHit(config, &stream, sink);
+			double tProcessHit = 0;
+			for(unsigned n = 0; n < nBuffers; n++) {
+				EventBuffer<RawHit> *in = copyBuffer(raw);
+				double t0 = now();
+				processHit->pushEvents(in);
+				tProcessHit += now() - t0;
+				sink->clear();
+			}
+			delete processHit;
+			delete raw;
+
+			double hits = 1E-6 * nBuffers * N;
+			printf("%-14s %-6s %10.1f %10.1f %8.2f\n", flagSets[f].name, modeNames[mode],
+				hits / tReference, hits / tProcessHit, tReference / tProcessHit);
+		}
+		delete config;
+	}
+	return 0;
+}
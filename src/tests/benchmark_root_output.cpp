@@ -0,0 +1,74 @@
+/*
+ * Write throughput of the ROOT output with the serial fill of the output tree, entry by
+ * entry, against batches compressed by worker threads and appended with a fast copy, for
+ * singles, groups and coincidences, with write*Events() and with buffers formatted ahead.
+ * Usage: benchmark_root_output [number of repetitions] [directory]
+ */
+
+#include "OutputReference.hpp"
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	unsigned nRepetitions = (argc > 1) ? atoi(argv[1]) : 3;
+	TestDir dir;
+	std::string path = (argc > 2) ? std::string(argv[2]) : dir.path;
+
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+
+	std::mt19937 rng(43);
+	TestEvents events;
+	makeTestEvents(events, config, &stream, system, 32, 50000, 1LL << 20, rng);
+
+	struct { const char *name; EVENT_TYPE eventType; } eventTypes[] = {
+		{ "singles", SINGLE },
+		{ "groups", GROUP },
+		{ "coincidences", COINCIDENCE }
+	};
+	std::string fileName = path + "/benchmark_root_output.root";
+
+	printf("# %u buffers written to a ROOT file, best of %u; Mentries/s and MB\n", events.size(), nRepetitions);
+	printf("%14s %8s %10s %10s %10s %8s %8s %8s\n", "events", "ahead", "entries", "serial", "batches", "speedup", "serial", "batches");
+	for(unsigned e = 0; e < sizeof(eventTypes) / sizeof(eventTypes[0]); e++)
+	for(int formatAhead = 0; formatAhead < 2; formatAhead++) {
+		double t[2] = { 1E9, 1E9 };
+		long long size[2] = { 0, 0 };
+		long long nEntries = 0;
+		for(int batches = 0; batches < 2; batches++) {
+			for(unsigned r = 0; r < nRepetitions; r++) {
+				double t0 = now();
+				DataFileWriter *writer = new DataFileWriter((char *)fileName.c_str(), false, frequency, eventTypes[e].eventType, FILE_ROOT,
+					0, 1, 1024, 0, 0);
+				if(batches) writer->enableRootBatches();
+				writeTestEvents(writer, events, eventTypes[e].eventType, 0, 0, formatAhead);
+				delete writer;
+				t[batches] = std::min(t[batches], now() - t0);
+			}
+			struct stat st;
+			stat(fileName.c_str(), &st);
+			size[batches] = st.st_size;
+		}
+		for(unsigned n = 0; n < events.size(); n++) {
+			if(eventTypes[e].eventType == SINGLE) nEntries += events.singles[n]->getSize();
+			else if(eventTypes[e].eventType == GROUP) nEntries += events.groups[n]->getSize();
+			else nEntries += events.coincidences[n]->getSize();
+		}
+
+		printf("%14s %8s %10lld %10.2f %10.2f %8.2f %8.1f %8.1f\n", eventTypes[e].name, formatAhead ? "yes" : "no", nEntries,
+			1E-6 * nEntries / t[0], 1E-6 * nEntries / t[1], t[0] / t[1], size[0] / 1048576.0, size[1] / 1048576.0);
+	}
+	unlink(fileName.c_str());
+
+	delete config;
+	return 0;
+}
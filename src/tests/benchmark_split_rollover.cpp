@@ -0,0 +1,132 @@
+/*
+ * Latency of DataFileWriter::writeBlock() with split output, as histograms of the blocks
+ * which start a new part and of the other blocks, for the text and binary formats.
+ * Blocks are written as fast as possible, when the writer waits for the previous part to be
+ * closed if parts take less time than that, and at the rate at which the data was acquired.
+ * Usage: benchmark_split_rollover [number of parts] [directory]
+ */
+
+#include "OutputReference.hpp"
+#include <math.h>
+#include <algorithm>
+#include <unistd.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+// Counts of latencies in powers of 2 of a microsecond
+struct Histogram {
+	static const int nBins = 22;
+	long long counts[nBins];
+	std::vector<double> values;
+
+	Histogram() { memset(counts, 0, sizeof(counts)); };
+
+	void fill(double seconds) {
+		int bin = (int)floor(log2(seconds * 1E6 + 1));
+		if(bin >= nBins) bin = nBins - 1;
+		counts[bin] += 1;
+		values.push_back(seconds);
+	};
+
+	double quantile(double q) {
+		if(values.empty()) return NAN;
+		std::sort(values.begin(), values.end());
+		return values[(size_t)(q * (values.size() - 1))];
+	};
+};
+
+static void report(const char *what, Histogram &rollover, Histogram &other)
+{
+	printf("# %s\n", what);
+	printf("%14s %10s %10s\n", "us", "rollover", "other");
+	for(int b = 0; b < Histogram::nBins; b++) {
+		if(rollover.counts[b] == 0 && other.counts[b] == 0) continue;
+		printf("%6d - %-6d %10lld %10lld\n", (1 << b) - 1, (1 << (b + 1)) - 1, rollover.counts[b], other.counts[b]);
+	}
+	printf("%14s %10.1f %10.1f\n", "p50", 1E6 * rollover.quantile(0.5), 1E6 * other.quantile(0.5));
+	printf("%14s %10.1f %10.1f\n", "p99", 1E6 * rollover.quantile(0.99), 1E6 * other.quantile(0.99));
+	printf("%14s %10.1f %10.1f\n", "max", 1E6 * rollover.quantile(1.0), 1E6 * other.quantile(1.0));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nParts = (argc > 1) ? atoi(argv[1]) : 200;
+	TestDir dir;
+	std::string path = (argc > 2) ? std::string(argv[2]) : dir.path;
+
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+
+	std::mt19937 rng(47);
+	TestEvents events;
+	const long long bufferLength = 1LL << 20;
+	const unsigned nBuffers = 16;
+	makeTestEvents(events, config, &stream, system, nBuffers, 50000, bufferLength, rng);
+	// Parts of 4 buffers
+	const unsigned partBuffers = 4;
+	float splitTime = partBuffers * bufferLength / frequency;
+
+	struct { const char *name; FILE_TYPE fileType; bool async; const char *extension; } formats[] = {
+		{ "text", FILE_TEXT, false, ".txt" },
+		{ "text, asynchronous", FILE_TEXT, true, ".txt" },
+		{ "binary", FILE_BINARY, false, "" },
+		{ "binary, asynchronous", FILE_BINARY, true, "" }
+	};
+
+	printf("# writeBlock() latency of %u parts of %u buffers of %u singles\n", nParts, partBuffers, events.singles[0]->getSize());
+	for(int paced = 0; paced < 2; paced++)
+	for(unsigned f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		std::string fileName = path + "/benchmark_rollover" + formats[f].extension;
+		DataFileWriter *writer = new DataFileWriter((char *)fileName.c_str(), formats[f].async, frequency, SINGLE, formats[f].fileType,
+			0, 1, 1024, splitTime, 0);
+		writer->setStepValues(0, 0);
+
+		Histogram rollover, other;
+		double start = now();
+		for(unsigned n = 0; n < nParts * partBuffers; n++) {
+			// The same hits again and again, in a buffer which starts later each time
+			EventBuffer<Hit> *hits = events.singles[n % nBuffers];
+			EventBuffer<Hit> *buffer = new EventBuffer<Hit>(hits->getSize(), n, n * bufferLength);
+			for(unsigned i = 0; i < hits->getSize(); i++) buffer->push(hits->get(i));
+			OutputBlock *block = writer->formatSingleEvents(buffer, 0);
+			delete buffer;
+
+			if(paced) {
+				double wait = start + n * bufferLength / frequency - now();
+				if(wait > 0) usleep(wait * 1E6);
+			}
+			double s = now();
+			writer->writeBlock(block);
+			double latency = now() - s;
+			if(n > 0 && n % partBuffers == 0) rollover.fill(latency);
+			else other.fill(latency);
+		}
+		writer->closeStep();
+		delete writer;
+		std::string what = std::string(formats[f].name) + (paced ? ", at the acquisition rate" : ", as fast as possible");
+		report(what.c_str(), rollover, other);
+
+		// Remove the parts
+		char partName[1024];
+		for(unsigned n = 0; n < nParts; n++) {
+			std::string base = path + "/benchmark_rollover";
+			if(formats[f].fileType == FILE_TEXT) {
+				sprintf(partName, "%s_%08u.txt", base.c_str(), n);
+				unlink(partName);
+			}
+			else {
+				sprintf(partName, "%s_%08u.ldat", base.c_str(), n);
+				unlink(partName);
+				sprintf(partName, "%s_%08u.lidx", base.c_str(), n);
+				unlink(partName);
+			}
+		}
+	}
+
+	delete config;
+	return 0;
+}
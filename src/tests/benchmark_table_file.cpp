@@ -0,0 +1,93 @@
+/*
+ * Startup time of the calibration tables: TableFile against the line by line loader which
+ * SystemConfig used before it (fscanf, five regular expression replacements and sscanf per
+ * line), over the TDC table, and the whole of SystemConfig::fromFile(), for systems of
+ * 2048 and 16384 channels.
+ * Usage: benchmark_table_file [repetitions]
+ */
+
+#include "TestUtil.hpp"
+#include <TableFile.hpp>
+#include <boost/regex.hpp>
+#include <limits.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+// The line normalization of the old loader
+static void normalizeLine(char *line) {
+	std::string s = std::string(line);
+	s = boost::regex_replace(s, boost::regex("\r"), "");
+	s = boost::regex_replace(s, boost::regex("\\s*#.*"), "");
+	s = boost::regex_replace(s, boost::regex("^\\s+"), "");
+	s = boost::regex_replace(s, boost::regex("\\s+$"), "");
+	s = boost::regex_replace(s, boost::regex("\\s+"), "\t");
+	strcpy(line, s.c_str());
+}
+
+// Rows of a TDC table, as the old loader read them
+static unsigned loadOld(const char *fn)
+{
+	FILE *f = fopen(fn, "r");
+	if(f == NULL) {
+		fprintf(stderr, "Could not open '%s' for reading: %s\n", fn, strerror(errno));
+		exit(1);
+	}
+	unsigned nRows = 0;
+	char line[PATH_MAX];
+	while(fscanf(f, "%[^\n]\n", line) == 1) {
+		normalizeLine(line);
+		if(strlen(line) == 0) continue;
+
+		unsigned portID, slaveID, chipID, channelID, tacID;
+		char bStr;
+		float t0, a0, a1, a2;
+		if(sscanf(line, "%d\t%u\t%u\t%u\t%u\t%c\t%f\t%f\t%f\t%f\n",
+			&portID, &slaveID, &chipID, &channelID, &tacID, &bStr,
+			&t0, &a0, &a1, &a2) != 10) continue;
+		nRows++;
+	}
+	fclose(f);
+	return nRows;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned nRepetitions = (argc > 1) ? atoi(argv[1]) : 3;
+	const unsigned nPorts[] = { 4, 32 };
+
+	printf("# TDC table and whole configuration load, best of %u; seconds\n", nRepetitions);
+	printf("%10s %10s %10s %10s %10s %10s\n", "channels", "TDC MB", "old", "TableFile", "speedup", "fromFile");
+	for(unsigned s = 0; s < sizeof(nPorts) / sizeof(nPorts[0]); s++) {
+		TestDir dir;
+		TestSystem system(dir, nPorts[s]);
+		std::string configName = system.writeConfig("config.ini");
+		std::string tdcName = dir.file("tdc.tsv");
+		struct stat st;
+		stat(tdcName.c_str(), &st);
+
+		double tOld = 1E9, tNew = 1E9, tConfig = 1E9;
+		unsigned nOld = 0, nNew = 0;
+		for(unsigned r = 0; r < nRepetitions; r++) {
+			double t0 = now();
+			nOld = loadOld(tdcName.c_str());
+			double t1 = now();
+			TableFile *table = new TableFile(tdcName.c_str(), "uuuuucffff");
+			table->start();
+			table->wait();
+			nNew = table->getNumberOfRows();
+			delete table;
+			double t2 = now();
+			SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+			double t3 = now();
+			delete config;
+			tOld = std::min(tOld, t1 - t0);
+			tNew = std::min(tNew, t2 - t1);
+			tConfig = std::min(tConfig, t3 - t2);
+		}
+		if(nOld != nNew) fprintf(stderr, "ERROR: %u rows from the old loader, %u from TableFile\n", nOld, nNew);
+		printf("%10u %10.1f %10.4f %10.4f %10.1f %10.4f\n", system.getNumberOfChannels(), st.st_size / 1048576.0,
+			tOld, tNew, tOld / tNew, tConfig);
+	}
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Processing time of a raw file through RawReader, CoarseSorter, ProcessHit, SimpleGrouper
+ * and CoincidenceGrouper, as convert_raw_to_coincidence runs it, with time slices of
+ * 100%, 50%, 25%, 10% and 1% of every 1024 frames selected by RawReader::setTimeSlicePrescale().
+ * Usage: benchmark_time_slices [number of frames] [repetitions]
+ */
+
+#include "TestUtil.hpp"
+#include <RawReader.hpp>
+#include <CoarseSorter.hpp>
+#include <algorithm>
+#include <sys/stat.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+static double runStep(TestDir &dir, SystemConfig *config, unsigned sliceFrames, unsigned windowFrames)
+{
+	double t0 = now();
+	RawReader *reader = RawReader::openFile(dir.file("run").c_str(), RawReader::SYNC);
+	if(sliceFrames < windowFrames) reader->setTimeSlicePrescale(sliceFrames, windowFrames);
+	reader->setSystemConfig(config);
+	while(reader->getNextStep()) {
+		reader->processStep(false,
+			new CoarseSorter(
+			new ProcessHit(config, reader,
+			new SimpleGrouper(config, reader,
+			new CoincidenceGrouper(config, reader,
+			new NullSink<Coincidence>()
+			)))));
+	}
+	delete reader;
+	return now() - t0;
+}
+
+int main(int argc, char *argv[])
+{
+	long long nFrames = (argc > 1) ? atoll(argv[1]) : 16384;
+	unsigned nRepetitions = (argc > 2) ? atoi(argv[2]) : 3;
+
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n");
+	// ToT mode, as the raw file header says
+	u_int64_t mask = SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS
+		^ SystemConfig::LOAD_QDC_CALIBRATION ^ SystemConfig::LOAD_ENERGY_CALIBRATION;
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), mask);
+
+	const long long firstFrame = 1000003 * 8;
+	std::mt19937 rng(46);
+	EventBuffer<RawHit> *generated = new EventBuffer<RawHit>(nFrames * 100, 0, 0);
+	generateRawHits(generated, config, system, nFrames * 100, 0, 10, rng);
+	std::vector<RawHit> kept;
+	for(unsigned n = 0; n < generated->getSize(); n++) {
+		RawHit hit = generated->get(n);
+		hit.time += firstFrame * 1024;
+		hit.timeEnd += firstFrame * 1024;
+		hit.frameID = hit.time / 1024;
+		if(hit.frameID >= firstFrame + nFrames) continue;
+		kept.push_back(hit);
+	}
+	delete generated;
+	std::stable_sort(kept.begin(), kept.end(), [](const RawHit &a, const RawHit &b) { return a.time < b.time; });
+	EventBuffer<RawHit> *hits = new EventBuffer<RawHit>(kept.size(), 0, 0);
+	for(unsigned n = 0; n < kept.size(); n++) hits->push(kept[n]);
+	std::vector<RawHit>().swap(kept);
+	writeRawFile(dir, "run", hits, firstFrame, firstFrame + nFrames);
+	struct stat st;
+	stat(dir.file("run.rawf").c_str(), &st);
+
+	const double fractions[] = { 100, 50, 25, 10, 1 };
+	const unsigned windowFrames = 1024;
+
+	printf("# %u hits in %lld frames (%.1f MB), best of %u; seconds\n", hits->getSize(), nFrames, st.st_size / 1048576.0, nRepetitions);
+	printf("%10s %10s %10s %10s\n", "fraction", "frames", "seconds", "speedup");
+	delete hits;
+	double tFull = 0;
+	for(unsigned f = 0; f < sizeof(fractions) / sizeof(fractions[0]); f++) {
+		// As convert_raw_to_coincidence sets it from --timeSliceFraction
+		unsigned sliceFrames = round(windowFrames * fractions[f] / 100.0);
+		double t = 1E9;
+		for(unsigned r = 0; r < nRepetitions; r++) {
+			t = std::min(t, runStep(dir, config, sliceFrames, windowFrames));
+		}
+		if(f == 0) tFull = t;
+		printf("%9.0f%% %10u %10.3f %10.1f\n", fractions[f], sliceFrames, t, tFull / t);
+	}
+
+	delete config;
+	return 0;
+}
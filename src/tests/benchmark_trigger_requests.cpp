@@ -0,0 +1,87 @@
+/*
+ * Throughput and working memory of findTriggerRequestsDense() and findTriggerRequestsSparse(),
+ * over buffer lengths and hit rates.
+ * Usage: benchmark_trigger_requests [number of repetitions]
+ */
+
+#include "TestUtil.hpp"
+#include <HwTriggerSimulator.hpp>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	unsigned nRepeat = (argc > 1) ? atoi(argv[1]) : 5;
+
+	TestDir dir;
+	TestSystem system(dir, 1);
+	std::string configName = system.writeConfig("config.ini");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), 0);
+	config->sw_fw_trigger_group_min_energy = 0;
+	config->sw_fw_trigger_group_max_energy = 128;
+	config->sw_fw_trigger_group_min_nhits = 1;
+	config->sw_fw_trigger_group_max_nhits = 1024;
+
+	// Buffer length in clocks and hits per clock per region
+	struct { unsigned nRegions, arraySize; double rate; } loads[] = {
+		{ 64, 100000, 1E-3 },
+		{ 64, 100000, 1E-2 },
+		{ 64, 1000000, 1E-3 },
+		{ 64, 1000000, 1E-2 },
+		{ 256, 1000000, 1E-3 },
+		{ 256, 1000000, 1E-1 },
+	};
+
+	printf("# %u repetitions; memory is the working arrays, throughput in Mhits/s\n", nRepeat);
+	printf("%8s %8s %8s %8s | %10s %10s | %10s %10s\n", "regions", "clocks", "rate", "hits",
+		"dense MB", "Mhits/s", "sparse MB", "Mhits/s");
+	std::mt19937 rng(36);
+	std::uniform_real_distribution<double> u(0, 1);
+	for(unsigned l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+		unsigned nRegions = loads[l].nRegions;
+		unsigned arraySize = loads[l].arraySize;
+		unsigned nHits = loads[l].rate * nRegions * arraySize;
+
+		std::vector<TriggerHit> hits;
+		for(unsigned n = 0; n < nHits; n++) {
+			TriggerHit hit = { (int)(rng() % nRegions), (long long)(rng() % arraySize), n, 0.1875 + 10 * u(rng) };
+			hits.push_back(hit);
+		}
+		std::sort(hits.begin(), hits.end());
+
+		double tDense = 0, tSparse = 0;
+		for(unsigned k = 0; k < nRepeat; k++) {
+			std::vector<int> *dense = new std::vector<int>[nRegions];
+			double t0 = now();
+			findTriggerRequestsDense(config, hits, arraySize, nRegions, dense);
+			tDense += now() - t0;
+			delete [] dense;
+
+			std::vector<int> *sparse = new std::vector<int>[nRegions];
+			t0 = now();
+			findTriggerRequestsSparse(config, hits, arraySize, sparse);
+			tSparse += now() - t0;
+			delete [] sparse;
+		}
+
+		// The dense search holds an energy and a multiplicity for every clock of every region;
+		// the sparse search holds one bin of at most 16 bytes per occupied clock, for one region at a time
+		unsigned maxRegionHits = 0;
+		for(unsigned h0 = 0, h = 0; h <= hits.size(); h++) {
+			if(h == hits.size() || hits[h].region != hits[h0].region) {
+				maxRegionHits = std::max(maxRegionHits, h - h0);
+				h0 = h;
+			}
+		}
+		double denseMB = 1E-6 * nRegions * arraySize * (sizeof(float) + sizeof(short));
+		double sparseMB = 1E-6 * maxRegionHits * 16;
+		double mHits = 1E-6 * nHits * nRepeat;
+		printf("%8u %8u %8.0e %8u | %10.1f %10.1f | %10.3f %10.1f\n", nRegions, arraySize, loads[l].rate, nHits,
+			denseMB, mHits / tDense, sparseMB, mHits / tSparse);
+	}
+
+	delete config;
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * The binary formats written a buffer at a time must be byte-identical to the records and
+ * step index which DataFileWriter wrote one event at a time, for every event type,
+ * hit limit and event fraction, with buffers formatted ahead out of order, and with
+ * synchronous and asynchronous writing.
+ */
+
+#include "OutputReference.hpp"
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n"
+		"coincidence_delayed_offsets = 1000\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+	const double t0 = 123456789;
+
+	std::mt19937 rng(42);
+	TestEvents events;
+	makeTestEvents(events, config, &stream, system, 8, 20000, 1LL << 20, rng);
+
+	const EVENT_TYPE eventTypes[] = { SINGLE, GROUP, COINCIDENCE };
+	const FILE_TYPE fileTypes[] = { FILE_BINARY, FILE_BINARY_COMPACT };
+	const int hitLimits[] = { 1, 3 };
+	const int eventFractions[] = { 1024, 300 };
+	std::string fileName = dir.file("out");
+	unsigned nCompared = 0;
+	size_t nBytes = 0;
+	for(unsigned e = 0; e < 3; e++)
+	for(unsigned f = 0; f < 2; f++)
+	for(unsigned l = 0; l < 2; l++)
+	for(unsigned k = 0; k < 2; k++)
+	for(short delayed = 0; delayed < ((eventTypes[e] == COINCIDENCE) ? 2 : 1); delayed++)
+	for(int mode = 0; mode < 3; mode++) {
+		// Written with write*Events(), formatted ahead, and formatted ahead with asynchronous writing
+		bool formatAhead = (mode > 0);
+		bool async = (mode == 2);
+
+		ReferenceBinaryWriter reference(frequency, fileTypes[f], hitLimits[l], eventFractions[k]);
+		reference.writeTestEvents(events, eventTypes[e], t0, delayed);
+
+		DataFileWriter *writer = new DataFileWriter((char *)fileName.c_str(), async, frequency, eventTypes[e], fileTypes[f],
+			0, hitLimits[l], eventFractions[k], 0, 0);
+		writeTestEvents(writer, events, eventTypes[e], t0, delayed, formatAhead);
+		delete writer;
+
+		std::string data = dir.readFile("out.ldat");
+		std::string index = dir.readFile("out.lidx");
+		bool same = (data == reference.data) && (index == reference.index);
+		if(!same) {
+			fprintf(stderr, "event type %d, file type %d, hit limit %d, event fraction %d, delayed %d, mode %d: "
+				"%lu bytes instead of %lu, index '%s' instead of '%s'\n",
+				eventTypes[e], fileTypes[f], hitLimits[l], eventFractions[k], delayed, mode,
+				data.size(), reference.data.size(), index.c_str(), reference.index.c_str());
+		}
+		CHECK(same);
+		CHECK(eventTypes[e] == SINGLE && fileTypes[f] == FILE_BINARY_COMPACT || reference.data.size() > 10000);
+		nCompared++;
+		nBytes += data.size();
+	}
+	fprintf(stderr, "compared %u outputs, %lu bytes\n", nCompared, nBytes);
+
+	delete config;
+	return result("test_binary_output");
+}
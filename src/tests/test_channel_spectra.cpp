@@ -0,0 +1,231 @@
+/*
+ * Channel spectra: every valid single must be counted once in the energy spectrum of its
+ * channel, or as underflow or overflow, and once in its time of frame spectrum, the bin of
+ * its time since the start of its frame, with buffers which do not start at a frame boundary.
+ * Counts filled from several threads must add up to the counts filled from one, and each
+ * step must start empty. The .lspc file must read back through its documented layout.
+ */
+
+#include "TestUtil.hpp"
+#include <DataFileWriter.hpp>
+#include <ChannelSpectra.hpp>
+#include <math.h>
+#include <map>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+struct ExpectedChannel {
+	uint32_t energyUnderflow;
+	uint32_t energyOverflow;
+	std::vector<uint32_t> energy;
+	std::vector<uint32_t> time;
+};
+
+// Singles of buffers from firstBuffer to endBuffer, as channel records in channelID order
+static std::vector<uint32_t> expectedRecords(SystemConfig *config, double Tps, std::vector<EventBuffer<Hit> *> &buffers,
+	unsigned firstBuffer, unsigned endBuffer, uint64_t &nChannels)
+{
+	unsigned energyBins = config->channel_spectra_energy_bins;
+	unsigned timeBins = config->channel_spectra_time_bins;
+	double energyMin = config->channel_spectra_energy_min;
+	double energyMax = config->channel_spectra_energy_max;
+	float Tns = Tps / 1000;
+	long double frameLength = 1024 * (long double)Tps;
+
+	std::map<uint32_t, ExpectedChannel> channels;
+	for(unsigned b = firstBuffer; b < endBuffer; b++) {
+		EventBuffer<Hit> *buffer = buffers[b];
+		for(unsigned i = 0; i < buffer->getSize(); i++) {
+			Hit &hit = buffer->get(i);
+			if(!hit.valid) continue;
+			ExpectedChannel &channel = channels[hit.channelID];
+			if(channel.energy.empty()) {
+				channel.energyUnderflow = channel.energyOverflow = 0;
+				channel.energy.resize(energyBins, 0);
+				channel.time.resize(timeBins, 0);
+			}
+
+			float energy = hit.energy * (hit.qdcMode ? 1.0f : Tns);
+			if(energy < energyMin) channel.energyUnderflow += 1;
+			else if(energy >= energyMax || !isfinite(energy)) channel.energyOverflow += 1;
+			else channel.energy[(unsigned)floor((energy - energyMin) * energyBins / (energyMax - energyMin))] += 1;
+
+			long double t = buffer->getTMin() * (long double)Tps + hit.time;
+			long double timeOfFrame = t - floorl(t / frameLength) * frameLength;
+			channel.time[(unsigned)(timeOfFrame / frameLength * timeBins)] += 1;
+		}
+	}
+
+	std::vector<uint32_t> records;
+	for(auto it = channels.begin(); it != channels.end(); it++) {
+		ChannelSpectraChannel header = { it->first, it->second.energyUnderflow, it->second.energyOverflow, 0 };
+		records.insert(records.end(), (uint32_t *)&header, (uint32_t *)(&header + 1));
+		records.insert(records.end(), it->second.energy.begin(), it->second.energy.end());
+		records.insert(records.end(), it->second.time.begin(), it->second.time.end());
+	}
+	nChannels = channels.size();
+	return records;
+}
+
+struct FillJob {
+	ChannelSpectra *spectra;
+	DataFileWriter *writer;
+	std::vector<EventBuffer<Hit> *> *buffers;
+	std::vector<OutputBlock *> *blocks;
+	unsigned firstBuffer;
+	unsigned endBuffer;
+	unsigned thread;
+	unsigned nThreads;
+};
+
+// Fill or format every nThreads-th buffer
+static void *fillThread(void *arg)
+{
+	FillJob *job = (FillJob *)arg;
+	for(unsigned b = job->firstBuffer + job->thread; b < job->endBuffer; b += job->nThreads) {
+		if(job->spectra != NULL) job->spectra->fill((*job->buffers)[b]);
+		else (*job->blocks)[b] = job->writer->formatSingleEvents((*job->buffers)[b], 0);
+	}
+	return NULL;
+}
+
+static void fillThreads(ChannelSpectra *spectra, DataFileWriter *writer, std::vector<EventBuffer<Hit> *> &buffers,
+	std::vector<OutputBlock *> &blocks, unsigned firstBuffer, unsigned endBuffer, unsigned nThreads)
+{
+	std::vector<pthread_t> threads(nThreads);
+	std::vector<FillJob> jobs(nThreads);
+	for(unsigned k = 0; k < nThreads; k++) {
+		jobs[k] = { spectra, writer, &buffers, &blocks, firstBuffer, endBuffer, k, nThreads };
+		pthread_create(&threads[k], NULL, fillThread, &jobs[k]);
+	}
+	for(unsigned k = 0; k < nThreads; k++) pthread_join(threads[k], NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double Tps = 1E12 / stream.getFrequency();
+	float Tns = Tps / 1000;
+
+	// Buffers starting away from the frame boundaries
+	std::mt19937 rng(50);
+	const unsigned nBuffers = 12;
+	std::vector<EventBuffer<Hit> *> buffers;
+	for(unsigned b = 0; b < nBuffers; b++) {
+		long long tMin = 1000003LL * (b + 1) + 517;
+		EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(20000, b, tMin);
+		generateRawHits(raw, config, system, 20000, 0.5, 20, rng);
+		for(unsigned i = 0; i < raw->getSize(); i++) {
+			RawHit &hit = raw->get(i);
+			hit.time += tMin;
+			hit.timeEnd += tMin;
+			hit.frameID = hit.time / 1024;
+			hit.tcoarse = hit.time % 1024;
+			hit.ecoarse = hit.timeEnd % 1024;
+		}
+		raw->setTMax(tMin + 1000000);
+		buffers.push_back(processHits(config, &stream, raw));
+		CHECK(buffers[b]->getTMin() % 1024 != 0);
+	}
+
+	// Energy bins over most of the singles, so that there is underflow and overflow
+	std::vector<float> energies;
+	for(unsigned b = 0; b < nBuffers; b++) {
+		for(unsigned i = 0; i < buffers[b]->getSize(); i++) {
+			Hit &hit = buffers[b]->get(i);
+			float energy = hit.energy * (hit.qdcMode ? 1.0f : Tns);
+			if(hit.valid && isfinite(energy)) energies.push_back(energy);
+		}
+	}
+	std::sort(energies.begin(), energies.end());
+	char section[256];
+	sprintf(section,
+		"[channel_spectra]\n"
+		"energy_bins = 6\n"
+		"energy_min = %f\n"
+		"energy_max = %f\n"
+		"time_bins = 7\n", energies[energies.size() / 10], energies[energies.size() * 9 / 10]);
+	std::string spectraConfigName = system.writeConfig("spectra.ini", section);
+	SystemConfig *spectraConfig = SystemConfig::fromFile(spectraConfigName.c_str(), 0);
+
+	uint64_t nExpected;
+	std::vector<uint32_t> expected = expectedRecords(spectraConfig, Tps, buffers, 0, nBuffers, nExpected);
+	uint64_t nUnderflow = 0, nOverflow = 0, nTime = 0;
+	for(size_t begin = 0; begin < expected.size(); begin += 4 + 6 + 7) {
+		ChannelSpectraChannel *channel = (ChannelSpectraChannel *)&expected[begin];
+		nUnderflow += channel->energyUnderflow;
+		nOverflow += channel->energyOverflow;
+		for(unsigned n = 0; n < 7; n++) nTime += expected[begin + 4 + 6 + n];
+	}
+	fprintf(stderr, "%lu singles in %lu channels, %lu energy underflows, %lu overflows\n", nTime, nExpected, nUnderflow, nOverflow);
+	CHECK(nUnderflow > 0 && nOverflow > 0);
+	CHECK(nExpected > 100);
+
+	// One thread, then four threads on the same spectra, which must be empty after each step
+	std::vector<OutputBlock *> blocks(nBuffers, (OutputBlock *)NULL);
+	ChannelSpectra spectra(spectraConfig, Tps);
+	CHECK(spectra.getRecordSize() == 4 + 6 + 7);
+	const unsigned threadCounts[] = { 1, 4, 3 };
+	for(unsigned t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++) {
+		fillThreads(&spectra, NULL, buffers, blocks, 0, nBuffers, threadCounts[t]);
+		std::vector<uint32_t> records;
+		uint64_t nChannels;
+		spectra.takeStep(records, nChannels);
+		if(records != expected) fprintf(stderr, "%u threads: %lu channels instead of %lu\n", threadCounts[t], nChannels, nExpected);
+		CHECK(records == expected);
+		CHECK(nChannels == nExpected);
+	}
+	std::vector<uint32_t> records;
+	uint64_t nChannels;
+	spectra.takeStep(records, nChannels);
+	CHECK(records.empty() && nChannels == 0);
+
+	// Two steps of a .lspc file, with the buffers of each step formatted by four threads
+	std::string prefix = dir.file("spectra");
+	DataFileWriter *writer = new DataFileWriter((char *)prefix.c_str(), false, stream.getFrequency(), SINGLE, FILE_CHANNEL_SPECTRA,
+		0, 1, 1024, 0, 0, spectraConfig);
+	const unsigned stepBuffers[] = { 0, 5, nBuffers };
+	for(unsigned s = 0; s < 2; s++) {
+		writer->setStepValues(s + 1, 10 * (s + 1));
+		fillThreads(NULL, writer, buffers, blocks, stepBuffers[s], stepBuffers[s + 1], 4);
+		for(unsigned b = stepBuffers[s]; b < stepBuffers[s + 1]; b++) writer->writeBlock(blocks[b]);
+		writer->closeStep();
+	}
+	delete writer;
+
+	FILE *f = fopen((prefix + ".lspc").c_str(), "rb");
+	CHECK(f != NULL);
+	ChannelSpectraHeader header;
+	CHECK(f != NULL && fread(&header, sizeof(header), 1, f) == 1);
+	CHECK(memcmp(header.magic, "PSSPECTR", 8) == 0);
+	CHECK(header.energyBins == 6 && header.timeBins == 7);
+	CHECK(sameBits(header.energyMin, (float)spectraConfig->channel_spectra_energy_min));
+	CHECK(sameBits(header.energyMax, (float)spectraConfig->channel_spectra_energy_max));
+	CHECK(sameBits(header.frameLength, (float)(1024 * Tps)));
+	for(unsigned s = 0; s < 2 && f != NULL; s++) {
+		ChannelSpectraStep step;
+		CHECK(fread(&step, sizeof(step), 1, f) == 1);
+		CHECK(step.step1 == s + 1 && step.step2 == 10 * (s + 1));
+		uint64_t nStepChannels;
+		std::vector<uint32_t> stepExpected = expectedRecords(spectraConfig, Tps, buffers, stepBuffers[s], stepBuffers[s + 1], nStepChannels);
+		CHECK(step.nChannels == nStepChannels);
+		std::vector<uint32_t> stepRecords(step.nChannels * (4 + 6 + 7));
+		CHECK(fread(stepRecords.data(), sizeof(uint32_t), stepRecords.size(), f) == stepRecords.size());
+		CHECK(stepRecords == stepExpected);
+	}
+	if(f != NULL) {
+		CHECK(fgetc(f) == EOF);
+		fclose(f);
+	}
+
+	for(unsigned b = 0; b < nBuffers; b++) delete buffers[b];
+	delete spectraConfig;
+	delete config;
+	return result("test_channel_spectra");
+}
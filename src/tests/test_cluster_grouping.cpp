@@ -0,0 +1,194 @@
+/*
+ * Cluster grouping engine: every connected set of hits, where two hits are linked when
+ * their channels are neighbours and their times are within the group time window, must
+ * become one photon, however its hits are chained and in whichever order they arrive.
+ * Sets of more than group_max_hits hits overflow and give no photon, nor do their hits
+ * join any other photon. The engine must also work when chosen after the grouper was built.
+ */
+
+#include "TestUtil.hpp"
+#include <map>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+typedef std::vector<unsigned> Members;
+
+static void pushHit(EventBuffer<Hit> *buffer, SystemConfig *config, unsigned channelID, long long time)
+{
+	Hit &hit = buffer->getWriteSlot();
+	unsigned index = config->getChannelIndex(channelID);
+	SystemConfig::ChannelPosition &p = config->getChannelPosition(index);
+	hit.valid = true;
+	hit.qdcMode = false;
+	hit.tacID = 0;
+	hit.channelID = channelID;
+	hit.channelIndex = index;
+	hit.rawTime = hit.rawTimeEnd = 0;
+	hit.time = time;
+	hit.timeEnd = time + 100000;
+	hit.energy = 100 - buffer->getSize();
+	hit.region = config->getTriggerRegion(index);
+	hit.denseRegion = config->getDenseTriggerRegion(index);
+	hit.x = p.x;
+	hit.y = p.y;
+	hit.z = p.z;
+	hit.xi = p.xi;
+	hit.yi = p.yi;
+	buffer->pushWriteSlot();
+}
+
+static unsigned findRoot(std::vector<unsigned> &parent, unsigned i)
+{
+	while(parent[i] != i) i = parent[i];
+	return i;
+}
+
+// Connected sets of valid hits by brute force, each with its hits in buffer order
+static std::vector<Members> findComponents(SystemConfig *config, EventBuffer<Hit> *hits, long long timeWindow)
+{
+	float radius2 = config->sw_trigger_group_max_distance * config->sw_trigger_group_max_distance;
+	unsigned N = hits->getSize();
+	std::vector<unsigned> parent(N);
+	for(unsigned i = 0; i < N; i++) {
+		parent[i] = i;
+		Hit &h1 = hits->get(i);
+		if(!h1.valid || h1.denseRegion == -1) continue;
+		for(unsigned j = 0; j < i; j++) {
+			Hit &h2 = hits->get(j);
+			if(!h2.valid || h2.denseRegion == -1) continue;
+			if(llabs(h1.time - h2.time) > timeWindow) continue;
+			if(!config->isMultiHitAllowedDense(h2.denseRegion, h1.denseRegion)) continue;
+			SystemConfig::ChannelPosition &p1 = config->getChannelPosition(h1.channelIndex);
+			SystemConfig::ChannelPosition &p2 = config->getChannelPosition(h2.channelIndex);
+			float u = p1.x - p2.x;
+			float v = p1.y - p2.y;
+			float w = p1.z - p2.z;
+			if(u*u + v*v + w*w > radius2) continue;
+			unsigned r1 = findRoot(parent, i);
+			unsigned r2 = findRoot(parent, j);
+			parent[std::max(r1, r2)] = std::min(r1, r2);
+		}
+	}
+
+	std::map<unsigned, Members> components;
+	for(unsigned i = 0; i < N; i++) {
+		if(hits->get(i).valid) components[findRoot(parent, i)].push_back(i);
+	}
+	std::vector<Members> result;
+	for(auto it = components.begin(); it != components.end(); it++) result.push_back(it->second);
+	return result;
+}
+
+// Hits of each photon, in buffer order
+static std::vector<Members> photonMembers(EventBuffer<GammaPhoton> *photons, EventBuffer<Hit> *hits)
+{
+	std::vector<Members> result;
+	for(unsigned n = 0; n < photons->getSize(); n++) {
+		GammaPhoton &photon = photons->get(n);
+		Members members;
+		for(int k = 0; k < photon.nHits; k++) members.push_back(photon.hits[k] - hits->getPtr());
+		std::sort(members.begin(), members.end());
+		result.push_back(members);
+	}
+	return result;
+}
+
+// Photons must be the connected sets of up to maxHits hits, in the order of their first hits
+static bool matchComponents(std::vector<Members> &photons, std::vector<Members> &components, unsigned maxHits, unsigned &nOverflow)
+{
+	std::vector<Members> expected;
+	nOverflow = 0;
+	for(unsigned n = 0; n < components.size(); n++) {
+		if(components[n].size() <= maxHits) expected.push_back(components[n]);
+		else nOverflow++;
+	}
+	return photons == expected;
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	TestEventStream stream;
+	double Tps = 1E12 / stream.getFrequency();
+	u_int64_t mask = SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS;
+
+	// Hand made sets, in region 2, with only the channels next to each other (3.2 mm) as neighbours
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"group_engine = cluster\n"
+		"group_time_window = 4\n"
+		"group_max_distance = 5\n"
+		"group_max_hits = 4\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), mask);
+	EventBuffer<Hit> *hits = new EventBuffer<Hit>(32, 0, 0);
+	// Channels 0 and 2 are only linked through channel 1, which arrives last
+	pushHit(hits, config, system.getRegionChannelID(2, 0), 1000000);
+	pushHit(hits, config, system.getRegionChannelID(2, 2), 1000000);
+	pushHit(hits, config, system.getRegionChannelID(2, 1), 1000000);
+	// The hits of channel 20, 30 ns apart, are only linked through channel 21
+	pushHit(hits, config, system.getRegionChannelID(2, 20), 2000000);
+	pushHit(hits, config, system.getRegionChannelID(2, 21), 2015000);
+	pushHit(hits, config, system.getRegionChannelID(2, 20), 2030000);
+	// Five linked hits overflow; channel 47 is not a neighbour of any of them
+	for(unsigned k = 32; k <= 36; k++) pushHit(hits, config, system.getRegionChannelID(2, k), 3000000);
+	pushHit(hits, config, system.getRegionChannelID(2, 47), 3000000);
+	// Channels 50 and 52 are not neighbours
+	pushHit(hits, config, system.getRegionChannelID(2, 50), 4000000);
+	pushHit(hits, config, system.getRegionChannelID(2, 52), 4000000);
+	hits->setTMax(5000000);
+
+	EventBuffer<GammaPhoton> *photons = groupHits(config, &stream, hits);
+	std::vector<Members> found = photonMembers(photons, hits);
+	std::vector<Members> expected = { { 0, 1, 2 }, { 3, 4, 5 }, { 11 }, { 12 }, { 13 } };
+	CHECK(found == expected);
+	std::vector<Members> components = findComponents(config, hits, 4 * Tps);
+	unsigned nOverflow;
+	CHECK(matchComponents(found, components, 4, nOverflow));
+	CHECK(nOverflow == 1);
+	delete photons;
+	delete config;
+
+	// Clusters from the generator, of up to 6 hits in neighbour channels and 4 hits at most per photon,
+	// without energy cuts, which would drop whole sets
+	struct { const char *name; const char *engine; unsigned clusterSize; double interval; } runs[] = {
+		{ "clusters of 3", "cluster", 3, 20 },
+		{ "clusters of 6", "cluster", 6, 20 },
+		{ "dense", "cluster", 3, 2 },
+		{ "chosen after construction", "scan", 3, 20 },
+	};
+	for(unsigned r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+		char settings[256];
+		sprintf(settings, "[sw_trigger]\ngroup_engine = %s\ngroup_max_hits = 4\ngroup_min_energy = -1E30\ngroup_max_energy = 1E30\n", runs[r].engine);
+		configName = system.writeConfig("config.ini", settings);
+		config = SystemConfig::fromFile(configName.c_str(), mask);
+		CaptureSink<GammaPhoton> *sink = new CaptureSink<GammaPhoton>();
+		SimpleGrouper *grouper = new SimpleGrouper(config, &stream, sink);
+		config->sw_trigger_group_engine = SystemConfig::GROUP_ENGINE_CLUSTER;
+
+		std::mt19937 rng(33 + r);
+		EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(20000, 0, 0);
+		generateRawHits(raw, config, system, 20000, 0.5, runs[r].interval, rng, -1, runs[r].clusterSize);
+		hits = processHits(config, &stream, raw);
+		photons = runStage(grouper, sink, hits);
+
+		found = photonMembers(photons, hits);
+		components = findComponents(config, hits, llround(config->sw_trigger_group_time_window * Tps));
+		unsigned nLinked = 0;
+		for(unsigned n = 0; n < found.size(); n++) {
+			if(found[n].size() > 1) nLinked++;
+		}
+		bool same = matchComponents(found, components, 4, nOverflow);
+		fprintf(stderr, "%s: %lu photons, %u of them of several hits, %u sets overflow\n", runs[r].name, found.size(), nLinked, nOverflow);
+		CHECK(same);
+		CHECK(nLinked > found.size() / 10);
+		if(runs[r].clusterSize > 4) CHECK(nOverflow > 100);
+
+		delete photons;
+		delete config;
+	}
+
+	return result("test_cluster_grouping");
+}
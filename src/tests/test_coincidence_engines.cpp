@@ -0,0 +1,67 @@
+/*
+ * The region queue coincidence engine must produce the same coincidences as the scan engine,
+ * in the same order, for short and long windows and with regions in coincidence with themselves.
+ */
+
+#include "TestUtil.hpp"
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+int main(int argc, char *argv[])
+{
+	const double windows[] = { 0.2, 2, 20, 200 };
+
+	unsigned nCoincidencesChecked = 0;
+	for(int selfCoincidence = 0; selfCoincidence < 2; selfCoincidence++) {
+		TestDir dir;
+		TestSystem system(dir, 2, selfCoincidence);
+		for(unsigned w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+			char extra[128];
+			sprintf(extra, "[sw_trigger]\ncoincidence_time_window = %g\n", windows[w]);
+			std::string configName = system.writeConfig("config.ini", extra);
+			SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+			TestEventStream stream;
+
+			// Low and high photon rates: the region engine tests the window directly
+			// when it holds fewer photons than there are regions to visit
+			for(int density = 0; density < 2; density++) {
+				std::mt19937 rng(34 + 10 * w + density + 100 * selfCoincidence);
+				EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(30000, 0, 0);
+				generateRawHits(raw, config, system, 30000, 0.5, (density == 0) ? 50 : 1, rng);
+
+				config->sw_trigger_coincidence_engine = SystemConfig::COINCIDENCE_ENGINE_SCAN;
+				EventBuffer<GammaPhoton> *scanPhotons = groupHits(config, &stream, processHits(config, &stream, copyBuffer(raw)));
+				EventBuffer<Coincidence> *scan = findCoincidences(config, &stream, scanPhotons);
+
+				config->sw_trigger_coincidence_engine = SystemConfig::COINCIDENCE_ENGINE_REGION;
+				EventBuffer<GammaPhoton> *regionPhotons = groupHits(config, &stream, processHits(config, &stream, raw));
+				EventBuffer<Coincidence> *region = findCoincidences(config, &stream, regionPhotons);
+
+				unsigned nDifferent = 0;
+				CHECK(region->getSize() == scan->getSize());
+				for(unsigned n = 0; n < scan->getSize() && n < region->getSize(); n++) {
+					Coincidence &a = scan->get(n);
+					Coincidence &b = region->get(n);
+					if(a.nPhotons != b.nPhotons || a.delayed != b.delayed
+					|| (a.photons[0] - scanPhotons->getPtr()) != (b.photons[0] - regionPhotons->getPtr())
+					|| (a.photons[1] - scanPhotons->getPtr()) != (b.photons[1] - regionPhotons->getPtr())) nDifferent++;
+				}
+				if(nDifferent != 0 || region->getSize() != scan->getSize()) {
+					fprintf(stderr, "window %g, self coincidence %d, density %d: %u of %lu coincidences differ (%lu from the scan engine)\n",
+						windows[w], selfCoincidence, density, nDifferent, region->getSize(), scan->getSize());
+				}
+				CHECK(nDifferent == 0);
+				CHECK(scan->getSize() > 0);
+				nCoincidencesChecked += scan->getSize();
+
+				delete scan;
+				delete region;
+			}
+			delete config;
+		}
+	}
+	fprintf(stderr, "compared %u coincidences\n", nCoincidencesChecked);
+
+	return result("test_coincidence_engines");
+}
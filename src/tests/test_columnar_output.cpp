@@ -0,0 +1,168 @@
+/*
+ * Columnar files must round-trip: the records rebuilt from the columns which
+ * ColumnarFileReader maps must be byte-identical to the binary records of the same events,
+ * and the steps must cover the same records, for every event type, hit limit and event
+ * fraction, with buffers formatted ahead out of order, and with asynchronous writing.
+ */
+
+#include "OutputReference.hpp"
+#include <ColumnarFile.hpp>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+struct RecordField {
+	const char *name;
+	size_t offset;
+	size_t size;
+};
+
+static const RecordField singleFields[] = {
+	{ "time", offsetof(Event, time), 8 },
+	{ "energy", offsetof(Event, e), 4 },
+	{ "channelID", offsetof(Event, id), 4 }
+};
+
+static const RecordField groupFields[] = {
+	{ "mh_n", offsetof(GroupEvent, mh_n), 1 },
+	{ "mh_j", offsetof(GroupEvent, mh_j), 1 },
+	{ "time", offsetof(GroupEvent, time), 8 },
+	{ "energy", offsetof(GroupEvent, e), 4 },
+	{ "channelID", offsetof(GroupEvent, id), 4 }
+};
+
+static const RecordField coincidenceFields[] = {
+	{ "mh_n1", offsetof(CoincidenceEvent, mh_n1), 1 },
+	{ "mh_j1", offsetof(CoincidenceEvent, mh_j1), 1 },
+	{ "time1", offsetof(CoincidenceEvent, time1), 8 },
+	{ "energy1", offsetof(CoincidenceEvent, e1), 4 },
+	{ "channelID1", offsetof(CoincidenceEvent, id1), 4 },
+	{ "mh_n2", offsetof(CoincidenceEvent, mh_n2), 1 },
+	{ "mh_j2", offsetof(CoincidenceEvent, mh_j2), 1 },
+	{ "time2", offsetof(CoincidenceEvent, time2), 8 },
+	{ "energy2", offsetof(CoincidenceEvent, e2), 4 },
+	{ "channelID2", offsetof(CoincidenceEvent, id2), 4 }
+};
+
+// Rebuild the binary records from the columns, and the step index in bytes of records
+static void readColumnarFile(const char *fileName, EVENT_TYPE eventType, std::string &data, std::string &index)
+{
+	const RecordField *fields;
+	unsigned nFields;
+	size_t recordSize;
+	if(eventType == SINGLE) {
+		fields = singleFields;
+		nFields = sizeof(singleFields) / sizeof(RecordField);
+		recordSize = sizeof(Event);
+	}
+	else if(eventType == GROUP) {
+		fields = groupFields;
+		nFields = sizeof(groupFields) / sizeof(RecordField);
+		recordSize = sizeof(GroupEvent);
+	}
+	else {
+		fields = coincidenceFields;
+		nFields = sizeof(coincidenceFields) / sizeof(RecordField);
+		recordSize = sizeof(CoincidenceEvent);
+	}
+
+	ColumnarFileReader reader(fileName);
+	CHECK(reader.getEventType() == (unsigned)eventType);
+	CHECK(reader.getNumberOfColumns() == nFields);
+	std::vector<int> columns(nFields);
+	for(unsigned k = 0; k < nFields; k++) {
+		columns[k] = reader.getColumnIndex(fields[k].name);
+		CHECK(columns[k] >= 0 && reader.getColumnSize(columns[k]) == fields[k].size);
+		// Each column is aligned for use in place
+		if(reader.getNumberOfBlocks() > 0) CHECK((uintptr_t)reader.getColumn(0, columns[k]) % fields[k].size == 0);
+	}
+	if(reader.getNumberOfColumns() != nFields) return;
+
+	std::vector<uint64_t> blockBegin(1, 0);
+	uint64_t nRows = 0;
+	for(uint64_t b = 0; b < reader.getNumberOfBlocks(); b++) {
+		uint64_t N = reader.getNumberOfRows(b);
+		std::string records(N * recordSize, '\0');
+		for(unsigned k = 0; k < nFields; k++) {
+			if(columns[k] < 0) continue;
+			const char *column = (const char *)reader.getColumn(b, columns[k]);
+			for(uint64_t r = 0; r < N; r++) {
+				memcpy(&records[r * recordSize + fields[k].offset], column + r * fields[k].size, fields[k].size);
+			}
+		}
+		data += records;
+		nRows += N;
+		blockBegin.push_back(nRows);
+	}
+	CHECK(reader.getTotalRows() == nRows);
+
+	for(uint64_t s = 0; s < reader.getNumberOfSteps(); s++) {
+		const ColumnarStepInfo &step = reader.getStep(s);
+		char line[256];
+		sprintf(line, "%ld\t%ld\t%e\t%e\n", (long)(blockBegin[step.firstBlock] * recordSize),
+			(long)(blockBegin[step.endBlock] * recordSize), step.step1, step.step2);
+		index += line;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n"
+		"coincidence_delayed_offsets = 1000\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+	const double t0 = 123456789;
+
+	std::mt19937 rng(44);
+	TestEvents events;
+	makeTestEvents(events, config, &stream, system, 8, 20000, 1LL << 20, rng);
+
+	const EVENT_TYPE eventTypes[] = { SINGLE, GROUP, COINCIDENCE };
+	const int hitLimits[] = { 1, 3 };
+	const int eventFractions[] = { 1024, 300 };
+	std::string fileName = dir.file("out");
+	unsigned nCompared = 0;
+	size_t nBytes = 0;
+	for(unsigned e = 0; e < 3; e++)
+	for(unsigned l = 0; l < 2; l++)
+	for(unsigned k = 0; k < 2; k++)
+	for(short delayed = 0; delayed < ((eventTypes[e] == COINCIDENCE) ? 2 : 1); delayed++)
+	for(int mode = 0; mode < 3; mode++) {
+		// Written with write*Events(), formatted ahead, and formatted ahead with asynchronous writing
+		bool formatAhead = (mode > 0);
+		bool async = (mode == 2);
+
+		// The columns are those of the full binary records
+		ReferenceBinaryWriter reference(frequency, FILE_BINARY, hitLimits[l], eventFractions[k]);
+		reference.writeTestEvents(events, eventTypes[e], t0, delayed);
+
+		DataFileWriter *writer = new DataFileWriter((char *)fileName.c_str(), async, frequency, eventTypes[e], FILE_COLUMNAR,
+			0, hitLimits[l], eventFractions[k], 0, 0);
+		writeTestEvents(writer, events, eventTypes[e], t0, delayed, formatAhead);
+		delete writer;
+
+		std::string data;
+		std::string index;
+		readColumnarFile(dir.file("out.lcol").c_str(), eventTypes[e], data, index);
+		bool same = (data == reference.data) && (index == reference.index);
+		if(!same) {
+			fprintf(stderr, "event type %d, hit limit %d, event fraction %d, delayed %d, mode %d: "
+				"%lu bytes instead of %lu, index '%s' instead of '%s'\n",
+				eventTypes[e], hitLimits[l], eventFractions[k], delayed, mode,
+				data.size(), reference.data.size(), index.c_str(), reference.index.c_str());
+		}
+		CHECK(same);
+		CHECK(reference.data.size() > 10000);
+		nCompared++;
+		nBytes += data.size();
+	}
+	fprintf(stderr, "compared %u outputs, %lu bytes\n", nCompared, nBytes);
+
+	delete config;
+	return result("test_columnar_output");
+}
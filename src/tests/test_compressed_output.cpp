@@ -0,0 +1,123 @@
+/*
+ * Compressed binary files must round-trip: CompressedFileReader must give back the
+ * records and step index of the .ldat file of the same events, reading through in pieces
+ * of any size and from the start of each step, for every event type and record layout,
+ * hit limit and event fraction, with buffers formatted ahead out of order, and with
+ * asynchronous writing.
+ */
+
+#include "OutputReference.hpp"
+#include <CompressedFile.hpp>
+#include <sys/stat.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+// The whole stream, in pieces of random sizes which cross the blocks and the records
+static std::string readAll(CompressedFileReader &reader, std::mt19937 &rng)
+{
+	std::string data;
+	std::vector<char> buffer(100000);
+	while(true) {
+		size_t count = 1 + rng() % ((rng() % 2) ? 40 : buffer.size());
+		size_t n = reader.read(buffer.data(), count);
+		data.append(buffer.data(), n);
+		if(n < count) break;
+	}
+	return data;
+}
+
+static long long fileSize(const std::string &fileName)
+{
+	struct stat st;
+	return (stat(fileName.c_str(), &st) == 0) ? st.st_size : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n"
+		"coincidence_delayed_offsets = 1000\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+	const double t0 = 123456789;
+
+	std::mt19937 rng(45);
+	TestEvents events;
+	makeTestEvents(events, config, &stream, system, 8, 20000, 1LL << 20, rng);
+
+	const EVENT_TYPE eventTypes[] = { SINGLE, GROUP, COINCIDENCE };
+	const FILE_TYPE fileTypes[] = { FILE_BINARY, FILE_BINARY_COMPACT };
+	const int hitLimits[] = { 1, 3 };
+	const int eventFractions[] = { 1024, 300 };
+	const int compressionLevels[] = { 1, 3, 9 };
+	std::string fileName = dir.file("out");
+	unsigned nCompared = 0;
+	size_t nBytes = 0;
+	size_t nCompressedBytes = 0;
+	for(unsigned e = 0; e < 3; e++)
+	for(unsigned f = 0; f < 2; f++)
+	for(unsigned l = 0; l < 2; l++)
+	for(unsigned k = 0; k < 2; k++)
+	for(short delayed = 0; delayed < ((eventTypes[e] == COINCIDENCE) ? 2 : 1); delayed++)
+	for(int mode = 0; mode < 3; mode++) {
+		// Singles have no compact format
+		if(eventTypes[e] == SINGLE && fileTypes[f] == FILE_BINARY_COMPACT) continue;
+		// Written with write*Events(), formatted ahead, and formatted ahead with asynchronous writing
+		bool formatAhead = (mode > 0);
+		bool async = (mode == 2);
+		int level = compressionLevels[mode];
+
+		ReferenceBinaryWriter reference(frequency, fileTypes[f], hitLimits[l], eventFractions[k]);
+		reference.writeTestEvents(events, eventTypes[e], t0, delayed);
+
+		DataFileWriter *writer = new DataFileWriter((char *)fileName.c_str(), async, frequency, eventTypes[e], fileTypes[f],
+			0, hitLimits[l], eventFractions[k], 0, level);
+		writeTestEvents(writer, events, eventTypes[e], t0, delayed, formatAhead);
+		delete writer;
+
+		CompressedFileReader reader(fileName.c_str());
+		std::string data = readAll(reader, rng);
+		std::string index;
+		bool sameSteps = true;
+		for(unsigned s = 0; s < reader.getNumberOfSteps(); s++) {
+			const CompressedFileReader::Step &step = reader.getStep(s);
+			char line[256];
+			sprintf(line, "%ld\t%ld\t%e\t%e\n", (long)step.rawBegin, (long)step.rawEnd, step.step1, step.step2);
+			index += line;
+
+			// Each step can be read on its own
+			reader.seekStep(s);
+			std::string stepData(step.rawEnd - step.rawBegin, '\0');
+			size_t n = reader.read(&stepData[0], stepData.size());
+			sameSteps = sameSteps && (n == stepData.size()) && (reference.data.compare(step.rawBegin, n, stepData) == 0);
+			sameSteps = sameSteps && (s == 0 || step.fileBegin == reader.getStep(s - 1).fileEnd);
+		}
+		long long compressedSize = fileSize(fileName + ".ldatz");
+		sameSteps = sameSteps && (reader.getNumberOfSteps() > 0) && (reader.getStep(reader.getNumberOfSteps() - 1).fileEnd == compressedSize);
+
+		bool same = (data == reference.data) && (index == reference.index);
+		if(!same || !sameSteps) {
+			fprintf(stderr, "event type %d, file type %d, hit limit %d, event fraction %d, delayed %d, mode %d: "
+				"%lu bytes instead of %lu, index '%s' instead of '%s'%s\n",
+				eventTypes[e], fileTypes[f], hitLimits[l], eventFractions[k], delayed, mode,
+				data.size(), reference.data.size(), index.c_str(), reference.index.c_str(),
+				sameSteps ? "" : ", steps read on their own differ");
+		}
+		CHECK(same);
+		CHECK(sameSteps);
+		CHECK(reference.data.size() > 10000);
+		CHECK(compressedSize < (long long)reference.data.size());
+		nCompared++;
+		nBytes += data.size();
+		nCompressedBytes += compressedSize;
+	}
+	fprintf(stderr, "compared %u outputs, %lu bytes compressed to %lu\n", nCompared, nBytes, nCompressedBytes);
+
+	delete config;
+	return result("test_compressed_output");
+}
@@ -0,0 +1,133 @@
+/*
+ * A SystemConfig loaded from the binary cache must hold the same tables as one loaded
+ * from the text tables, and the cache must not be used once a table has changed.
+ */
+
+#include "TestUtil.hpp"
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+static unsigned nCompared = 0;
+
+// FirmwareConfig has padding after isValid, which the loaders leave uninitialised
+static bool sameFirmwareConfig(SystemConfig::FirmwareConfig &a, SystemConfig::FirmwareConfig &b)
+{
+	return sameBits(a.p0, b.p0) && sameBits(a.p1, b.p1) && sameBits(a.p2, b.p2)
+		&& sameBits(a.k0, b.k0) && a.isValid == b.isValid;
+}
+
+static void compareConfigs(SystemConfig *a, SystemConfig *b, TestSystem &system)
+{
+	CHECK(a->useTDCCalibration() == b->useTDCCalibration());
+	CHECK(a->useQDCCalibration() == b->useQDCCalibration());
+	CHECK(a->useEnergyCalibration() == b->useEnergyCalibration());
+	CHECK(a->useTimeOffsetCalibration() == b->useTimeOffsetCalibration());
+	CHECK(a->useXYZ() == b->useXYZ());
+
+	// Channels of the system, and channels which are in no table
+	unsigned nDifferent = 0;
+	for(unsigned n = 0; n < system.getNumberOfChannels() + 64; n++) {
+		unsigned channelID = (n < system.getNumberOfChannels()) ? system.getChannelID(n) : ((31 << 17) | n);
+		unsigned index = a->getChannelIndex(channelID);
+		bool same = (index == b->getChannelIndex(channelID));
+		for(unsigned tac = 0; same && tac < 4; tac++) {
+			same = sameBits(a->getTacConfigT(index, tac), b->getTacConfigT(index, tac))
+				&& sameBits(a->getTacConfigE(index, tac), b->getTacConfigE(index, tac))
+				&& sameBits(a->getQacConfig(index, tac), b->getQacConfig(index, tac))
+				&& sameBits(a->getEnergyConfig(index, tac), b->getEnergyConfig(index, tac))
+				&& sameFirmwareConfig(a->getFirmwareConfig(index, tac), b->getFirmwareConfig(index, tac));
+		}
+		same = same && sameBits(a->getTimeOffset(index), b->getTimeOffset(index))
+			&& sameBits(a->getChannelPosition(index), b->getChannelPosition(index))
+			&& a->getTriggerRegion(index) == b->getTriggerRegion(index)
+			&& a->getDenseTriggerRegion(index) == b->getDenseTriggerRegion(index);
+		if(!same) nDifferent++;
+		nCompared++;
+	}
+	CHECK(nDifferent == 0);
+
+	CHECK(a->getNumberOfDenseRegions() == b->getNumberOfDenseRegions());
+	for(unsigned d = 0; d < a->getNumberOfDenseRegions() && d < b->getNumberOfDenseRegions(); d++) {
+		CHECK(a->getRegionFromDense(d) == b->getRegionFromDense(d));
+	}
+	unsigned nRegionsDifferent = 0;
+	for(int r1 = -1; r1 < (int)system.getNumberOfRegions() + 2; r1++) {
+		if(a->getDenseRegion(r1) != b->getDenseRegion(r1)) nRegionsDifferent++;
+		for(int r2 = -1; r2 < (int)system.getNumberOfRegions() + 2; r2++) {
+			if(a->isCoincidenceAllowed(r1, r2) != b->isCoincidenceAllowed(r1, r2)) nRegionsDifferent++;
+			if(a->isMultiHitAllowed(r1, r2) != b->isMultiHitAllowed(r1, r2)) nRegionsDifferent++;
+		}
+	}
+	CHECK(nRegionsDifferent == 0);
+	CHECK(a->mapTriggerRegions == b->mapTriggerRegions);
+	CHECK(a->mapTriggerRegionsInverted == b->mapTriggerRegionsInverted);
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string textName = system.writeConfig("text.ini");
+	std::string cachedName = system.writeConfig("cached.ini", "config_cache = %CDIR%/.config_cache\n");
+
+	const u_int64_t masks[] = {
+		SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS,
+		SystemConfig::LOAD_MAPPING,
+		SystemConfig::LOAD_TDC_CALIBRATION | SystemConfig::LOAD_QDC_CALIBRATION,
+		0
+	};
+	for(unsigned m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+		u_int64_t mask = masks[m];
+		SystemConfig *text = SystemConfig::fromFile(textName.c_str(), mask);
+
+		// No cache yet; loading from the tables writes it
+		CHECK(SystemConfig::fromCache(cachedName.c_str(), mask) == NULL);
+		SystemConfig *first = SystemConfig::fromFile(cachedName.c_str(), mask);
+		compareConfigs(text, first, system);
+		delete first;
+
+		SystemConfig *cached = SystemConfig::fromCache(cachedName.c_str(), mask);
+		CHECK(cached != NULL);
+		if(cached != NULL) {
+			compareConfigs(text, cached, system);
+			delete cached;
+		}
+		delete text;
+	}
+
+	// A changed table invalidates the cache, and fromFile() reloads it
+	u_int64_t mask = SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS;
+	std::string offsets = dir.readFile("time_offset.tsv");
+	size_t tab = offsets.rfind('\t', offsets.find('\n'));
+	offsets.replace(tab + 1, offsets.find('\n') - tab - 1, "123.000");
+	dir.writeFile("time_offset.tsv", offsets);
+	CHECK(SystemConfig::fromCache(cachedName.c_str(), mask) == NULL);
+	SystemConfig *reloaded = SystemConfig::fromFile(cachedName.c_str(), mask);
+	CHECK(reloaded->getTimeOffset(reloaded->getChannelIndex(system.getChannelID(0))) == 123.0f);
+	SystemConfig *text = SystemConfig::fromFile(textName.c_str(), mask);
+	compareConfigs(text, reloaded, system);
+	delete text;
+	delete reloaded;
+	SystemConfig *cached = SystemConfig::fromCache(cachedName.c_str(), mask);
+	CHECK(cached != NULL);
+	delete cached;
+
+	// A corrupted cache body is not used
+	std::string cacheFile = dir.file(".config_cache");
+	char suffix[32];
+	sprintf(suffix, ".%016llx", (unsigned long long)mask);
+	FILE *f = fopen((cacheFile + suffix).c_str(), "r+");
+	CHECK(f != NULL);
+	if(f != NULL) {
+		fseek(f, -10, SEEK_END);
+		int c = fgetc(f);
+		fseek(f, -10, SEEK_END);
+		fputc(c ^ 0xFF, f);
+		fclose(f);
+	}
+	CHECK(SystemConfig::fromCache(cachedName.c_str(), mask) == NULL);
+
+	fprintf(stderr, "compared %u channels\n", nCompared);
+	return result("test_config_cache");
+}
@@ -0,0 +1,201 @@
+/*
+ * ConfigReloader under continuous load: SIGHUPs arrive while a ThreadPool keeps processing,
+ * and the pipeline is rebuilt whenever a reloaded configuration is picked up.
+ * No hit may be lost, reordered or processed with a mix of configurations, and a broken
+ * table must be rejected without stopping processing. Runs with and without main:config_cache.
+ * Needs check_config next to the test program.
+ */
+
+#include "TestUtil.hpp"
+#include <ConfigReloader.hpp>
+#include <ThreadPool.hpp>
+#include <UnorderedEventHandler.hpp>
+#include <OrderedEventHandler.hpp>
+#include <signal.h>
+#include <unistd.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+// Stamps each hit with the channel index of its configuration and the generation of that configuration
+class StampHits : public UnorderedEventHandler<RawHit, RawHit> {
+public:
+	StampHits(SystemConfig *config, unsigned generation, EventSink<RawHit> *sink)
+	: UnorderedEventHandler<RawHit, RawHit>(sink), config(config), generation(generation)
+	{
+	};
+
+protected:
+	virtual EventBuffer<RawHit> *handleEvents(EventBuffer<RawHit> *inBuffer) {
+		unsigned N = inBuffer->getSize();
+		EventBuffer<RawHit> *outBuffer = new EventBuffer<RawHit>(N, inBuffer);
+		for(unsigned n = 0; n < N; n++) {
+			RawHit &hit = outBuffer->getWriteSlot();
+			hit = inBuffer->get(n);
+			hit.channelIndex = config->getChannelIndex(hit.channelID);
+			hit.frameID = generation;
+			outBuffer->pushWriteSlot();
+		}
+		return outBuffer;
+	};
+
+private:
+	SystemConfig *config;
+	unsigned generation;
+};
+
+struct Received {
+	long long nHits;
+	long long nBuffers;
+	long long lastTime;
+	unsigned lastGeneration;
+	unsigned nErrors;
+};
+
+// Receives the buffers in order
+class CheckHits : public OrderedEventHandler<RawHit, RawHit> {
+public:
+	CheckHits(Received &received) : OrderedEventHandler<RawHit, RawHit>(new NullSink<RawHit>()), received(received) {
+	};
+
+protected:
+	virtual EventBuffer<RawHit> *handleEvents(EventBuffer<RawHit> *buffer) {
+		received.nBuffers++;
+		for(unsigned n = 0; n < buffer->getSize(); n++) {
+			RawHit &hit = buffer->get(n);
+			if(hit.time != received.lastTime + 1) received.nErrors++;
+			if(hit.frameID < received.lastGeneration) received.nErrors++;
+			if(n > 0 && hit.frameID != buffer->get(0).frameID) received.nErrors++;
+			if(hit.channelIndex == 0) received.nErrors++;
+			received.lastTime = hit.time;
+			received.lastGeneration = hit.frameID;
+			received.nHits++;
+		}
+		return buffer;
+	};
+
+private:
+	Received &received;
+};
+
+struct Script {
+	TestDir *dir;
+	unsigned nSwaps;
+	unsigned nSwapsWhileBroken;
+	bool done;
+};
+
+static unsigned getSwaps(Script *s)
+{
+	return __atomic_load_n(&s->nSwaps, __ATOMIC_ACQUIRE);
+}
+
+// Reloads are served in the background; give them time to be picked up
+static void settle()
+{
+	usleep(500000);
+}
+
+static void *signalThread(void *arg)
+{
+	Script *s = (Script *)arg;
+
+	for(int n = 0; n < 20; n++) {
+		kill(getpid(), SIGHUP);
+		usleep(20000);
+	}
+	settle();
+
+	unsigned nSwaps = getSwaps(s);
+	std::string trigger = s->dir->readFile("trigger.tsv");
+	s->dir->writeFile("trigger.tsv", trigger + "1\t2\n");
+	kill(getpid(), SIGHUP);
+	settle();
+	s->nSwapsWhileBroken = getSwaps(s) - nSwaps;
+
+	// The repaired tables are picked up again, with a new time offset for the first channel
+	s->dir->writeFile("trigger.tsv", trigger);
+	std::string offsets = s->dir->readFile("time_offset.tsv");
+	size_t tab = offsets.rfind('\t', offsets.find('\n'));
+	offsets.replace(tab + 1, offsets.find('\n') - tab - 1, "123.000");
+	s->dir->writeFile("time_offset.tsv", offsets);
+	kill(getpid(), SIGHUP);
+	settle();
+
+	__atomic_store_n(&s->done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void runReloads(const char *extra)
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini", extra);
+	u_int64_t mask = SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS;
+	unsigned channelID = system.getChannelID(0);
+
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), mask);
+	ConfigReloader *reloader = new ConfigReloader(configName.c_str(), mask);
+	ThreadPool<RawHit> *pool = new ThreadPool<RawHit>();
+
+	Received received = { 0, 0, -1, 0, 0 };
+	unsigned generation = 0;
+	EventSink<RawHit> *pipeline = new StampHits(config, generation, new CheckHits(received));
+
+	Script script = { &dir, 0, 0, false };
+	pthread_t thread;
+	pthread_create(&thread, NULL, signalThread, (void *)&script);
+
+	std::mt19937 rng(40);
+	unsigned nChannels = system.getNumberOfChannels();
+	long long nSent = 0;
+	size_t seqN = 0;
+	while(!__atomic_load_n(&script.done, __ATOMIC_ACQUIRE)) {
+		for(int k = 0; k < 8; k++) {
+			EventBuffer<RawHit> *buffer = new EventBuffer<RawHit>(2048, seqN++, 0);
+			for(int n = 0; n < 2048; n++) {
+				RawHit &hit = buffer->getWriteSlot();
+				// Channel 63 of chip 0 is not in the channel map
+				do {
+					hit.channelID = system.getChannelID(rng() % nChannels);
+				} while(hit.channelID % 4096 == 63);
+				hit.time = nSent++;
+				buffer->pushWriteSlot();
+			}
+			pool->queueTask(buffer, pipeline);
+		}
+		pool->completeQueue();
+
+		SystemConfig *newConfig = reloader->takeConfig();
+		if(newConfig != NULL) {
+			delete pipeline;
+			delete config;
+			config = newConfig;
+			generation++;
+			pipeline = new StampHits(config, generation, new CheckHits(received));
+			seqN = 0;
+			__atomic_store_n(&script.nSwaps, generation, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_join(thread, NULL);
+	delete pipeline;
+
+	fprintf(stderr, "%s: %u reloads, %lld hits in %lld buffers\n", (extra[0] == '\0') ? "tables" : "cache",
+		generation, received.nHits, received.nBuffers);
+	CHECK(received.nErrors == 0);
+	CHECK(received.nHits == nSent);
+	CHECK(generation >= 2);
+	CHECK(script.nSwapsWhileBroken == 0);
+	CHECK(config->getTimeOffset(config->getChannelIndex(channelID)) == 123.0f);
+
+	delete reloader;
+	delete pool;
+	delete config;
+}
+
+int main(int argc, char *argv[])
+{
+	runReloads("");
+	runReloads("config_cache = %CDIR%/.config_cache\n");
+	return result("test_config_reload");
+}
@@ -0,0 +1,96 @@
+/*
+ * On uncorrelated photons every prompt is a random coincidence, so the delayed windows
+ * must count as many pairs as the prompt window, within statistical errors, both for
+ * pairs of different regions and for pairs within a region in coincidence with itself.
+ */
+
+#include "TestUtil.hpp"
+#include <math.h>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+struct Counts {
+	double prompts[2];		// Pairs of different regions, pairs within a region
+	double delayed[2];
+};
+
+// Prompts and delayed counts should agree to within 5 standard deviations of their difference
+static bool agree(double prompts, double delayed, int nDelayedWindows)
+{
+	double expected = delayed / nDelayedWindows;
+	double sigma = sqrt(prompts + delayed / (nDelayedWindows * nDelayedWindows));
+	fprintf(stderr, "  %10.0f prompts, %10.0f per delayed window (%+.2f sigma)\n", prompts, expected, (prompts - expected) / sigma);
+	return fabs(prompts - expected) < 5 * sigma;
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2, true);
+	const int nDelayedWindows = 3;
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 2\n"
+		"coincidence_delayed_offsets = 100, 1000 5000\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	CHECK(config->sw_trigger_coincidence_delayed_offsets.size() == nDelayedWindows);
+
+	TestEventStream stream;
+	double Tps = 1E12 / stream.getFrequency();
+	unsigned R = system.getNumberOfRegions();
+
+	for(int engine = 0; engine < 2; engine++) {
+		config->sw_trigger_coincidence_engine = (engine == 0) ? SystemConfig::COINCIDENCE_ENGINE_SCAN : SystemConfig::COINCIDENCE_ENGINE_REGION;
+		Counts counts = { { 0, 0 }, { 0, 0 } };
+
+		std::mt19937 rng(35 + engine);
+		std::exponential_distribution<double> interval(1.0 / 5);
+		std::uniform_real_distribution<double> u(0, 1);
+		// Buffers of 1 ms, each starting where the previous ended
+		const long long bufferLength = 200000;
+		for(unsigned b = 0; b < 20; b++) {
+			EventBuffer<GammaPhoton> *photons = new EventBuffer<GammaPhoton>(1024, b, b * bufferLength);
+			photons->setTMax((b + 1) * bufferLength);
+			// Photons uniform in time and over the regions, with small time disorder
+			double t = 0;
+			while(true) {
+				t += interval(rng);
+				if(t >= bufferLength) break;
+				GammaPhoton &photon = photons->getWriteSlot();
+				photon.valid = true;
+				photon.time = llround((t + u(rng)) * Tps);
+				photon.region = rng() % R;
+				photon.denseRegion = config->getDenseRegion(photon.region);
+				photon.energy = 511;
+				photon.nHits = 0;
+				photon.x = photon.y = photon.z = 0;
+				photons->pushWriteSlot();
+			}
+
+			EventBuffer<Coincidence> *coincidences = findCoincidences(config, &stream, photons);
+			for(unsigned n = 0; n < coincidences->getSize(); n++) {
+				Coincidence &c = coincidences->get(n);
+				int k = (c.photons[0]->region == c.photons[1]->region) ? 1 : 0;
+				CHECK(config->isCoincidenceAllowed(c.photons[0]->region, c.photons[1]->region));
+				if(c.delayed == 0)
+					counts.prompts[k] += 1;
+				else
+					counts.delayed[k] += 1;
+			}
+			delete coincidences;
+		}
+
+		fprintf(stderr, "%s engine\n", (engine == 0) ? "scan" : "region");
+		fprintf(stderr, " pairs of different regions\n");
+		CHECK(agree(counts.prompts[0], counts.delayed[0], nDelayedWindows));
+		fprintf(stderr, " pairs within a region\n");
+		CHECK(agree(counts.prompts[1], counts.delayed[1], nDelayedWindows));
+		CHECK(counts.prompts[0] > 10000);
+		CHECK(counts.prompts[1] > 10000);
+	}
+
+	delete config;
+	return result("test_delayed_randoms");
+}
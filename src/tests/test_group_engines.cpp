@@ -0,0 +1,79 @@
+/*
+ * The region bucket grouping engine must produce the same photons, in the same order
+ * and with the same hits, as the scan engine, for any window, distance and cut settings.
+ */
+
+#include "TestUtil.hpp"
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+static bool samePhoton(GammaPhoton &a, EventBuffer<Hit> *hitsA, GammaPhoton &b, EventBuffer<Hit> *hitsB)
+{
+	if(a.nHits != b.nHits) return false;
+	for(int k = 0; k < a.nHits; k++) {
+		if((a.hits[k] - hitsA->getPtr()) != (b.hits[k] - hitsB->getPtr())) return false;
+	}
+	return a.valid == b.valid && a.time == b.time && sameBits(a.energy, b.energy)
+		&& a.region == b.region && a.denseRegion == b.denseRegion
+		&& sameBits(a.x, b.x) && sameBits(a.y, b.y) && sameBits(a.z, b.z);
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+
+	struct { const char *name; const char *settings; } configs[] = {
+		{ "default", "" },
+		{ "short window", "group_time_window = 2\n" },
+		{ "long window", "group_time_window = 200\n" },
+		{ "small distance", "group_max_distance = 5\n" },
+		{ "max 2 hits", "group_max_hits = 2\n" },
+		{ "min 2 hits", "group_min_hits = 2\n" },
+		{ "energy cuts", "group_min_energy = 20\ngroup_max_energy = 200\n" },
+	};
+
+	unsigned nPhotonsChecked = 0;
+	for(unsigned c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		std::string extra = std::string("[sw_trigger]\n") + configs[c].settings;
+		std::string configName = system.writeConfig("config.ini", extra.c_str());
+		SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+		TestEventStream stream;
+
+		// Dense and sparse hit rates, and clusters larger than max_hits
+		for(int density = 0; density < 3; density++) {
+			std::mt19937 rng(31 + 10 * c + density);
+			EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(30000, 0, 0);
+			generateRawHits(raw, config, system, 30000, 0.5, (density == 0) ? 40 : 2, rng, -1, (density == 2) ? 6 : 3);
+
+			config->sw_trigger_group_engine = SystemConfig::GROUP_ENGINE_SCAN;
+			EventBuffer<Hit> *scanHits = processHits(config, &stream, copyBuffer(raw));
+			EventBuffer<GammaPhoton> *scan = groupHits(config, &stream, scanHits);
+
+			config->sw_trigger_group_engine = SystemConfig::GROUP_ENGINE_REGION;
+			EventBuffer<Hit> *regionHits = processHits(config, &stream, raw);
+			EventBuffer<GammaPhoton> *region = groupHits(config, &stream, regionHits);
+
+			unsigned nDifferent = 0;
+			CHECK(region->getSize() == scan->getSize());
+			for(unsigned n = 0; n < scan->getSize() && n < region->getSize(); n++) {
+				if(!samePhoton(scan->get(n), scanHits, region->get(n), regionHits)) nDifferent++;
+			}
+			if(nDifferent != 0 || region->getSize() != scan->getSize()) {
+				fprintf(stderr, "%s, density %d: %u of %lu photons differ (%lu from the scan engine)\n",
+					configs[c].name, density, nDifferent, region->getSize(), scan->getSize());
+			}
+			CHECK(nDifferent == 0);
+			CHECK(scan->getSize() > 0);
+			nPhotonsChecked += scan->getSize();
+
+			delete scan;
+			delete region;
+		}
+		delete config;
+	}
+	fprintf(stderr, "compared %u photons\n", nPhotonsChecked);
+
+	return result("test_group_engines");
+}
@@ -0,0 +1,223 @@
+/*
+ * HwTriggerSimulator must pass exactly the hits of a brute force trigger: a trigger request
+ * is a clock whose 5 clock window passes the energy and multiplicity cuts; a request is
+ * accepted, for its whole group of 4 trigger region IDs, when a request of a region in
+ * coincidence is within the coincidence window; a request is kept when an accepted request
+ * of its group, from any of its regions, is within the window; and a hit passes when a kept
+ * request of its region is within its pre and post windows. Hits of channels outside the
+ * trigger map never pass. Passed hits come out in time order.
+ */
+
+#include "TestUtil.hpp"
+#include <HwTriggerSimulator.hpp>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <tuple>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+typedef std::tuple<long long, unsigned, unsigned short, unsigned short, unsigned short> HitKey;
+
+static HitKey hitKey(RawHit &hit)
+{
+	return HitKey(hit.time, hit.channelID, hit.tacID, hit.tfine, hit.efine);
+}
+
+// Region IDs with gaps, so that groups of 4 region IDs are not groups of 4 dense regions
+static unsigned sparseRegion(unsigned region)
+{
+	return region + region / 3;
+}
+
+// Rewrite the given region columns of a table of the test system with sparseRegion()
+static void remapRegions(TestDir &dir, const char *name, std::vector<unsigned> columns)
+{
+	std::ifstream in(dir.file(name).c_str());
+	std::string out, line;
+	while(std::getline(in, line)) {
+		std::istringstream fields(line);
+		std::string field;
+		for(unsigned c = 0; std::getline(fields, field, '\t'); c++) {
+			if(c != 0) out += "\t";
+			if(std::find(columns.begin(), columns.end(), c) != columns.end())
+				field = std::to_string(sparseRegion(atoi(field.c_str())));
+			out += field;
+		}
+		out += "\n";
+	}
+	dir.writeFile(name, out);
+}
+
+static bool withinAny(int request, std::vector<int> &others, long long w)
+{
+	for(unsigned n = 0; n < others.size(); n++) {
+		if(llabs((long long)request - others[n]) <= w) return true;
+	}
+	return false;
+}
+
+// The hits HwTriggerSimulator must pass, by brute force
+static std::vector<HitKey> referenceTrigger(SystemConfig *config, EventBuffer<RawHit> *in)
+{
+	unsigned N = in->getSize();
+	long long timeMin = in->get(0).time;
+	long long timeMax = in->get(0).time;
+	for(unsigned i = 0; i < N; i++) {
+		timeMin = std::min(timeMin, in->get(i).time);
+		timeMax = std::max(timeMax, in->get(i).time);
+	}
+	timeMin -= 100;
+	timeMax += 100;
+	long long arraySize = timeMax - timeMin;
+	unsigned nRegions = config->getNumberOfDenseRegions();
+
+	// Clock and energy of each hit, and the sums of each region and clock
+	std::vector<long long> bin(N);
+	std::vector<int> region(N);
+	std::vector<std::vector<float> > energy(nRegions, std::vector<float>(arraySize, 0));
+	std::vector<std::vector<int> > multiplicity(nRegions, std::vector<int>(arraySize, 0));
+	for(unsigned i = 0; i < N; i++) {
+		RawHit &hit = in->get(i);
+		SystemConfig::FirmwareConfig &cf = config->getFirmwareConfig(hit.channelIndex, hit.tacID);
+		double e = cf.p0 + cf.p1 * hit.efine + cf.p2 * hit.efine * hit.efine;
+		if(e < 0.1875) e = 0.1875;
+		bin[i] = hit.time - (long long)(0.06 + cf.k0 / e) - timeMin;
+		region[i] = config->getDenseTriggerRegion(hit.channelIndex);
+		if(region[i] == -1 || bin[i] < 0 || bin[i] >= arraySize) continue;
+		energy[region[i]][bin[i]] += e;
+		multiplicity[region[i]][bin[i]] += 1;
+	}
+
+	std::vector<std::vector<int> > requests(nRegions);
+	for(unsigned r = 0; r < nRegions; r++) {
+		for(long long j = 0; j < arraySize; j++) {
+			double energySum = 0;
+			int n = 0;
+			for(long long k = std::max(0LL, j - 2); k <= std::min(arraySize - 1, j + 2); k++) {
+				energySum += energy[r][k];
+				n += multiplicity[r][k];
+			}
+			if(energySum <= config->sw_fw_trigger_group_min_energy || energySum >= config->sw_fw_trigger_group_max_energy) continue;
+			if(n < config->sw_fw_trigger_group_min_nhits || n > config->sw_fw_trigger_group_max_nhits) continue;
+			requests[r].push_back(j);
+		}
+	}
+
+	long long coincWindow = floor(config->sw_fw_trigger_coinc_window);
+	long long preWindow = floor(config->sw_fw_trigger_pre_window);
+	long long postWindow = floor(config->sw_fw_trigger_post_window);
+	std::vector<std::vector<int> > accepted(nRegions);
+	for(unsigned r1 = 0; r1 < nRegions; r1++) {
+		for(unsigned n = 0; n < requests[r1].size(); n++) {
+			bool coincident = false;
+			for(unsigned r2 = 0; r2 < nRegions; r2++) {
+				if(config->isCoincidenceAllowedDense(r1, r2) && withinAny(requests[r1][n], requests[r2], coincWindow))
+					coincident = true;
+			}
+			if(coincident) accepted[r1].push_back(requests[r1][n]);
+		}
+	}
+
+	std::vector<std::vector<int> > kept(nRegions);
+	for(unsigned r1 = 0; r1 < nRegions; r1++) {
+		for(unsigned n = 0; n < requests[r1].size(); n++) {
+			bool inGroup = false;
+			for(unsigned r2 = 0; r2 < nRegions; r2++) {
+				if(config->getRegionFromDense(r2) / 4 != config->getRegionFromDense(r1) / 4) continue;
+				if(withinAny(requests[r1][n], accepted[r2], coincWindow)) inGroup = true;
+			}
+			if(inGroup) kept[r1].push_back(requests[r1][n]);
+		}
+	}
+
+	std::vector<HitKey> passed;
+	for(unsigned i = 0; i < N; i++) {
+		if(region[i] == -1) continue;
+		std::vector<int> &k = kept[region[i]];
+		for(unsigned n = 0; n < k.size(); n++) {
+			if(k[n] - preWindow <= bin[i] && bin[i] <= k[n] + postWindow) {
+				passed.push_back(hitKey(in->get(i)));
+				break;
+			}
+		}
+	}
+	std::sort(passed.begin(), passed.end());
+	return passed;
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	remapRegions(dir, "map.tsv", { 4 });
+	remapRegions(dir, "trigger.tsv", { 0, 1 });
+
+	// Empirical calibration with a spread of energies and time walks
+	std::mt19937 rng(37);
+	std::uniform_real_distribution<double> u(0, 1);
+	std::string firmware;
+	char line[256];
+	for(unsigned n = 0; n < system.getNumberOfChannels(); n++) {
+		unsigned channelID = system.getChannelID(n);
+		for(unsigned tac = 0; tac < 4; tac++) {
+			sprintf(line, "%u\t%u\t%u\t%u\t%u\t%.6f\t%.6f\t%.8f\t%.6f\n",
+				channelID >> 17, (channelID >> 12) % 32, (channelID >> 6) % 64, channelID % 64, tac,
+				1 + 10 * u(rng), 0.02 * u(rng), 1E-5 * u(rng), 5 * u(rng));
+			firmware += line;
+		}
+	}
+	dir.writeFile("firmware.tsv", firmware);
+
+	struct { const char *name; const char *settings; } configs[] = {
+		{ "default", "" },
+		{ "energy cuts", "group_min_energy = 15\ngroup_max_energy = 60\n" },
+		{ "multiplicity cuts", "group_min_multiplicity = 2\ngroup_max_multiplicity = 5\n" },
+		{ "wide windows", "group_max_energy = 60\ncoincidence_window = 6.5\npre_window = 0\npost_window = 9\n" },
+	};
+	// Mean clocks between events over the 16 regions
+	const double intervals[] = { 200, 20, 3 };
+
+	unsigned nChecked = 0;
+	for(unsigned c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		std::string extra = std::string("[hw_trigger]\nhwtrigger_empirical_calibration_table = %CDIR%/firmware.tsv\n") + configs[c].settings;
+		std::string configName = system.writeConfig("config.ini", extra.c_str());
+		SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL);
+		CHECK(config->getNumberOfDenseRegions() == 16);
+		CHECK(config->getRegionFromDense(3) == 4);
+
+		for(unsigned i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+			EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(20000, 0, 0);
+			generateRawHits(raw, config, system, 20000, 0, intervals[i], rng);
+			std::vector<HitKey> expected = referenceTrigger(config, raw);
+			unsigned nOutside = 0;
+			for(unsigned n = 0; n < raw->getSize(); n++) {
+				if(config->getDenseTriggerRegion(raw->get(n).channelIndex) == -1) nOutside++;
+			}
+
+			CaptureSink<RawHit> *sink = new CaptureSink<RawHit>();
+			EventBuffer<RawHit> *out = runStage(new HwTriggerSimulator(config, sink), sink, raw);
+			std::vector<HitKey> passed;
+			bool timeOrder = true;
+			for(unsigned n = 0; n < out->getSize(); n++) {
+				passed.push_back(hitKey(out->get(n)));
+				if(n > 0 && out->get(n).time < out->get(n - 1).time) timeOrder = false;
+			}
+			std::sort(passed.begin(), passed.end());
+
+			fprintf(stderr, "%s, interval %g: %lu of 20000 hits passed, %lu expected, %u outside of the trigger map\n",
+				configs[c].name, intervals[i], passed.size(), expected.size(), nOutside);
+			CHECK(passed == expected);
+			CHECK(timeOrder);
+			CHECK(nOutside > 0);
+			CHECK(expected.size() > 0 && expected.size() < 20000 - nOutside);
+			nChecked += expected.size();
+			delete out;
+		}
+		delete config;
+	}
+	fprintf(stderr, "checked %u passed hits\n", nChecked);
+
+	return result("test_hw_trigger");
+}
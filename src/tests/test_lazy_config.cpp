@@ -0,0 +1,147 @@
+/*
+ * Lazy configuration loading: a configuration loaded for some ASICs only must give the
+ * channels of those ASICs the same calibration, position and trigger region values as the
+ * full load, give the other channels none, and keep the trigger region numbering and maps.
+ * RawReader must take the active ASICs from the .modf file when there is one, from a
+ * prescan of the raw data otherwise, and give none for data still being written.
+ */
+
+#include "TestUtil.hpp"
+#include <RawReader.hpp>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+static bool sameChannel(SystemConfig *a, unsigned ia, SystemConfig *b, unsigned ib)
+{
+	bool same = true;
+	for(unsigned tac = 0; tac < 4; tac++) {
+		same = same && sameBits(a->getTacConfigT(ia, tac), b->getTacConfigT(ib, tac));
+		same = same && sameBits(a->getTacConfigE(ia, tac), b->getTacConfigE(ib, tac));
+		same = same && sameBits(a->getQacConfig(ia, tac), b->getQacConfig(ib, tac));
+		same = same && sameBits(a->getEnergyConfig(ia, tac), b->getEnergyConfig(ib, tac));
+	}
+	same = same && sameBits(a->getTimeOffset(ia), b->getTimeOffset(ib));
+	same = same && sameBits(a->getChannelPosition(ia), b->getChannelPosition(ib));
+	same = same && (a->getTriggerRegion(ia) == b->getTriggerRegion(ib));
+	same = same && (a->getDenseTriggerRegion(ia) == b->getDenseTriggerRegion(ib));
+	return same;
+}
+
+static bool sameAsics(const bool *a, const bool *b)
+{
+	if(a == NULL || b == NULL) return false;
+	for(unsigned n = 0; n < MAX_NUMBER_ASICS; n++) {
+		if(a[n] != b[n]) return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 4);
+	std::string configName = system.writeConfig("config.ini");
+	u_int64_t mask = SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS;
+	SystemConfig *full = SystemConfig::fromFile(configName.c_str(), mask);
+
+	// Hits in 5 of the 32 ASICs, among them chip 0 of slave 0, whose channel 63 is not in
+	// the channel map, and chip 1 of slave 0, whose channels 0 to 3 have no calibration
+	const unsigned hitAsics[] = { 0, 1, 9, 22, 31 };
+	bool *expected = new bool[MAX_NUMBER_ASICS]();
+	for(unsigned k = 0; k < 5; k++) expected[system.getChannelID(hitAsics[k] * 64) >> 6] = true;
+
+	std::mt19937 rng(30);
+	EventBuffer<RawHit> *generated = new EventBuffer<RawHit>(200000, 0, 0);
+	generateRawHits(generated, full, system, 200000, 0, 10, rng);
+	std::vector<RawHit> kept;
+	for(unsigned n = 0; n < generated->getSize(); n++) {
+		RawHit &hit = generated->get(n);
+		if(expected[hit.channelID >> 6]) kept.push_back(hit);
+	}
+	delete generated;
+	std::stable_sort(kept.begin(), kept.end(), [](const RawHit &a, const RawHit &b) { return a.frameID < b.frameID; });
+	EventBuffer<RawHit> *hits = new EventBuffer<RawHit>(kept.size(), 0, 0);
+	for(unsigned n = 0; n < kept.size(); n++) hits->push(kept[n]);
+	long long endFrame = kept.back().frameID + 1;
+
+	// Prescan of the raw data
+	writeRawFile(dir, "run", hits, 0, endFrame);
+	RawReader *reader = RawReader::openFile(dir.file("run").c_str(), RawReader::SYNC);
+	const bool *prescanned = reader->getActiveAsics();
+	CHECK(prescanned != NULL);
+	CHECK(sameAsics(prescanned, expected));
+
+	SystemConfig *lazy = SystemConfig::fromFile(configName.c_str(), mask, prescanned);
+	unsigned nActive = 0;
+	unsigned nSame = 0;
+	unsigned nOutside = 0;
+	for(unsigned n = 0; n < system.getNumberOfChannels(); n++) {
+		unsigned channelID = system.getChannelID(n);
+		unsigned fullIndex = full->getChannelIndex(channelID);
+		unsigned lazyIndex = lazy->getChannelIndex(channelID);
+		if(!expected[channelID >> 6]) {
+			if(lazyIndex != 0) nOutside++;
+			continue;
+		}
+		CHECK(fullIndex != 0);
+		CHECK(lazyIndex != 0);
+		nActive++;
+		if(sameChannel(full, fullIndex, lazy, lazyIndex)) nSame++;
+	}
+	fprintf(stderr, "%u of %u channels loaded, %u the same as in the full load, %u outside of the active ASICs\n",
+		lazy->getNumberOfChannels() - 1, full->getNumberOfChannels() - 1, nSame, nOutside);
+	CHECK(nActive == 5 * 64);
+	CHECK(nSame == nActive);
+	CHECK(nOutside == 0);
+	CHECK(lazy->getNumberOfChannels() - 1 == nActive);
+
+	// Regions of the ASICs which were not loaded keep their numbering and maps
+	CHECK(lazy->getNumberOfDenseRegions() == full->getNumberOfDenseRegions());
+	unsigned R = system.getNumberOfRegions();
+	bool sameRegions = true;
+	for(unsigned r1 = 0; r1 < R; r1++) {
+		sameRegions = sameRegions && (lazy->getDenseRegion(r1) == full->getDenseRegion(r1));
+		for(unsigned r2 = 0; r2 < R; r2++) {
+			sameRegions = sameRegions && (lazy->isCoincidenceAllowed(r1, r2) == full->isCoincidenceAllowed(r1, r2));
+			sameRegions = sameRegions && (lazy->isMultiHitAllowed(r1, r2) == full->isMultiHitAllowed(r1, r2));
+		}
+	}
+	CHECK(sameRegions);
+	CHECK(lazy->mapTriggerRegions == full->mapTriggerRegions);
+	delete lazy;
+	delete reader;
+
+	// The mode file lists the configured ASICs, which need not have any hits
+	std::string modeFile = "#portID\tslaveID\tchipID\tchannelID\tmode\n";
+	bool *configured = new bool[MAX_NUMBER_ASICS]();
+	const unsigned configuredAsics[] = { 3, 9, 17 };
+	for(unsigned k = 0; k < 3; k++) {
+		for(unsigned channel = 0; channel < 64; channel++) {
+			unsigned channelID = system.getChannelID(configuredAsics[k] * 64 + channel);
+			char line[128];
+			sprintf(line, "%u\t%u\t%u\t%u\ttot\n", channelID >> 17, (channelID >> 12) % 32, (channelID >> 6) % 64, channel);
+			modeFile += line;
+			configured[channelID >> 6] = true;
+		}
+	}
+	dir.writeFile("run.modf", modeFile);
+	reader = RawReader::openFile(dir.file("run").c_str(), RawReader::SYNC);
+	CHECK(sameAsics(reader->getActiveAsics(), configured));
+	delete reader;
+	unlink(dir.file("run.modf").c_str());
+
+	// Data still being written, with a temporary index
+	writeRawFile(dir, "open", hits, 0, endFrame);
+	rename(dir.file("open.idxf").c_str(), dir.file("open.tmpf").c_str());
+	reader = RawReader::openFile(dir.file("open").c_str(), RawReader::SYNC);
+	CHECK(reader->getActiveAsics() == NULL);
+	delete reader;
+
+	delete hits;
+	delete [] expected;
+	delete [] configured;
+	delete full;
+	return result("test_lazy_config");
+}
@@ -0,0 +1,117 @@
+/*
+ * LOR histogram counts: every prompt coincidence of two photons must be counted once, in
+ * the bins of the time difference of the first hits of its photons and of the energies of
+ * the photons, scaled as in the coincidence output, with the photons ordered by channel.
+ */
+
+#include "OutputReference.hpp"
+#include <LORHistogram.hpp>
+#include <math.h>
+#include <map>
+#include <algorithm>
+#include <tuple>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+typedef std::tuple<uint32_t, uint32_t, int, int, int> Bins;
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+	float Tns = 1E12 / frequency / 1000;
+
+	std::mt19937 rng(49);
+	TestEvents events;
+	makeTestEvents(events, config, &stream, system, 8, 50000, 1LL << 20, rng);
+
+	// Energy bins over most of the photons with an energy (not those of uncalibrated channels),
+	// time bins over the coincidence window, so that both cuts are tested
+	std::vector<double> energies;
+	unsigned nMultipleHits = 0;
+	unsigned nCoincidences = 0;
+	for(unsigned b = 0; b < events.size(); b++) {
+		EventBuffer<Coincidence> *buffer = events.coincidences[b];
+		for(unsigned i = 0; i < buffer->getSize(); i++) {
+			Coincidence &e = buffer->get(i);
+			if(!e.valid || e.nPhotons != 2) continue;
+			int nFinite = 0;
+			for(int k = 0; k < 2; k++) {
+				GammaPhoton &p = *e.photons[k];
+				double energy = p.energy * (p.hits[0]->qdcMode ? 1.0 : Tns);
+				if(!isfinite(energy)) continue;
+				energies.push_back(energy);
+				nFinite++;
+				if(p.nHits > 1) nMultipleHits++;
+			}
+			if(nFinite == 2) nCoincidences++;
+		}
+	}
+	CHECK(nMultipleHits > 100);
+	std::sort(energies.begin(), energies.end());
+	double energyMin = energies[energies.size() / 50];
+	double energyMax = energies[energies.size() * 9 / 10];
+	char section[256];
+	sprintf(section,
+		"[lor_histogram]\n"
+		"time_bin_width = 20000\n"
+		"time_bins = 9\n"
+		"energy_bins = 6\n"
+		"energy_min = %f\n"
+		"energy_max = %f\n", energyMin, energyMax);
+	std::string histogramConfigName = system.writeConfig("histogram.ini", section);
+	SystemConfig *histogramConfig = SystemConfig::fromFile(histogramConfigName.c_str(), 0);
+
+	LORHistogram histogram(histogramConfig, Tns);
+	std::map<Bins, uint32_t> expected;
+	double energyBinWidth = (histogramConfig->lor_histogram_energy_max - histogramConfig->lor_histogram_energy_min) / 6;
+	for(unsigned b = 0; b < events.size(); b++) {
+		EventBuffer<Coincidence> *buffer = events.coincidences[b];
+		histogram.fill(buffer, 0);
+		for(unsigned i = 0; i < buffer->getSize(); i++) {
+			Coincidence &e = buffer->get(i);
+			if(!e.valid || e.nPhotons != 2) continue;
+			GammaPhoton *p1 = e.photons[0];
+			GammaPhoton *p2 = e.photons[1];
+			if(p2->hits[0]->channelID < p1->hits[0]->channelID) std::swap(p1, p2);
+
+			int timeBin = (int)floor((p2->hits[0]->time - p1->hits[0]->time) / 20000.0) + 4;
+			int energyBin1 = (int)floor((p1->energy * (p1->hits[0]->qdcMode ? 1.0 : Tns) - histogramConfig->lor_histogram_energy_min) / energyBinWidth);
+			int energyBin2 = (int)floor((p2->energy * (p2->hits[0]->qdcMode ? 1.0 : Tns) - histogramConfig->lor_histogram_energy_min) / energyBinWidth);
+			if(timeBin < 0 || timeBin >= 9) continue;
+			if(energyBin1 < 0 || energyBin1 >= 6 || energyBin2 < 0 || energyBin2 >= 6) continue;
+			expected[Bins(p1->hits[0]->channelID, p2->hits[0]->channelID, timeBin, energyBin1, energyBin2)] += 1;
+		}
+	}
+
+	std::vector<LORHistogramEntry> entries;
+	histogram.takeStep(entries);
+	std::map<Bins, uint32_t> counted;
+	uint64_t nCounted = 0;
+	for(unsigned n = 0; n < entries.size(); n++) {
+		LORHistogramEntry &entry = entries[n];
+		counted[Bins(entry.channelID1, entry.channelID2, entry.timeBin, entry.energyBin1, entry.energyBin2)] += entry.counts;
+		nCounted += entry.counts;
+	}
+	uint64_t nExpected = 0;
+	for(auto it = expected.begin(); it != expected.end(); it++) nExpected += it->second;
+	fprintf(stderr, "%lu of %u coincidences with energies in %lu bins, expected %lu in %lu bins\n", nCounted, nCoincidences, entries.size(), nExpected, expected.size());
+	CHECK(counted == expected);
+	CHECK(counted.size() == entries.size());
+	CHECK(nExpected > nCoincidences / 4 && nExpected < nCoincidences);
+
+	// The next step starts empty
+	histogram.takeStep(entries);
+	CHECK(entries.empty());
+
+	delete histogramConfig;
+	delete config;
+	return result("test_lor_histogram");
+}
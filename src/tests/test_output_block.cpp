@@ -0,0 +1,103 @@
+/*
+ * OutputBlock must render integers and floats exactly as the printf formats which it
+ * replaces in the text writers: "%lld", "%llu" and "%f", both with std::to_chars and
+ * with the snprintf fallback.
+ */
+
+#include "TestUtil.hpp"
+#include <OutputBlock.hpp>
+#include <limits.h>
+#include <limits>
+#include <math.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+// Render all values into one block, growing it as the writers do, and compare with printf
+template <class T>
+static void compare(const char *what, const std::vector<T> &values, const char *format, void (OutputBlock::*put)(T))
+{
+	OutputBlock block(0, 0);
+	std::string expected;
+	char tmp[512];
+	for(size_t n = 0; n < values.size(); n++) {
+		block.reserveRecord();
+		(block.*put)(values[n]);
+		block.putChar('\t');
+		snprintf(tmp, sizeof(tmp), format, values[n]);
+		expected += tmp;
+		expected += '\t';
+	}
+
+	std::string actual(block.getData(), block.getSize());
+	if(actual != expected) {
+		size_t n = 0;
+		while(n < actual.size() && n < expected.size() && actual[n] == expected[n]) n++;
+		size_t start = expected.rfind('\t', n);
+		start = (start == std::string::npos) ? 0 : start + 1;
+		fprintf(stderr, "%s: differs at byte %lu: '%s' instead of '%s'\n", what, n,
+			actual.substr(start, 32).c_str(), expected.substr(start, 32).c_str());
+	}
+	CHECK(actual == expected);
+}
+
+int main(int argc, char *argv[])
+{
+	std::mt19937_64 rng(41);
+	std::uniform_real_distribution<double> u(0, 1);
+
+	std::vector<long long> ints = { 0, 1, -1, 9, -9, 10, -10, LLONG_MAX, LLONG_MIN, LLONG_MIN + 1 };
+	for(long long p = 1; p <= LLONG_MAX / 10; p *= 10) {
+		ints.push_back(p);
+		ints.push_back(p - 1);
+		ints.push_back(-p);
+		ints.push_back(-p + 1);
+	}
+	for(int n = 0; n < 100000; n++) {
+		ints.push_back((long long)rng() >> (rng() % 64));
+	}
+	compare("putInt", ints, "%lld", &OutputBlock::putInt);
+
+	std::vector<unsigned long long> unsignedInts = { 0, 1, ULLONG_MAX, ULLONG_MAX - 1 };
+	for(int n = 0; n < 100000; n++) {
+		unsignedInts.push_back(rng() >> (rng() % 64));
+	}
+	compare("putUnsigned", unsignedInts, "%llu", &OutputBlock::putUnsigned);
+
+	std::vector<double> floats = {
+		0.0, -0.0, 1.0, -1.0, 1E-7, -1E-7, 4E-7, -4E-7, 5E-7, -5E-7, 6E-7,
+		0.5, 0.25, 1234567.890625, 999999.9999995, 9.9999995, 1E15, -1E15,
+		NAN, -NAN, INFINITY, -INFINITY,
+		std::numeric_limits<double>::denorm_min(), std::numeric_limits<double>::min()
+	};
+	// Halfway cases of the 6th decimal and their neighbours, where rounding must agree
+	for(int n = 0; n < 2000; n++) {
+		double v = (rng() % 100000000) * 1E-6 + 5E-7;
+		floats.push_back(v);
+		floats.push_back(nextafter(v, 0));
+		floats.push_back(nextafter(v, 1E9));
+		floats.push_back(-v);
+	}
+	// Values of all the magnitudes which the writers see, as floats and as doubles
+	for(int n = 0; n < 100000; n++) {
+		double v = pow(10, -10 + 25 * u(rng)) * ((rng() % 2) ? 1 : -1);
+		floats.push_back(v);
+		floats.push_back((float)v);
+	}
+	// Times in ps and energies, as the writers compute them
+	for(int n = 0; n < 20000; n++) {
+		floats.push_back((long long)(rng() % 1000000000000000LL) + 1E-3 * (rng() % 1000));
+		floats.push_back((float)(1000 * u(rng)));
+	}
+
+#ifdef __cpp_lib_to_chars
+	compare("putFixedToChars", floats, "%f", &OutputBlock::putFixedToChars);
+#else
+	fprintf(stderr, "std::to_chars for floating point is not available, only the fallback was tested\n");
+#endif
+	compare("putFixedPrintf", floats, "%f", &OutputBlock::putFixedPrintf);
+	compare("putFixed", floats, "%f", &OutputBlock::putFixed);
+
+	fprintf(stderr, "compared %lu integers and %lu floats\n", ints.size() + unsignedInts.size(), floats.size());
+	return result("test_output_block");
+}
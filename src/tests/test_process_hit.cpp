@@ -0,0 +1,113 @@
+/*
+ * ProcessHit runs one of its kernel specialisations for each buffer, chosen from the
+ * configuration flags, the trigger and the energy mode of the buffer's hits.
+ * Check that every combination gives the same hits as the generic loop.
+ */
+
+#include "TestUtil.hpp"
+#include "ProcessHitReference.hpp"
+#include <ProcessHit.hpp>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+static const int TRIGGER_ID = 5;
+
+static bool compareHits(Hit &a, Hit &b)
+{
+	return a.valid == b.valid && a.qdcMode == b.qdcMode && a.tacID == b.tacID && a.efine == b.efine
+		&& a.channelID == b.channelID && a.channelIndex == b.channelIndex
+		&& a.rawTime == b.rawTime && a.rawTimeEnd == b.rawTimeEnd
+		&& a.time == b.time && a.timeEnd == b.timeEnd && sameBits(a.energy, b.energy)
+		&& a.region == b.region && a.denseRegion == b.denseRegion && a.xi == b.xi && a.yi == b.yi
+		&& sameBits(a.x, b.x) && sameBits(a.y, b.y) && sameBits(a.z, b.z);
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	const char *modeNames[] = { "ToT", "QDC", "mixed" };
+	const double qdcFractions[] = { 0.0, 1.0, 0.5 };
+
+	// The same raw hits are given to every configuration
+	std::string allConfigName = system.writeConfig("all.ini");
+	SystemConfig *allConfig = SystemConfig::fromFile(allConfigName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	std::mt19937 rng(27);
+	EventBuffer<RawHit> *rawBuffers[3];
+	for(int mode = 0; mode < 3; mode++) {
+		rawBuffers[mode] = new EventBuffer<RawHit>(20000, 0, 0);
+		generateRawHits(rawBuffers[mode], allConfig, system, 20000, qdcFractions[mode], 20, rng, TRIGGER_ID);
+	}
+	delete allConfig;
+
+	unsigned nCombinations = 0;
+	for(unsigned flags = 0; flags < 32; flags++) {
+		bool useTDC = flags & 1;
+		bool useQDC = flags & 2;
+		bool useEnergyCal = flags & 4;
+		bool useTimeOffsetCal = flags & 8;
+		bool useXYZ = flags & 16;
+		// The energy calibration is only loaded with the QDC calibration
+		if(useEnergyCal && !useQDC) continue;
+
+		u_int64_t mask = 0;
+		if(useTDC) mask |= SystemConfig::LOAD_TDC_CALIBRATION;
+		if(useQDC) mask |= SystemConfig::LOAD_QDC_CALIBRATION;
+		if(useTimeOffsetCal) mask |= SystemConfig::LOAD_TIMEALIGN_CALIBRATION;
+		if(useXYZ) mask |= SystemConfig::LOAD_MAPPING;
+
+		std::string content = "[main]\n"
+			"tdc_calibration_table = %CDIR%/tdc.tsv\n"
+			"qdc_calibration_table = %CDIR%/qdc.tsv\n"
+			"time_offset_calibration_table = %CDIR%/time_offset.tsv\n"
+			"channel_map = %CDIR%/map.tsv\n"
+			"trigger_map = %CDIR%/trigger.tsv\n";
+		if(useEnergyCal) content += "energy_calibration_table = %CDIR%/energy.tsv\n";
+		dir.writeFile("flags.ini", content);
+		SystemConfig *config = SystemConfig::fromFile(dir.file("flags.ini").c_str(), mask);
+		CHECK(config->useTDCCalibration() == useTDC);
+		CHECK(config->useQDCCalibration() == useQDC);
+		CHECK(config->useEnergyCalibration() == useEnergyCal);
+		CHECK(config->useTimeOffsetCalibration() == useTimeOffsetCal);
+		CHECK(config->useXYZ() == useXYZ);
+
+		for(int triggerID = -1; triggerID <= TRIGGER_ID; triggerID += TRIGGER_ID + 1) {
+			TestEventStream stream(200E6, triggerID);
+			for(int mode = 0; mode < 3; mode++) {
+				EventBuffer<RawHit> *in = copyBuffer(rawBuffers[mode]);
+				for(unsigned n = 0; n < in->getSize(); n++) {
+					in->get(n).channelIndex = config->getChannelIndex(in->get(n).channelID);
+				}
+				EventBuffer<Hit> *expected = processHitsReference(config, &stream, in);
+
+				CaptureSink<Hit> *sink = new CaptureSink<Hit>();
+				ProcessHit *processHit = new ProcessHit(config, &stream, sink);
+				processHit->pushEvents(in);
+				EventBuffer<Hit> *out = sink->buffers[0];
+
+				unsigned nDifferent = 0;
+				CHECK(out->getSize() == expected->getSize());
+				for(unsigned n = 0; n < out->getSize() && n < expected->getSize(); n++) {
+					if(!compareHits(out->get(n), expected->get(n))) nDifferent++;
+				}
+				if(nDifferent != 0 || out->getSize() != expected->getSize()) {
+					fprintf(stderr, "flags TDC=%d QDC=%d energy=%d offsets=%d XYZ=%d trigger=%d %s buffer: %u of %lu hits differ (%lu expected)\n",
+						useTDC, useQDC, useEnergyCal, useTimeOffsetCal, useXYZ, triggerID, modeNames[mode],
+						nDifferent, out->getSize(), expected->getSize());
+				}
+				CHECK(nDifferent == 0);
+				CHECK(out->getSize() > 0);
+				nCombinations++;
+
+				delete processHit;
+				delete expected;
+			}
+		}
+		delete config;
+	}
+	fprintf(stderr, "compared %u combinations of flags, trigger and buffer energy mode\n", nCombinations);
+
+	for(int mode = 0; mode < 3; mode++) delete rawBuffers[mode];
+	return result("test_process_hit");
+}
@@ -0,0 +1,180 @@
+/*
+ * Hit, photon and coincidence times are integer picoseconds.
+ * Check that they are the calibrated times in clock periods, which they replaced,
+ * truncated to picoseconds, and that SimpleGrouper and CoincidenceGrouper find the same
+ * photons and coincidences as they did when comparing times in clock periods.
+ */
+
+#include "TestUtil.hpp"
+#include "ProcessHitReference.hpp"
+#include <ProcessHit.hpp>
+#include <SimpleGrouper.hpp>
+#include <CoincidenceGrouper.hpp>
+#include <math.h>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+static bool compareEnergy(Hit *a, Hit *b) { return a->energy > b->energy; }
+
+/*
+ * Photons as SimpleGrouper made them with times in clock periods,
+ * as lists of hits, highest energy first; only photons passing the cuts are listed
+ */
+static void groupClockTimes(SystemConfig *config, EventBuffer<Hit> *inBuffer, std::vector<double> &clockTimes,
+	std::vector<std::vector<Hit *> > &photons)
+{
+	double timeWindow1 = config->sw_trigger_group_time_window;
+	float radius2 = config->sw_trigger_group_max_distance * config->sw_trigger_group_max_distance;
+	int maxHits = config->sw_trigger_group_max_hits;
+	int minHits = config->sw_trigger_group_min_hits;
+	unsigned N = inBuffer->getSize();
+	std::vector<bool> taken(N, false);
+	Hit *hits[GammaPhoton::maxHits];
+
+	for(unsigned i = 0; i < N; i++) {
+		Hit &hit = inBuffer->get(i);
+		if(!hit.valid || taken[i]) continue;
+		taken[i] = true;
+		hits[0] = &hit;
+		int nHits = 1;
+		for(unsigned j = i + 1; j < N; j++) {
+			Hit &hit2 = inBuffer->get(j);
+			if(!hit2.valid || taken[j]) continue;
+			if((clockTimes[j] - clockTimes[i]) > (timeWindow1 + MAX_UNORDER)) break;
+			if(!config->isMultiHitAllowed(hit2.region, hit.region)) continue;
+			if(fabs(clockTimes[i] - clockTimes[j]) > timeWindow1) continue;
+			float u = hit.x - hit2.x;
+			float v = hit.y - hit2.y;
+			float w = hit.z - hit2.z;
+			if(u*u + v*v + w*w > radius2) continue;
+			taken[j] = true;
+			if(nHits < maxHits) hits[nHits] = &hit2;
+			nHits++;
+		}
+		if(nHits > maxHits || nHits < minHits) continue;
+		std::sort(hits, hits + nHits, compareEnergy);
+
+		float totalEnergy = 0;
+		for(int k = 0; k < nHits; k++) totalEnergy += hits[k]->energy;
+		if(totalEnergy < config->sw_trigger_group_min_energy || totalEnergy > config->sw_trigger_group_max_energy) continue;
+		photons.push_back(std::vector<Hit *>(hits, hits + nHits));
+	}
+}
+
+/*
+ * Coincidences as CoincidenceGrouper made them with times in clock periods, as pairs of photon indices
+ */
+static void pairClockTimes(SystemConfig *config, EventBuffer<GammaPhoton> *inBuffer, std::vector<double> &clockTimes,
+	std::vector<std::pair<unsigned, unsigned> > &pairs)
+{
+	double cWindow = config->sw_trigger_coincidence_time_window;
+	unsigned N = inBuffer->getSize();
+	for(unsigned i = 0; i < N; i++) {
+		GammaPhoton &photon1 = inBuffer->get(i);
+		for(unsigned j = i + 1; j < N; j++) {
+			GammaPhoton &photon2 = inBuffer->get(j);
+			if((clockTimes[j] - clockTimes[i]) > (cWindow + MAX_UNORDER)) break;
+			if(!config->isCoincidenceAllowed(photon1.region, photon2.region)) continue;
+			if(fabs(clockTimes[i] - clockTimes[j]) <= cWindow) {
+				bool first1 = photon1.region > photon2.region;
+				pairs.push_back(first1 ? std::make_pair(i, j) : std::make_pair(j, i));
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"group_engine = scan\n"
+		"coincidence_engine = scan\n"
+		"group_time_window = 20\n"
+		"coincidence_time_window = 2\n"
+		"group_max_distance = 100\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+
+	// Frequencies whose clock period is and is not a whole number of picoseconds
+	const double frequencies[] = { 200E6, 160E6, 170E6 };
+	unsigned nHitsChecked = 0, nPhotonsChecked = 0, nCoincidencesChecked = 0;
+	for(unsigned f = 0; f < sizeof(frequencies) / sizeof(frequencies[0]); f++) {
+		TestEventStream stream(frequencies[f]);
+		double Tps = 1E12 / frequencies[f];
+		std::mt19937 rng(29 + f);
+		EventBuffer<RawHit> *raw = new EventBuffer<RawHit>(50000, 0, 0);
+		generateRawHits(raw, config, system, 50000, 0.5, 8, rng);
+
+		// Hits: picoseconds are the clock period times truncated
+		std::vector<double> hitClockTimes;
+		delete processHitsReference(config, &stream, raw, &hitClockTimes);
+
+		// Each handler deletes its sink; the buffers are taken out of the sinks first
+		CaptureSink<Hit> *hitSink = new CaptureSink<Hit>();
+		ProcessHit *processHit = new ProcessHit(config, &stream, hitSink);
+		processHit->pushEvents(raw);
+		EventBuffer<Hit> *hits = hitSink->buffers[0];
+		hitSink->buffers.clear();
+		delete processHit;
+
+		CHECK(hits->getSize() == hitClockTimes.size());
+		for(unsigned n = 0; n < hits->getSize() && n < hitClockTimes.size(); n++) {
+			double t = hitClockTimes[n] * Tps;
+			CHECK(hits->get(n).time <= t && hits->get(n).time > t - 1);
+			nHitsChecked++;
+		}
+
+		// Photons
+		std::vector<std::vector<Hit *> > expectedPhotons;
+		groupClockTimes(config, hits, hitClockTimes, expectedPhotons);
+		CaptureSink<GammaPhoton> *photonSink = new CaptureSink<GammaPhoton>();
+		SimpleGrouper *grouper = new SimpleGrouper(config, &stream, photonSink);
+		grouper->pushEvents(hits);
+		EventBuffer<GammaPhoton> *photons = photonSink->buffers[0];
+		photonSink->buffers.clear();
+		delete grouper;
+
+		std::vector<double> photonClockTimes;
+		CHECK(photons->getSize() == expectedPhotons.size());
+		for(unsigned n = 0; n < photons->getSize() && n < expectedPhotons.size(); n++) {
+			GammaPhoton &photon = photons->get(n);
+			std::vector<Hit *> &expected = expectedPhotons[n];
+			bool same = (unsigned)photon.nHits == expected.size();
+			for(int k = 0; same && k < photon.nHits; k++) same = photon.hits[k] == expected[k];
+			CHECK(same);
+			CHECK(photon.time == photon.hits[0]->time);
+			photonClockTimes.push_back(hitClockTimes[photon.hits[0] - hits->getPtr()]);
+			nPhotonsChecked++;
+		}
+		CHECK(photons->getSize() > 1000);
+
+		// Coincidences
+		std::vector<std::pair<unsigned, unsigned> > expectedPairs;
+		pairClockTimes(config, photons, photonClockTimes, expectedPairs);
+		CaptureSink<Coincidence> *coincidenceSink = new CaptureSink<Coincidence>();
+		CoincidenceGrouper *coincidenceGrouper = new CoincidenceGrouper(config, &stream, coincidenceSink);
+		coincidenceGrouper->pushEvents(photons);
+		EventBuffer<Coincidence> *coincidences = coincidenceSink->buffers[0];
+		coincidenceSink->buffers.clear();
+		delete coincidenceGrouper;
+
+		CHECK(coincidences->getSize() == expectedPairs.size());
+		for(unsigned n = 0; n < coincidences->getSize() && n < expectedPairs.size(); n++) {
+			Coincidence &c = coincidences->get(n);
+			CHECK(c.photons[0] - photons->getPtr() == expectedPairs[n].first);
+			CHECK(c.photons[1] - photons->getPtr() == expectedPairs[n].second);
+			nCoincidencesChecked++;
+		}
+		CHECK(coincidences->getSize() > 100);
+
+		// The coincidence buffer owns the photon and hit buffers
+		delete coincidences;
+	}
+	fprintf(stderr, "checked %u hits, %u photons and %u coincidences\n", nHitsChecked, nPhotonsChecked, nCoincidencesChecked);
+
+	delete config;
+	return result("test_ps_times");
+}
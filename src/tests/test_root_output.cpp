@@ -0,0 +1,124 @@
+/*
+ * ROOT output written in batches must read back as the serial fill: the data tree must
+ * hold the same entries in the same order, branch by branch, and the index tree the same
+ * steps (step1, step2, stepBegin, stepEnd), for singles, groups, prompt and delayed
+ * coincidences, with write*Events() and with buffers formatted ahead out of order.
+ * Batches are not used with an event fraction, which must then also match.
+ */
+
+#include "OutputReference.hpp"
+#include <TFile.h>
+#include <TTree.h>
+#include <TBranch.h>
+#include <TLeaf.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+// Branch names of a tree, and its entries as the bytes of all branches in order
+struct TreeContents {
+	std::vector<std::string> branches;
+	std::vector<std::string> entries;
+};
+
+static TreeContents readTree(const std::string &fileName, const char *treeName)
+{
+	TreeContents contents;
+	TFile *file = TFile::Open(fileName.c_str(), "READ");
+	if(file == NULL || file->IsZombie()) {
+		fprintf(stderr, "Could not open '%s' with ROOT\n", fileName.c_str());
+		delete file;
+		return contents;
+	}
+	TTree *tree = (TTree *)file->Get(treeName);
+	if(tree == NULL) {
+		fprintf(stderr, "'%s' has no tree '%s'\n", fileName.c_str(), treeName);
+		delete file;
+		return contents;
+	}
+
+	TObjArray *branches = tree->GetListOfBranches();
+	for(int b = 0; b < branches->GetEntriesFast(); b++) {
+		contents.branches.push_back(branches->At(b)->GetName());
+	}
+	for(Long64_t n = 0; n < tree->GetEntries(); n++) {
+		tree->GetEntry(n);
+		std::string entry;
+		for(int b = 0; b < branches->GetEntriesFast(); b++) {
+			TLeaf *leaf = (TLeaf *)((TBranch *)branches->At(b))->GetListOfLeaves()->At(0);
+			entry.append((const char *)leaf->GetValuePointer(), leaf->GetLenType() * leaf->GetLen());
+		}
+		contents.entries.push_back(entry);
+	}
+	delete file;
+	return contents;
+}
+
+static bool sameTree(const std::string &batchedName, const std::string &serialName, const char *treeName)
+{
+	TreeContents batched = readTree(batchedName, treeName);
+	TreeContents serial = readTree(serialName, treeName);
+	unsigned nDifferent = 0;
+	for(size_t n = 0; n < std::min(batched.entries.size(), serial.entries.size()); n++) {
+		if(batched.entries[n] != serial.entries[n]) nDifferent++;
+	}
+	bool same = (batched.branches == serial.branches) && (batched.entries.size() == serial.entries.size()) && (nDifferent == 0);
+	if(!same) {
+		fprintf(stderr, "%s tree: %lu branches and %lu entries instead of %lu and %lu, %u entries differ\n", treeName,
+			batched.branches.size(), batched.entries.size(), serial.branches.size(), serial.entries.size(), nDifferent);
+	}
+	return same && !serial.entries.empty();
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n"
+		"coincidence_delayed_offsets = 1000\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+	const double t0 = 123456789;
+
+	// More singles than two batches in each step, so that batches are appended while others are compressed
+	std::mt19937 rng(43);
+	TestEvents events;
+	makeTestEvents(events, config, &stream, system, 32, 20000, 1LL << 20, rng);
+
+	const EVENT_TYPE eventTypes[] = { SINGLE, GROUP, COINCIDENCE };
+	const int eventFractions[] = { 1024, 300 };
+	std::string serialName = dir.file("serial.root");
+	std::string batchedName = dir.file("batched.root");
+	unsigned nCompared = 0;
+	for(unsigned e = 0; e < 3; e++)
+	for(unsigned k = 0; k < 2; k++)
+	for(short delayed = 0; delayed < ((eventTypes[e] == COINCIDENCE) ? 2 : 1); delayed++)
+	for(int formatAhead = 0; formatAhead < 2; formatAhead++) {
+		DataFileWriter *writer = new DataFileWriter((char *)serialName.c_str(), false, frequency, eventTypes[e], FILE_ROOT,
+			0, 1, eventFractions[k], 0, 0);
+		writeTestEvents(writer, events, eventTypes[e], t0, delayed, formatAhead);
+		delete writer;
+
+		writer = new DataFileWriter((char *)batchedName.c_str(), false, frequency, eventTypes[e], FILE_ROOT,
+			0, 1, eventFractions[k], 0, 0);
+		writer->enableRootBatches();
+		writeTestEvents(writer, events, eventTypes[e], t0, delayed, formatAhead);
+		delete writer;
+
+		bool same = sameTree(batchedName, serialName, "data") && sameTree(batchedName, serialName, "index");
+		if(!same) {
+			fprintf(stderr, "event type %d, event fraction %d, delayed %d, format ahead %d differ\n",
+				eventTypes[e], eventFractions[k], delayed, formatAhead);
+		}
+		CHECK(same);
+		CHECK(readTree(batchedName, "index").entries.size() == 2);
+		nCompared++;
+	}
+	fprintf(stderr, "compared %u outputs\n", nCompared);
+
+	delete config;
+	return result("test_root_output");
+}
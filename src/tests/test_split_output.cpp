@@ -0,0 +1,179 @@
+/*
+ * Split output must neither lose nor duplicate events: the parts, read in order, must give
+ * the same events as the output written without splitting, in every format, for every
+ * event type and event fraction, with buffers formatted ahead out of order, and with
+ * asynchronous writing. Each part must be complete on its own and take its final name.
+ */
+
+#include "OutputReference.hpp"
+#include <CompressedFile.hpp>
+#include <ColumnarFile.hpp>
+#include <dirent.h>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+struct OutputFormat {
+	const char *name;
+	FILE_TYPE fileType;
+	int compressionLevel;
+	const char *extension;
+};
+
+// Events of an output file, as a byte stream which does not depend on how the output is split
+static std::string readEvents(const std::string &name, const OutputFormat &format)
+{
+	std::string events;
+	if(format.compressionLevel > 0) {
+		CompressedFileReader reader(name.c_str());
+		char buffer[65536];
+		size_t n;
+		while((n = reader.read(buffer, sizeof(buffer))) > 0) events.append(buffer, n);
+		// Steps and file offsets are contiguous and cover the whole part
+		long long rawEnd = 0;
+		long long fileEnd = sizeof(CompressedFileHeader);
+		for(unsigned s = 0; s < reader.getNumberOfSteps(); s++) {
+			const CompressedFileReader::Step &step = reader.getStep(s);
+			CHECK(step.rawBegin == rawEnd && step.fileBegin == fileEnd);
+			rawEnd = step.rawEnd;
+			fileEnd = step.fileEnd;
+		}
+		CHECK(rawEnd == (long long)events.size());
+	}
+	else if(format.fileType == FILE_COLUMNAR) {
+		// Blocks are whole buffers, so they are the same with and without splitting
+		ColumnarFileReader reader((name + ".lcol").c_str());
+		for(uint64_t b = 0; b < reader.getNumberOfBlocks(); b++) {
+			for(unsigned c = 0; c < reader.getNumberOfColumns(); c++) {
+				events.append((const char *)reader.getColumn(b, c), reader.getNumberOfRows(b) * reader.getColumnSize(c));
+			}
+		}
+		uint64_t endBlock = 0;
+		for(uint64_t s = 0; s < reader.getNumberOfSteps(); s++) {
+			CHECK(reader.getStep(s).firstBlock == endBlock);
+			endBlock = reader.getStep(s).endBlock;
+		}
+		CHECK(endBlock == reader.getNumberOfBlocks());
+	}
+	else {
+		FILE *f = fopen((name + format.extension).c_str(), "r");
+		CHECK(f != NULL);
+		if(f == NULL) return events;
+		char buffer[65536];
+		size_t n;
+		while((n = fread(buffer, 1, sizeof(buffer), f)) > 0) events.append(buffer, n);
+		fclose(f);
+		if(format.fileType != FILE_TEXT) {
+			// Steps are contiguous and cover the whole part
+			FILE *indexFile = fopen((name + ".lidx").c_str(), "r");
+			CHECK(indexFile != NULL);
+			long long begin, end, stepEnd = 0;
+			while(indexFile != NULL && fscanf(indexFile, "%lld %lld %*f %*f", &begin, &end) == 2) {
+				CHECK(begin == stepEnd);
+				stepEnd = end;
+			}
+			if(indexFile != NULL) fclose(indexFile);
+			CHECK(stepEnd == (long long)events.size());
+		}
+	}
+	return events;
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS);
+	TestEventStream stream;
+	double frequency = stream.getFrequency();
+	const double t0 = 123456789;
+
+	std::mt19937 rng(47);
+	TestEvents events;
+	const long long bufferLength = 1LL << 20;
+	const unsigned nBuffers = 12;
+	makeTestEvents(events, config, &stream, system, nBuffers, 5000, bufferLength, rng);
+	// Parts of 2.5 buffers, so that both the parts and the steps end inside and at the end of buffers
+	float splitTime = 2.5 * bufferLength / frequency;
+	const unsigned nParts = 5;
+
+	const OutputFormat formats[] = {
+		{ "text", FILE_TEXT, 0, "" },
+		{ "binary", FILE_BINARY, 0, ".ldat" },
+		{ "compact", FILE_BINARY_COMPACT, 0, ".ldat" },
+		{ "compressed", FILE_BINARY, 3, ".ldatz" },
+		{ "columnar", FILE_COLUMNAR, 0, ".lcol" }
+	};
+	const EVENT_TYPE eventTypes[] = { SINGLE, GROUP, COINCIDENCE };
+	const int eventFractions[] = { 1024, 300 };
+	unsigned nCompared = 0;
+	for(unsigned f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+	for(unsigned e = 0; e < 3; e++)
+	for(unsigned k = 0; k < 2; k++)
+	for(int mode = 0; mode < 3; mode++) {
+		const OutputFormat &format = formats[f];
+		// Singles have no compact format
+		if(eventTypes[e] == SINGLE && format.fileType == FILE_BINARY_COMPACT) continue;
+		bool formatAhead = (mode > 0);
+		bool async = (mode == 2);
+
+		// Text output is named with its extension, the others by their prefix
+		bool text = (format.fileType == FILE_TEXT);
+		std::string wholeName = dir.file(text ? "whole.txt" : "whole");
+		DataFileWriter *writer = new DataFileWriter((char *)wholeName.c_str(), async, frequency, eventTypes[e], format.fileType,
+			0, 2, eventFractions[k], 0, format.compressionLevel);
+		writeTestEvents(writer, events, eventTypes[e], t0, false, formatAhead);
+		delete writer;
+		std::string whole = readEvents(text ? wholeName : dir.file("whole"), format);
+
+		std::string splitName = dir.file(text ? "split.txt" : "split");
+		writer = new DataFileWriter((char *)splitName.c_str(), async, frequency, eventTypes[e], format.fileType,
+			0, 2, eventFractions[k], splitTime, format.compressionLevel);
+		writeTestEvents(writer, events, eventTypes[e], t0, false, formatAhead);
+		delete writer;
+
+		// All the parts have their final names, the next part opened in advance is gone
+		std::vector<std::string> files;
+		DIR *d = opendir(dir.path.c_str());
+		struct dirent *entry;
+		while((entry = readdir(d)) != NULL) {
+			if(strncmp(entry->d_name, "split", 5) == 0) files.push_back(entry->d_name);
+		}
+		closedir(d);
+		std::sort(files.begin(), files.end());
+		std::string split;
+		unsigned nFound = 0;
+		for(unsigned n = 0; n < nParts; n++) {
+			char partName[64];
+			sprintf(partName, text ? "split_%08u.txt" : "split_%08u", n);
+			std::string dataName = std::string(partName) + format.extension;
+			if(std::find(files.begin(), files.end(), dataName) == files.end()) continue;
+			nFound++;
+			std::string part = readEvents(dir.file(partName), format);
+			CHECK(part.size() > 0);
+			split += part;
+		}
+		unsigned nFilesPerPart = (format.fileType == FILE_BINARY || format.fileType == FILE_BINARY_COMPACT) ? 2 : 1;
+		CHECK(nFound == nParts);
+		CHECK(files.size() == nParts * nFilesPerPart);
+
+		bool same = (split == whole);
+		if(!same || nFound != nParts) {
+			fprintf(stderr, "%s, event type %d, event fraction %d, mode %d: %u parts of %lu bytes instead of %lu bytes\n",
+				format.name, eventTypes[e], eventFractions[k], mode, nFound, split.size(), whole.size());
+		}
+		CHECK(same);
+		CHECK(whole.size() > 10000);
+		nCompared++;
+
+		for(unsigned n = 0; n < files.size(); n++) unlink(dir.file(files[n].c_str()).c_str());
+	}
+	fprintf(stderr, "compared %u split outputs\n", nCompared);
+
+	delete config;
+	return result("test_split_output");
+}
@@ -0,0 +1,89 @@
+/*
+ * TableFile tokenizing: comments, blank lines and extra columns are ignored, blank lines
+ * still count in the line numbers, a field with anything after its number makes its line
+ * malformed, lines may be longer than PATH_MAX, and CRLF files read as LF files.
+ */
+
+#include "TestUtil.hpp"
+#include <TableFile.hpp>
+#include <limits.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+struct Row {
+	int line;
+	unsigned u;
+	int d;
+	float f;
+	char c;
+};
+
+static bool readsAs(TestDir &dir, const char *name, std::string content, std::vector<Row> expected, int firstBadLine)
+{
+	dir.writeFile(name, content);
+	TableFile table(dir.file(name).c_str(), "udfc");
+	table.start();
+	table.wait();
+
+	bool same = (table.getNumberOfRows() == expected.size()) && (table.getFirstBadLine() == firstBadLine);
+	for(unsigned n = 0; same && n < expected.size(); n++) {
+		const TableFile::Value *v = table.getRow(n);
+		same = (table.getLineNumber(n) == expected[n].line) && (v[0].u == expected[n].u) && (v[1].d == expected[n].d)
+			&& sameBits(v[2].f, expected[n].f) && (v[3].c == expected[n].c);
+	}
+	if(!same) fprintf(stderr, "%s: %u rows, first bad line %d\n", name, table.getNumberOfRows(), table.getFirstBadLine());
+	return same;
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+
+	std::string longColumns;
+	while(longColumns.size() < 2 * PATH_MAX) longColumns += " 0";
+	std::string longComment(2 * PATH_MAX, 'x');
+
+	std::string content =
+		"# portID\tvalue\tfloat\tchar\n"		// 1
+		"1\t-2\t3.5\tT\n"				// 2
+		"\n"						// 3
+		"   \t  \n"					// 4
+		"  4   5  6.25  E   # trailing comment\n"	// 5
+		"7 8 9x C\n"					// 6: trailing garbage
+		"10 11 12.5 T extra columns\n"			// 7
+		"13 14\n"					// 8: missing columns
+		"+19 -20 +2.5e1 T\n"				// 9
+		"21 22 23 T" + longColumns + "\n"		// 10
+		"24 25 26 E #" + longComment + "\n"		// 11
+		"27 28# 29 T\n"					// 12: comment cuts the columns
+		"30 31 32 E";					// 13, without a newline
+	std::vector<Row> expected = {
+		{ 2, 1, -2, 3.5, 'T' },
+		{ 5, 4, 5, 6.25, 'E' },
+		{ 7, 10, 11, 12.5, 'T' },
+		{ 9, 19, -20, 25, 'T' },
+		{ 10, 21, 22, 23, 'T' },
+		{ 11, 24, 25, 26, 'E' },
+		{ 13, 30, 31, 32, 'E' },
+	};
+	CHECK(readsAs(dir, "lf.tsv", content, expected, 6));
+
+	std::string crlf;
+	for(unsigned n = 0; n < content.size(); n++) {
+		if(content[n] == '\n') crlf += '\r';
+		crlf += content[n];
+	}
+	CHECK(readsAs(dir, "crlf.tsv", crlf, expected, 6));
+
+	// Garbage after the number of any column type
+	CHECK(readsAs(dir, "u.tsv", "1 2 3 T\n1u 2 3 T\n", { { 1, 1, 2, 3, 'T' } }, 2));
+	CHECK(readsAs(dir, "d.tsv", "1 2 3 T\n1 2.0 3 T\n", { { 1, 1, 2, 3, 'T' } }, 2));
+	CHECK(readsAs(dir, "f.tsv", "1 2 3 T\n\n1 2 3.5.1 T\n", { { 1, 1, 2, 3, 'T' } }, 3));
+
+	// Empty and comment only files
+	CHECK(readsAs(dir, "empty.tsv", "", {}, 0));
+	CHECK(readsAs(dir, "comments.tsv", "# a\n\n  # b\n", {}, 0));
+
+	return result("test_table_file");
+}
@@ -0,0 +1,191 @@
+/*
+ * Time slice prescaling in RawReader: the coincidences of a prescaled run must be exactly
+ * those of the full run whose hits are all in the selected frames, for several slice and
+ * window lengths. The buffers are cut at other frames when prescaling, and events
+ * are split at the edges of the buffers in any run, so in the raw file no event crosses
+ * a frame boundary. No two hits are at the same clock, so that the order of the hits
+ * does not depend on how the buffers are cut either. Times in picoseconds are truncated
+ * relative to the start of their buffer, so they may differ by 1 ps.
+ */
+
+#include "TestUtil.hpp"
+#include <RawReader.hpp>
+#include <CoarseSorter.hpp>
+#include <algorithm>
+#include <limits.h>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+struct CoincidenceRecord {
+	long long firstFrame;
+	long long lastFrame;
+	// Times of the photons and their hits
+	std::vector<long long> times;
+	// Channels and energies
+	std::string fields;
+
+	bool operator< (const CoincidenceRecord &other) const {
+		return (times[0] != other.times[0]) ? (times[0] < other.times[0]) : (fields < other.fields);
+	};
+};
+
+static bool sameRecords(const std::vector<CoincidenceRecord> &a, const std::vector<CoincidenceRecord> &b)
+{
+	if(a.size() != b.size()) return false;
+	for(size_t n = 0; n < a.size(); n++) {
+		if(a[n].fields != b[n].fields || a[n].times.size() != b[n].times.size()) return false;
+		for(size_t k = 0; k < a[n].times.size(); k++) {
+			if(llabs(a[n].times[k] - b[n].times[k]) > 1) return false;
+		}
+	}
+	return true;
+}
+
+template <class T>
+static void append(std::string &s, const T &value)
+{
+	s.append((const char *)&value, sizeof(T));
+}
+
+// Keeps the absolute times, channels and energies of every coincidence, and the frames of its hits
+class CollectCoincidences : public EventSink<Coincidence> {
+public:
+	CollectCoincidences(std::vector<CoincidenceRecord> &records, pthread_mutex_t *lock, double frequency)
+	: records(records), lock(lock), Tps(1E12 / frequency)
+	{
+	};
+
+	virtual void pushT0(double t0) {};
+	virtual void pushEvents(EventBuffer<Coincidence> *buffer) {
+		long long tMin = buffer->getTMin();
+		std::vector<CoincidenceRecord> bufferRecords;
+		for(unsigned i = 0; i < buffer->getSize(); i++) {
+			Coincidence &e = buffer->get(i);
+			if(!e.valid) continue;
+			CoincidenceRecord r;
+			r.firstFrame = LLONG_MAX;
+			r.lastFrame = LLONG_MIN;
+			for(int k = 0; k < e.nPhotons; k++) {
+				GammaPhoton &p = *e.photons[k];
+				r.times.push_back(p.time + tMin * (long long)Tps);
+				append(r.fields, p.energy);
+				append(r.fields, p.nHits);
+				for(int m = 0; m < p.nHits; m++) {
+					Hit &h = *p.hits[m];
+					long long frame = (h.rawTime + tMin) / 1024;
+					r.firstFrame = std::min(r.firstFrame, frame);
+					r.lastFrame = std::max(r.lastFrame, frame);
+					append(r.fields, h.channelID);
+					r.times.push_back(h.time + tMin * (long long)Tps);
+					append(r.fields, h.energy);
+				}
+			}
+			bufferRecords.push_back(r);
+		}
+		pthread_mutex_lock(lock);
+		records.insert(records.end(), bufferRecords.begin(), bufferRecords.end());
+		pthread_mutex_unlock(lock);
+		delete buffer;
+	};
+	virtual void finish() {};
+	virtual void report() {};
+	virtual void resetCounters() {};
+
+private:
+	std::vector<CoincidenceRecord> &records;
+	pthread_mutex_t *lock;
+	double Tps;
+};
+
+static void runStep(TestDir &dir, SystemConfig *config, unsigned sliceFrames, unsigned windowFrames, std::vector<CoincidenceRecord> &records)
+{
+	RawReader *reader = RawReader::openFile(dir.file("run").c_str(), RawReader::SYNC);
+	if(sliceFrames < windowFrames) reader->setTimeSlicePrescale(sliceFrames, windowFrames);
+	reader->setSystemConfig(config);
+
+	pthread_mutex_t lock;
+	pthread_mutex_init(&lock, NULL);
+	while(reader->getNextStep()) {
+		reader->processStep(false,
+			new CoarseSorter(
+			new ProcessHit(config, reader,
+			new SimpleGrouper(config, reader,
+			new CoincidenceGrouper(config, reader,
+			new CollectCoincidences(records, &lock, reader->getFrequency())
+			)))));
+	}
+	pthread_mutex_destroy(&lock);
+	delete reader;
+	std::sort(records.begin(), records.end());
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 2);
+	std::string configName = system.writeConfig("config.ini",
+		"[sw_trigger]\n"
+		"coincidence_time_window = 20\n");
+	// ToT mode, as the raw file header says
+	u_int64_t mask = SystemConfig::LOAD_ALL ^ SystemConfig::LOAD_FIRMWARE_EMPIRICAL_CALIBRATIONS
+		^ SystemConfig::LOAD_QDC_CALIBRATION ^ SystemConfig::LOAD_ENERGY_CALIBRATION;
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), mask);
+
+	// Frames which are not aligned to any window
+	const long long firstFrame = 1000003 * 8;
+	const long long nFrames = 4096;
+	std::mt19937 rng(46);
+	EventBuffer<RawHit> *generated = new EventBuffer<RawHit>(nFrames * 100, 0, 0);
+	generateRawHits(generated, config, system, nFrames * 100, 0, 10, rng);
+
+	std::vector<RawHit> kept;
+	for(unsigned n = 0; n < generated->getSize(); n++) {
+		RawHit hit = generated->get(n);
+		hit.time += firstFrame * 1024;
+		hit.timeEnd += firstFrame * 1024;
+		hit.frameID = hit.time / 1024;
+		// Quiet clocks around the frame boundaries
+		if(hit.tcoarse < 100 || hit.tcoarse >= 900) continue;
+		if(hit.frameID >= firstFrame + nFrames) continue;
+		kept.push_back(hit);
+	}
+	delete generated;
+	std::stable_sort(kept.begin(), kept.end(), [](const RawHit &a, const RawHit &b) { return a.time < b.time; });
+	EventBuffer<RawHit> *hits = new EventBuffer<RawHit>(kept.size(), 0, 0);
+	for(unsigned n = 0; n < kept.size(); n++) {
+		if(n > 0 && kept[n].time == kept[n-1].time) continue;
+		hits->push(kept[n]);
+	}
+	writeRawFile(dir, "run", hits, firstFrame, firstFrame + nFrames);
+	fprintf(stderr, "%u hits in %lld frames\n", hits->getSize(), nFrames);
+	delete hits;
+
+	std::vector<CoincidenceRecord> full;
+	runStep(dir, config, 1, 1, full);
+	CHECK(full.size() > 10000);
+
+	const unsigned slices[][2] = { { 8, 32 }, { 104, 1024 }, { 512, 1024 }, { 1016, 1024 } };
+	for(unsigned s = 0; s < sizeof(slices) / sizeof(slices[0]); s++) {
+		unsigned sliceFrames = slices[s][0];
+		unsigned windowFrames = slices[s][1];
+
+		std::vector<CoincidenceRecord> expected;
+		for(unsigned n = 0; n < full.size(); n++) {
+			CoincidenceRecord &r = full[n];
+			CHECK(r.firstFrame == r.lastFrame);
+			if((r.firstFrame % windowFrames) < sliceFrames) expected.push_back(r);
+		}
+
+		std::vector<CoincidenceRecord> prescaled;
+		runStep(dir, config, sliceFrames, windowFrames, prescaled);
+		bool same = sameRecords(prescaled, expected);
+		fprintf(stderr, "slices of %u in %u frames: %lu coincidences of %lu, expected %lu\n",
+			sliceFrames, windowFrames, prescaled.size(), full.size(), expected.size());
+		CHECK(same);
+		CHECK(expected.size() > 0 && expected.size() < full.size());
+	}
+
+	delete config;
+	return result("test_time_slices");
+}
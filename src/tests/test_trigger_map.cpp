@@ -0,0 +1,117 @@
+/*
+ * The trigger map is held as bit matrices over dense region IDs.
+ * Check it against the full 4096 x 4096 tables it replaced, filled line by line,
+ * on a random map with repeated and overriding lines, and check the dense numbering.
+ */
+
+#include "TestUtil.hpp"
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+static const int MAX_REGIONS = 4096;
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	std::mt19937 rng(32);
+
+	// Regions over the whole range, including both ends
+	std::vector<int> pool;
+	pool.push_back(0);
+	pool.push_back(MAX_REGIONS - 1);
+	for(int n = 0; n < 150; n++) pool.push_back(rng() % MAX_REGIONS);
+
+	// Channels in regions of the trigger map and in regions absent from it
+	std::string map;
+	char line[512];
+	for(unsigned n = 0; n < 512; n++) {
+		int region = (n % 8 == 7) ? (int)(rng() % MAX_REGIONS) : pool[rng() % pool.size()];
+		sprintf(line, "%u\t%u\t%u\t%u\t%d\t0\t0\t0.0\t0.0\t0.0\n", n / 256, (n / 64) % 4, 0, n % 64, region);
+		map += line;
+	}
+	dir.writeFile("map.tsv", map);
+
+	bool *coincidence = new bool[MAX_REGIONS * MAX_REGIONS];
+	bool *multihit = new bool[MAX_REGIONS * MAX_REGIONS];
+	for(int i = 0; i < MAX_REGIONS * MAX_REGIONS; i++) coincidence[i] = multihit[i] = false;
+
+	std::string trigger;
+	const char types[] = "CMcm";
+	for(unsigned n = 0; n < 3000; n++) {
+		// Many lines repeat a pair of an earlier line, in either order, so that later lines override earlier ones
+		int r1 = pool[rng() % 40];
+		int r2 = pool[rng() % ((n % 3 == 0) ? pool.size() : 40)];
+		char c = types[rng() % 4];
+		sprintf(line, "%d\t%d\t%c\n", r1, r2, c);
+		trigger += line;
+
+		bool isC = (toupper(c) == 'C');
+		coincidence[r1 * MAX_REGIONS + r2] = isC;
+		coincidence[r2 * MAX_REGIONS + r1] = isC;
+		multihit[r1 * MAX_REGIONS + r2] = !isC;
+		multihit[r2 * MAX_REGIONS + r1] = !isC;
+	}
+	dir.writeFile("trigger.tsv", trigger);
+	dir.writeFile("config.ini", "[main]\nchannel_map = %CDIR%/map.tsv\ntrigger_map = %CDIR%/trigger.tsv\n");
+	SystemConfig *config = SystemConfig::fromFile(dir.file("config.ini").c_str(), SystemConfig::LOAD_MAPPING);
+
+	// Every pair of regions, and out of range regions
+	unsigned nCoincidenceDifferent = 0, nMultihitDifferent = 0, nAllowed = 0;
+	for(int r1 = -1; r1 <= MAX_REGIONS; r1++) {
+		for(int r2 = -1; r2 <= MAX_REGIONS; r2++) {
+			bool inRange = (r1 >= 0) && (r1 < MAX_REGIONS) && (r2 >= 0) && (r2 < MAX_REGIONS);
+			bool c = inRange && coincidence[r1 * MAX_REGIONS + r2];
+			bool m = inRange && multihit[r1 * MAX_REGIONS + r2];
+			if(config->isCoincidenceAllowed(r1, r2) != c) nCoincidenceDifferent++;
+			if(config->isMultiHitAllowed(r1, r2) != m) nMultihitDifferent++;
+			if(c || m) nAllowed++;
+		}
+	}
+	fprintf(stderr, "%u allowed region pairs\n", nAllowed);
+	CHECK(nCoincidenceDifferent == 0);
+	CHECK(nMultihitDifferent == 0);
+	CHECK(nAllowed > 1000);
+
+	// Dense IDs: the regions of the trigger map, numbered in increasing order
+	std::vector<bool> inTriggerMap(MAX_REGIONS, false);
+	for(unsigned n = 0; n < trigger.size(); n++) {
+		int r1, r2;
+		if(sscanf(trigger.c_str() + n, "%d\t%d", &r1, &r2) == 2) {
+			inTriggerMap[r1] = inTriggerMap[r2] = true;
+		}
+		n = trigger.find('\n', n);
+	}
+	int nDense = 0;
+	for(int r = 0; r < MAX_REGIONS; r++) {
+		int d = config->getDenseRegion(r);
+		if(inTriggerMap[r]) {
+			CHECK(d == nDense);
+			CHECK(config->getRegionFromDense(d) == r);
+			nDense++;
+		}
+		else {
+			CHECK(d == -1);
+		}
+	}
+	CHECK((int)config->getNumberOfDenseRegions() == nDense);
+	CHECK(config->getDenseRegion(-1) == -1);
+	CHECK(config->getDenseRegion(MAX_REGIONS) == -1);
+
+	// Channels carry the dense ID of their region
+	unsigned nChannels = 0, nChannelsOutside = 0;
+	for(unsigned n = 0; n < 512; n++) {
+		unsigned channelID = ((n / 256) << 17) | (((n / 64) % 4) << 12) | (n % 64);
+		unsigned index = config->getChannelIndex(channelID);
+		int region = config->getTriggerRegion(index);
+		CHECK(config->getDenseTriggerRegion(index) == config->getDenseRegion(region));
+		nChannels++;
+		if(config->getDenseRegion(region) == -1) nChannelsOutside++;
+	}
+	CHECK(nChannelsOutside > 0 && nChannelsOutside < nChannels);
+
+	delete [] coincidence;
+	delete [] multihit;
+	delete config;
+	return result("test_trigger_map");
+}
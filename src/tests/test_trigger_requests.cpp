@@ -0,0 +1,87 @@
+/*
+ * findTriggerRequestsSparse() must find exactly the trigger requests of
+ * findTriggerRequestsDense(), whenever empty clocks are not requests themselves.
+ */
+
+#include "TestUtil.hpp"
+#include <HwTriggerSimulator.hpp>
+#include <algorithm>
+
+using namespace PETSYS;
+using namespace PETSYS::Test;
+
+// Random hits over nRegions regions and the hits of no region, sorted as HwTriggerSimulator sorts them
+static void makeHits(std::vector<TriggerHit> &hits, unsigned nHits, unsigned nRegions, unsigned arraySize, std::mt19937 &rng)
+{
+	std::uniform_real_distribution<double> u(0, 1);
+	hits.clear();
+	for(unsigned n = 0; n < nHits; n++) {
+		TriggerHit hit;
+		hit.region = (u(rng) < 0.05) ? -1 : (int)(rng() % nRegions);
+		// Hits beyond both ends of the trigger array are kept by the caller, and skipped here
+		hit.bin = (long long)(rng() % (arraySize + 200)) - 100;
+		hit.order = n;
+		// Fine energies, so that sums depend on their order
+		hit.energy = 0.1875 + 20 * u(rng) * u(rng);
+		hits.push_back(hit);
+	}
+	std::sort(hits.begin(), hits.end());
+}
+
+int main(int argc, char *argv[])
+{
+	TestDir dir;
+	TestSystem system(dir, 1);
+	std::string configName = system.writeConfig("config.ini");
+	SystemConfig *config = SystemConfig::fromFile(configName.c_str(), 0);
+
+	struct { float minEnergy, maxEnergy; int minHits, maxHits; } cuts[] = {
+		{ 0, 128, 1, 1024 },		// The default
+		{ 5, 50, 1, 1024 },
+		{ 0, 1E6, 2, 3 },
+		{ 10, 30, 2, 1024 },
+		{ -1, 1E6, 1, 1 },
+	};
+	// Sparse and dense hits, and several hits in the same clock
+	struct { unsigned nHits, arraySize; } loads[] = {
+		{ 100, 100000 },
+		{ 5000, 20000 },
+		{ 20000, 2000 },
+	};
+
+	std::mt19937 rng(36);
+	unsigned nRequests = 0;
+	const unsigned nRegions = 16;
+	std::vector<TriggerHit> hits;
+	for(unsigned c = 0; c < sizeof(cuts) / sizeof(cuts[0]); c++) {
+		config->sw_fw_trigger_group_min_energy = cuts[c].minEnergy;
+		config->sw_fw_trigger_group_max_energy = cuts[c].maxEnergy;
+		config->sw_fw_trigger_group_min_nhits = cuts[c].minHits;
+		config->sw_fw_trigger_group_max_nhits = cuts[c].maxHits;
+
+		for(unsigned l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+			for(int repeat = 0; repeat < 5; repeat++) {
+				makeHits(hits, loads[l].nHits, nRegions, loads[l].arraySize, rng);
+
+				std::vector<int> dense[nRegions];
+				std::vector<int> sparse[nRegions];
+				findTriggerRequestsDense(config, hits, loads[l].arraySize, nRegions, dense);
+				findTriggerRequestsSparse(config, hits, loads[l].arraySize, sparse);
+
+				for(unsigned r = 0; r < nRegions; r++) {
+					if(sparse[r] != dense[r]) {
+						fprintf(stderr, "cuts %u, load %u, region %u: %lu sparse requests, %lu dense requests\n",
+							c, l, r, sparse[r].size(), dense[r].size());
+					}
+					CHECK(sparse[r] == dense[r]);
+					nRequests += dense[r].size();
+				}
+			}
+		}
+	}
+	fprintf(stderr, "compared %u trigger requests\n", nRequests);
+	CHECK(nRequests > 10000);
+
+	delete config;
+	return result("test_trigger_requests");
+}